@@ -0,0 +1,185 @@
+#!/usr/bin/env bash
+#
+# Copyright (C) 2023 flexiWAN Ltd.
+#
+# This file is added by the Flexiwan feature: crypto_sw_scheduler_workers.
+#
+# Compares ESP AES-GCM-128 encryption throughput of the synchronous crypto
+# (inline on the RX worker) and the asynchronous crypto (crypto_sw_scheduler
+# plugin) on different number of worker cores. The asynchronous crypto runs
+# twice: with the scheduler defaults (single frame per dequeue) and with
+# batch-size 256 and work-stealing, which stay off by default until this
+# benchmark shows they pay off.
+#
+# Every worker runs its own packet-generator stream routed into its own
+# IPIP tunnel protected by its own SA, so the workers do not hand packets
+# off to each other. The encrypted packets are dropped on loop0.
+#
+# usage: ipsec_async_bench.sh [-b <vpp binary>] [-w "<workers list>"]
+#                             [-n <packets per worker>] [-s <packet size>]
+#                             [-c <first core>]
+#
+# The workers are pinned to cores <first core>+1 .. <first core>+N.
+# 0 workers runs one stream on the main thread, e.g. on single core hosts.
+#
+
+VPP=${VPP:-build-root/install-vpp-native/vpp/bin/vpp}
+WORKERS="2 4 8"
+PACKETS=2000000
+SIZE=512
+CORE=0
+RUNDIR=$(mktemp -d /tmp/ipsec_async_bench.XXXXXX)
+SOCK=$RUNDIR/cli.sock
+
+while getopts "b:w:n:s:c:h" opt; do
+  case $opt in
+    b) VPP=$OPTARG ;;
+    w) WORKERS=$OPTARG ;;
+    n) PACKETS=$OPTARG ;;
+    s) SIZE=$OPTARG ;;
+    c) CORE=$OPTARG ;;
+    *) sed -n '/^# usage/,/^# The workers/p' "$0" | sed 's/^# \{0,1\}//'
+       exit 1 ;;
+  esac
+done
+
+VPPCTL=$(dirname "$VPP")/vppctl
+[ -x "$VPP" ] || { echo "vpp binary $VPP not found" >&2; exit 1; }
+[ -x "$VPPCTL" ] || { echo "vppctl binary $VPPCTL not found" >&2; exit 1; }
+
+cleanup ()
+{
+  [ -n "$VPP_PID" ] && kill "$VPP_PID" 2>/dev/null && wait "$VPP_PID"
+  rm -rf "$RUNDIR"
+}
+trap cleanup EXIT
+
+cli ()
+{
+  "$VPPCTL" -s "$SOCK" "$@"
+}
+
+# $1 - number of streams, one per worker
+write_setup ()
+{
+  local n=$1 i
+  local key=4a506a794f574265564551694d653768
+
+  cat > "$RUNDIR/setup.cli" <<EOF
+create packet-generator interface pg0
+set int ip address pg0 10.10.0.1/24
+set int state pg0 up
+loop create
+set int ip address loop0 10.0.0.1/24
+set int state loop0 up
+EOF
+
+  for ((i = 0; i < n; i++)); do
+    cat >> "$RUNDIR/setup.cli" <<EOF
+set ip neighbor loop0 10.0.0.$((i + 10)) 02:00:00:00:00:$(printf %02x $((i + 10)))
+ipsec sa add $((100 + i)) spi $((1000 + i)) esp crypto-alg aes-gcm-128 crypto-key $key salt 0x$(printf %08x $((i + 1)))
+ipsec sa add $((200 + i)) spi $((2000 + i)) esp crypto-alg aes-gcm-128 crypto-key $key salt 0x$(printf %08x $((i + 1)))
+create ipip tunnel src 10.0.0.1 dst 10.0.0.$((i + 10)) instance $i
+ipsec tunnel protect ipip$i sa-in $((200 + i)) sa-out $((100 + i))
+set int unnumbered ipip$i use loop0
+set int state ipip$i up
+ip route add 16.$i.0.0/16 via ipip$i
+packet-generator new {
+  name s$i
+  limit $PACKETS
+  size $SIZE-$SIZE
+  worker $i
+  interface pg0
+  node ip4-input
+  data {
+    UDP: 10.10.0.2 -> 16.$i.0.1
+    UDP: 1234 -> 4321
+    incrementing 16
+  }
+}
+EOF
+  done
+}
+
+# $1 - number of workers, $2 - sync|async|batch
+write_startup ()
+{
+  local n=$1 mode=$2
+
+  local cpu="main-core $CORE"
+
+  [ "$n" -gt 0 ] && cpu="$cpu corelist-workers $((CORE + 1))-$((CORE + n))"
+  cat > "$RUNDIR/startup.conf" <<EOF
+unix { nodaemon cli-listen $SOCK exec $RUNDIR/setup.cli }
+cpu { $cpu }
+buffers { buffers-per-numa 131072 }
+plugins {
+  plugin dpdk_plugin.so { disable }
+}
+EOF
+  if [ "$mode" = async ]; then
+    echo "crypto-sw-scheduler { async-mode }" >> "$RUNDIR/startup.conf"
+  elif [ "$mode" = batch ]; then
+    echo "crypto-sw-scheduler { async-mode batch-size 256 work-stealing }" \
+      >> "$RUNDIR/startup.conf"
+  fi
+}
+
+# $1 - number of workers, $2 - sync|async|batch; prints Mpps
+run_one ()
+{
+  local n=$1 mode=$2 t0 t1 i drops
+  local streams=$((n > 0 ? n : 1))
+
+  write_setup "$streams"
+  write_startup "$n" "$mode"
+
+  "$VPP" -c "$RUNDIR/startup.conf" > "$RUNDIR/vpp.log" 2>&1 &
+  VPP_PID=$!
+
+  for ((i = 0; i < 100; i++)); do
+    cli show packet-generator 2>/dev/null | grep -q "s$((streams - 1))" && break
+    sleep 0.1
+  done
+  if [ $i -eq 100 ]; then
+    echo "$n workers $mode: setup failed" >&2
+    tail -5 "$RUNDIR/vpp.log" >&2
+    kill "$VPP_PID" 2>/dev/null
+    wait "$VPP_PID" 2>/dev/null
+    VPP_PID=
+    echo 0
+    return
+  fi
+
+  # The run is over when all packets are encrypted and dropped on loop0,
+  # async crypto can still be in flight when the streams are done.
+  t0=$(date +%s.%N)
+  cli packet-generator enable-stream
+  for ((i = 0; i < 6000; i++)); do
+    drops=$(cli show interface loop0 | awk '/drops/ { print $2 + 0 }')
+    [ "${drops:-0}" -ge $((streams * PACKETS)) ] && break
+    sleep 0.05
+  done
+  t1=$(date +%s.%N)
+  [ $i -eq 6000 ] &&
+    echo "$n workers $mode: ${drops:-0} of $((streams * PACKETS)) packets" \
+      "encrypted" >&2
+
+  cli show errors > "$RUNDIR/errors.$n.$mode"
+  kill "$VPP_PID" 2>/dev/null
+  wait "$VPP_PID" 2>/dev/null
+  VPP_PID=
+
+  echo "$streams $PACKETS $t0 $t1" |
+    awk '{ printf "%.3f", $1 * $2 / ($4 - $3) / 1000000 }'
+}
+
+printf "%-10s%-14s%-14s%-14s%-10s\n" "workers" "sync Mpps" "async Mpps" \
+  "batch Mpps" "batch/async"
+for n in $WORKERS; do
+  sync=$(run_one "$n" sync)
+  async=$(run_one "$n" async)
+  batch=$(run_one "$n" batch)
+  printf "%-10s%-14s%-14s%-14s%-10s\n" "$n" "$sync" "$async" "$batch" \
+    "$(echo "$async $batch" | awk '{ printf "%.2f", ($1 > 0) ? $2 / $1 : 0 }')"
+done
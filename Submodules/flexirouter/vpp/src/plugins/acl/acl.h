@@ -12,6 +12,17 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+
+/*
+ *  Copyright (C) 2023 flexiWAN Ltd.
+ *  List of fixes and changes made for FlexiWAN (denoted by FLEXIWAN_FIX and FLEXIWAN_FEATURE flags):
+ *   - Add acl_change_epoch that is bumped on every change of ACL rules or
+ *     lookup contexts. It is used by FWABF flow cache to invalidate cached
+ *     classification results.
+ *   - single_pass_classification: Add the last id given to the ACL list of
+ *     lookup context, see acl_lookup_context_t.
+ */
+
 #ifndef included_acl_h
 #define included_acl_h
 
@@ -123,6 +134,14 @@ typedef struct {
   acl_lookup_context_t *acl_lookup_contexts;
 
   acl_list_t *acls;	/* Pool of ACLs */
+#ifdef FLEXIWAN_FEATURE
+  /* Bumped on every ACL/lookup context change, see lookup_context.c */
+  volatile u32 acl_change_epoch;
+#endif /* FLEXIWAN_FEATURE */
+#ifdef FLEXIWAN_FEATURE /* single_pass_classification */
+  /* The last id given to ACL list of lookup context */
+  u32 acl_list_id_last;
+#endif /* FLEXIWAN_FEATURE - single_pass_classification */
   hash_acl_info_t *hash_acl_infos; /* corresponding hash matching housekeeping info */
   clib_bihash_48_8_t acl_lookup_hash; /* ACL lookup hash table. */
   u32 hash_lookup_hash_buckets;
@@ -13,6 +13,18 @@
  * limitations under the License.
  */
 
+/*
+ *  Copyright (C) 2023 flexiWAN Ltd.
+ *  List of fixes and changes made for FlexiWAN (denoted by FLEXIWAN_FIX and FLEXIWAN_FEATURE flags):
+ *   - Bump acl_change_epoch on ACL and lookup context changes.
+ *   - incremental_lookup_context: on change of the ACL list of lookup context
+ *     keep applied the ACLs of the head, that is common for the old and
+ *     the new lists, and reapply the rest only. Adding ACL to the end of list
+ *     costs the new ACL rules only instead of rules of all ACLs in the list.
+ *   - single_pass_classification: give the same acl_list_id to the lookup
+ *     contexts with the same ACL list, see acl_lookup_context_set_list_id().
+ */
+
 #include <plugins/acl/acl.h>
 #include <plugins/acl/fa_node.h>
 #include <vlib/unix/plugin.h>
@@ -87,6 +99,32 @@ static u32 acl_plugin_register_user_module (char *user_module_name, char *val1_l
   return user_id;
 }
 
+#ifdef FLEXIWAN_FEATURE /* single_pass_classification */
+/*
+ * Gives the context the id of its ACL list: the id of other context with
+ * the same ACL list, or a new id. So the datapath can compare ids of
+ * contexts instead of their ACL lists, see classify_result_lc_equal().
+ * There are just a few contexts, so they are scanned.
+ */
+static void
+acl_lookup_context_set_list_id (acl_main_t *am, acl_lookup_context_t *acontext)
+{
+  acl_lookup_context_t *other;
+  u32 n_acls = vec_len(acontext->acl_indices);
+
+  pool_foreach (other, am->acl_lookup_contexts)
+   {
+    if (other != acontext && vec_len(other->acl_indices) == n_acls &&
+        0 == memcmp(other->acl_indices, acontext->acl_indices,
+                    n_acls * sizeof(u32))) {
+      acontext->acl_list_id = other->acl_list_id;
+      return;
+    }
+  }
+  acontext->acl_list_id = ++am->acl_list_id_last;
+}
+#endif /* FLEXIWAN_FEATURE - single_pass_classification */
+
 /*
  * Allocate a new lookup context index.
  * Supply the id assigned to your module during registration,
@@ -114,6 +152,9 @@ static int acl_plugin_get_lookup_context_index (u32 acl_user_id, u32 val1, u32 v
   acontext->context_user_id = acl_user_id;
   acontext->user_val1 = val1;
   acontext->user_val2 = val2;
+#ifdef FLEXIWAN_FEATURE /* single_pass_classification */
+  acl_lookup_context_set_list_id(am, acontext);
+#endif /* FLEXIWAN_FEATURE - single_pass_classification */
 
   u32 new_context_id = acontext - am->acl_lookup_contexts;
   vec_add1(am->acl_users[acl_user_id].lookup_contexts, new_context_id);
@@ -129,6 +170,7 @@ lock_acl(acl_main_t *am, u32 acl, u32 lc_index)
   vec_add1(am->lc_index_vec_by_acl[acl], lc_index);
 }
 
+#ifndef FLEXIWAN_FEATURE /* incremental_lookup_context */
 static void
 lock_acl_vec(u32 lc_index, u32 *acls)
 {
@@ -138,6 +180,7 @@ lock_acl_vec(u32 lc_index, u32 *acls)
     lock_acl(am, acls[i], lc_index);
   }
 }
+#endif /* FLEXIWAN_FEATURE - incremental_lookup_context */
 
 static void
 unlock_acl(acl_main_t *am, u32 acl, u32 lc_index)
@@ -161,6 +204,7 @@ unlock_acl_vec(u32 lc_index, u32 *acls)
 }
 
 
+#ifndef FLEXIWAN_FEATURE /* incremental_lookup_context */
 static void
 apply_acl_vec(u32 lc_index, u32 *acls)
 {
@@ -170,6 +214,7 @@ apply_acl_vec(u32 lc_index, u32 *acls)
   for(i=0; i<vec_len(acls); i++)
     hash_acl_apply(am, lc_index, acls[i], i);
 }
+#endif /* FLEXIWAN_FEATURE - incremental_lookup_context */
 
 
 static void
@@ -254,10 +299,42 @@ static int acl_plugin_set_acl_vec_for_context (u32 lc_index, u32 *acl_list)
   u32 *old_acl_vector = acontext->acl_indices;
   acontext->acl_indices = vec_dup(acl_list);
 
+#ifdef FLEXIWAN_FEATURE /* incremental_lookup_context */
+  {
+    /*
+     * The applied ACEs are ordered by ACL position, so the ACLs of the common
+     * head of lists stay intact, only the tails are unapplied and applied.
+     * See hash_acl_reapply() that uses the same approach.
+     */
+    u32 i, n_common = 0;
+    u32 n_old = vec_len(old_acl_vector);
+    u32 n_new = vec_len(acontext->acl_indices);
+
+    while (n_common < n_old && n_common < n_new &&
+           old_acl_vector[n_common] == acontext->acl_indices[n_common])
+      n_common++;
+
+    for (i = n_old; i > n_common; i--)
+      hash_acl_unapply(am, lc_index, old_acl_vector[i-1]);
+    for (i = n_common; i < n_old; i++)
+      unlock_acl(am, old_acl_vector[i], lc_index);
+    for (i = n_common; i < n_new; i++)
+      lock_acl(am, acontext->acl_indices[i], lc_index);
+    for (i = n_common; i < n_new; i++)
+      hash_acl_apply(am, lc_index, acontext->acl_indices[i], i);
+  }
+#else  /* FLEXIWAN_FEATURE - incremental_lookup_context */
   unapply_acl_vec(lc_index, old_acl_vector);
   unlock_acl_vec(lc_index, old_acl_vector);
   lock_acl_vec(lc_index, acontext->acl_indices);
   apply_acl_vec(lc_index, acontext->acl_indices);
+#endif /* FLEXIWAN_FEATURE - incremental_lookup_context */
+#ifdef FLEXIWAN_FEATURE
+  am->acl_change_epoch++;
+#endif /* FLEXIWAN_FEATURE */
+#ifdef FLEXIWAN_FEATURE /* single_pass_classification */
+  acl_lookup_context_set_list_id(am, acontext);
+#endif /* FLEXIWAN_FEATURE - single_pass_classification */
 
   vec_free(old_acl_vector);
 
@@ -270,6 +347,9 @@ done:
 void acl_plugin_lookup_context_notify_acl_change(u32 acl_num)
 {
   acl_main_t *am = &acl_main;
+#ifdef FLEXIWAN_FEATURE
+  am->acl_change_epoch++;
+#endif /* FLEXIWAN_FEATURE */
   if (acl_plugin_acl_exists(acl_num)) {
     if (hash_acl_exists(am, acl_num)) {
         /* this is a modification, clean up the older entries */
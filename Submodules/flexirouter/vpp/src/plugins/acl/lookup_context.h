@@ -13,6 +13,14 @@
  * limitations under the License.
  */
 
+/*
+ *  Copyright (C) 2023 flexiWAN Ltd.
+ *  List of features made for FlexiWAN (denoted by FLEXIWAN_FEATURE flag):
+ *   - single_pass_classification: lookup contexts with the same ACL list
+ *     have the same acl_list_id, so the ACL lookup result of one context
+ *     can be reused by the other one by comparing the ids.
+ */
+
 #ifndef included_acl_lookup_context_h
 #define included_acl_lookup_context_h
 
@@ -36,6 +44,10 @@ typedef struct {
   u32 user_val1;
   /* per-instance user value 2 */
   u32 user_val2;
+#ifdef FLEXIWAN_FEATURE /* single_pass_classification */
+  /* the same for contexts with the same acl_indices */
+  u32 acl_list_id;
+#endif /* FLEXIWAN_FEATURE - single_pass_classification */
 } acl_lookup_context_t;
 
 void acl_plugin_lookup_context_notify_acl_change(u32 acl_num);
@@ -7,6 +7,10 @@
  *  attribute. The classification result is marked in the packet and can be
  *  made use of in other functions like scheduling, policing, marking etc.
  *
+ *  - single_pass_classification: the ACL classification result is stored in
+ *  buffer metadata, so the downstream nodes, like fwabf, can reuse it instead
+ *  of running ACL lookup again.
+ *
  * This file is added by the Flexiwan feature: acl_based_classification.
  */
 
@@ -174,6 +178,44 @@ VLIB_CLI_COMMAND (classifier_acls_set_interface_command, static) =
 /* *INDENT-ON* */
 
 
+static clib_error_t *
+classifier_acls_shared_classification_command_fn (vlib_main_t * vm,
+                                                  unformat_input_t * input,
+                                                  vlib_cli_command_t * cmd)
+{
+  classifier_acls_main_t * cmp = &classifier_acls_main;
+  u8 enable = 1;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "enable"))
+        enable = 1;
+      else if (unformat (input, "disable"))
+        enable = 0;
+      else
+        return clib_error_return (0, "unknown input '%U'",
+                                  format_unformat_error, input);
+  }
+
+  cmp->shared_classification = enable;
+  return NULL;
+}
+
+/* *INDENT-OFF* */
+/*
+ * Command to enable or disable storing of the classification result in the
+ * packet metadata. The stored result is reused by the downstream nodes, like
+ * fwabf, instead of running the ACL lookup again. See classify_result.h.
+ */
+VLIB_CLI_COMMAND (classifier_acls_shared_classification_command, static) =
+{
+  .path = "classifier-acls shared-classification",
+  .short_help = "classifier-acls shared-classification [enable|disable]",
+  .function = classifier_acls_shared_classification_command_fn,
+};
+/* *INDENT-ON* */
+
+
 /*
  * Function that sets up ACL plugin context for the ACLs identified using the
  * given unique acl_list_id
@@ -226,6 +268,8 @@ classifier_acls_show_command_fn (vlib_main_t * vm,
 {
   classifier_acls_main_t * cmp = &classifier_acls_main;
 
+  vlib_cli_output (vm, "shared classification: %s\n",
+                   cmp->shared_classification ? "enabled" : "disabled");
   vlib_cli_output (vm, "sw_if_index   acl_list_id\n");
   for (int i = 0; i < vec_len (cmp->acl_list_id_by_sw_if_index); i++)
     {
@@ -357,6 +401,7 @@ static clib_error_t * classifier_acls_init (vlib_main_t * vm)
   cmp->vlib_main = vm;
   cmp->vnet_main = vnet_get_main();
   cmp->acl_list_id_by_sw_if_index = 0;
+  cmp->shared_classification = 0;
   for (int i = 0; i < CLASSIFIER_MAX_ACL_SETS; i++)
     cmp->acl_lc_index_by_acl_list_id[i] = ~0;
 
@@ -377,7 +422,16 @@ classifier_acls_sw_interface_add_del (vnet_main_t * vnm, u32 sw_if_index,
 				      u32 is_add)
 {
   classifier_acls_main_t * cmp = &classifier_acls_main;
-  if (0 == is_add)
+  if (is_add)
+    {
+      /*
+       * Presize the per interface table, so the datapath never has to grow
+       * it. Interfaces are created under worker barrier.
+       */
+      vec_validate_init_empty (cmp->acl_list_id_by_sw_if_index, sw_if_index,
+                               ~0);
+    }
+  else
     {
       if (vec_len (cmp->acl_list_id_by_sw_if_index) > sw_if_index)
         /* Reset acl_list_id of the interface */
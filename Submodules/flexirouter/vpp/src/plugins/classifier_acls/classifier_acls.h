@@ -7,6 +7,10 @@
  *  attribute. The classification result is marked in the packet and can be
  *  made use of in other functions like scheduling, policing, marking etc.
  *
+ *  - single_pass_classification: the ACL classification result is stored in
+ *  buffer metadata, so the downstream nodes, like fwabf, can reuse it instead
+ *  of running ACL lookup again.
+ *
  * This file is added by the Flexiwan feature: acl_based_classification.
  */
 
@@ -37,6 +41,9 @@ typedef struct {
     /* Classifer ACLs module user id */
     u32 acl_user_id;
 
+    /* Store classification result in buffer for reuse by downstream nodes */
+    u8 shared_classification;
+
     /* API message ID base */
     u16 msg_id_base;
 
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2023 FlexiWAN
+ *
+ * List of features made for FlexiWAN (denoted by FLEXIWAN_FEATURE flag):
+ *  - single_pass_classification: the ACL classification result of the
+ *  classifier-acls node is stored in buffer metadata, so the downstream nodes,
+ *  like fwabf, can reuse it instead of running ACL lookup again.
+ *
+ * This file is added by the Flexiwan feature: single_pass_classification.
+ */
+
+/*
+ * The classifier-acls node runs ACL lookup on LAN ingress to mark packets with
+ * service class and importance. The fwabf-input node, that follows it on the
+ * ip4-unicast/ip6-unicast arcs, runs ACL lookup on the same packet again to
+ * find the policy. If the shared classification mode is enabled, the
+ * classifier-acls node stores the lookup result in vnet_buffer2()->classify
+ * and sets the VNET_BUFFER_F_CLASSIFY_RESULT_VALID flag. The consumer uses
+ * the stored result instead of its own lookup, if:
+ *   - the packet was classified on the same RX interface, so the packet
+ *     was not rewritten, e.g. decapsulated, after classification.
+ *   - the consumer lookup context has the same list of ACLs as the context
+ *     the packet was classified with. As ACL lookup returns the first match
+ *     in the list, the result of lookup in such contexts is the same.
+ *     The ACL plugin gives such contexts the same acl_list_id.
+ * Results with ACL position that does not fit the metadata are not stored.
+ *
+ * The QoS marking, policer and HQoS nodes use the service class and
+ * importance marked in vnet_buffer2()->qos by classifier and do not run ACL
+ * lookup, so they need no changes.
+ */
+
+#ifndef included_classifier_acls_classify_result_h
+#define included_classifier_acls_classify_result_h
+
+#include <vnet/buffer.h>
+
+#include <plugins/acl/acl.h>
+
+#define CLASSIFY_RESULT_NO_MATCH ((u16) ~0)
+
+/*
+ * The function stores the ACL lookup result in the buffer metadata.
+ * The 'acl_pos' and 'rule_index' are ~0 if lookup found no match.
+ */
+always_inline void
+classify_result_save (vlib_buffer_t * b, u32 sw_if_index, u32 lc_index,
+                      u32 acl_pos, u32 rule_index)
+{
+  if (acl_pos == ~0)
+    {
+      acl_pos = CLASSIFY_RESULT_NO_MATCH;
+      rule_index = 0;
+    }
+  else if (PREDICT_FALSE (acl_pos >= CLASSIFY_RESULT_NO_MATCH))
+    goto not_stored;
+
+  vnet_buffer2 (b)->classify.sw_if_index = sw_if_index;
+  vnet_buffer2 (b)->classify.lc_index = lc_index;
+  vnet_buffer2 (b)->classify.rule_index = rule_index;
+  vnet_buffer2 (b)->classify.acl_pos = acl_pos;
+  b->flags |= VNET_BUFFER_F_CLASSIFY_RESULT_VALID;
+  return;
+
+not_stored:
+  b->flags &= ~VNET_BUFFER_F_CLASSIFY_RESULT_VALID;
+}
+
+/*
+ * The function checks if the given lookup contexts have the same ACL list.
+ * It is called per packet, so it compares the ids given to the ACL lists by
+ * the ACL plugin, see acl_lookup_context_set_list_id(), and not the lists.
+ */
+always_inline int
+classify_result_lc_equal (acl_main_t * am, u32 lc_index1, u32 lc_index2)
+{
+  acl_lookup_context_t *lc1, *lc2;
+
+  if (lc_index1 == lc_index2)
+    return 1;
+  if (PREDICT_FALSE (pool_is_free_index (am->acl_lookup_contexts, lc_index1)))
+    return 0;
+
+  lc1 = pool_elt_at_index (am->acl_lookup_contexts, lc_index1);
+  lc2 = pool_elt_at_index (am->acl_lookup_contexts, lc_index2);
+  return lc1->acl_list_id == lc2->acl_list_id;
+}
+
+/*
+ * The function fetches the ACL lookup result stored in the buffer metadata,
+ * if it can be used for lookup in the 'lc_index' context for the packet
+ * received on the 'sw_if_index' interface.
+ *
+ * Returns -1 if there is no usable result and lookup should be done,
+ * 0 if the stored result is no match and 1 on match.
+ */
+always_inline int
+classify_result_get (acl_main_t * am, vlib_buffer_t * b, u32 sw_if_index,
+                     u32 lc_index, u32 * out_acl_pos, u32 * out_acl_index,
+                     u32 * out_rule_index)
+{
+  acl_lookup_context_t *lc;
+  u32 acl_pos;
+
+  if (!(b->flags & VNET_BUFFER_F_CLASSIFY_RESULT_VALID) ||
+      vnet_buffer2 (b)->classify.sw_if_index != sw_if_index ||
+      !classify_result_lc_equal (am, vnet_buffer2 (b)->classify.lc_index,
+                                 lc_index))
+    return -1;
+
+  acl_pos = vnet_buffer2 (b)->classify.acl_pos;
+  if (acl_pos == CLASSIFY_RESULT_NO_MATCH)
+    return 0;
+
+  lc = pool_elt_at_index (am->acl_lookup_contexts, lc_index);
+  *out_acl_pos = acl_pos;
+  *out_acl_index = lc->acl_indices[acl_pos];
+  *out_rule_index = vnet_buffer2 (b)->classify.rule_index;
+  return 1;
+}
+
+#endif /* included_classifier_acls_classify_result_h */
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
@@ -7,6 +7,10 @@
  *  attribute. The classification result is marked in the packet and can be
  *  made use of in other functions like scheduling, policing, marking etc.
  *
+ *  - single_pass_classification: the ACL classification result is stored in
+ *  buffer metadata, so the downstream nodes, like fwabf, can reuse it instead
+ *  of running ACL lookup again.
+ *
  * This file is added by the Flexiwan feature: acl_based_classification.
  */
 
@@ -16,9 +20,57 @@
 #include <vnet/qos/qos_types.h>
 
 #include <plugins/classifier_acls/classifier_acls.h>
+#include <plugins/classifier_acls/classify_result.h>
 
 extern classifier_acls_main_t classifier_acls_main;
 
+#define CLASSIFIER_ACLS_BATCH_SIZE 4
+
+/*
+ * The function returns the ACL plugin lookup context of ACLs attached to the
+ * interface or ~0 if no ACLs are attached. The acl_list_id_by_sw_if_index
+ * vector is presized by control plane on interface creation, so it is not
+ * reallocated by workers.
+ */
+always_inline u32
+classifier_acls_get_lc_index (classifier_acls_main_t * cmp, u32 sw_if_index)
+{
+  u32 acl_list_id;
+
+  if (PREDICT_FALSE (sw_if_index >= vec_len (cmp->acl_list_id_by_sw_if_index)))
+    return ~0;
+  acl_list_id = cmp->acl_list_id_by_sw_if_index[sw_if_index];
+  if (acl_list_id == ~0)
+    return ~0;
+  return cmp->acl_lc_index_by_acl_list_id[acl_list_id];
+}
+
+/*
+ * The function marks the packet with attributes of the matched ACL rule.
+ * Returns 1 on success, 0 if attributes can't be fetched.
+ */
+always_inline u32
+classifier_acls_mark_packet (classifier_acls_main_t * cmp, vlib_buffer_t * b,
+                             u32 acl_index, u32 rule_index)
+{
+  u8 service_class, importance;
+
+  if (acl_plugin_get_acl_attributes_inline
+      (cmp->acl_plugin.p_acl_main, acl_index, rule_index,
+       &service_class, &importance) != 0)
+    {
+      clib_warning ("ACL attr get failed- ACL index: %u Rule index: %u",
+                    acl_index, rule_index);
+      return 0;
+    }
+
+  vnet_buffer2 (b)->qos.service_class = service_class;
+  vnet_buffer2 (b)->qos.importance = importance;
+  vnet_buffer2 (b)->qos.source = QOS_SOURCE_IP;
+  b->flags |= VNET_BUFFER_F_IS_CLASSIFIED;
+  return 1;
+}
+
 /*
  * The function classifies the given packet based on ACLs attached to the
  * specified interface
@@ -36,10 +88,8 @@ classifier_acls_classify_packet (vlib_buffer_t *b, u32 sw_if_index, u8 is_ip6,
   u8 action;
   u32 lc_index;
 
-  vec_validate_init_empty (cmp->acl_list_id_by_sw_if_index, sw_if_index, ~0);
-  u32 acl_list_id = cmp->acl_list_id_by_sw_if_index[sw_if_index];
-  if ((acl_list_id == ~0) ||
-      ((lc_index = cmp->acl_lc_index_by_acl_list_id[acl_list_id]) == ~0))
+  lc_index = classifier_acls_get_lc_index (cmp, sw_if_index);
+  if (lc_index == ~0)
     {
       /* No ACLs attached */
       return 0;
@@ -52,21 +102,15 @@ classifier_acls_classify_packet (vlib_buffer_t *b, u32 sw_if_index, u8 is_ip6,
        &fa_5tuple0, is_ip6, &action, &match_acl_pos,
        &match_acl_index, &match_rule_index, &trace_bitmap))
     {
+      if (cmp->shared_classification)
+        classify_result_save (b, sw_if_index, lc_index, match_acl_pos,
+                              match_rule_index);
+
       /* match - fetch acl attributes */
-      u8 service_class, importance;
-      if (acl_plugin_get_acl_attributes_inline
-          (cmp->acl_plugin.p_acl_main, match_acl_index, match_rule_index,
-           &service_class, &importance) != 0)
-        {
-          clib_warning ("ACL attr get failed- ACL index: %u Rule index: %u",
-			  match_acl_index, match_rule_index);
-	  return 0;
-        }
+      if (!classifier_acls_mark_packet (cmp, b, match_acl_index,
+                                        match_rule_index))
+        return 0;
 
-      vnet_buffer2 (b)->qos.service_class = service_class;
-      vnet_buffer2 (b)->qos.importance = importance;
-      vnet_buffer2 (b)->qos.source = QOS_SOURCE_IP;
-      b->flags |= VNET_BUFFER_F_IS_CLASSIFIED;
       if (out_acl_index)
         {
 	  *out_acl_index = match_acl_index;
@@ -79,8 +123,132 @@ classifier_acls_classify_packet (vlib_buffer_t *b, u32 sw_if_index, u8 is_ip6,
     }
   else
     {
+      if (cmp->shared_classification)
+        classify_result_save (b, sw_if_index, lc_index, ~0, ~0);
       return 0;
     }
 }
 
+/*
+ * The function runs ACL lookup for a batch of packets. The packets are
+ * processed by groups of CLASSIFIER_ACLS_BATCH_SIZE in pipelined manner:
+ * while 5-tuples of the group are built and looked up, the data of the next
+ * group and the headers of the group after it are prefetched. The ACL hash
+ * buckets are not prefetched: it needs the mask and the hash of the lookup to
+ * be computed twice, that costs more than it saves.
+ *
+ * The lc_indexes[i] is lookup context of the i-th packet, ~0 if the packet
+ * should not be looked up. The out_acl_pos[i] is ~0 if the packet had no match.
+ * Returns number of matched packets.
+ */
+always_inline u32
+classifier_acls_match_batch (acl_main_t * am, vlib_buffer_t ** b,
+                             const u32 * lc_indexes, u32 n_packets, u8 is_ip6,
+                             u32 * out_acl_pos, u32 * out_acl_index,
+                             u32 * out_rule_index)
+{
+  fa_5tuple_opaque_t fa_5tuple[CLASSIFIER_ACLS_BATCH_SIZE];
+  u32 n_left = n_packets;
+  u32 matches = 0;
+  u32 trace_bitmap;
+  u32 i, n;
+  u8 action;
+
+  while (n_left > 0)
+    {
+      n = clib_min (n_left, CLASSIFIER_ACLS_BATCH_SIZE);
+
+      for (i = n; i < clib_min (n_left, 2 * CLASSIFIER_ACLS_BATCH_SIZE); i++)
+        vlib_prefetch_buffer_data (b[i], LOAD);
+      for (i = 2 * CLASSIFIER_ACLS_BATCH_SIZE;
+           i < clib_min (n_left, 3 * CLASSIFIER_ACLS_BATCH_SIZE); i++)
+        vlib_prefetch_buffer_header (b[i], LOAD);
+
+      for (i = 0; i < n; i++)
+        {
+          if (lc_indexes[i] == ~0)
+            continue;
+          acl_plugin_fill_5tuple_inline (am, lc_indexes[i], b[i], is_ip6,
+                                         1 /* is_input */, 0 /* is_l2 */,
+                                         &fa_5tuple[i]);
+        }
+
+      for (i = 0; i < n; i++)
+        {
+          out_acl_pos[i] = ~0;
+          if (lc_indexes[i] == ~0)
+            continue;
+          if (acl_plugin_match_5tuple_inline (am, lc_indexes[i], &fa_5tuple[i],
+                                              is_ip6, &action, &out_acl_pos[i],
+                                              &out_acl_index[i],
+                                              &out_rule_index[i],
+                                              &trace_bitmap))
+            matches++;
+          else
+            out_acl_pos[i] = ~0;
+        }
+
+      b += n;
+      lc_indexes += n;
+      out_acl_pos += n;
+      out_acl_index += n;
+      out_rule_index += n;
+      n_left -= n;
+    }
+  return matches;
+}
+
+/*
+ * The function classifies the given packets based on ACLs attached to their
+ * RX interfaces. It is the batched version of
+ * classifier_acls_classify_packet(), see classifier_acls_match_batch().
+ * The out_acl_index[i] is ~0 if the i-th packet was not classified.
+ * Returns number of classified packets.
+ */
+always_inline u32
+classifier_acls_classify_packets (vlib_buffer_t ** b, u32 n_packets, u8 is_ip6,
+                                  u32 * out_acl_index, u32 * out_rule_index)
+{
+  classifier_acls_main_t * cmp = &classifier_acls_main;
+  u32 lc_indexes[VLIB_FRAME_SIZE];
+  u32 acl_pos[VLIB_FRAME_SIZE];
+  u32 sw_if_index;
+  u32 matches = 0;
+  u32 i;
+
+  ASSERT (n_packets <= VLIB_FRAME_SIZE);
+
+  for (i = 0; i < n_packets; i++)
+    {
+      sw_if_index = vnet_buffer (b[i])->sw_if_index[VLIB_RX];
+      lc_indexes[i] = classifier_acls_get_lc_index (cmp, sw_if_index);
+    }
+
+  classifier_acls_match_batch (cmp->acl_plugin.p_acl_main, b, lc_indexes,
+                               n_packets, is_ip6, acl_pos, out_acl_index,
+                               out_rule_index);
+
+  for (i = 0; i < n_packets; i++)
+    {
+      if (lc_indexes[i] == ~0)
+        {
+          out_acl_index[i] = ~0;
+          continue;
+        }
+      if (cmp->shared_classification)
+        classify_result_save (b[i], vnet_buffer (b[i])->sw_if_index[VLIB_RX],
+                              lc_indexes[i], acl_pos[i],
+                              (acl_pos[i] == ~0) ? ~0 : out_rule_index[i]);
+      if (acl_pos[i] == ~0 ||
+          !classifier_acls_mark_packet (cmp, b[i], out_acl_index[i],
+                                        out_rule_index[i]))
+        {
+          out_acl_index[i] = ~0;
+          continue;
+        }
+      matches++;
+    }
+  return matches;
+}
+
 #endif
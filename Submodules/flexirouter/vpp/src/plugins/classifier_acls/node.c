@@ -79,85 +79,75 @@ classifier_acls_node_inline (vlib_main_t * vm,
 			     vlib_node_runtime_t * node,
 			     vlib_frame_t * frame, u8 is_ip6)
 {
+  vlib_buffer_t *bufs[VLIB_FRAME_SIZE], **b;
+  u16 nexts[VLIB_FRAME_SIZE], *next;
+  u32 match_acl_index[VLIB_FRAME_SIZE];
+  u32 match_rule_index[VLIB_FRAME_SIZE];
   u32 n_left_from, * from;
-  classifier_acls_next_t next_index;
-  u32 matches = 0;
-  u32 misses = 0;
-  u32 match_acl_index;
-  u32 match_rule_index;
+  u32 matches;
+  u32 i;
 
   from = vlib_frame_vector_args (frame);
   n_left_from = frame->n_vectors;
-  next_index = node->cached_next_index;
+  vlib_get_buffers (vm, from, bufs, n_left_from);
+
+  /* classify the whole frame in batches, see classifier_acls_match_batch() */
+  matches = classifier_acls_classify_packets (bufs, n_left_from, is_ip6,
+					      match_acl_index,
+					      match_rule_index);
 
+  b = bufs;
+  next = nexts;
+  while (n_left_from >= 4)
+    {
+      /* move on down the feature arc */
+      vnet_feature_next_u16 (&next[0], b[0]);
+      vnet_feature_next_u16 (&next[1], b[1]);
+      vnet_feature_next_u16 (&next[2], b[2]);
+      vnet_feature_next_u16 (&next[3], b[3]);
+
+      b += 4;
+      next += 4;
+      n_left_from -= 4;
+    }
   while (n_left_from > 0)
     {
-      u32 n_left_to_next, * to_next;
-      vlib_get_next_frame (vm, node, next_index,
-			   to_next, n_left_to_next);
+      vnet_feature_next_u16 (&next[0], b[0]);
 
-      while (n_left_from > 0 && n_left_to_next > 0)
+      b += 1;
+      next += 1;
+      n_left_from -= 1;
+    }
+
+  if (PREDICT_FALSE (node->flags & VLIB_NODE_FLAG_TRACE))
+    {
+      for (i = 0; i < frame->n_vectors; i++)
 	{
-	  u32 bi0;
-	  vlib_buffer_t * b0;
-	  u32 next0;
-	  u32 sw_if_index;
-          match_acl_index = ~0;
-
-	  /* speculatively enqueue b0 to the current next frame */
-	  bi0 = from[0];
-	  to_next[0] = bi0;
-	  from += 1;
-	  to_next += 1;
-	  n_left_from -= 1;
-	  n_left_to_next -= 1;
-
-	  b0 = vlib_get_buffer (vm, bi0);
-	  sw_if_index = vnet_buffer (b0)->sw_if_index[VLIB_RX];
-
-	  if (classifier_acls_classify_packet (b0, sw_if_index, is_ip6,
-					       &match_acl_index,
-					       &match_rule_index))
-	    {
-	      matches++;
-	    }
-	  else
-	    {
-	      misses++;
-	    }
-
-	  /* move on down the feature arc */
-	  vnet_feature_next (&next0, b0);
-
-	  if (PREDICT_FALSE ((node->flags & VLIB_NODE_FLAG_TRACE)
-			     && (b0->flags & VLIB_BUFFER_IS_TRACED)))
-	    {
-	      classifier_acls_trace_t *t = vlib_add_trace (vm, node, b0,
-							   sizeof (*t));
-	      t->next_index = next0;
-	      t->sw_if_index = sw_if_index;
-	      t->match_flag = (match_acl_index != ~0) ? 1 : 0;
-	      t->service_class = vnet_buffer2 (b0)->qos.service_class;
-	      t->importance = vnet_buffer2 (b0)->qos.importance;
-	      t->match_acl_index = match_acl_index;
-	      t->match_rule_index = (t->match_flag) ? match_rule_index : ~0;
-	    }
-	  /* verify speculative enqueue, maybe switch current next frame */
-	  vlib_validate_buffer_enqueue_x1 (vm, node, next_index,
-					   to_next, n_left_to_next,
-					   bi0, next0);
+	  if (!(bufs[i]->flags & VLIB_BUFFER_IS_TRACED))
+	    continue;
+
+	  classifier_acls_trace_t *t = vlib_add_trace (vm, node, bufs[i],
+						       sizeof (*t));
+	  t->next_index = nexts[i];
+	  t->sw_if_index = vnet_buffer (bufs[i])->sw_if_index[VLIB_RX];
+	  t->match_flag = (match_acl_index[i] != ~0) ? 1 : 0;
+	  t->service_class = vnet_buffer2 (bufs[i])->qos.service_class;
+	  t->importance = vnet_buffer2 (bufs[i])->qos.importance;
+	  t->match_acl_index = match_acl_index[i];
+	  t->match_rule_index = (t->match_flag) ? match_rule_index[i] : ~0;
 	}
-
-      vlib_put_next_frame (vm, node, next_index, n_left_to_next);
     }
 
+  vlib_buffer_enqueue_to_next (vm, node, from, nexts, frame->n_vectors);
+
   if (matches)
     vlib_node_increment_counter (vm, node->node_index,
 				 CLASSIFIER_ACLS_MATCHES, matches);
 
-  if (misses)
+  if (frame->n_vectors - matches)
     vlib_node_increment_counter (vm, node->node_index,
-				 CLASSIFIER_ACLS_MISSES, misses);
+				 CLASSIFIER_ACLS_MISSES,
+				 frame->n_vectors - matches);
 
   return frame->n_vectors;
 }
@@ -13,6 +13,15 @@
  * limitations under the License.
  */
 
+/*
+ * List of features made for FlexiWAN (denoted by FLEXIWAN_FEATURE flag):
+ *  - crypto_sw_scheduler_workers: production mode of the async scheduler.
+ *    The crypto workers can claim a batch of pending frames at once and
+ *    start from the own queue, stealing from other threads in round robin.
+ *    Both are off by default until measured on multi-core hosts. The crypto
+ *    workers and async mode can be set in startup configuration.
+ */
+
 #include <vnet/crypto/crypto.h>
 
 #ifndef __crypto_sw_scheduler_h__
@@ -21,6 +30,15 @@
 #define CRYPTO_SW_SCHEDULER_QUEUE_SIZE 64
 #define CRYPTO_SW_SCHEDULER_QUEUE_MASK (CRYPTO_SW_SCHEDULER_QUEUE_SIZE - 1)
 
+#ifdef FLEXIWAN_FEATURE /* crypto_sw_scheduler_workers */
+/* Max number of frames a crypto worker claims by single dequeue call */
+#define CRYPTO_SW_SCHEDULER_BATCH_FRAMES 8
+#define CRYPTO_SW_SCHEDULER_BATCH_SIZE_MAX \
+  (CRYPTO_SW_SCHEDULER_BATCH_FRAMES * VNET_CRYPTO_FRAME_SIZE)
+/* Single frame per dequeue call, as without the feature */
+#define CRYPTO_SW_SCHEDULER_BATCH_SIZE_DEFAULT 1
+#endif /* FLEXIWAN_FEATURE - crypto_sw_scheduler_workers */
+
 typedef struct
 {
   CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
@@ -39,6 +57,13 @@ typedef struct
   vnet_crypto_op_t *chained_integ_ops;
   vnet_crypto_op_chunk_t *chunks;
   u8 self_crypto_enabled;
+#ifdef FLEXIWAN_FEATURE /* crypto_sw_scheduler_workers */
+  vnet_crypto_async_frame_t *batch[CRYPTO_SW_SCHEDULER_BATCH_FRAMES];
+  u32 steal_cursor;		/* next thread to steal frames from */
+  u64 n_batches;
+  u64 n_frames_own;
+  u64 n_frames_stolen;
+#endif /* FLEXIWAN_FEATURE - crypto_sw_scheduler_workers */
 } crypto_sw_scheduler_per_thread_data_t;
 
 typedef struct
@@ -46,6 +71,12 @@ typedef struct
   u32 crypto_engine_index;
   crypto_sw_scheduler_per_thread_data_t *per_thread_data;
   vnet_crypto_key_t *keys;
+#ifdef FLEXIWAN_FEATURE /* crypto_sw_scheduler_workers */
+  u32 batch_size;		/* max elements claimed by single dequeue */
+  u8 work_stealing;		/* own queue first, then others round robin */
+  uword *crypto_workers;	/* startup config, 0 - all workers */
+  u8 async_mode;		/* enable ipsec async mode on startup */
+#endif /* FLEXIWAN_FEATURE - crypto_sw_scheduler_workers */
 } crypto_sw_scheduler_main_t;
 
 extern crypto_sw_scheduler_main_t crypto_sw_scheduler_main;
@@ -13,9 +13,27 @@
  * limitations under the License.
  */
 
+/*
+ * List of features made for FlexiWAN (denoted by FLEXIWAN_FEATURE flag):
+ *  - crypto_sw_scheduler_workers: production mode of the async scheduler.
+ *    The crypto workers can claim a batch of pending frames at once and
+ *    start from the own queue, stealing from other threads in round robin.
+ *    The ops of all frames in the batch, which may belong to different SAs,
+ *    are processed by single call to the crypto engine. The frames are still
+ *    returned to the producer in the queue order, so the packet order of an
+ *    SA is kept. The dedicated crypto workers, the batch size, the work
+ *    stealing and the IPsec async mode can be set in the
+ *    "crypto-sw-scheduler" startup section. The batching and the work
+ *    stealing are off by default, as they were not measured on multi-core
+ *    hosts yet, see extras/scripts/ipsec_async_bench.sh.
+ */
+
 #include <vlib/vlib.h>
 #include <vnet/plugin/plugin.h>
 #include <vpp/app/version.h>
+#ifdef FLEXIWAN_FEATURE /* crypto_sw_scheduler_workers */
+#include <vnet/ipsec/ipsec.h>
+#endif /* FLEXIWAN_FEATURE - crypto_sw_scheduler_workers */
 
 #include "crypto_sw_scheduler.h"
 
@@ -262,6 +280,183 @@ crypto_sw_scheduler_convert_link_crypto (vlib_main_t * vm,
   crypto_op->user_data = integ_op->user_data = index;
 }
 
+#ifdef FLEXIWAN_FEATURE /* crypto_sw_scheduler_workers */
+/*
+ * The op user_data keeps the frame position in the batch in the upper bits
+ * and the element index in the frame in the lower bits.
+ */
+#define CRYPTO_SW_SCHEDULER_OP_USER_DATA(k, i) (((k) << 16) | (i))
+
+static_always_inline void
+process_ops (vlib_main_t * vm, vnet_crypto_async_frame_t ** frames,
+	     vnet_crypto_op_t * ops, u8 * states)
+{
+  u32 n_fail, n_ops = vec_len (ops);
+  vnet_crypto_op_t *op = ops;
+
+  if (n_ops == 0)
+    return;
+
+  n_fail = n_ops - vnet_crypto_process_ops (vm, op, n_ops);
+
+  while (n_fail)
+    {
+      ASSERT (op - ops < n_ops);
+
+      if (op->status != VNET_CRYPTO_OP_STATUS_COMPLETED)
+	{
+	  frames[op->user_data >> 16]->elts[op->user_data & 0xffff].status =
+	    op->status;
+	  states[op->user_data >> 16] = VNET_CRYPTO_FRAME_STATE_ELT_ERROR;
+	  n_fail--;
+	}
+      op++;
+    }
+}
+
+static_always_inline void
+process_chained_ops (vlib_main_t * vm, vnet_crypto_async_frame_t ** frames,
+		     vnet_crypto_op_t * ops, vnet_crypto_op_chunk_t * chunks,
+		     u8 * states)
+{
+  u32 n_fail, n_ops = vec_len (ops);
+  vnet_crypto_op_t *op = ops;
+
+  if (n_ops == 0)
+    return;
+
+  n_fail = n_ops - vnet_crypto_process_chained_ops (vm, op, chunks, n_ops);
+
+  while (n_fail)
+    {
+      ASSERT (op - ops < n_ops);
+
+      if (op->status != VNET_CRYPTO_OP_STATUS_COMPLETED)
+	{
+	  frames[op->user_data >> 16]->elts[op->user_data & 0xffff].status =
+	    op->status;
+	  states[op->user_data >> 16] = VNET_CRYPTO_FRAME_STATE_ELT_ERROR;
+	  n_fail--;
+	}
+      op++;
+    }
+}
+
+static_always_inline u32
+crypto_sw_scheduler_claim_queue (crypto_sw_scheduler_main_t * cm,
+				 crypto_sw_scheduler_per_thread_data_t * ptd,
+				 crypto_sw_scheduler_queue_t * q,
+				 u32 n_frames, u32 * n_elts)
+{
+  vnet_crypto_async_frame_t *f;
+
+  while (n_frames < CRYPTO_SW_SCHEDULER_BATCH_FRAMES &&
+	 *n_elts < cm->batch_size &&
+	 (f = crypto_sw_scheduler_get_pending_frame (q)))
+    {
+      ptd->batch[n_frames++] = f;
+      *n_elts += f->n_elts;
+    }
+  return n_frames;
+}
+
+/*
+ * Claims pending frames of the async op into the thread batch. Without work
+ * stealing the queues are scanned from the first thread on, as without the
+ * feature. With work stealing the own queue goes first, as its buffers are
+ * hot in the cache. Then the frames are stolen from the other threads. The
+ * thread to start stealing from rotates with every call, so the busy
+ * producers are served evenly. Returns the number of claimed frames.
+ */
+static_always_inline u32
+crypto_sw_scheduler_claim_frames (crypto_sw_scheduler_main_t * cm,
+				  crypto_sw_scheduler_per_thread_data_t * ptd,
+				  u32 thread_index,
+				  vnet_crypto_async_op_id_t async_op_id)
+{
+  u32 n_threads = vec_len (cm->per_thread_data);
+  u32 n_frames = 0, n_own = 0, n_elts = 0, n, i, t;
+
+  if (!cm->work_stealing)
+    {
+      for (t = 0; t < n_threads; t++)
+	{
+	  if (n_frames == CRYPTO_SW_SCHEDULER_BATCH_FRAMES ||
+	      n_elts >= cm->batch_size)
+	    break;
+	  n = crypto_sw_scheduler_claim_queue (cm, ptd,
+					       cm->per_thread_data[t].
+					       queues[async_op_id],
+					       n_frames, &n_elts);
+	  if (t == thread_index)
+	    n_own = n - n_frames;
+	  n_frames = n;
+	}
+      goto done;
+    }
+
+  n_frames = n_own = crypto_sw_scheduler_claim_queue (cm, ptd,
+						      ptd->queues[async_op_id],
+						      0, &n_elts);
+
+  for (i = 0; i < n_threads; i++)
+    {
+      if (n_frames == CRYPTO_SW_SCHEDULER_BATCH_FRAMES ||
+	  n_elts >= cm->batch_size)
+	break;
+      t = (ptd->steal_cursor + i) % n_threads;
+      if (t == thread_index)
+	continue;
+      n_frames = crypto_sw_scheduler_claim_queue (cm, ptd,
+						  cm->per_thread_data[t].
+						  queues[async_op_id],
+						  n_frames, &n_elts);
+    }
+  ptd->steal_cursor = (ptd->steal_cursor + 1) % n_threads;
+
+done:
+  if (n_frames)
+    {
+      ptd->n_batches++;
+      ptd->n_frames_own += n_own;
+      ptd->n_frames_stolen += n_frames - n_own;
+    }
+  return n_frames;
+}
+
+/*
+ * Marks the batched frames as processed. The dispatch node signals only the
+ * thread returned in enqueue_thread_idx, so the producers of the rest of the
+ * frames are signaled here.
+ */
+static_always_inline void
+crypto_sw_scheduler_complete_frames (crypto_sw_scheduler_per_thread_data_t *
+				     ptd, u8 * states, u32 n_frames,
+				     u32 * nb_elts_processed,
+				     u32 * enqueue_thread_idx)
+{
+  vnet_crypto_main_t *vcm = &crypto_main;
+  vnet_crypto_async_frame_t *f;
+  u32 k, n_elts = 0, thread_index;
+
+  *enqueue_thread_idx = ptd->batch[0]->enqueue_thread_index;
+
+  for (k = 0; k < n_frames; k++)
+    {
+      f = ptd->batch[k];
+      n_elts += f->n_elts;
+      thread_index = f->enqueue_thread_index;
+      /* the frame can be freed by the producer once the state is set */
+      f->state = states[k];
+      if (vcm->dispatch_mode == VNET_CRYPTO_ASYNC_DISPATCH_INTERRUPT &&
+	  thread_index != *enqueue_thread_idx)
+	vlib_node_set_interrupt_pending (vlib_mains[thread_index],
+					 vcm->crypto_node_index);
+    }
+  *nb_elts_processed = n_elts;
+}
+
+#else /* FLEXIWAN_FEATURE - crypto_sw_scheduler_workers */
 static_always_inline void
 process_ops (vlib_main_t * vm, vnet_crypto_async_frame_t * f,
 	     vnet_crypto_op_t * ops, u8 * state)
@@ -315,6 +510,152 @@ process_chained_ops (vlib_main_t * vm, vnet_crypto_async_frame_t * f,
     }
 }
 
+#endif /* FLEXIWAN_FEATURE - crypto_sw_scheduler_workers */
+
+#ifdef FLEXIWAN_FEATURE /* crypto_sw_scheduler_workers */
+static_always_inline vnet_crypto_async_frame_t *
+crypto_sw_scheduler_dequeue_aead (vlib_main_t * vm,
+				  vnet_crypto_async_op_id_t async_op_id,
+				  vnet_crypto_op_id_t sync_op_id, u8 tag_len,
+				  u8 aad_len, u32 * nb_elts_processed,
+				  u32 * enqueue_thread_idx)
+{
+  crypto_sw_scheduler_main_t *cm = &crypto_sw_scheduler_main;
+  crypto_sw_scheduler_per_thread_data_t *ptd =
+    cm->per_thread_data + vm->thread_index;
+  u8 states[CRYPTO_SW_SCHEDULER_BATCH_FRAMES];
+  vnet_crypto_async_frame_t *f;
+  vnet_crypto_async_frame_elt_t *fe;
+  u32 *bi;
+  u32 n_elts, n_frames = 0, k;
+
+  if (ptd->self_crypto_enabled)
+    n_frames = crypto_sw_scheduler_claim_frames (cm, ptd, vm->thread_index,
+						 async_op_id);
+
+  if (n_frames)
+    {
+      vec_reset_length (ptd->crypto_ops);
+      vec_reset_length (ptd->chained_crypto_ops);
+      vec_reset_length (ptd->chunks);
+
+      for (k = 0; k < n_frames; k++)
+	{
+	  f = ptd->batch[k];
+	  states[k] = VNET_CRYPTO_FRAME_STATE_SUCCESS;
+	  n_elts = f->n_elts;
+	  fe = f->elts;
+	  bi = f->buffer_indices;
+
+	  while (n_elts--)
+	    {
+	      if (n_elts > 1)
+		CLIB_PREFETCH (fe + 1, CLIB_CACHE_LINE_BYTES, LOAD);
+
+	      crypto_sw_scheduler_convert_aead (vm, ptd, fe,
+						CRYPTO_SW_SCHEDULER_OP_USER_DATA
+						(k, fe - f->elts), bi[0],
+						sync_op_id, aad_len, tag_len);
+	      bi++;
+	      fe++;
+	    }
+	}
+
+      process_ops (vm, ptd->batch, ptd->crypto_ops, states);
+      process_chained_ops (vm, ptd->batch, ptd->chained_crypto_ops,
+			   ptd->chunks, states);
+      crypto_sw_scheduler_complete_frames (ptd, states, n_frames,
+					   nb_elts_processed,
+					   enqueue_thread_idx);
+    }
+
+  return crypto_sw_scheduler_get_completed_frame (ptd->queues[async_op_id]);
+}
+
+static_always_inline vnet_crypto_async_frame_t *
+crypto_sw_scheduler_dequeue_link (vlib_main_t * vm,
+				  vnet_crypto_async_op_id_t async_op_id,
+				  vnet_crypto_op_id_t sync_crypto_op_id,
+				  vnet_crypto_op_id_t sync_integ_op_id,
+				  u16 digest_len, u8 is_enc,
+				  u32 * nb_elts_processed,
+				  u32 * enqueue_thread_idx)
+{
+  crypto_sw_scheduler_main_t *cm = &crypto_sw_scheduler_main;
+  crypto_sw_scheduler_per_thread_data_t *ptd =
+    cm->per_thread_data + vm->thread_index;
+  u8 states[CRYPTO_SW_SCHEDULER_BATCH_FRAMES];
+  vnet_crypto_async_frame_t *f;
+  vnet_crypto_async_frame_elt_t *fe;
+  u32 *bi;
+  u32 n_elts, n_frames = 0, k;
+
+  if (ptd->self_crypto_enabled)
+    n_frames = crypto_sw_scheduler_claim_frames (cm, ptd, vm->thread_index,
+						 async_op_id);
+
+  if (n_frames)
+    {
+      vec_reset_length (ptd->crypto_ops);
+      vec_reset_length (ptd->integ_ops);
+      vec_reset_length (ptd->chained_crypto_ops);
+      vec_reset_length (ptd->chained_integ_ops);
+      vec_reset_length (ptd->chunks);
+
+      for (k = 0; k < n_frames; k++)
+	{
+	  f = ptd->batch[k];
+	  states[k] = VNET_CRYPTO_FRAME_STATE_SUCCESS;
+	  n_elts = f->n_elts;
+	  fe = f->elts;
+	  bi = f->buffer_indices;
+
+	  while (n_elts--)
+	    {
+	      if (n_elts > 1)
+		CLIB_PREFETCH (fe + 1, CLIB_CACHE_LINE_BYTES, LOAD);
+
+	      crypto_sw_scheduler_convert_link_crypto (vm, ptd,
+						       cm->keys + fe->key_index,
+						       fe,
+						       CRYPTO_SW_SCHEDULER_OP_USER_DATA
+						       (k, fe - f->elts),
+						       bi[0], sync_crypto_op_id,
+						       sync_integ_op_id,
+						       digest_len, is_enc);
+	      bi++;
+	      fe++;
+	    }
+	}
+
+      if (is_enc)
+	{
+	  process_ops (vm, ptd->batch, ptd->crypto_ops, states);
+	  process_chained_ops (vm, ptd->batch, ptd->chained_crypto_ops,
+			       ptd->chunks, states);
+	  process_ops (vm, ptd->batch, ptd->integ_ops, states);
+	  process_chained_ops (vm, ptd->batch, ptd->chained_integ_ops,
+			       ptd->chunks, states);
+	}
+      else
+	{
+	  process_ops (vm, ptd->batch, ptd->integ_ops, states);
+	  process_chained_ops (vm, ptd->batch, ptd->chained_integ_ops,
+			       ptd->chunks, states);
+	  process_ops (vm, ptd->batch, ptd->crypto_ops, states);
+	  process_chained_ops (vm, ptd->batch, ptd->chained_crypto_ops,
+			       ptd->chunks, states);
+	}
+
+      crypto_sw_scheduler_complete_frames (ptd, states, n_frames,
+					   nb_elts_processed,
+					   enqueue_thread_idx);
+    }
+
+  return crypto_sw_scheduler_get_completed_frame (ptd->queues[async_op_id]);
+}
+
+#else /* FLEXIWAN_FEATURE - crypto_sw_scheduler_workers */
 static_always_inline vnet_crypto_async_frame_t *
 crypto_sw_scheduler_dequeue_aead (vlib_main_t * vm,
 				  vnet_crypto_async_op_id_t async_op_id,
@@ -467,6 +808,8 @@ crypto_sw_scheduler_dequeue_link (vlib_main_t * vm,
   return crypto_sw_scheduler_get_completed_frame (ptd->queues[async_op_id]);
 }
 
+#endif /* FLEXIWAN_FEATURE - crypto_sw_scheduler_workers */
+
 static clib_error_t *
 sw_scheduler_set_worker_crypto (vlib_main_t * vm, unformat_input_t * input,
 				vlib_cli_command_t * cmd)
@@ -540,6 +883,24 @@ sw_scheduler_show_workers (vlib_main_t * vm, unformat_input_t * input,
   crypto_sw_scheduler_main_t *cm = &crypto_sw_scheduler_main;
   u32 i;
 
+#ifdef FLEXIWAN_FEATURE /* crypto_sw_scheduler_workers */
+  crypto_sw_scheduler_per_thread_data_t *ptd;
+
+  vlib_cli_output (vm, "batch size: %u, work stealing: %s", cm->batch_size,
+		   cm->work_stealing ? "on" : "off");
+  vlib_cli_output (vm, "%-7s%-20s%-8s%-14s%-14s%-14s", "ID", "Name",
+		   "Crypto", "Batches", "Own frames", "Stolen frames");
+  for (i = 1; i < vlib_thread_main.n_vlib_mains; i++)
+    {
+      ptd = cm->per_thread_data + i;
+      vlib_cli_output (vm, "%-7d%-20s%-8s%-14lu%-14lu%-14lu",
+		       vlib_get_worker_index (i),
+		       (vlib_worker_threads + i)->name,
+		       ptd->self_crypto_enabled ? "on" : "off",
+		       ptd->n_batches, ptd->n_frames_own,
+		       ptd->n_frames_stolen);
+    }
+#else /* FLEXIWAN_FEATURE - crypto_sw_scheduler_workers */
   vlib_cli_output (vm, "%-7s%-20s%-8s", "ID", "Name", "Crypto");
   for (i = 1; i < vlib_thread_main.n_vlib_mains; i++)
     {
@@ -548,6 +909,7 @@ sw_scheduler_show_workers (vlib_main_t * vm, unformat_input_t * input,
 		       cm->
 		       per_thread_data[i].self_crypto_enabled ? "on" : "off");
     }
+#endif /* FLEXIWAN_FEATURE - crypto_sw_scheduler_workers */
 
   return 0;
 }
@@ -577,6 +939,93 @@ sw_scheduler_cli_init (vlib_main_t * vm)
 
 VLIB_INIT_FUNCTION (sw_scheduler_cli_init);
 
+#ifdef FLEXIWAN_FEATURE /* crypto_sw_scheduler_workers */
+/*
+ * crypto-sw-scheduler {
+ *   crypto-workers <list>   - only these workers process the crypto frames,
+ *                             the rest of workers just enqueue the frames
+ *                             and collect them back
+ *   batch-size <n>          - max number of elements claimed by a worker
+ *                             at once, the frames of different SAs included,
+ *                             1 (single frame) by default
+ *   work-stealing           - claim the own frames first, then the frames of
+ *                             other threads in round robin, off by default
+ *   async-mode              - run IPsec with async crypto from the start
+ * }
+ */
+static clib_error_t *
+crypto_sw_scheduler_config (vlib_main_t * vm, unformat_input_t * input)
+{
+  crypto_sw_scheduler_main_t *cm = &crypto_sw_scheduler_main;
+  uword *bitmap = 0;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "crypto-workers %U", unformat_bitmap_list,
+		    &bitmap))
+	{
+	  clib_bitmap_free (cm->crypto_workers);
+	  cm->crypto_workers = bitmap;
+	  bitmap = 0;
+	}
+      else if (unformat (input, "batch-size %u", &cm->batch_size))
+	{
+	  if (cm->batch_size == 0 ||
+	      cm->batch_size > CRYPTO_SW_SCHEDULER_BATCH_SIZE_MAX)
+	    return clib_error_return (0, "batch-size must be 1..%u",
+				      CRYPTO_SW_SCHEDULER_BATCH_SIZE_MAX);
+	}
+      else if (unformat (input, "work-stealing"))
+	cm->work_stealing = 1;
+      else if (unformat (input, "async-mode"))
+	cm->async_mode = 1;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  return 0;
+}
+
+VLIB_CONFIG_FUNCTION (crypto_sw_scheduler_config, "crypto-sw-scheduler");
+
+/*
+ * The startup configuration is applied once the workers are created, as the
+ * async mode turns on the crypto dispatch node on every worker.
+ */
+static clib_error_t *
+crypto_sw_scheduler_main_loop_enter (vlib_main_t * vm)
+{
+  crypto_sw_scheduler_main_t *cm = &crypto_sw_scheduler_main;
+  u32 i, n_workers = vlib_num_workers ();
+
+  if (cm->crypto_workers)
+    {
+      if (clib_bitmap_last_set (cm->crypto_workers) >= n_workers)
+	return clib_error_return (0, "crypto-workers: invalid worker %u",
+				  clib_bitmap_last_set (cm->crypto_workers));
+
+      for (i = 0; i < n_workers; i++)
+	cm->per_thread_data[vlib_get_worker_thread_index (i)].
+	  self_crypto_enabled = clib_bitmap_get (cm->crypto_workers, i);
+    }
+
+  if (cm->async_mode)
+    {
+      vnet_crypto_request_async_mode (1);
+      ipsec_set_async_mode (1);
+    }
+
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_MAIN_LOOP_ENTER_FUNCTION (crypto_sw_scheduler_main_loop_enter) = {
+  .runs_after = VLIB_INITS ("start_workers"),
+};
+/* *INDENT-ON* */
+#endif /* FLEXIWAN_FEATURE - crypto_sw_scheduler_workers */
+
 /* *INDENT-OFF* */
 #define _(n, s, k, t, a)                                                      \
   static vnet_crypto_async_frame_t                                            \
@@ -636,6 +1085,11 @@ crypto_sw_scheduler_init (vlib_main_t * vm)
   vec_validate_aligned (cm->per_thread_data, tm->n_vlib_mains - 1,
 			CLIB_CACHE_LINE_BYTES);
 
+#ifdef FLEXIWAN_FEATURE /* crypto_sw_scheduler_workers */
+  if (cm->batch_size == 0)
+    cm->batch_size = CRYPTO_SW_SCHEDULER_BATCH_SIZE_DEFAULT;
+#endif /* FLEXIWAN_FEATURE - crypto_sw_scheduler_workers */
+
   vec_foreach (ptd, cm->per_thread_data)
   {
     ptd->self_crypto_enabled = 1;
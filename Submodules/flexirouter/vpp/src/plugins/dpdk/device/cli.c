@@ -21,6 +21,24 @@
  *    The FlexiWAN commit makes the required corresponding changes and brings
  *    back the feature to working state. Additionaly made enhancements in the
  *    context of WAN QoS needs.
+ *
+ *  - hqos_adaptive_thread : The HQoS thread sleeps on eventfd when there is
+ *    no traffic and is woken up by workers. Partial bursts are flushed by time
+ *    deadline and every device is served up to its dequeue budget per round.
+ *
+ *  - hqos_stats_segment : The HQoS thread samples scheduler statistics of
+ *    its devices periodically into the stats segment: per queue (subport,
+ *    pipe, traffic class) enqueued and dropped packets and bytes and queue
+ *    occupancy, and per subport and traffic class enqueued and dropped
+ *    packets and bytes.
+ *
+ *  - hqos_metadata_set_x4 : The 'test dpdk hqos metadata-set' command
+ *    measures cycles per packet spent by dpdk_hqos_metadata_set() on
+ *    classified and unclassified packets.
+ *
+ *  - hqos_runtime_reconfig : The 'set dpdk interface hqos reconfig' command
+ *    changes subport/pipe profile rates and mappings at runtime as one
+ *    transaction, without worker barrier.
  */
 
 #include <unistd.h>
@@ -269,6 +287,117 @@ VLIB_CLI_COMMAND (cmd_test_dpdk_buffer,static) = {
 };
 /* *INDENT-ON* */
 
+#ifdef FLEXIWAN_FEATURE /* hqos_metadata_set_x4 */
+static clib_error_t *
+test_dpdk_hqos_metadata_set (vlib_main_t * vm, unformat_input_t * input,
+			     vlib_cli_command_t * cmd)
+{
+  dpdk_main_t *dm = &dpdk_main;
+  dpdk_device_hqos_per_worker_thread_t *hqos;
+  vnet_hw_interface_t *hw;
+  dpdk_device_t *xd;
+  struct rte_mbuf **mbufs = 0;
+  vlib_buffer_t *b;
+  u32 hw_if_index = ~0, n_pkts = VLIB_FRAME_SIZE, n_iterations = 10000;
+  u32 *buffers = 0, n_alloc, i, j, classified;
+  u64 t0, cycles;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "%U", unformat_vnet_hw_interface, dm->vnet_main,
+		    &hw_if_index))
+	;
+      else if (unformat (input, "packets %u", &n_pkts))
+	;
+      else if (unformat (input, "iterations %u", &n_iterations))
+	;
+      else
+	return clib_error_return (0, "parse error: '%U'",
+				  format_unformat_error, input);
+    }
+
+  if (hw_if_index == (u32) ~ 0)
+    return clib_error_return (0, "please specify valid interface name");
+  if (n_pkts == 0 || n_iterations == 0)
+    return clib_error_return (0, "packets and iterations should be positive");
+
+  hw = vnet_get_hw_interface (dm->vnet_main, hw_if_index);
+  xd = vec_elt_at_index (dm->devices, hw->dev_instance);
+  if ((xd->flags & DPDK_DEVICE_FLAG_HQOS) == 0)
+    return clib_error_return (0, "hqos not enabled on interface");
+
+  hqos = &xd->hqos_wt[vm->thread_index];
+  if (hqos->hqos_field0_slabmask || hqos->hqos_field1_slabmask ||
+      hqos->hqos_field2_slabmask)
+    return clib_error_return (0, "hqos pktfield classification is set");
+
+  vec_validate (buffers, n_pkts - 1);
+  n_alloc = vlib_buffer_alloc (vm, buffers, n_pkts);
+  if (n_alloc < n_pkts)
+    {
+      vlib_buffer_free (vm, buffers, n_alloc);
+      vec_free (buffers);
+      return clib_error_return (0, "failed to allocate %u buffers", n_pkts);
+    }
+
+  vec_validate (mbufs, n_pkts - 1);
+  for (i = 0; i < n_pkts; i++)
+    mbufs[i] = rte_mbuf_from_vlib_buffer (vlib_get_buffer (vm, buffers[i]));
+
+  for (classified = 0; classified < 2; classified++)
+    {
+      cycles = 0;
+      for (j = 0; j < n_iterations; j++)
+	{
+	  /* dpdk_hqos_metadata_set() resets qos.id, so set it every time */
+	  for (i = 0; i < n_pkts; i++)
+	    {
+	      b = vlib_get_buffer (vm, buffers[i]);
+	      if (classified)
+		b->flags |= VNET_BUFFER_F_IS_CLASSIFIED;
+	      else
+		b->flags &= ~VNET_BUFFER_F_IS_CLASSIFIED;
+	      vnet_buffer2 (b)->qos.bits = i & 0x3F;
+	      vnet_buffer2 (b)->qos.id = 0;
+	    }
+
+	  t0 = clib_cpu_time_now ();
+	  dpdk_hqos_metadata_set (hqos, xd->hqos_ht->hqos, mbufs, n_pkts);
+	  cycles += clib_cpu_time_now () - t0;
+	}
+
+      vlib_cli_output (vm, "%-14s %u packets x %u: %.2f cycles/packet",
+		       classified ? "classified" : "unclassified", n_pkts,
+		       n_iterations, (f64) cycles / ((f64) n_pkts *
+						      n_iterations));
+    }
+
+  vlib_buffer_free (vm, buffers, n_pkts);
+  vec_free (buffers);
+  vec_free (mbufs);
+  return 0;
+}
+
+/*?
+ * This command measures the CPU cycles per packet spent by the workers on
+ * setting the HQoS scheduler metadata of packets classified by the ACL based
+ * classification and of unclassified packets.
+ *
+ * The interface should have HQoS enabled without pktfield classification.
+ *
+ * @cliexpar
+ * @cliexcmd{test dpdk hqos metadata-set GigabitEthernet0/8/0 packets 256 iterations 10000}
+?*/
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (cmd_test_dpdk_hqos_metadata_set, static) = {
+  .path = "test dpdk hqos metadata-set",
+  .short_help = "test dpdk hqos metadata-set <interface> [packets <n>] "
+                "[iterations <n>]",
+  .function = test_dpdk_hqos_metadata_set,
+};
+/* *INDENT-ON* */
+#endif /* FLEXIWAN_FEATURE - hqos_metadata_set_x4 */
+
 static clib_error_t *
 set_dpdk_if_desc (vlib_main_t * vm, unformat_input_t * input,
 		  vlib_cli_command_t * cmd)
@@ -403,6 +532,13 @@ show_dpdk_if_hqos_placement (vlib_main_t * vm, unformat_input_t * input,
        vlib_cli_output (vm, "Thread %u (%s at lcore %u):", cpu,
                         vlib_worker_threads[cpu].name,
                         vlib_worker_threads[cpu].cpu_id);
+#ifdef FLEXIWAN_FEATURE /* hqos_adaptive_thread */
+      if (cpu < vec_len (dm->hqos_thread_data) &&
+          dm->hqos_thread_data[cpu].eventfd >= 0)
+        vlib_cli_output (vm, "  adaptive: sleeps %llu, wakeups %llu",
+                         dm->hqos_thread_data[cpu].n_sleeps,
+                         dm->hqos_thread_data[cpu].n_wakeups);
+#endif /* FLEXIWAN_FEATURE - hqos_adaptive_thread */
 
       vec_foreach (dq, dm->devices_by_hqos_cpu[cpu])
       {
@@ -496,6 +632,11 @@ set_dpdk_if_hqos_placement (vlib_main_t * vm, unformat_input_t * input,
            vec_add2 (dm->devices_by_hqos_cpu[cpu], dq, 1);
            dq->queue_id = 0;
            dq->device = xd->device_index;
+#ifdef FLEXIWAN_FEATURE /* hqos_adaptive_thread */
+           if (xd->hqos_ht->thread_data)
+             xd->hqos_ht->thread_data =
+               vec_elt_at_index (dm->hqos_thread_data, cpu);
+#endif /* FLEXIWAN_FEATURE - hqos_adaptive_thread */
 
            vec_sort_with_function (dm->devices_by_hqos_cpu[i],
                                    dpdk_device_queue_sort);
@@ -1023,6 +1164,136 @@ VLIB_CLI_COMMAND (cmd_set_dpdk_if_hqos_subport, static) = {
 };
 /* *INDENT-ON* */
 
+#ifdef FLEXIWAN_FEATURE /* hqos_runtime_reconfig */
+static clib_error_t *
+set_dpdk_if_hqos_reconfig (vlib_main_t * vm, unformat_input_t * input,
+			   vlib_cli_command_t * cmd)
+{
+  unformat_input_t _line_input, *line_input = &_line_input;
+  dpdk_main_t *dm = &dpdk_main;
+  dpdk_device_t *xd;
+  dpdk_device_config_t *devconf;
+  dpdk_hqos_reconfig_t rc = { 0 };
+  struct rte_sched_subport_profile_params sp;
+  struct rte_sched_pipe_params pp;
+  clib_error_t *error = NULL;
+  u32 hw_if_index = ~0;
+  u32 subport_id, pipe_id, profile_id, rate, tb_size, i;
+
+  if (!unformat_user (input, unformat_line_input, line_input))
+    {
+      return 0;
+    }
+
+  /* The interface goes first, as the profile changes start from its config */
+  if (!unformat (line_input, "%U", unformat_vnet_hw_interface, dm->vnet_main,
+		 &hw_if_index))
+    {
+      error = clib_error_return (0, "please specify valid interface name");
+      goto done;
+    }
+
+  error = dpdk_hqos_get_intf_context (hw_if_index, &xd, &devconf);
+  if (error)
+    {
+      goto done;
+    }
+  if ((xd->flags & DPDK_DEVICE_FLAG_HQOS) == 0)
+    {
+      error = clib_error_return (0, "hqos not enabled on interface");
+      goto done;
+    }
+
+  while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT)
+    {
+      tb_size = 0;
+      if (unformat (line_input, "subport-profile %u rate %u bktsize %u",
+		    &profile_id, &rate, &tb_size) ||
+	  unformat (line_input, "subport-profile %u rate %u",
+		    &profile_id, &rate))
+	{
+	  error = dpdk_hqos_get_subport_profile (&devconf->hqos, profile_id,
+						 &sp);
+	  if (error)
+	    goto done;
+	  sp.tb_rate = rate;
+	  for (i = 0; i < RTE_SCHED_TRAFFIC_CLASSES_PER_PIPE; i++)
+	    sp.tc_rate[i] = rate;
+	  sp.tb_size = tb_size ? tb_size :
+	    MAX ((HQOS_DEFAULT_SCHED_TB_SIZE_MS * (sp.tb_rate / 1000)),
+		 HQOS_MIN_SCHED_TB_SIZE_BYTES);
+	  dpdk_hqos_reconfig_add_subport_profile (&rc, profile_id, &sp);
+	}
+      else if (unformat (line_input, "pipe-profile %u %u rate %u bktsize %u",
+			 &subport_id, &profile_id, &rate, &tb_size) ||
+	       unformat (line_input, "pipe-profile %u %u rate %u",
+			 &subport_id, &profile_id, &rate))
+	{
+	  error = dpdk_hqos_get_pipe_profile (&devconf->hqos, subport_id,
+					      profile_id, &pp);
+	  if (error)
+	    goto done;
+	  pp.tb_rate = rate;
+	  for (i = 0; i < RTE_SCHED_TRAFFIC_CLASSES_PER_PIPE; i++)
+	    pp.tc_rate[i] = rate;
+	  pp.tb_size = tb_size ? tb_size :
+	    MAX ((HQOS_DEFAULT_SCHED_TB_SIZE_MS * (pp.tb_rate / 1000)),
+		 HQOS_MIN_SCHED_TB_SIZE_BYTES);
+	  dpdk_hqos_reconfig_add_pipe_profile (&rc, subport_id, profile_id,
+					       &pp);
+	}
+      else if (unformat (line_input, "subport %u profile %u",
+			 &subport_id, &profile_id))
+	dpdk_hqos_reconfig_add_subport (&rc, subport_id, profile_id);
+      else if (unformat (line_input, "pipe %u %u profile %u",
+			 &subport_id, &pipe_id, &profile_id))
+	dpdk_hqos_reconfig_add_pipe (&rc, subport_id, pipe_id, profile_id);
+      else
+	{
+	  error = clib_error_return (0, "parse error: '%U'",
+				     format_unformat_error, line_input);
+	  goto done;
+	}
+    }
+
+  error = dpdk_hqos_reconfig_commit (vm, xd, &devconf->hqos, &rc);
+
+done:
+  dpdk_hqos_reconfig_free (&rc);
+  unformat_free (line_input);
+
+  return error;
+}
+
+/*?
+ * This command is used to change the rates of existing subport and pipe
+ * profiles and the profiles of existing subports and pipes while traffic
+ * is running. All changes of the command are applied by the HQoS thread at
+ * once between two bursts, without worker barrier, after all of them are
+ * validated. The subports and pipes that use the changed profile are
+ * reloaded with the new rates, which resets their credits. To add new
+ * profiles, subports or pipes use the 'set dpdk interface hqos
+ * subport-profile' and similar commands.
+ *
+ * @cliexpar
+ * Example of how to change the rate of subport profile 0 and to move pipe 2
+ * of subport 0 to pipe profile 1:
+ * @cliexcmd{set dpdk interface hqos reconfig GigabitEthernet0/8/0 subport-profile 0 rate 12500000 pipe 0 2 profile 1}
+?*/
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (cmd_set_dpdk_if_hqos_reconfig, static) = {
+  .path = "set dpdk interface hqos reconfig",
+  .short_help = "set dpdk interface hqos reconfig <interface> "
+                "[subport-profile <profile_id> rate <n> [bktsize <n>]] "
+                "[pipe-profile <subport_id> <profile_id> rate <n> "
+                "[bktsize <n>]] [subport <subport_id> profile <profile_id>] "
+                "[pipe <subport_id> <pipe_id> profile <profile_id>] ...",
+  .function = set_dpdk_if_hqos_reconfig,
+  .is_mp_safe = 1,
+};
+/* *INDENT-ON* */
+#endif /* FLEXIWAN_FEATURE - hqos_runtime_reconfig */
+
 static clib_error_t *
 set_dpdk_if_hqos_tctbl (vlib_main_t * vm, unformat_input_t * input,
                        vlib_cli_command_t * cmd)
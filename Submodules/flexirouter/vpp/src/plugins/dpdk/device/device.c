@@ -21,6 +21,10 @@
  *    The FlexiWAN commit makes the required corresponding changes and brings
  *    back the feature to working state. Additionaly made enhancements in the
  *    context of WAN QoS needs.
+ *
+ *  - hqos_adaptive_thread : The HQoS thread sleeps on eventfd when there is
+ *    no traffic and is woken up by workers. Partial bursts are flushed by time
+ *    deadline and every device is served up to its dequeue budget per round.
  */
 
 #include <vnet/vnet.h>
@@ -195,6 +199,10 @@ static_always_inline
           dpdk_hqos_metadata_set (hqos, xd->hqos_ht->hqos, mb, n_left);
           n_sent = rte_ring_sp_enqueue_burst (hqos->swq, (void **) mb,
                                               n_left, 0);
+#ifdef FLEXIWAN_FEATURE /* hqos_adaptive_thread */
+          if (xd->hqos_ht->thread_data && n_sent > 0)
+            dpdk_hqos_thread_wakeup (xd->hqos_ht->thread_data);
+#endif /* FLEXIWAN_FEATURE - hqos_adaptive_thread */
         }
       else if (PREDICT_TRUE (xd->flags & DPDK_DEVICE_FLAG_PMD))
 #else     /* integrating_dpdk_qos_sched */
@@ -31,6 +31,24 @@
  *    DPDK capability to initialize TAP interface. This set of changes enable
  *    VPP to initialize TAP interfaces using DPDK. This sets up TAP interfaces
  *    to make use of DPDK interface feature like QoS.
+ *
+ *  - hqos_adaptive_thread : The HQoS thread does not spin the core when there
+ *    is no traffic: it sleeps on eventfd and is woken up by workers that
+ *    enqueue packets into its SWQs. Partial bursts are flushed into the
+ *    scheduler by time deadline instead of the loop iteration count, and
+ *    every device of the thread is served up to its dequeue budget per round.
+ *
+ *  - hqos_stats_segment : The HQoS thread samples scheduler statistics of
+ *    its devices periodically into the stats segment: per queue (subport,
+ *    pipe, traffic class) enqueued and dropped packets and bytes and queue
+ *    occupancy, and per subport and traffic class enqueued and dropped
+ *    packets and bytes.
+ *
+ *  - hqos_runtime_reconfig : Subport and pipe profile rates and the
+ *    subport/pipe to profile mappings can be changed while traffic is running.
+ *    The changes are collected into transaction that is applied by the HQoS
+ *    thread between two bursts, so neither worker barrier nor port restart
+ *    is needed. The changes are validated before, so applying can't fail.
  */
 
 #ifndef __included_dpdk_h__
@@ -159,6 +177,55 @@ typedef enum
 
 typedef uint16_t dpdk_portid_t;
 
+#ifdef FLEXIWAN_FEATURE /* hqos_adaptive_thread */
+typedef struct
+{
+  /* Required for vec_validate_aligned */
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+
+  int eventfd;                  /* wakes up the sleeping HQoS thread */
+  volatile u32 sleeping;        /* set by HQoS thread before it sleeps */
+  u64 n_sleeps;
+  u64 n_wakeups;
+} dpdk_hqos_thread_data_t;
+#endif /* FLEXIWAN_FEATURE - hqos_adaptive_thread */
+
+#ifdef FLEXIWAN_FEATURE /* hqos_runtime_reconfig */
+typedef enum
+{
+  DPDK_HQOS_RECONFIG_SUBPORT_PROFILE,
+  DPDK_HQOS_RECONFIG_PIPE_PROFILE,
+  DPDK_HQOS_RECONFIG_SUBPORT,
+  DPDK_HQOS_RECONFIG_PIPE,
+} dpdk_hqos_reconfig_op_type_t;
+
+typedef struct
+{
+  dpdk_hqos_reconfig_op_type_t type;
+  u32 subport_id;
+  u32 pipe_id;
+  u32 profile_id;
+  union
+  {
+    struct rte_sched_subport_profile_params subport_profile;
+    struct rte_sched_pipe_params pipe_profile;
+  };
+} dpdk_hqos_reconfig_op_t;
+
+/*
+ * The runtime reconfiguration transaction. It is built and committed by the
+ * main thread, see dpdk_hqos_reconfig_commit(), and applied by the HQoS
+ * thread of device between two bursts.
+ */
+typedef struct
+{
+  dpdk_hqos_reconfig_op_t *ops;
+  u32 n_applied;
+  int rv;                         /* result of the first failed op */
+  volatile u32 done;              /* set by the HQoS thread when applied */
+} dpdk_hqos_reconfig_t;
+#endif /* FLEXIWAN_FEATURE - hqos_runtime_reconfig */
+
 #ifdef FLEXIWAN_FEATURE /* integrating_dpdk_qos_sched */
 typedef struct
 {
@@ -192,6 +259,35 @@ typedef struct
   u32 pkts_enq_len;
   u32 swq_pos;
   u32 flush_count;
+#ifdef FLEXIWAN_FEATURE /* hqos_adaptive_thread */
+  u64 flush_deadline;   /* CPU clocks, 0 if no partial burst is pending */
+  u32 deq_budget;       /* packets sent per visit of device */
+  u32 n_in_sched;       /* packets held by scheduler */
+  /* The HQoS thread serving the device, NULL if thread is not adaptive */
+  dpdk_hqos_thread_data_t *thread_data;
+#endif /* FLEXIWAN_FEATURE - hqos_adaptive_thread */
+#ifdef FLEXIWAN_FEATURE /* hqos_stats_segment */
+  /*
+   * Scheduler statistics in stats segment, written by the HQoS thread.
+   * The queue counters are indexed by the scheduler queue id:
+   * (subport * n_pipes + pipe) * RTE_SCHED_QUEUES_PER_PIPE + queue,
+   * the subport counters by subport * RTE_SCHED_TRAFFIC_CLASSES_PER_PIPE + tc.
+   */
+  vlib_combined_counter_main_t queue_enqueued;
+  vlib_combined_counter_main_t queue_dropped;
+  vlib_simple_counter_main_t queue_length;
+  vlib_combined_counter_main_t subport_enqueued;
+  vlib_combined_counter_main_t subport_dropped;
+  u32 n_subports;
+  u32 n_queues;
+  u32 stats_pos;            /* next queue to sample, ~0 if sampling is idle */
+  u64 stats_interval;       /* CPU clocks, 0 if export is disabled */
+  u64 stats_next_sample;    /* CPU clocks */
+#endif /* FLEXIWAN_FEATURE - hqos_stats_segment */
+#ifdef FLEXIWAN_FEATURE /* hqos_runtime_reconfig */
+  /* Published by main thread, claimed by the HQoS thread */
+  dpdk_hqos_reconfig_t *volatile reconfig;
+#endif /* FLEXIWAN_FEATURE - hqos_runtime_reconfig */
 } dpdk_device_hqos_per_hqos_thread_t;
 #endif /* FLEXIWAN_FEATURE - integrating_dpdk_qos_sched */
 
@@ -376,6 +472,22 @@ typedef struct
 #define HQOS_BURST_ENQ                       24
 #define HQOS_BURST_DEQ                       20
 
+#ifdef FLEXIWAN_FEATURE /* hqos_adaptive_thread */
+#define HQOS_DEQ_BUDGET                      64   /* packets per device visit */
+#define HQOS_FLUSH_TIMEOUT_US                20
+#define HQOS_IDLE_SLEEP_US                   1000 /* max sleep with no traffic */
+#define HQOS_BACKLOG_SLEEP_US                20   /* sleep if scheduler shapes */
+#define HQOS_IDLE_ROUNDS                     64   /* idle rounds before sleep */
+#endif /* FLEXIWAN_FEATURE - hqos_adaptive_thread */
+
+#ifdef FLEXIWAN_FEATURE /* hqos_stats_segment */
+#define HQOS_STATS_QUEUES_PER_ROUND          32   /* queues sampled at once */
+#endif /* FLEXIWAN_FEATURE - hqos_stats_segment */
+
+#ifdef FLEXIWAN_FEATURE /* hqos_runtime_reconfig */
+#define HQOS_RECONFIG_TIMEOUT                1.0  /* seconds */
+#endif /* FLEXIWAN_FEATURE - hqos_runtime_reconfig */
+
 
 typedef struct dpdk_device_config_hqos_t
 {
@@ -393,6 +505,9 @@ typedef struct dpdk_device_config_hqos_t
   u64 pktfield1_slabmask;
   u64 pktfield2_slabmask;
   u32 tc_table[64];
+#ifdef FLEXIWAN_FEATURE /* hqos_adaptive_thread */
+  u32 deq_budget;
+#endif /* FLEXIWAN_FEATURE - hqos_adaptive_thread */
 
   /*
    * Optional configuration input from startup conf. It is used to configure
@@ -473,6 +588,14 @@ typedef struct
   u32 coremask;
   u32 nchannels;
   u32 num_crypto_mbufs;
+#ifdef FLEXIWAN_FEATURE /* hqos_adaptive_thread */
+  u8 hqos_adaptive;
+  u32 hqos_flush_timeout_us;
+  u32 hqos_idle_sleep_us;
+#endif /* FLEXIWAN_FEATURE - hqos_adaptive_thread */
+#ifdef FLEXIWAN_FEATURE /* hqos_stats_segment */
+  f64 hqos_stats_interval;  /* seconds, 0 if export is disabled */
+#endif /* FLEXIWAN_FEATURE - hqos_stats_segment */
 
   /*
    * format interface names ala xxxEthernet%d/%d/%d instead of
@@ -521,6 +644,10 @@ typedef struct
   u32 hqos_cpu_first_index;
   u32 hqos_cpu_count;
 #endif   /* FLEXIWAN_FEATURE - integrating_dpdk_qos_sched */
+#ifdef FLEXIWAN_FEATURE /* hqos_adaptive_thread */
+  /* Indexed by thread index, allocated in adaptive mode only */
+  dpdk_hqos_thread_data_t *hqos_thread_data;
+#endif /* FLEXIWAN_FEATURE - hqos_adaptive_thread */
 
   /* buffer flags template, configurable to enable/disable tcp / udp cksum */
   u32 buffer_flags_template;
@@ -725,6 +852,71 @@ void dpdk_hqos_metadata_set (dpdk_device_hqos_per_worker_thread_t * hqos,
                             struct rte_sched_port * port,
                             struct rte_mbuf **pkts, u32 n_pkts);
 
+#ifdef FLEXIWAN_FEATURE /* hqos_adaptive_thread */
+clib_error_t *dpdk_hqos_adaptive_init (dpdk_main_t * dm);
+void dpdk_hqos_thread_signal (dpdk_hqos_thread_data_t * td);
+
+/*
+ * Wakes up the adaptive HQoS thread if it sleeps.
+ * Should be called by worker after it enqueued packets into SWQ.
+ */
+static_always_inline void
+dpdk_hqos_thread_wakeup (dpdk_hqos_thread_data_t * td)
+{
+  /*
+   * Pairs with the barrier in dpdk_hqos_thread_sleep(): either the HQoS
+   * thread sees the packets in SWQ, or the worker sees it sleeping.
+   */
+  CLIB_MEMORY_BARRIER ();
+  if (PREDICT_FALSE (td->sleeping) &&
+      clib_atomic_bool_cmp_and_swap (&td->sleeping, 1, 0))
+    dpdk_hqos_thread_signal (td);
+}
+#endif /* FLEXIWAN_FEATURE - hqos_adaptive_thread */
+
+#ifdef FLEXIWAN_FEATURE /* hqos_stats_segment */
+void dpdk_hqos_stats_init (dpdk_device_t * xd,
+                           dpdk_device_config_hqos_t * hqos);
+#endif /* FLEXIWAN_FEATURE - hqos_stats_segment */
+
+#ifdef FLEXIWAN_FEATURE /* hqos_runtime_reconfig */
+void dpdk_hqos_reconfig_add_subport_profile (dpdk_hqos_reconfig_t * rc,
+                                             u32 profile_id,
+                                             struct
+                                             rte_sched_subport_profile_params *
+                                             params);
+void dpdk_hqos_reconfig_add_pipe_profile (dpdk_hqos_reconfig_t * rc,
+                                          u32 subport_id, u32 profile_id,
+                                          struct rte_sched_pipe_params *
+                                          params);
+void dpdk_hqos_reconfig_add_subport (dpdk_hqos_reconfig_t * rc,
+                                     u32 subport_id, u32 profile_id);
+void dpdk_hqos_reconfig_add_pipe (dpdk_hqos_reconfig_t * rc, u32 subport_id,
+                                  u32 pipe_id, u32 profile_id);
+clib_error_t *dpdk_hqos_reconfig_commit (vlib_main_t * vm,
+                                         dpdk_device_t * xd,
+                                         dpdk_device_config_hqos_t * hqos,
+                                         dpdk_hqos_reconfig_t * rc);
+void dpdk_hqos_reconfig_free (dpdk_hqos_reconfig_t * rc);
+void dpdk_hqos_reconfig_apply (struct rte_sched_port *port,
+                               dpdk_hqos_reconfig_t * rc);
+
+/*
+ * Applies the pending reconfiguration of device, if any.
+ * Should be called by HQoS thread between scheduler enqueue/dequeue bursts.
+ */
+static_always_inline void
+dpdk_hqos_reconfig_poll (dpdk_device_hqos_per_hqos_thread_t * hqos)
+{
+  dpdk_hqos_reconfig_t *rc = hqos->reconfig;
+
+  /* The main thread might retract transaction on timeout, hence the CAS */
+  if (PREDICT_FALSE (rc != NULL) &&
+      clib_atomic_bool_cmp_and_swap (&hqos->reconfig, rc, NULL))
+    dpdk_hqos_reconfig_apply (hqos->hqos, rc);
+}
+#endif /* FLEXIWAN_FEATURE - hqos_runtime_reconfig */
+
 #endif   /* FLEXIWAN_FEATURE - integrating_dpdk_qos_sched */
 
 #endif /* __included_dpdk_h__ */
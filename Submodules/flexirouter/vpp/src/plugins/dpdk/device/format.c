@@ -32,6 +32,9 @@
  *    VPP to initialize TAP interfaces using DPDK. This sets up TAP interfaces
  *    to make use of DPDK interface feature like QoS.
  *
+ *  - hqos_adaptive_thread : The HQoS thread sleeps on eventfd when there is
+ *    no traffic and is woken up by workers. Partial bursts are flushed by time
+ *    deadline and every device is served up to its dequeue budget per round.
  */
 
 #include <vnet/vnet.h>
@@ -1015,6 +1018,10 @@ unformat_hqos (unformat_input_t * input, dpdk_device_config_hqos_t * hqos)
         ;
       else if (unformat (input, "num-pipes %u", &hqos->max_pipes))
         ;
+#ifdef FLEXIWAN_FEATURE /* hqos_adaptive_thread */
+      else if (unformat (input, "dequeue-budget %u", &hqos->deq_budget))
+        ;
+#endif /* FLEXIWAN_FEATURE - hqos_adaptive_thread */
       else
        {
          error = clib_error_return (0, "unknown input `%U'",
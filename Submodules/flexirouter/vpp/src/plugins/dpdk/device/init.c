@@ -34,6 +34,16 @@
  *    VPP to initialize TAP interfaces using DPDK. This sets up TAP interfaces
  *    to make use of DPDK interface feature like QoS.
  *
+ *  - hqos_adaptive_thread : The HQoS thread sleeps on eventfd when there is
+ *    no traffic and is woken up by workers. Partial bursts are flushed by time
+ *    deadline and every device is served up to its dequeue budget per round.
+ *
+ *  - hqos_stats_segment : The HQoS thread samples scheduler statistics of
+ *    its devices periodically into the stats segment: per queue (subport,
+ *    pipe, traffic class) enqueued and dropped packets and bytes and queue
+ *    occupancy, and per subport and traffic class enqueued and dropped
+ *    packets and bytes.
+ *
  *  List of fixes made for FlexiWAN (denoted by FLEXIWAN_FIX flag):
  *   - added support for vendor 0x1f18
  */
@@ -354,6 +364,14 @@ dpdk_lib_init (dpdk_main_t * dm)
   vec_validate_aligned (dm->devices_by_hqos_cpu, tm->n_vlib_mains - 1,
                        CLIB_CACHE_LINE_BYTES);
 #endif    /* FLEXIWAN_FEATURE - integrating_dpdk_qos_sched */
+#ifdef FLEXIWAN_FEATURE /* hqos_adaptive_thread */
+  if (dm->conf->hqos_adaptive)
+    {
+      error = dpdk_hqos_adaptive_init (dm);
+      if (error)
+        return error;
+    }
+#endif /* FLEXIWAN_FEATURE - hqos_adaptive_thread */
 
   nports = rte_eth_dev_count_avail ();
 
@@ -839,6 +857,11 @@ dpdk_lib_init (dpdk_main_t * dm)
          clib_error_t * rv = dpdk_port_setup_hqos (xd, &devconf->hqos);
          if (rv)
            return rv;
+#ifdef FLEXIWAN_FEATURE /* hqos_adaptive_thread */
+         if (dm->conf->hqos_adaptive)
+           xd->hqos_ht->thread_data =
+             vec_elt_at_index (dm->hqos_thread_data, cpu);
+#endif /* FLEXIWAN_FEATURE - hqos_adaptive_thread */
 
          dpdk_device_and_queue_t *dq;
          vec_add2 (dm->devices_by_hqos_cpu[cpu], dq, 1);
@@ -960,6 +983,11 @@ dpdk_lib_init (dpdk_main_t * dm)
 
       sw = vnet_get_hw_sw_interface (dm->vnet_main, xd->hw_if_index);
       xd->sw_if_index = sw->sw_if_index;
+#ifdef FLEXIWAN_FEATURE /* hqos_stats_segment */
+      if ((xd->flags & DPDK_DEVICE_FLAG_HQOS) &&
+          dm->conf->hqos_stats_interval > 0)
+        dpdk_hqos_stats_init (xd, &devconf->hqos);
+#endif /* FLEXIWAN_FEATURE - hqos_stats_segment */
       vnet_hw_interface_set_input_node (dm->vnet_main, xd->hw_if_index,
 					dpdk_input_node.index);
 
@@ -1658,6 +1686,21 @@ dpdk_config (vlib_main_t * vm, unformat_input_t * input)
 
       else if (unformat (input, "no-multi-seg"))
 	conf->no_multi_seg = 1;
+#ifdef FLEXIWAN_FEATURE /* hqos_adaptive_thread */
+      else if (unformat (input, "hqos-adaptive"))
+	conf->hqos_adaptive = 1;
+      else if (unformat (input, "hqos-flush-timeout-us %u",
+			 &conf->hqos_flush_timeout_us))
+	;
+      else if (unformat (input, "hqos-idle-sleep-us %u",
+			 &conf->hqos_idle_sleep_us))
+	;
+#endif /* FLEXIWAN_FEATURE - hqos_adaptive_thread */
+#ifdef FLEXIWAN_FEATURE /* hqos_stats_segment */
+      else if (unformat (input, "hqos-stats-interval %f",
+			 &conf->hqos_stats_interval))
+	;
+#endif /* FLEXIWAN_FEATURE - hqos_stats_segment */
 
       else if (unformat (input, "dev default %U", unformat_vlib_cli_sub_input,
 			 &sub_input))
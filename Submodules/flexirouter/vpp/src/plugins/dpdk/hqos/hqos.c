@@ -36,6 +36,26 @@
  *    there will be no worker threads, as one core will be used for main thread and other - for HQoS.
  *    In this case, the multi-threading data structures will be not initialized. But some of them,
  *    like per thread buffer pools, are used by the HQoS thread. So we have to initialize them manually.
+ *
+ *  - hqos_adaptive_thread : The HQoS thread sleeps on eventfd when there is
+ *    no traffic and is woken up by workers. Partial bursts are flushed by time
+ *    deadline and every device is served up to its dequeue budget per round.
+ *
+ *  - hqos_stats_segment : The HQoS thread samples scheduler statistics of
+ *    its devices periodically into the stats segment: per queue (subport,
+ *    pipe, traffic class) enqueued and dropped packets and bytes and queue
+ *    occupancy, and per subport and traffic class enqueued and dropped
+ *    packets and bytes.
+ *
+ *  - hqos_metadata_set_x4 : The scheduler metadata of packets classified by
+ *    the ACL based classification is set four packets at a time with
+ *    prefetch of the next four packets, as it is done for the legacy packet
+ *    field based classification.
+ *
+ *  - hqos_runtime_reconfig : Subport and pipe profile rates and the
+ *    subport/pipe to profile mappings are changed at runtime by transaction
+ *    that is validated up front and applied by the HQoS thread between two
+ *    bursts. The reloaded subports and pipes get their credits reset.
  *  
  * This deprecated file is enhanced and added as part of the
  * flexiwan feature - integrating_dpdk_qos_sched
@@ -49,6 +69,10 @@
 #include <sys/mount.h>
 #include <string.h>
 #include <fcntl.h>
+//#ifdef FLEXIWAN_FEATURE /* hqos_adaptive_thread */
+#include <sys/select.h>
+#include <sys/eventfd.h>
+//#endif /* FLEXIWAN_FEATURE - hqos_adaptive_thread */
 //#ifdef FLEXIWAN_FEATURE /* enable_dpdk_tun_init */
 #include <net/if.h>
 //#endif /* FLEXIWAN_FEATURE - enable_dpdk_tun_init */
@@ -720,6 +744,403 @@ done:
   return error;
 }
 
+#ifdef FLEXIWAN_FEATURE /* hqos_runtime_reconfig */
+void
+dpdk_hqos_reconfig_add_subport_profile (dpdk_hqos_reconfig_t * rc,
+					u32 profile_id,
+					struct rte_sched_subport_profile_params
+					* params)
+{
+  dpdk_hqos_reconfig_op_t *op;
+
+  vec_add2 (rc->ops, op, 1);
+  clib_memset (op, 0, sizeof (*op));
+  op->type = DPDK_HQOS_RECONFIG_SUBPORT_PROFILE;
+  op->profile_id = profile_id;
+  op->subport_profile = *params;
+}
+
+void
+dpdk_hqos_reconfig_add_pipe_profile (dpdk_hqos_reconfig_t * rc,
+				     u32 subport_id, u32 profile_id,
+				     struct rte_sched_pipe_params * params)
+{
+  dpdk_hqos_reconfig_op_t *op;
+
+  vec_add2 (rc->ops, op, 1);
+  clib_memset (op, 0, sizeof (*op));
+  op->type = DPDK_HQOS_RECONFIG_PIPE_PROFILE;
+  op->subport_id = subport_id;
+  op->profile_id = profile_id;
+  op->pipe_profile = *params;
+}
+
+void
+dpdk_hqos_reconfig_add_subport (dpdk_hqos_reconfig_t * rc, u32 subport_id,
+				u32 profile_id)
+{
+  dpdk_hqos_reconfig_op_t *op;
+
+  vec_add2 (rc->ops, op, 1);
+  clib_memset (op, 0, sizeof (*op));
+  op->type = DPDK_HQOS_RECONFIG_SUBPORT;
+  op->subport_id = subport_id;
+  op->profile_id = profile_id;
+}
+
+void
+dpdk_hqos_reconfig_add_pipe (dpdk_hqos_reconfig_t * rc, u32 subport_id,
+			     u32 pipe_id, u32 profile_id)
+{
+  dpdk_hqos_reconfig_op_t *op;
+
+  vec_add2 (rc->ops, op, 1);
+  clib_memset (op, 0, sizeof (*op));
+  op->type = DPDK_HQOS_RECONFIG_PIPE;
+  op->subport_id = subport_id;
+  op->pipe_id = pipe_id;
+  op->profile_id = profile_id;
+}
+
+void
+dpdk_hqos_reconfig_free (dpdk_hqos_reconfig_t * rc)
+{
+  vec_free (rc->ops);
+}
+
+static int
+dpdk_hqos_reconfig_op_apply (struct rte_sched_port *port,
+			     dpdk_hqos_reconfig_op_t * op)
+{
+  switch (op->type)
+    {
+    case DPDK_HQOS_RECONFIG_SUBPORT_PROFILE:
+      return rte_sched_port_subport_profile_update (port, op->profile_id,
+						    &op->subport_profile);
+    case DPDK_HQOS_RECONFIG_PIPE_PROFILE:
+      return rte_sched_subport_pipe_profile_update (port, op->subport_id,
+						    op->profile_id,
+						    &op->pipe_profile);
+    case DPDK_HQOS_RECONFIG_SUBPORT:
+      return rte_sched_subport_config (port, op->subport_id, NULL,
+				       op->profile_id);
+    case DPDK_HQOS_RECONFIG_PIPE:
+      return rte_sched_pipe_config (port, op->subport_id, op->pipe_id,
+				    op->profile_id);
+    }
+  return -EINVAL;
+}
+
+/*
+ * Runs on the HQoS thread between bursts, so the scheduler is not accessed
+ * concurrently. The queued packets stay in place, but every reloaded subport
+ * and pipe has its token bucket and traffic class credits reset, as the
+ * scheduler does on subport or pipe configuration, so it may send a bit more
+ * or less than its rate right after the change.
+ *
+ * The ops are validated by dpdk_hqos_reconfig_op_prepare(), so they can't
+ * fail. Nothing is undone if they still do, as the failed subport or pipe
+ * configuration frees the scheduler port.
+ */
+void
+dpdk_hqos_reconfig_apply (struct rte_sched_port *port,
+			  dpdk_hqos_reconfig_t * rc)
+{
+  u32 i, n_ops = vec_len (rc->ops);
+  int rv = 0;
+
+  for (i = 0; i < n_ops; i++)
+    {
+      rv = dpdk_hqos_reconfig_op_apply (port, &rc->ops[i]);
+      if (rv)
+	break;
+    }
+  rc->n_applied = i;
+  rc->rv = rv;
+
+  clib_atomic_store_rel_n (&rc->done, 1);
+}
+
+/*
+ * The checks of rte_sched_port_subport_profile_update(), that are not
+ * exported by the scheduler.
+ */
+static clib_error_t *
+dpdk_hqos_reconfig_subport_profile_check (dpdk_device_config_hqos_t * hqos,
+					  struct
+					  rte_sched_subport_profile_params * p)
+{
+  u32 i;
+
+  if (p->tb_rate == 0 || p->tb_rate > hqos->port_params.rate)
+    return clib_error_return (0, "subport profile rate %llu out of range "
+			      "(1 to %llu)", p->tb_rate,
+			      hqos->port_params.rate);
+  if (p->tb_size == 0)
+    return clib_error_return (0, "subport profile bucket size is zero");
+  for (i = 0; i < RTE_SCHED_TRAFFIC_CLASSES_PER_PIPE; i++)
+    if (p->tc_rate[i] == 0 || p->tc_rate[i] > p->tb_rate)
+      return clib_error_return (0, "subport profile traffic class %u rate "
+				"%llu out of range", i, p->tc_rate[i]);
+  if (p->tc_period == 0)
+    return clib_error_return (0, "subport profile tc period is zero");
+  return NULL;
+}
+
+/*
+ * The checks of rte_sched_subport_pipe_profile_update(), that are not
+ * exported by the scheduler.
+ */
+static clib_error_t *
+dpdk_hqos_reconfig_pipe_profile_check (dpdk_device_config_hqos_t * hqos,
+				       u32 subport_id,
+				       struct rte_sched_pipe_params * p)
+{
+  u16 *qsize = hqos->subport_params[subport_id].qsize;
+  u32 i;
+
+  if (p->tb_rate == 0 || p->tb_rate > hqos->port_params.rate)
+    return clib_error_return (0, "pipe profile rate %llu out of range "
+			      "(1 to %llu)", p->tb_rate,
+			      hqos->port_params.rate);
+  if (p->tb_size == 0)
+    return clib_error_return (0, "pipe profile bucket size is zero");
+  for (i = 0; i < RTE_SCHED_TRAFFIC_CLASSES_PER_PIPE; i++)
+    if ((qsize[i] == 0 && p->tc_rate[i] != 0) ||
+	(qsize[i] != 0 && (p->tc_rate[i] == 0 || p->tc_rate[i] > p->tb_rate)))
+      return clib_error_return (0, "pipe profile traffic class %u rate %llu "
+				"out of range (queue size %u)", i,
+				p->tc_rate[i], qsize[i]);
+  if (p->tc_rate[RTE_SCHED_TRAFFIC_CLASS_BE] == 0 ||
+      qsize[RTE_SCHED_TRAFFIC_CLASS_BE] == 0)
+    return clib_error_return (0, "pipe profile best effort rate is zero");
+  if (p->tc_period == 0)
+    return clib_error_return (0, "pipe profile tc period is zero");
+  if (p->tc_ov_weight == 0)
+    return clib_error_return (0, "pipe profile tc ov weight is zero");
+  for (i = 0; i < RTE_SCHED_BE_QUEUES_PER_PIPE; i++)
+    if (p->wrr_weights[i] == 0)
+      return clib_error_return (0, "pipe profile wrr weight %u is zero", i);
+  return NULL;
+}
+
+/*
+ * Checks the op against the running configuration and against everything
+ * the scheduler checks, as the scheduler frees the whole port if subport or
+ * pipe configuration fails, so the op must not fail once it is handed over
+ * to the HQoS thread. Only existing profiles, subports and pipes can be
+ * changed at runtime, new ones are added by dpdk_hqos_setup_subport_profile()
+ * and friends.
+ */
+static clib_error_t *
+dpdk_hqos_reconfig_op_prepare (dpdk_device_config_hqos_t * hqos,
+			       dpdk_hqos_reconfig_t * rc,
+			       dpdk_hqos_reconfig_op_t * op)
+{
+  dpdk_hqos_reconfig_op_t *o;
+  u32 n_subports = vec_len (hqos->subport_params);
+
+  if (op->type != DPDK_HQOS_RECONFIG_SUBPORT_PROFILE &&
+      op->subport_id >= n_subports)
+    return clib_error_return (0, "subport %u not found", op->subport_id);
+
+  switch (op->type)
+    {
+    case DPDK_HQOS_RECONFIG_SUBPORT_PROFILE:
+    case DPDK_HQOS_RECONFIG_SUBPORT:
+      if (op->profile_id >= hqos->port_params.n_subport_profiles)
+	return clib_error_return (0, "subport profile %u not found",
+				  op->profile_id);
+      if (op->type == DPDK_HQOS_RECONFIG_SUBPORT_PROFILE)
+	return dpdk_hqos_reconfig_subport_profile_check (hqos,
+							 &op->subport_profile);
+      break;
+    case DPDK_HQOS_RECONFIG_PIPE_PROFILE:
+    case DPDK_HQOS_RECONFIG_PIPE:
+      if (op->profile_id >= hqos->subport_params[op->subport_id].n_pipe_profiles)
+	return clib_error_return (0, "pipe profile %u not found in subport %u",
+				  op->profile_id, op->subport_id);
+      if (op->type == DPDK_HQOS_RECONFIG_PIPE_PROFILE)
+	return dpdk_hqos_reconfig_pipe_profile_check (hqos, op->subport_id,
+						      &op->pipe_profile);
+      if (op->pipe_id >= hqos->pipes[op->subport_id] ||
+	  op->pipe_id >=
+	  hqos->subport_params[op->subport_id].n_pipes_per_subport_enabled)
+	return clib_error_return (0, "pipe %u not found in subport %u",
+				  op->pipe_id, op->subport_id);
+      break;
+    }
+
+  /* The ops are applied in order, so the same item is changed only once */
+  for (o = rc->ops; o < op; o++)
+    {
+      if (o->type == op->type && o->subport_id == op->subport_id &&
+	  o->pipe_id == op->pipe_id &&
+	  (o->profile_id == op->profile_id ||
+	   op->type == DPDK_HQOS_RECONFIG_SUBPORT ||
+	   op->type == DPDK_HQOS_RECONFIG_PIPE))
+	return clib_error_return (0, "the same item is changed twice");
+    }
+  return NULL;
+}
+
+static int
+dpdk_hqos_reconfig_has_op (dpdk_hqos_reconfig_op_t * ops,
+			   dpdk_hqos_reconfig_op_type_t type, u32 subport_id,
+			   u32 pipe_id)
+{
+  dpdk_hqos_reconfig_op_t *op;
+
+  vec_foreach (op, ops)
+  {
+    if (op->type == type && op->subport_id == subport_id &&
+	op->pipe_id == pipe_id)
+      return 1;
+  }
+  return 0;
+}
+
+/*
+ * Orders the ops, so profiles are updated before the subports and pipes
+ * are (re)mapped, and adds the ops that reload subports and pipes which use
+ * the updated profiles, as the scheduler picks the profile parameters up
+ * on subport or pipe configuration only.
+ */
+static void
+dpdk_hqos_reconfig_expand (dpdk_device_config_hqos_t * hqos,
+			   dpdk_hqos_reconfig_t * rc)
+{
+  dpdk_hqos_reconfig_op_t *ops = NULL, *maps = NULL, *op, *new_op;
+  u32 s, p;
+
+  vec_foreach (op, rc->ops)
+  {
+    if (op->type == DPDK_HQOS_RECONFIG_SUBPORT_PROFILE ||
+	op->type == DPDK_HQOS_RECONFIG_PIPE_PROFILE)
+      vec_add1 (ops, *op);
+    else
+      vec_add1 (maps, *op);
+  }
+
+  vec_foreach (op, ops)
+  {
+    if (op->type == DPDK_HQOS_RECONFIG_SUBPORT_PROFILE)
+      {
+	for (s = 0; s < vec_len (hqos->subport_params); s++)
+	  if (hqos->subport_profile_id_map[s] == op->profile_id &&
+	      !dpdk_hqos_reconfig_has_op (maps, DPDK_HQOS_RECONFIG_SUBPORT, s,
+					  0))
+	    {
+	      vec_add2 (maps, new_op, 1);
+	      clib_memset (new_op, 0, sizeof (*new_op));
+	      new_op->type = DPDK_HQOS_RECONFIG_SUBPORT;
+	      new_op->subport_id = s;
+	      new_op->profile_id = op->profile_id;
+	    }
+      }
+    else
+      {
+	s = op->subport_id;
+	for (p = 0; p < hqos->pipes[s]; p++)
+	  if (hqos->pipe_profile_id_map[s][p] == op->profile_id &&
+	      !dpdk_hqos_reconfig_has_op (maps, DPDK_HQOS_RECONFIG_PIPE, s, p))
+	    {
+	      vec_add2 (maps, new_op, 1);
+	      clib_memset (new_op, 0, sizeof (*new_op));
+	      new_op->type = DPDK_HQOS_RECONFIG_PIPE;
+	      new_op->subport_id = s;
+	      new_op->pipe_id = p;
+	      new_op->profile_id = op->profile_id;
+	    }
+      }
+  }
+
+  vec_append (ops, maps);
+  vec_free (maps);
+  vec_free (rc->ops);
+  rc->ops = ops;
+}
+
+/*
+ * Commits the runtime reconfiguration of device. The transaction is handed
+ * over to the HQoS thread of device that applies it between two bursts,
+ * so no worker barrier is needed and the queued packets are not lost.
+ * The caller should run in process context and free the transaction.
+ */
+clib_error_t *
+dpdk_hqos_reconfig_commit (vlib_main_t * vm, dpdk_device_t * xd,
+			   dpdk_device_config_hqos_t * hqos,
+			   dpdk_hqos_reconfig_t * rc)
+{
+  dpdk_device_hqos_per_hqos_thread_t *ht = xd->hqos_ht;
+  dpdk_hqos_reconfig_op_t *op;
+  clib_error_t *error;
+  f64 deadline;
+
+  if (vec_len (rc->ops) == 0)
+    return NULL;
+
+  vec_foreach (op, rc->ops)
+  {
+    error = dpdk_hqos_reconfig_op_prepare (hqos, rc, op);
+    if (error)
+      return error;
+  }
+
+  /* The added ops reload the validated subports and pipes */
+  dpdk_hqos_reconfig_expand (hqos, rc);
+
+  rc->n_applied = 0;
+  rc->rv = 0;
+  rc->done = 0;
+  if (!clib_atomic_bool_cmp_and_swap (&ht->reconfig, NULL, rc))
+    return clib_error_return (0, "reconfiguration is in progress");
+#ifdef FLEXIWAN_FEATURE /* hqos_adaptive_thread */
+  if (ht->thread_data)
+    dpdk_hqos_thread_wakeup (ht->thread_data);
+#endif /* FLEXIWAN_FEATURE - hqos_adaptive_thread */
+
+  deadline = vlib_time_now (vm) + HQOS_RECONFIG_TIMEOUT;
+  while (!clib_atomic_load_acq_n (&rc->done))
+    {
+      if (vlib_time_now (vm) > deadline &&
+	  clib_atomic_bool_cmp_and_swap (&ht->reconfig, rc, NULL))
+	return clib_error_return (0, "HQoS thread did not respond");
+      vlib_process_suspend (vm, 1e-4);
+    }
+
+  /* Should not happen, the port is not usable anymore */
+  if (rc->rv)
+    return clib_error_return (0, "reconfiguration failed %d at change %u "
+			      "of %u, the port should be recreated", rc->rv,
+			      rc->n_applied, vec_len (rc->ops));
+
+  /* Sync the configuration kept for the subsequent changes */
+  vec_foreach (op, rc->ops)
+  {
+    switch (op->type)
+      {
+      case DPDK_HQOS_RECONFIG_SUBPORT_PROFILE:
+	hqos->port_params.subport_profiles[op->profile_id] =
+	  op->subport_profile;
+	break;
+      case DPDK_HQOS_RECONFIG_PIPE_PROFILE:
+	hqos->subport_params[op->subport_id].pipe_profiles[op->profile_id] =
+	  op->pipe_profile;
+	break;
+      case DPDK_HQOS_RECONFIG_SUBPORT:
+	hqos->subport_profile_id_map[op->subport_id] = op->profile_id;
+	break;
+      case DPDK_HQOS_RECONFIG_PIPE:
+	hqos->pipe_profile_id_map[op->subport_id][op->pipe_id] =
+	  op->profile_id;
+	break;
+      }
+  }
+  return NULL;
+}
+#endif /* FLEXIWAN_FEATURE - hqos_runtime_reconfig */
+
 clib_error_t *
 dpdk_hqos_get_queue_stats (dpdk_device_t * xd,
 			   dpdk_device_config_hqos_t * hqos, u32 subport_id,
@@ -765,6 +1186,26 @@ dpdk_hqos_get_queue_stats (dpdk_device_t * xd,
   else
     qindex += pipe_id * RTE_SCHED_QUEUES_PER_PIPE + tc + tc_q;
 
+#ifdef FLEXIWAN_FEATURE /* hqos_stats_segment */
+  /*
+   * The scheduler clears its statistics on read. If the HQoS thread exports
+   * them, report the counters it accumulates in stats segment.
+   */
+  if (xd->hqos_ht->stats_interval)
+    {
+      vlib_counter_t c;
+
+      clib_memset (stats, 0, sizeof (*stats));
+      vlib_get_combined_counter (&xd->hqos_ht->queue_enqueued, qindex, &c);
+      stats->n_pkts = c.packets;
+      stats->n_bytes = c.bytes;
+      vlib_get_combined_counter (&xd->hqos_ht->queue_dropped, qindex, &c);
+      stats->n_pkts_dropped = c.packets;
+      stats->n_bytes_dropped = c.bytes;
+      return 0;
+    }
+#endif /* FLEXIWAN_FEATURE - hqos_stats_segment */
+
   u16 qlen;
   int rv =rte_sched_queue_read_stats (xd->hqos_ht->hqos, qindex, stats,
 				      &qlen);
@@ -904,6 +1345,10 @@ dpdk_port_setup_hqos (dpdk_device_t * xd, dpdk_device_config_hqos_t * hqos)
   xd->hqos_ht->pkts_enq_len = 0;
   xd->hqos_ht->swq_pos = 0;
   xd->hqos_ht->flush_count = 0;
+#ifdef FLEXIWAN_FEATURE /* hqos_adaptive_thread */
+  xd->hqos_ht->deq_budget = hqos->deq_budget ? hqos->deq_budget :
+    HQOS_DEQ_BUDGET;
+#endif /* FLEXIWAN_FEATURE - hqos_adaptive_thread */
 
   /* Set up per-thread device data for each worker thread and main-thread-0 */
   dpdk_hqos_setup_pktfield_default (xd, hqos, 0);
@@ -923,6 +1368,49 @@ dpdk_port_setup_hqos (dpdk_device_t * xd, dpdk_device_config_hqos_t * hqos)
   return error;
 }
 
+#ifdef FLEXIWAN_FEATURE /* hqos_stats_segment */
+/*
+ * Registers the scheduler statistics of device in stats segment under
+ * /hqos/<sw_if_index>/. Should be called once the device has sw_if_index.
+ */
+void
+dpdk_hqos_stats_init (dpdk_device_t * xd, dpdk_device_config_hqos_t * hqos)
+{
+  dpdk_device_hqos_per_hqos_thread_t *hqos_ht = xd->hqos_ht;
+  vlib_main_t *vm = vlib_get_main ();
+  u32 n_subport_tcs;
+
+  hqos_ht->n_subports = hqos->port_params.n_subports_per_port;
+  hqos_ht->n_queues = hqos_ht->n_subports *
+    hqos->port_params.n_pipes_per_subport * RTE_SCHED_QUEUES_PER_PIPE;
+  n_subport_tcs = hqos_ht->n_subports * RTE_SCHED_TRAFFIC_CLASSES_PER_PIPE;
+
+#define _(cm, what, n, validate)                                        \
+  hqos_ht->cm.name = (char *) format (0, "hqos-%u-" what "%c",         \
+                                      xd->sw_if_index, 0);              \
+  hqos_ht->cm.stat_segment_name =                                       \
+    (char *) format (0, "/hqos/%u/" what "%c", xd->sw_if_index, 0);     \
+  validate (&hqos_ht->cm, (n) - 1);
+
+  _(queue_enqueued, "queues/enqueued", hqos_ht->n_queues,
+    vlib_validate_combined_counter);
+  _(queue_dropped, "queues/dropped", hqos_ht->n_queues,
+    vlib_validate_combined_counter);
+  _(queue_length, "queues/length", hqos_ht->n_queues,
+    vlib_validate_simple_counter);
+  _(subport_enqueued, "subports/enqueued", n_subport_tcs,
+    vlib_validate_combined_counter);
+  _(subport_dropped, "subports/dropped", n_subport_tcs,
+    vlib_validate_combined_counter);
+#undef _
+
+  hqos_ht->stats_pos = ~0;
+  hqos_ht->stats_next_sample = 0;
+  hqos_ht->stats_interval =
+    dpdk_main.conf->hqos_stats_interval * vm->clib_time.clocks_per_second;
+}
+#endif /* FLEXIWAN_FEATURE - hqos_stats_segment */
+
 /***
  *
  * HQoS run-time
@@ -934,6 +1422,71 @@ dpdk_port_setup_hqos (dpdk_device_t * xd, dpdk_device_config_hqos_t * hqos)
  * w
  *     Information for the current thread
  */
+#ifdef FLEXIWAN_FEATURE /* hqos_stats_segment */
+/*
+ * Accumulates the scheduler statistics of device into the stats segment
+ * counters, as the scheduler clears them on read. Every interval all queues
+ * are sampled, HQOS_STATS_QUEUES_PER_ROUND queues per call, so the sampling
+ * does not stall the scheduler. The subports are sampled at the end of sweep.
+ */
+static_always_inline void
+dpdk_hqos_stats_sample (u32 thread_index,
+			dpdk_device_hqos_per_hqos_thread_t * hqos, u64 now)
+{
+  struct rte_sched_queue_stats qs;
+  struct rte_sched_subport_stats ss;
+  u32 n, subport_id, tc, tc_ov, index;
+  u16 qlen;
+
+  if (hqos->stats_pos == ~0)
+    {
+      if (now < hqos->stats_next_sample)
+	return;
+      hqos->stats_pos = 0;
+      hqos->stats_next_sample = now + hqos->stats_interval;
+    }
+
+  for (n = 0; n < HQOS_STATS_QUEUES_PER_ROUND &&
+       hqos->stats_pos < hqos->n_queues; n++, hqos->stats_pos++)
+    {
+      if (rte_sched_queue_read_stats (hqos->hqos, hqos->stats_pos, &qs,
+				      &qlen))
+	continue;
+      vlib_increment_combined_counter (&hqos->queue_enqueued, thread_index,
+				       hqos->stats_pos, qs.n_pkts,
+				       qs.n_bytes);
+      vlib_increment_combined_counter (&hqos->queue_dropped, thread_index,
+				       hqos->stats_pos, qs.n_pkts_dropped,
+				       qs.n_bytes_dropped);
+      vlib_set_simple_counter (&hqos->queue_length, thread_index,
+			       hqos->stats_pos, qlen);
+    }
+
+  if (hqos->stats_pos < hqos->n_queues)
+    return;
+
+  for (subport_id = 0; subport_id < hqos->n_subports; subport_id++)
+    {
+      if (rte_sched_subport_read_stats (hqos->hqos, subport_id, &ss,
+					&tc_ov))
+	continue;
+      for (tc = 0; tc < RTE_SCHED_TRAFFIC_CLASSES_PER_PIPE; tc++)
+	{
+	  index = subport_id * RTE_SCHED_TRAFFIC_CLASSES_PER_PIPE + tc;
+	  vlib_increment_combined_counter (&hqos->subport_enqueued,
+					   thread_index, index,
+					   ss.n_pkts_tc[tc],
+					   ss.n_bytes_tc[tc]);
+	  vlib_increment_combined_counter (&hqos->subport_dropped,
+					   thread_index, index,
+					   ss.n_pkts_tc_dropped[tc],
+					   ss.n_bytes_tc_dropped[tc]);
+	}
+    }
+  hqos->stats_pos = ~0;
+}
+#endif /* FLEXIWAN_FEATURE - hqos_stats_segment */
+
 static_always_inline void
 dpdk_hqos_thread_internal_hqos_dbg_bypass (vlib_main_t * vm)
 {
@@ -1120,11 +1673,255 @@ dpdk_hqos_thread_internal (vlib_main_t * vm)
 				      (uint16_t) (pkts_deq_len - n_pkts));
       }
 
+#ifdef FLEXIWAN_FEATURE /* hqos_stats_segment */
+      if (PREDICT_FALSE (hqos->stats_interval))
+	dpdk_hqos_stats_sample (thread_index, hqos, clib_cpu_time_now ());
+#endif /* FLEXIWAN_FEATURE - hqos_stats_segment */
+#ifdef FLEXIWAN_FEATURE /* hqos_runtime_reconfig */
+      dpdk_hqos_reconfig_poll (hqos);
+#endif /* FLEXIWAN_FEATURE - hqos_runtime_reconfig */
+
       /* Advance to next device */
       dev_pos++;
     }
 }
 
+#ifdef FLEXIWAN_FEATURE /* hqos_adaptive_thread */
+clib_error_t *
+dpdk_hqos_adaptive_init (dpdk_main_t * dm)
+{
+  vlib_thread_main_t *tm = vlib_get_thread_main ();
+  dpdk_config_main_t *conf = dm->conf;
+  dpdk_hqos_thread_data_t *td;
+  u32 i;
+
+  if (conf->hqos_flush_timeout_us == 0)
+    conf->hqos_flush_timeout_us = HQOS_FLUSH_TIMEOUT_US;
+  if (conf->hqos_idle_sleep_us == 0)
+    conf->hqos_idle_sleep_us = HQOS_IDLE_SLEEP_US;
+
+  vec_validate_aligned (dm->hqos_thread_data, tm->n_vlib_mains - 1,
+			CLIB_CACHE_LINE_BYTES);
+  vec_foreach (td, dm->hqos_thread_data) td->eventfd = -1;
+
+  for (i = dm->hqos_cpu_first_index;
+       i < dm->hqos_cpu_first_index + dm->hqos_cpu_count; i++)
+    {
+      td = vec_elt_at_index (dm->hqos_thread_data, i);
+      td->eventfd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if (td->eventfd < 0)
+	return clib_error_return_unix (0, "HQoS thread %u: eventfd", i);
+    }
+  return NULL;
+}
+
+void
+dpdk_hqos_thread_signal (dpdk_hqos_thread_data_t * td)
+{
+  u64 val = 1;
+  int __clib_unused rv;
+
+  /* EAGAIN means the counter is not read yet, so the thread wakes anyway */
+  rv = write (td->eventfd, &val, sizeof (val));
+}
+
+/*
+ * Moves packets out of SWQs of device into the scheduler. The partial burst
+ * is kept until the flush deadline, so packets are not held for long when
+ * the traffic is low. Returns the number of packets read out of SWQs.
+ */
+static_always_inline u32
+dpdk_hqos_device_enqueue (dpdk_device_hqos_per_hqos_thread_t * hqos,
+			  u64 now, u64 flush_timeout)
+{
+  struct rte_mbuf **pkts_enq = hqos->pkts_enq;
+  u32 pkts_enq_len = hqos->pkts_enq_len;
+  u32 swq_pos = hqos->swq_pos;
+  u32 n_swq = vec_len (hqos->swq), i, n, n_read = 0;
+
+  for (i = 0; i < n_swq; i++)
+    {
+      n = rte_ring_sc_dequeue_burst (hqos->swq[swq_pos],
+				     (void **) &pkts_enq[pkts_enq_len],
+				     hqos->hqos_burst_enq, 0);
+      pkts_enq_len += n;
+      n_read += n;
+
+      swq_pos++;
+      if (swq_pos >= n_swq)
+	swq_pos = 0;
+
+      if (pkts_enq_len >= hqos->hqos_burst_enq)
+	break;
+    }
+  hqos->swq_pos = swq_pos;
+
+  if (pkts_enq_len >= hqos->hqos_burst_enq ||
+      (pkts_enq_len && hqos->flush_deadline && now >= hqos->flush_deadline))
+    {
+      hqos->n_in_sched += rte_sched_port_enqueue (hqos->hqos, pkts_enq,
+						  pkts_enq_len);
+      pkts_enq_len = 0;
+      hqos->flush_deadline = 0;
+    }
+  else if (pkts_enq_len && hqos->flush_deadline == 0)
+    hqos->flush_deadline = now + flush_timeout;
+
+  hqos->pkts_enq_len = pkts_enq_len;
+  return n_read;
+}
+
+/*
+ * Sends packets out of the scheduler of device up to the device dequeue
+ * budget, so devices sharing the thread get fair share of it.
+ * Returns the number of packets sent.
+ */
+static_always_inline u32
+dpdk_hqos_device_dequeue (dpdk_device_t * xd,
+			  dpdk_device_hqos_per_hqos_thread_t * hqos,
+			  u16 queue_id)
+{
+  struct rte_mbuf **pkts_deq = hqos->pkts_deq;
+  u32 pkts_deq_len, n_pkts, n_deq = 0;
+
+  while (n_deq < hqos->deq_budget)
+    {
+      pkts_deq_len = rte_sched_port_dequeue (hqos->hqos, pkts_deq,
+					     clib_min (hqos->hqos_burst_deq,
+						       hqos->deq_budget -
+						       n_deq));
+      for (n_pkts = 0; n_pkts < pkts_deq_len;)
+	n_pkts += rte_eth_tx_burst (xd->port_id,
+				    (uint16_t) queue_id,
+				    &pkts_deq[n_pkts],
+				    (uint16_t) (pkts_deq_len - n_pkts));
+      n_deq += pkts_deq_len;
+
+      if (pkts_deq_len < hqos->hqos_burst_deq)
+	break;
+    }
+
+  hqos->n_in_sched -= clib_min (hqos->n_in_sched, n_deq);
+  return n_deq;
+}
+
+/*
+ * Sleeps until worker enqueues packets into SWQ of any device of thread,
+ * or until the timeout expires. The timeout is bounded, as the thread has
+ * to check the worker barrier and to serve packets shaped by scheduler.
+ */
+static_always_inline void
+dpdk_hqos_thread_sleep (vlib_main_t * vm, dpdk_hqos_thread_data_t * td,
+			u32 timeout_us)
+{
+  dpdk_main_t *dm = &dpdk_main;
+  struct timeval tv = {
+    .tv_sec = timeout_us / 1000000,
+    .tv_usec = timeout_us % 1000000,
+  };
+  fd_set fds;
+  dpdk_device_and_queue_t *dq;
+  dpdk_device_t *xd;
+  u64 val;
+  u32 i;
+
+  td->sleeping = 1;
+
+  /* Pairs with the barrier in dpdk_hqos_thread_wakeup() */
+  CLIB_MEMORY_BARRIER ();
+
+  /* Workers might enqueue packets before they saw the flag */
+  vec_foreach (dq, dm->devices_by_hqos_cpu[vm->thread_index])
+  {
+    xd = vec_elt_at_index (dm->devices, dq->device);
+    for (i = 0; i < vec_len (xd->hqos_ht->swq); i++)
+      if (!rte_ring_empty (xd->hqos_ht->swq[i]))
+	goto done;
+  }
+
+  td->n_sleeps++;
+  FD_ZERO (&fds);
+  FD_SET (td->eventfd, &fds);
+  if (select (td->eventfd + 1, &fds, NULL, NULL, &tv) > 0)
+    {
+      if (read (td->eventfd, &val, sizeof (val)) > 0)
+	td->n_wakeups++;
+    }
+
+done:
+  td->sleeping = 0;
+}
+
+/*
+ * The adaptive HQoS thread. Unlike dpdk_hqos_thread_internal() it serves
+ * every device of the thread in each round, flushes partial bursts by time
+ * and sleeps when there is no traffic instead of spinning the core.
+ */
+static_always_inline void
+dpdk_hqos_thread_internal_adaptive (vlib_main_t * vm)
+{
+  dpdk_main_t *dm = &dpdk_main;
+  dpdk_config_main_t *conf = dm->conf;
+  u32 thread_index = vm->thread_index;
+  dpdk_hqos_thread_data_t *td =
+    vec_elt_at_index (dm->hqos_thread_data, thread_index);
+  u64 flush_timeout = conf->hqos_flush_timeout_us *
+    vm->clib_time.clocks_per_second * 1e-6;
+  dpdk_device_hqos_per_hqos_thread_t *hqos;
+  dpdk_device_and_queue_t *dq;
+  dpdk_device_t *xd;
+  u32 n_work, n_in_enq, n_in_sched, n_idle_rounds = 0;
+  u64 now;
+
+  while (1)
+    {
+      vlib_worker_thread_barrier_check ();
+
+      if (PREDICT_FALSE (vec_len (dm->devices_by_hqos_cpu[thread_index]) ==
+			 0))
+	{
+	  sleep (1);
+	  continue;
+	}
+
+      now = clib_cpu_time_now ();
+      n_work = n_in_enq = n_in_sched = 0;
+
+      vec_foreach (dq, dm->devices_by_hqos_cpu[thread_index])
+      {
+	xd = vec_elt_at_index (dm->devices, dq->device);
+	hqos = xd->hqos_ht;
+
+	n_work += dpdk_hqos_device_enqueue (hqos, now, flush_timeout);
+	n_work += dpdk_hqos_device_dequeue (xd, hqos, dq->queue_id);
+#ifdef FLEXIWAN_FEATURE /* hqos_stats_segment */
+	if (PREDICT_FALSE (hqos->stats_interval))
+	  dpdk_hqos_stats_sample (thread_index, hqos, now);
+#endif /* FLEXIWAN_FEATURE - hqos_stats_segment */
+#ifdef FLEXIWAN_FEATURE /* hqos_runtime_reconfig */
+	dpdk_hqos_reconfig_poll (hqos);
+#endif /* FLEXIWAN_FEATURE - hqos_runtime_reconfig */
+
+	n_in_enq += hqos->pkts_enq_len;
+	n_in_sched += hqos->n_in_sched;
+      }
+
+      if (n_work)
+	{
+	  n_idle_rounds = 0;
+	  continue;
+	}
+
+      /* Keep spinning for a while, and until partial bursts are flushed */
+      if (++n_idle_rounds < HQOS_IDLE_ROUNDS || n_in_enq)
+	continue;
+
+      dpdk_hqos_thread_sleep (vm, td, n_in_sched ? HQOS_BACKLOG_SLEEP_US :
+			      conf->hqos_idle_sleep_us);
+    }
+}
+#endif /* FLEXIWAN_FEATURE - hqos_adaptive_thread */
+
 void
 dpdk_hqos_thread (vlib_worker_thread_t * w)
 {
@@ -1144,6 +1941,10 @@ dpdk_hqos_thread (vlib_worker_thread_t * w)
 
   if (DPDK_HQOS_DBG_BYPASS)
     dpdk_hqos_thread_internal_hqos_dbg_bypass (vm);
+#ifdef FLEXIWAN_FEATURE /* hqos_adaptive_thread */
+  else if (dpdk_main.conf->hqos_adaptive)
+    dpdk_hqos_thread_internal_adaptive (vm);
+#endif /* FLEXIWAN_FEATURE - hqos_adaptive_thread */
   else
     dpdk_hqos_thread_internal (vm);
 }
@@ -1184,6 +1985,52 @@ VLIB_REGISTER_THREAD (hqos_thread_reg, static) =
 })
 
 
+#ifdef FLEXIWAN_FEATURE /* hqos_metadata_set_x4 */
+static_always_inline void
+dpdk_hqos_metadata_prefetch (struct rte_mbuf *pkt)
+{
+  vlib_buffer_t *b = vlib_buffer_from_rte_mbuf (pkt);
+
+  /* The mbuf sched field is written, the buffer qos.id is reset */
+  CLIB_PREFETCH (pkt, CLIB_CACHE_LINE_BYTES, STORE);
+  CLIB_PREFETCH (b, 2 * CLIB_CACHE_LINE_BYTES, STORE);
+}
+
+/*
+ * Sets the scheduler metadata of packet classified by the ACL based
+ * classification, see dpdk_hqos_metadata_set().
+ */
+static_always_inline void
+dpdk_hqos_metadata_set_classified (dpdk_device_hqos_per_worker_thread_t *
+				   hqos, struct rte_sched_port *port,
+				   struct rte_mbuf *pkt)
+{
+  vlib_buffer_t *b = vlib_buffer_from_rte_mbuf (pkt);
+  u32 qos_id = vnet_buffer2 (b)->qos.id;
+  u32 tc_q;
+
+  /*
+   * Classified packet uses the marking: hqos_tc_table maps qos.bits to
+   * scheduler class (higher bits) and queue (lower 2 bits).
+   * Unclassified packet uses the default class and queue.
+   */
+  tc_q = (b->flags & VNET_BUFFER_F_IS_CLASSIFIED) ?
+    hqos->hqos_tc_table[vnet_buffer2 (b)->qos.bits] :
+    ((RTE_SCHED_TRAFFIC_CLASS_BE << 2) | (RTE_SCHED_BE_QUEUES_PER_PIPE - 1));
+
+  /*
+   * DPDK HQoS uses buffer metadata(qos.id) as below:
+   * The lower 16 bits represent the pipe id and the higher 16 bits
+   * represent the subport id.
+   */
+  rte_sched_port_pkt_write (port, pkt, qos_id >> 16, qos_id & 0xFFFF,
+			    (tc_q >> 2), (tc_q & 0x3), 0);
+
+  /* Reset QoS the identifier field */
+  vnet_buffer2 (b)->qos.id = 0;
+}
+#endif /* FLEXIWAN_FEATURE - hqos_metadata_set_x4 */
+
 void
 dpdk_hqos_metadata_set (dpdk_device_hqos_per_worker_thread_t * hqos,
 			struct rte_sched_port * port,
@@ -1198,6 +2045,40 @@ dpdk_hqos_metadata_set (dpdk_device_hqos_per_worker_thread_t * hqos,
 		   (hqos->hqos_field1_slabmask == 0) &&
 		   (hqos->hqos_field2_slabmask == 0)))
     {
+#ifdef FLEXIWAN_FEATURE /* hqos_metadata_set_x4 */
+      u32 i = 0;
+
+      /*
+       * Packets are handled four at a time, while the mbuf and the vlib
+       * buffer metadata of the next four packets are prefetched.
+       */
+      if (n_pkts >= 4)
+	{
+	  dpdk_hqos_metadata_prefetch (pkts[0]);
+	  dpdk_hqos_metadata_prefetch (pkts[1]);
+	  dpdk_hqos_metadata_prefetch (pkts[2]);
+	  dpdk_hqos_metadata_prefetch (pkts[3]);
+	}
+
+      for (; i + 4 <= n_pkts; i += 4)
+	{
+	  if (i + 8 <= n_pkts)
+	    {
+	      dpdk_hqos_metadata_prefetch (pkts[i + 4]);
+	      dpdk_hqos_metadata_prefetch (pkts[i + 5]);
+	      dpdk_hqos_metadata_prefetch (pkts[i + 6]);
+	      dpdk_hqos_metadata_prefetch (pkts[i + 7]);
+	    }
+
+	  dpdk_hqos_metadata_set_classified (hqos, port, pkts[i]);
+	  dpdk_hqos_metadata_set_classified (hqos, port, pkts[i + 1]);
+	  dpdk_hqos_metadata_set_classified (hqos, port, pkts[i + 2]);
+	  dpdk_hqos_metadata_set_classified (hqos, port, pkts[i + 3]);
+	}
+
+      for (; i < n_pkts; i++)
+	dpdk_hqos_metadata_set_classified (hqos, port, pkts[i]);
+#else /* FLEXIWAN_FEATURE - hqos_metadata_set_x4 */
       vlib_buffer_t * b;
       struct rte_mbuf * pkt;
       u8 tc_q;
@@ -1240,6 +2121,7 @@ dpdk_hqos_metadata_set (dpdk_device_hqos_per_worker_thread_t * hqos,
 	  /* Reset QoS the identifier field */
 	  vnet_buffer2 (b)->qos.id = 0;
 	}
+#endif /* FLEXIWAN_FEATURE - hqos_metadata_set_x4 */
       return;
     }
 #endif /* FLEXIWAN_FEATURE - acl_based_classification */
@@ -0,0 +1,104 @@
+/*
+ *  Copyright (C) 2023 flexiWAN Ltd.
+ *  This file is part of the FWABF plugin.
+ *  The FWABF plugin is fork of the FDIO VPP ABF plugin.
+ *  It enhances ABF with functionality required for Flexiwan Multi-Link feature.
+ *  For more details see official documentation on the Flexiwan Multi-Link.
+ */
+
+/*
+ * This file implements map of adjacency indexes into u32 values, e.g. labels
+ * or sw_if_index-s of links, used by FWABF datapath.
+ *
+ * The map is a flat vector indexed by adjacency index, as the fixed size
+ * array limited by 0xFFFF adjacencies was, so the lookup costs the same:
+ * one bound check and one memory access. The vector grows on set of
+ * adjacency that is out of its bounds, by FWABF_ADJ_MAP_GROW_SIZE values,
+ * so there is no limit on adjacency index. The adjacency indexes are pool
+ * indexes, so they are dense and the map takes 4 bytes per adjacency.
+ *
+ * Datapath threads read the map with no locks. To make it safe the vector
+ * is reallocated under worker barrier only.
+ */
+
+#ifndef __FWABF_ADJ_MAP_H__
+#define __FWABF_ADJ_MAP_H__
+
+#include <vlib/vlib.h>
+#include <vlib/threads.h>
+#include <vnet/dpo/dpo.h>
+
+#define FWABF_ADJ_MAP_GROW_SIZE  (1 << 12)
+
+typedef struct fwabf_adj_map_t_ {
+  u32* values;          /* vector of values indexed by adjacency index */
+  u32  default_value;   /* value of adjacencies that were not set */
+} fwabf_adj_map_t;
+
+/**
+ * Initializes the map. The first FWABF_ADJ_MAP_GROW_SIZE values are allocated
+ * right away, so the vector is never NULL and the lookup does not check it.
+ */
+static_always_inline void
+fwabf_adj_map_init (fwabf_adj_map_t * map, u32 default_value)
+{
+  map->values        = NULL;
+  map->default_value = default_value;
+  vec_validate_init_empty (map->values, FWABF_ADJ_MAP_GROW_SIZE - 1,
+                           default_value);
+}
+
+static_always_inline u32
+fwabf_adj_map_get (const fwabf_adj_map_t * map, u32 adj_index)
+{
+  if (PREDICT_FALSE (adj_index >= _vec_len (map->values)))
+    return map->default_value;
+  return map->values[adj_index];
+}
+
+/**
+ * Sets value of adjacency. Should be called by main thread only.
+ */
+static_always_inline void
+fwabf_adj_map_set (fwabf_adj_map_t * map, u32 adj_index, u32 value)
+{
+  ASSERT (vlib_get_thread_index () == 0);
+
+  if (PREDICT_FALSE (adj_index == INDEX_INVALID))
+    return;
+
+  if (PREDICT_FALSE (adj_index >= vec_len (map->values)))
+    {
+      /* No need to allocate memory for default value */
+      if (value == map->default_value)
+        return;
+
+      vlib_worker_thread_barrier_sync (vlib_get_main ());
+      vec_validate_init_empty (map->values,
+                               round_pow2 (adj_index + 1,
+                                           FWABF_ADJ_MAP_GROW_SIZE) - 1,
+                               map->default_value);
+      vlib_worker_thread_barrier_release (vlib_get_main ());
+    }
+
+  map->values[adj_index] = value;
+}
+
+/**
+ * Frees memory of the map. Should be called when datapath does not use it.
+ */
+static_always_inline void
+fwabf_adj_map_free (fwabf_adj_map_t * map)
+{
+  vec_free (map->values);
+}
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
+
+#endif /*__FWABF_ADJ_MAP_H__*/
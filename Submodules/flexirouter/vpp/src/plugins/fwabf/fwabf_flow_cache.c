@@ -0,0 +1,297 @@
+/*
+ *  Copyright (C) 2023 flexiWAN Ltd.
+ *  This file is part of the FWABF plugin.
+ *  The FWABF plugin is fork of the FDIO VPP ABF plugin.
+ *  It enhances ABF with functionality required for Flexiwan Multi-Link feature.
+ *  For more details see official documentation on the Flexiwan Multi-Link.
+ */
+
+/*
+ * This file implements the control plane part of the per-worker flow cache
+ * of FWABF decisions: initialization, the sweep of idle entries, eviction of
+ * entries when cache is full and CLI. The data plane part is implemented by inline functions
+ * in fwabf_flow_cache.h. See there for details.
+ */
+
+#include <plugins/fwabf/fwabf_flow_cache.h>
+
+#include <vppinfra/bihash_template.c>
+
+fwabf_flow_cache_main_t fwabf_flow_cache_main;
+
+/*
+ * The hash table is sized out of the number of entries: one bucket per page
+ * of BIHASH_KVP_PER_PAGE entries and memory for four times more key-value
+ * pairs than entries, as pages are split before they are full.
+ * The memory is reserved and is mapped on demand by bihash.
+ */
+#define FWABF_FLOW_CACHE_NUM_BUCKETS(_n) \
+  max_pow2 (clib_max ((_n) / BIHASH_KVP_PER_PAGE, 64))
+#define FWABF_FLOW_CACHE_MEMORY_SIZE(_n) \
+  (FWABF_FLOW_CACHE_NUM_BUCKETS(_n) * sizeof (clib_bihash_bucket_48_8_t) + \
+   (uword) (_n) * 4 * sizeof (clib_bihash_kv_48_8_t))
+
+static void
+fwabf_flow_cache_per_thread_init (fwabf_flow_cache_per_thread_t * fc,
+                                  u32 thread_index, u32 max_entries)
+{
+  clib_bihash_init2_args_48_8_t _a, *a = &_a;
+  u32 i;
+
+  clib_memset (a, 0, sizeof (*a));
+  a->h           = &fc->table;
+  a->name        = (char*) format (0, "fwabf flow cache %d%c", thread_index, 0);
+  a->nbuckets    = FWABF_FLOW_CACHE_NUM_BUCKETS (max_entries);
+  a->memory_size = FWABF_FLOW_CACHE_MEMORY_SIZE (max_entries);
+  a->instantiate_immediately = 1;
+  clib_bihash_init2_48_8 (a);
+  /* bihash keeps the name pointer, so the name is not freed */
+
+  vec_validate (fc->entries, max_entries - 1);
+  for (i = 0; i < max_entries; i++)
+    {
+      fc->entries[i].in_use    = 0;
+      fc->entries[i].next_free = (i + 1 < max_entries) ? i + 1 : ~0;
+    }
+  fc->free_head   = 0;
+  fc->n_entries   = 0;
+  fc->sweep_index = 0;
+}
+
+static void
+fwabf_flow_cache_per_thread_free (fwabf_flow_cache_per_thread_t * fc)
+{
+  vec_free (fc->table.name);
+  clib_bihash_free_48_8 (&fc->table);
+  vec_free (fc->entries);
+}
+
+static_always_inline void
+fwabf_flow_cache_entry_free (fwabf_flow_cache_per_thread_t * fc,
+                             fwabf_flow_cache_entry_t * e)
+{
+  clib_bihash_kv_48_8_t kv;
+
+  clib_memcpy_fast (kv.key, e->key.as_u64, sizeof (kv.key));
+  clib_bihash_add_del_48_8 (&fc->table, &kv, 0 /* is_add */);
+  e->in_use     = 0;
+  e->next_free  = fc->free_head;
+  fc->free_head = e - fc->entries;
+  fc->n_entries--;
+}
+
+static void
+fwabf_flow_cache_per_thread_flush (fwabf_flow_cache_per_thread_t * fc)
+{
+  fwabf_flow_cache_entry_t* e;
+
+  vec_foreach (e, fc->entries)
+    {
+      if (e->in_use)
+        fwabf_flow_cache_entry_free (fc, e);
+    }
+  fc->flushes++;
+}
+
+void
+fwabf_flow_cache_sweep (fwabf_flow_cache_per_thread_t * fc, u32 generation, u32 now)
+{
+  fwabf_flow_cache_entry_t* e;
+  u32 n_entries = vec_len (fc->entries);
+  u32 i;
+
+  if (fc->n_entries == 0)
+    return;
+
+  for (i = 0; i < FWABF_FLOW_CACHE_SWEEP_BUDGET; i++)
+    {
+      e = &fc->entries[fc->sweep_index];
+      if (e->in_use &&
+          (e->generation != generation ||
+           now - e->last_active > FWABF_FLOW_CACHE_IDLE_TIMEOUT))
+        {
+          fwabf_flow_cache_entry_free (fc, e);
+          fc->aged++;
+        }
+      if (++fc->sweep_index >= n_entries)
+        fc->sweep_index = 0;
+    }
+}
+
+fwabf_flow_cache_entry_t *
+fwabf_flow_cache_add (fwabf_flow_cache_per_thread_t * fc,
+                      const fwabf_flow_cache_key_t * key, u32 generation, u32 now)
+{
+  fwabf_flow_cache_entry_t* e;
+  clib_bihash_kv_48_8_t     kv;
+
+  if (PREDICT_FALSE (fc->free_head == ~0))
+    {
+      fwabf_flow_cache_sweep (fc, generation, now);
+      if (fc->free_head == ~0)
+        {
+          /* The sweep freed nothing - all entries are in use, evict one */
+          e = &fc->entries[fc->sweep_index];
+          fwabf_flow_cache_entry_free (fc, e);
+          fc->evicted++;
+          if (++fc->sweep_index >= vec_len (fc->entries))
+            fc->sweep_index = 0;
+        }
+    }
+
+  e = &fc->entries[fc->free_head];
+  clib_memcpy_fast (kv.key, key->as_u64, sizeof (kv.key));
+  kv.value = e - fc->entries;
+  if (PREDICT_FALSE (clib_bihash_add_del_48_8 (&fc->table, &kv, 1 /* is_add */) != 0))
+    return NULL;
+
+  fc->free_head = e->next_free;
+  fc->n_entries++;
+  clib_memset (e, 0, sizeof (*e));
+  e->key         = *key;
+  e->generation  = generation;
+  e->last_active = now;
+  e->in_use      = 1;
+  return e;
+}
+
+static clib_error_t *
+fwabf_flow_cache_set_cmd (vlib_main_t * vm,
+                          unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+  fwabf_flow_cache_main_t* fcm = &fwabf_flow_cache_main;
+  u32 enabled     = fcm->enabled;
+  u32 max_entries = fcm->max_entries;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "enable"))
+        enabled = 1;
+      else if (unformat (input, "disable"))
+        enabled = 0;
+      else if (unformat (input, "max-entries %d", &max_entries))
+        ;
+      else
+        return (clib_error_return (0, "unknown input '%U'",
+                                   format_unformat_error, input));
+    }
+
+  if (max_entries == 0)
+    return (clib_error_return (0, "max-entries should be positive"));
+
+  /*
+   * The command is not mp safe, so workers are stopped by barrier and
+   * the caches can be reallocated.
+   */
+  if (max_entries != fcm->max_entries)
+    {
+      fwabf_flow_cache_per_thread_t* fc;
+
+      vec_foreach (fc, fcm->per_thread)
+        {
+          fwabf_flow_cache_per_thread_free (fc);
+          fwabf_flow_cache_per_thread_init (fc, fc - fcm->per_thread, max_entries);
+        }
+    }
+
+  fcm->max_entries = max_entries;
+  fcm->enabled     = enabled;
+  fwabf_flow_cache_invalidate ();
+  return (NULL);
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (fwabf_flow_cache_set_cmd_node, static) = {
+  .path = "set fwabf flow-cache",
+  .function = fwabf_flow_cache_set_cmd,
+  .short_help = "set fwabf flow-cache [enable|disable] [max-entries <n>]",
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+fwabf_flow_cache_clear_cmd (vlib_main_t * vm,
+                            unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+  fwabf_flow_cache_per_thread_t* fc;
+
+  /* The command is not mp safe, so workers are stopped by barrier */
+  vec_foreach (fc, fwabf_flow_cache_main.per_thread)
+    {
+      fwabf_flow_cache_per_thread_flush (fc);
+      fc->hits = fc->misses = fc->stale = fc->aged = fc->evicted = fc->flushes = 0;
+    }
+  return (NULL);
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (fwabf_flow_cache_clear_cmd_node, static) = {
+  .path = "clear fwabf flow-cache",
+  .function = fwabf_flow_cache_clear_cmd,
+  .short_help = "clear fwabf flow-cache",
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+fwabf_flow_cache_show_cmd (vlib_main_t * vm,
+                           unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+  fwabf_flow_cache_main_t*       fcm = &fwabf_flow_cache_main;
+  fwabf_flow_cache_per_thread_t* fc;
+  u32 verbose = 0;
+
+  if (unformat (input, "verbose"))
+    verbose = 1;
+
+  vlib_cli_output (vm, "flow cache: %s, max entries per worker: %d, generation: %d",
+                   fcm->enabled ? "enabled" : "disabled", fcm->max_entries,
+                   fcm->generation);
+
+  vec_foreach (fc, fcm->per_thread)
+    {
+      vlib_cli_output (vm, " thread %d: entries:%d hits:%lld misses:%lld stale:%lld aged:%lld evicted:%lld flushes:%lld",
+                       fc - fcm->per_thread, fc->n_entries,
+                       fc->hits, fc->misses, fc->stale, fc->aged, fc->evicted,
+                       fc->flushes);
+      if (verbose)
+        vlib_cli_output (vm, "%U", format_bihash_48_8, &fc->table, 0 /* verbose */);
+    }
+  return (NULL);
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (fwabf_flow_cache_show_cmd_node, static) = {
+  .path = "show fwabf flow-cache",
+  .function = fwabf_flow_cache_show_cmd,
+  .short_help = "show fwabf flow-cache [verbose]",
+  .is_mp_safe = 1,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+fwabf_flow_cache_init (vlib_main_t * vm)
+{
+  fwabf_flow_cache_main_t*       fcm = &fwabf_flow_cache_main;
+  vlib_thread_main_t*            tm  = vlib_get_thread_main ();
+  fwabf_flow_cache_per_thread_t* fc;
+
+  fcm->enabled     = 1;
+  fcm->max_entries = FWABF_FLOW_CACHE_DEFAULT_MAX_ENTRIES;
+  fcm->generation  = 0;
+
+  vec_validate_aligned (fcm->per_thread, tm->n_vlib_mains - 1, CLIB_CACHE_LINE_BYTES);
+  vec_foreach (fc, fcm->per_thread)
+    {
+      fwabf_flow_cache_per_thread_init (fc, fc - fcm->per_thread, fcm->max_entries);
+    }
+  return (NULL);
+}
+
+VLIB_INIT_FUNCTION (fwabf_flow_cache_init);
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
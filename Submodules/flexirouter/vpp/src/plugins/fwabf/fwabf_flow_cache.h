@@ -0,0 +1,243 @@
+/*
+ *  Copyright (C) 2023 flexiWAN Ltd.
+ *  This file is part of the FWABF plugin.
+ *  The FWABF plugin is fork of the FDIO VPP ABF plugin.
+ *  It enhances ABF with functionality required for Flexiwan Multi-Link feature.
+ *  For more details see official documentation on the Flexiwan Multi-Link.
+ */
+
+/*
+ * This file implements the per-worker flow cache of FWABF decisions.
+ *
+ * The fwabf-input-ip4/fwabf-input-ip6 nodes perform ACL lookup and run
+ * policy link selection for every packet that hits labeled DPO or default
+ * route. For long living flows the result of this work is the same for every
+ * packet of flow, so it is cached per worker in bihash keyed by the ACL
+ * 5-tuple, the RX interface and the load balance found by FIB lookup.
+ * The cached value is the ACL match result (policy, service class, importance)
+ * and the DPO chosen by policy.
+ *
+ * Cache entries are not removed on configuration changes. Instead every entry
+ * is stamped with generation that is valid at the time the entry is created.
+ * The generation is the sum of two monotonic counters:
+ *    - the FWABF generation bumped on changes of links, labels, link quality,
+ *      policies and attachments.
+ *    - the ACL plugin acl_change_epoch bumped on changes of ACL rules and
+ *      lookup contexts.
+ * FIB changes are not tracked globally, as they would invalidate the whole
+ * cache on every route update. Instead the entry keeps the fingerprint of
+ * buckets of the load balance the decision was made for, and it is compared
+ * with the current buckets on hit. So only flows that use the updated load
+ * balance are recalculated.
+ * Entry with not matching generation or fingerprint is considered to be stale.
+ * It is recalculated and overwritten in place by the next packet of the flow.
+ *
+ * The entries are preallocated by control plane, so the data plane never
+ * allocates memory. Idle and stale entries are freed by a bounded sweep,
+ * run by worker once per frame, see fwabf_flow_cache_sweep(). If the cache is
+ * still full when a new flow arrives, the entry under the sweep cursor is
+ * evicted to make room for it.
+ *
+ * Note the label counters (see 'show fwabf labels') are updated on cache miss
+ * only, as link selection is not performed on cache hit.
+ * The policy counters are updated on every packet.
+ */
+
+#ifndef __FWABF_FLOW_CACHE_H__
+#define __FWABF_FLOW_CACHE_H__
+
+#include <vlib/vlib.h>
+#include <vnet/dpo/load_balance.h>
+#include <plugins/acl/exports.h>
+
+#include <vppinfra/bihash_48_8.h>
+#include <vppinfra/bihash_template.h>
+#include <vppinfra/xxhash.h>
+
+#define FWABF_FLOW_CACHE_DEFAULT_MAX_ENTRIES  (64 * 1024)
+#define FWABF_FLOW_CACHE_IDLE_TIMEOUT         60  /*seconds*/
+#define FWABF_FLOW_CACHE_SWEEP_BUDGET         16  /*entries checked per frame*/
+
+/*
+ * The flow cache key. It reuses the layout of ACL plugin 5-tuple for the
+ * addresses and L4 data, the rest of key is the RX interface and the index
+ * of load balance DPO found by FIB lookup.
+ */
+typedef union fwabf_flow_cache_key_t_ {
+  struct {
+    ip6_address_t addr[2];  /*ip4 addresses are placed as in fa_5tuple_t*/
+    u16           port[2];
+    u8            proto;
+    u8            tcp_flags;
+    u16           pkt_flags;
+    u32           sw_if_index;
+    u32           lb_index;
+  };
+  u64 as_u64[6];
+} fwabf_flow_cache_key_t;
+
+STATIC_ASSERT_SIZEOF (fwabf_flow_cache_key_t, 48);
+
+typedef struct fwabf_flow_cache_entry_t_ {
+  fwabf_flow_cache_key_t key;
+  dpo_id_t               dpo;           /*policy DPO, valid if 'match' is 1*/
+  u64                    lb_fingerprint;/*see fwabf_flow_cache_lb_fingerprint()*/
+  u32                    generation;
+  u32                    policy;        /*index of policy, INDEX_INVALID if no ACL match*/
+  u32                    last_active;   /*seconds*/
+  u32                    next_free;     /*next entry in free list, if not in use*/
+  u8                     in_use;
+  u8                     match;         /*fwabf_policy_get_dpo_ipX() result*/
+  u8                     service_class;
+  u8                     importance;
+} fwabf_flow_cache_entry_t;
+
+typedef struct fwabf_flow_cache_per_thread_t_ {
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  clib_bihash_48_8_t        table;    /*key -> index in 'entries'*/
+  fwabf_flow_cache_entry_t* entries;  /*preallocated, 'max_entries' long*/
+  u32 free_head;                      /*head of free entries list, ~0 if full*/
+  u32 n_entries;                      /*number of entries in use*/
+  u32 sweep_index;                    /*entry to be checked by next sweep*/
+  u64 hits;
+  u64 misses;
+  u64 stale;
+  u64 aged;                           /*entries freed by sweep*/
+  u64 evicted;                        /*entries replaced when cache is full*/
+  u64 flushes;
+} fwabf_flow_cache_per_thread_t;
+
+typedef struct fwabf_flow_cache_main_t_ {
+  fwabf_flow_cache_per_thread_t* per_thread;
+  volatile u32 generation;
+  u32          max_entries;   /*per worker*/
+  u8           enabled;
+} fwabf_flow_cache_main_t;
+
+extern fwabf_flow_cache_main_t fwabf_flow_cache_main;
+
+/**
+ * Invalidates all cached decisions. Should be called by the control plane on
+ * any change that might affect FWABF decisions and that is not tracked
+ * by ACL or FIB epochs.
+ */
+static_always_inline void
+fwabf_flow_cache_invalidate (void)
+{
+  fwabf_flow_cache_main.generation++;
+}
+
+/**
+ * Returns cache of the worker or NULL if cache is disabled.
+ */
+static_always_inline fwabf_flow_cache_per_thread_t *
+fwabf_flow_cache_get_per_thread (u32 thread_index)
+{
+  if (PREDICT_FALSE (fwabf_flow_cache_main.enabled == 0))
+    return NULL;
+  return vec_elt_at_index (fwabf_flow_cache_main.per_thread, thread_index);
+}
+
+/**
+ * Returns the current generation. Should be called once per frame.
+ */
+static_always_inline u32
+fwabf_flow_cache_generation (const acl_main_t * am)
+{
+  return fwabf_flow_cache_main.generation + am->acl_change_epoch;
+}
+
+/**
+ * Returns fingerprint of the load balance found by FIB lookup. The policy
+ * decision depends on the load balance buckets only, so the cached decision
+ * is valid as long as the fingerprint is not changed.
+ */
+static_always_inline u64
+fwabf_flow_cache_lb_fingerprint (const load_balance_t * lb)
+{
+  u64 fp = ((u64) lb->lb_hash_config << 16) | lb->lb_n_buckets;
+
+  for (u32 i = 0; i < lb->lb_n_buckets; i++)
+    fp = clib_xxhash (fp ^ load_balance_get_bucket_i (lb, i)->as_u64);
+  return fp;
+}
+
+/**
+ * Builds the cache key out of ACL 5-tuple filled by acl_plugin_fill_5tuple().
+ *
+ * @return 1 if packet can be cached, 0 otherwise. Non-first fragments are not
+ *         cached, as policy uses flow hash on packet headers to select link.
+ */
+static_always_inline int
+fwabf_flow_cache_key_init (fwabf_flow_cache_key_t * key,
+                           const fa_5tuple_opaque_t * fa_5tuple,
+                           u32 sw_if_index, u32 lb_index)
+{
+  const fa_5tuple_t* fa = (const fa_5tuple_t*) fa_5tuple;
+
+  if (PREDICT_FALSE (!fa->pkt.l4_valid || fa->pkt.is_nonfirst_fragment))
+    return 0;
+
+  key->as_u64[0]   = fa->kv_40_8.key[0];
+  key->as_u64[1]   = fa->kv_40_8.key[1];
+  key->as_u64[2]   = fa->kv_40_8.key[2];
+  key->as_u64[3]   = fa->kv_40_8.key[3];
+  key->port[0]     = fa->l4.port[0];
+  key->port[1]     = fa->l4.port[1];
+  key->proto       = fa->l4.proto;
+  key->tcp_flags   = fa->pkt.tcp_flags;
+  key->pkt_flags   = fa->pkt.tcp_flags_valid | (fa->pkt.is_ip6 << 1);
+  key->sw_if_index = sw_if_index;
+  key->lb_index    = lb_index;
+  return 1;
+}
+
+/**
+ * Looks up the flow in the worker cache.
+ *
+ * @return entry if found, NULL otherwise. The caller is responsible to check
+ *         the entry generation and to update the entry if it is stale.
+ */
+static_always_inline fwabf_flow_cache_entry_t *
+fwabf_flow_cache_lookup (fwabf_flow_cache_per_thread_t * fc,
+                         const fwabf_flow_cache_key_t * key, u32 now)
+{
+  clib_bihash_kv_48_8_t kv;
+  fwabf_flow_cache_entry_t* e;
+
+  clib_memcpy_fast (kv.key, key->as_u64, sizeof (kv.key));
+  if (clib_bihash_search_inline_48_8 (&fc->table, &kv) != 0)
+    return NULL;
+
+  e = vec_elt_at_index (fc->entries, kv.value);
+  e->last_active = now;
+  return e;
+}
+
+/**
+ * Frees up to FWABF_FLOW_CACHE_SWEEP_BUDGET idle or stale entries of the
+ * worker cache. Should be called by worker once per frame.
+ */
+extern void
+fwabf_flow_cache_sweep (fwabf_flow_cache_per_thread_t * fc, u32 generation, u32 now);
+
+/**
+ * Adds new flow into the worker cache. If the cache is full, the entry under
+ * the sweep cursor is evicted.
+ *
+ * @return the new entry to be filled by caller or NULL if the flow could not
+ *         be added to the hash table.
+ */
+extern fwabf_flow_cache_entry_t *
+fwabf_flow_cache_add (fwabf_flow_cache_per_thread_t * fc,
+                      const fwabf_flow_cache_key_t * key, u32 generation, u32 now);
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
+
+#endif /*__FWABF_FLOW_CACHE_H__*/
@@ -72,6 +72,8 @@
 #include <vnet/ip/ip6_inlines.h>
 #include <vnet/qos/qos_types.h>
 #include <plugins/acl/exports.h>
+#include <plugins/classifier_acls/classify_result.h>
+#include <plugins/fwabf/fwabf_flow_cache.h>
 
 /**
  * Forward declarations;
@@ -151,16 +153,23 @@ fwabf_itf_attach_db_del (u32 policy, u32 sw_if_index)
   hash_unset (fwabf_itf_attach_db, key);
 }
 
-static int
-fwabf_cmp_attach_for_sort (void *v1, void *v2)
+/*
+ * Inserts attachment into the interface vector of attachments, that is sorted
+ * by priority. The attachment is placed after attachments of the same
+ * priority, so the order of the existing attachments is kept. That enables
+ * the ACL plugin to update the lookup context incrementally: it reapplies only
+ * the ACL-s that follow the first changed position in the list. So attaching
+ * policies in order of priority costs the rules of the new policy only.
+ */
+static void
+fwabf_itf_attach_insert (u32 ** attachments, fwabf_itf_attach_t * fia)
 {
-  const fwabf_itf_attach_t *fia1;
-  const fwabf_itf_attach_t *fia2;
+  u32 fiai = fia - fwabf_itf_attach_pool;
+  u32 i    = vec_len (*attachments);
 
-  fia1 = fwabf_itf_attach_get (*(u32 *) v1);
-  fia2 = fwabf_itf_attach_get (*(u32 *) v2);
-
-  return (fia1->fia_prio - fia2->fia_prio);
+  while (i > 0 && fwabf_itf_attach_get ((*attachments)[i - 1])->fia_prio > fia->fia_prio)
+    i--;
+  vec_insert_elts (*attachments, &fiai, 1, i);
 }
 
 void fwabf_setup_acl_lc (fib_protocol_t fproto, u32 sw_if_index)
@@ -218,7 +227,7 @@ int fwabf_itf_attach (fib_protocol_t fproto, u32 policy_id, u32 priority, u32 sw
    * Insert the attachment/policy on the interfaces list.
    */
   vec_validate_init_empty (fwabf_attach_per_itf[fproto], sw_if_index, NULL);
-  vec_add1 (fwabf_attach_per_itf[fproto][sw_if_index], fia - fwabf_itf_attach_pool);
+  fwabf_itf_attach_insert (&fwabf_attach_per_itf[fproto][sw_if_index], fia);
   if (1 == vec_len (fwabf_attach_per_itf[fproto][sw_if_index]))
     {
       /*
@@ -236,19 +245,14 @@ int fwabf_itf_attach (fib_protocol_t fproto, u32 policy_id, u32 priority, u32 sw
       fwabf_acl_lc_per_itf[fproto][sw_if_index] =
         acl_plugin.get_lookup_context_index (fwabf_acl_user_id, sw_if_index, 0);
     }
-  else
-    {
-      /*
-       * take a care of priorities
-       */
-      vec_sort_with_function (
-            fwabf_attach_per_itf[fproto][sw_if_index], fwabf_cmp_attach_for_sort);
-    }
 
   /*
-   * update ACL plugin with our contexts
+   * update ACL plugin with our contexts.
+   * The lookup context merges rules of all attached policies into the single
+   * tuple space hash, so the lookup cost does not depend on number of policies.
    */
   fwabf_setup_acl_lc (fproto, sw_if_index);
+  fwabf_flow_cache_invalidate ();
   return (0);
 }
 
@@ -280,7 +284,8 @@ fwabf_itf_detach (fib_protocol_t fproto, u32 policy_id, u32 sw_if_index)
 		                  fia - fwabf_itf_attach_pool);
 
   ASSERT (index != ~0);
-  vec_del1 (fwabf_attach_per_itf[fproto][sw_if_index], index);
+  /* Keep the vector sorted by priority, see fwabf_itf_attach_insert() */
+  vec_delete (fwabf_attach_per_itf[fproto][sw_if_index], 1, index);
 
   if (0 == vec_len (fwabf_attach_per_itf[fproto][sw_if_index]))
     {
@@ -310,6 +315,7 @@ fwabf_itf_detach (fib_protocol_t fproto, u32 policy_id, u32 sw_if_index)
   fwabf_itf_attach_db_del (policy_id, sw_if_index);
   pool_put (fwabf_itf_attach_pool, fia);
 
+  fwabf_flow_cache_invalidate ();
   return (0);
 }
 
@@ -465,402 +471,800 @@ typedef enum
   FWABF_N_ERROR,
 } fwabf_error_t;
 
+/**
+ * The state of fwabf-input node shared by all packets of frame.
+ */
+typedef struct fwabf_input_frame_ctx_t_ {
+  fwabf_flow_cache_per_thread_t* fc;    /*NULL if flow cache is disabled*/
+  u32 generation;                       /*current generation of flow cache*/
+  u32 now;                              /*seconds*/
+  u32 thread_index;
+  u32 n_shared;                         /*ACL lookups saved by classifier-acls*/
+} fwabf_input_frame_ctx_t;
+
+static_always_inline void
+fwabf_input_frame_ctx_init (vlib_main_t * vm, fwabf_input_frame_ctx_t * ctx)
+{
+  ctx->thread_index = vm->thread_index;
+  ctx->fc           = fwabf_flow_cache_get_per_thread (vm->thread_index);
+  ctx->generation   = fwabf_flow_cache_generation (acl_plugin.p_acl_main);
+  ctx->now          = (u32) vlib_time_now (vm);
+  ctx->n_shared     = 0;
+  if (ctx->fc)
+    fwabf_flow_cache_sweep (ctx->fc, ctx->generation, ctx->now);
+}
+
+/**
+ * Marks the packet with classification result of policy ACL.
+ */
+static_always_inline void
+fwabf_input_mark (vlib_buffer_t * b0, u8 service_class, u8 importance)
+{
+  vnet_buffer2 (b0)->qos.service_class = service_class;
+  vnet_buffer2 (b0)->qos.importance    = importance;
+  vnet_buffer2 (b0)->qos.source        = QOS_SOURCE_IP;
+  b0->flags |= VNET_BUFFER_F_IS_CLASSIFIED;
+}
+
+/**
+ * Matches packet against policy ACL-s and on match runs policy to find DPO
+ * to be used for forwarding. The result is stored in the per-worker flow
+ * cache, so the next packets of the same flow skip the ACL lookup and
+ * the policy link selection. See fwabf_flow_cache.h for details.
+ * The ACL lookup is skipped also if the packet carries the result of lookup
+ * in the same ACL-s made by the classifier-acls node, see classify_result.h.
+ *
+ * @param ctx        the state shared by all packets of frame.
+ * @param dpo0       result of the function: DPO to be used for forwarding.
+ * @param policy0    result of the function: index of the matched policy.
+ * @param match0     result of the function: 1 if 'dpo0' should be used for
+ *                   forwarding, 0 otherwise.
+ * @return 1 if packet matched policy ACL, 0 otherwise.
+ */
+/**
+ * Matches packet against ACL-s of the lookup context.
+ * It is kept out of line: it runs on flow cache miss only, and inlining the ACL
+ * plugin hash lookup into every slot of the quad and dual loops makes gcc
+ * report false maybe-uninitialized on the bihash search result.
+ */
+static never_inline int
+fwabf_input_acl_match (acl_main_t * am, u32 lc_index,
+                       fa_5tuple_opaque_t * fa_5tuple, u8 is_ip6,
+                       u32 * match_acl_pos, u32 * match_acl_index,
+                       u32 * match_rule_index)
+{
+  u32 trace_bitmap = 0;
+  u8  action       = 0;
+
+  return acl_plugin_match_5tuple_inline (am, lc_index, fa_5tuple, is_ip6,
+                                         &action, match_acl_pos,
+                                         match_acl_index, match_rule_index,
+                                         &trace_bitmap);
+}
+
+static_always_inline u32
+fwabf_input_classify (vlib_main_t * vm, vlib_node_runtime_t * node,
+                      vlib_buffer_t * b0, const load_balance_t * lb0,
+                      fib_protocol_t fproto, fwabf_input_frame_ctx_t * ctx,
+                      dpo_id_t * dpo0, u32 * policy0, u32 * match0)
+{
+  acl_main_t*               am = acl_plugin.p_acl_main;
+  fwabf_flow_cache_per_thread_t* fc = ctx->fc;
+  fwabf_flow_cache_entry_t* ce0 = NULL;
+  fwabf_flow_cache_key_t    key0;
+  u64                       lb_fingerprint0 = 0;
+  fa_5tuple_opaque_t        fa_5tuple0;
+  const u32*                attachments0;
+  const fwabf_itf_attach_t* fia0;
+  const acl_rule_t*         rule0;
+  fwabf_quality_service_class_t sc;
+  u32 sw_if_index0;
+  u32 lc_index;
+  u32 match_acl_index   = ~0;
+  u32 match_acl_pos     = ~0;
+  u32 match_rule_index  = ~0;
+  u8  is_ip6            = (FIB_PROTOCOL_IP6 == fproto);
+  int acl_found0;
+
+  sw_if_index0 = vnet_buffer (b0)->sw_if_index[VLIB_RX];
+
+  ASSERT (vec_len (fwabf_attach_per_itf[fproto]) > sw_if_index0);
+  attachments0 = fwabf_attach_per_itf[fproto][sw_if_index0];
+
+  ASSERT (vec_len (fwabf_acl_lc_per_itf[fproto]) > sw_if_index0);
+  lc_index = fwabf_acl_lc_per_itf[fproto][sw_if_index0];
+
+  /*
+    A non-inline version looks like this:
+
+    acl_plugin.fill_5tuple (lc_index, b0, (FIB_PROTOCOL_IP6 == fproto),
+    1, 0, &fa_5tuple0);
+    if (acl_plugin.match_5tuple
+    (lc_index, &fa_5tuple0, (FIB_PROTOCOL_IP6 == fproto), &action,
+    &match_acl_pos, &match_acl_index, &match_rule_index,
+    &trace_bitmap))
+    . . .
+  */
+  acl_plugin_fill_5tuple_inline (am, lc_index, b0, is_ip6, 1, 0, &fa_5tuple0);
+
+  /*
+   * Use cached decision if it is still valid. Otherwise make ACL lookup
+   * and run policy, and store results in cache: either in the stale entry
+   * or in the new one.
+   */
+  if (fc && fwabf_flow_cache_key_init (&key0, &fa_5tuple0, sw_if_index0,
+                                       lb0 - load_balance_pool))
+    {
+      ce0 = fwabf_flow_cache_lookup (fc, &key0, ctx->now);
+      lb_fingerprint0 = fwabf_flow_cache_lb_fingerprint (lb0);
+      if (PREDICT_TRUE (ce0 != NULL && ce0->generation == ctx->generation &&
+                        ce0->lb_fingerprint == lb_fingerprint0))
+        {
+          fc->hits++;
+          if (ce0->policy == INDEX_INVALID)
+            return 0;
+
+          *policy0 = ce0->policy;
+          *match0  = ce0->match;
+          *dpo0    = ce0->dpo;
+          fwabf_policy_account_cached (ce0->policy, ctx->thread_index,
+                                       vlib_buffer_length_in_chain (vm, b0),
+                                       ce0->match, &ce0->dpo);
+          fwabf_input_mark (b0, ce0->service_class, ce0->importance);
+          return 1;
+        }
+
+      if (ce0)
+        {
+          fc->stale++;
+          ce0->generation = ctx->generation;
+        }
+      else
+        {
+          fc->misses++;
+          ce0 = fwabf_flow_cache_add (fc, &key0, ctx->generation, ctx->now);
+        }
+      if (ce0)
+        ce0->lb_fingerprint = lb_fingerprint0;
+    }
+
+  acl_found0 = classify_result_get (am, b0, sw_if_index0, lc_index,
+                                    &match_acl_pos, &match_acl_index,
+                                    &match_rule_index);
+  if (acl_found0 >= 0)
+    ctx->n_shared++;
+  else
+    acl_found0 = fwabf_input_acl_match (am, lc_index, &fa_5tuple0, is_ip6,
+                                        &match_acl_pos, &match_acl_index,
+                                        &match_rule_index);
+  if (!acl_found0)
+    {
+      if (ce0)
+        ce0->policy = INDEX_INVALID;
+      return 0;
+    }
+
+  /*
+   * match:
+   *  follow the DPO chain if available. Otherwise fallback to feature arc.
+   */
+  rule0 = &am->acls[match_acl_index].rules[match_rule_index];
+  sc    = rule0->service_class;
+  if (sc <= FWABF_QUALITY_SC_MIN || sc >= FWABF_QUALITY_SC_MAX) {
+    clib_warning("wrong value for service class %d must be in range from %d to %d",
+                sc, FWABF_QUALITY_SC_MIN, FWABF_QUALITY_SC_MAX);
+    sc = FWABF_QUALITY_SC_STANDARD;
+  }
+  fia0     = fwabf_itf_attach_get (attachments0[match_acl_pos]);
+  *policy0 = fia0->fia_policy;
+  *match0  = is_ip6 ?
+             fwabf_policy_get_dpo_ip6 (fia0->fia_policy, b0, lb0, sc, dpo0) :
+             fwabf_policy_get_dpo_ip4 (fia0->fia_policy, b0, lb0, sc, dpo0);
+
+  if (ce0)
+    {
+      ce0->policy        = fia0->fia_policy;
+      ce0->match         = *match0;
+      ce0->dpo           = *dpo0;
+      ce0->service_class = sc;
+      ce0->importance    = rule0->importance;
+    }
+
+  /* Mark the packet with classification result */
+  fwabf_input_mark (b0, sc, rule0->importance);
+  return 1;
+}
+
+/**
+ * Completes handling of IPv4 packet, once the FIB lookup was done for it:
+ * match packet against policy ACL-s and apply policy on match, otherwise
+ * use the DPO found by FIB lookup - the second part of ip4_lookup_inline.
+ * It is shared by the quad, dual and single loops of the fwabf-input-ip4 node,
+ * so all of them produce the same results.
+ *
+ * @return 1 if packet matched policy ACL, 0 otherwise.
+ */
+static_always_inline u32
+fwabf_input_ip4_finish (vlib_main_t * vm, vlib_node_runtime_t * node,
+                        vlib_buffer_t * b0, const load_balance_t * lb0,
+                        fwabf_input_frame_ctx_t * ctx, u16 * next)
+{
+  ip_lookup_next_t          next0 = IP_LOOKUP_NEXT_DROP;
+  const dpo_id_t*           dpo0;
+  dpo_id_t                  dpo0_policy = DPO_INVALID;
+  u32 policy0           = INDEX_INVALID;
+  u32 match0            = 0;
+  u32 acl_matched0      = 0;
+  ip4_header_t*             ip40 = vlib_buffer_get_current (b0);
+  u32                       hash_c0;
+  flow_hash_config_t        flow_hash_config0;
+
+  /*
+   * If FIB lookup brings not labeled DPO-s, the policy can't be applied,
+   * as it uses labels to choose DPO-s for forwarding.
+   * In this case there is no need to bother with ACL & Policy,
+   * go directly to deafult routing - use FIB lookup result.
+   * ASSUMPTION: if user wants policy, it labels all available tunnels,
+   *             so FIB lookup can't bring mix of labeled and not labeled
+   *             tunnels!
+   *
+   * The exception for this algorithm is DPO of default route.
+   * Even if it is not labeled, user might want to enforce the default
+   * route packets to go into policy tunnels on ACL & Policy match.
+   * This is needed for use case of Branch-to-HeadQuaters topology,
+   * where all traffic on the Branch VPP should go to the Head Quaters VPP,
+   * and there it should go to internet or to other tunnel.
+   */
+  if (fwabf_links_is_dpo_labeled_or_default_route (lb0, DPO_PROTO_IP4))
+    {
+      /*
+        * Perform ACL lookup and if found - apply policy.
+        */
+      acl_matched0 = fwabf_input_classify (vm, node, b0, lb0, FIB_PROTOCOL_IP4,
+                                           ctx,
+                                           &dpo0_policy, &policy0, &match0);
+      if (PREDICT_TRUE(match0))
+        {
+          next0 = dpo0_policy.dpoi_next_node;
+          vnet_buffer (b0)->ip.adj_index[VLIB_TX] = dpo0_policy.dpoi_index;
+        }
+    } /*if (fwabf_links_is_dpo_labeled_or_default_route (lb0)*/
+
+  /*
+   * If policy was not applied, finish the ip4_lookup_inline logic -
+   * part two of ip4_lookup_inline code - use DPO found by FIB lookup.
+   */
+  if (match0==0)
+    {
+      hash_c0 = vnet_buffer (b0)->ip.flow_hash = 0;
+      if (PREDICT_FALSE (lb0->lb_n_buckets > 1))
+        {
+          /* Use flow hash to compute multipath adjacency. */
+          flow_hash_config0 = lb0->lb_hash_config;
+          hash_c0 = vnet_buffer (b0)->ip.flow_hash =
+                    ip4_compute_flow_hash (ip40, flow_hash_config0);
+          dpo0 = load_balance_get_fwd_bucket (lb0,
+                          (hash_c0 & (lb0->lb_n_buckets_minus_1)));
+        }
+      else
+        {
+          dpo0 = load_balance_get_bucket_i (lb0, 0);
+        }
+
+      next0 = dpo0->dpoi_next_node;
+      vnet_buffer (b0)->ip.adj_index[VLIB_TX] = dpo0->dpoi_index;
+    }
+
+  if (PREDICT_FALSE (b0->flags & VLIB_BUFFER_IS_TRACED))
+    {
+      fwabf_input_trace_t *tr;
+
+      tr = vlib_add_trace (vm, node, b0, sizeof (*tr));
+      tr->next   = next0;
+      tr->adj    = vnet_buffer (b0)->ip.adj_index[VLIB_TX];
+      tr->match  = match0;
+      tr->policy = policy0;
+    }
+
+  *next = next0;
+  return acl_matched0;
+}
+
 static uword
 fwabf_input_ip4 (vlib_main_t * vm, vlib_node_runtime_t * node, vlib_frame_t * frame)
 {
-  u32 n_left_from, *from, *to_next, next_index, matches;
+  ip4_main_t*             im = &ip4_main;
+  u32                     n_left, *from, matches;
+  vlib_buffer_t*          bufs[VLIB_FRAME_SIZE];
+  vlib_buffer_t**         b = bufs;
+  u16                     nexts[VLIB_FRAME_SIZE], *next;
+  fwabf_input_frame_ctx_t ctx;
 
   from = vlib_frame_vector_args (frame);
-  n_left_from = frame->n_vectors;
-  next_index = node->cached_next_index;
+  n_left = frame->n_vectors;
+  next = nexts;
   matches = 0;
+  vlib_get_buffers (vm, from, bufs, n_left);
 
-  while (n_left_from > 0)
-    {
-      u32 n_left_to_next;
+  fwabf_input_frame_ctx_init (vm, &ctx);
 
-      vlib_get_next_frame (vm, node, next_index, to_next, n_left_to_next);
+  /*
+   * The fwabf_input_ip4 node replaces the ip4_lookup_inline node.
+   * This is done to avoid FIB lookup twice in case, when packet does
+   * not match policy classification (ACL lookup failure).
+   * Therefore we have to reuse the ip4_lookup_inline code.
+   * The last is consist of two parts - lookup in FIB and fetching
+   * adjacency DPO out of found load balancing DPO.
+   * Note the FIB lookup always brings the load balancing DPO, even
+   * if it points to single adjacency DPO only.
+   * The first part - FIB lookup - is done below in the same manner as
+   * in ip4_lookup_inline: buffers and headers are prefetched and mtrie steps
+   * are interleaved for a number of packets. It is used in both cases -
+   * either packet matches policy or not. The rest is done per packet
+   * by fwabf_input_ip4_finish().
+   */
+#if (CLIB_N_PREFETCHES >= 8)
+  while (n_left >= 4)
+    {
+      ip4_header_t *ip0, *ip1, *ip2, *ip3;
+      const load_balance_t *lb0, *lb1, *lb2, *lb3;
+      ip4_fib_mtrie_t *mtrie0, *mtrie1, *mtrie2, *mtrie3;
+      ip4_fib_mtrie_leaf_t leaf0, leaf1, leaf2, leaf3;
+      ip4_address_t *dst_addr0, *dst_addr1, *dst_addr2, *dst_addr3;
+      u32 lb_index0, lb_index1, lb_index2, lb_index3;
+
+      /* Prefetch next iteration. */
+      if (n_left >= 8)
+        {
+          vlib_prefetch_buffer_header (b[4], LOAD);
+          vlib_prefetch_buffer_header (b[5], LOAD);
+          vlib_prefetch_buffer_header (b[6], LOAD);
+          vlib_prefetch_buffer_header (b[7], LOAD);
+
+          CLIB_PREFETCH (b[4]->data, sizeof (ip0[0]), LOAD);
+          CLIB_PREFETCH (b[5]->data, sizeof (ip0[0]), LOAD);
+          CLIB_PREFETCH (b[6]->data, sizeof (ip0[0]), LOAD);
+          CLIB_PREFETCH (b[7]->data, sizeof (ip0[0]), LOAD);
+        }
 
-      while (n_left_from > 0 && n_left_to_next > 0)
+      ip0 = vlib_buffer_get_current (b[0]);
+      ip1 = vlib_buffer_get_current (b[1]);
+      ip2 = vlib_buffer_get_current (b[2]);
+      ip3 = vlib_buffer_get_current (b[3]);
+
+      dst_addr0 = &ip0->dst_address;
+      dst_addr1 = &ip1->dst_address;
+      dst_addr2 = &ip2->dst_address;
+      dst_addr3 = &ip3->dst_address;
+
+      ip_lookup_set_buffer_fib_index (im->fib_index_by_sw_if_index, b[0]);
+      ip_lookup_set_buffer_fib_index (im->fib_index_by_sw_if_index, b[1]);
+      ip_lookup_set_buffer_fib_index (im->fib_index_by_sw_if_index, b[2]);
+      ip_lookup_set_buffer_fib_index (im->fib_index_by_sw_if_index, b[3]);
+
+      mtrie0 = &ip4_fib_get (vnet_buffer (b[0])->ip.fib_index)->mtrie;
+      mtrie1 = &ip4_fib_get (vnet_buffer (b[1])->ip.fib_index)->mtrie;
+      mtrie2 = &ip4_fib_get (vnet_buffer (b[2])->ip.fib_index)->mtrie;
+      mtrie3 = &ip4_fib_get (vnet_buffer (b[3])->ip.fib_index)->mtrie;
+
+      leaf0 = ip4_fib_mtrie_lookup_step_one (mtrie0, dst_addr0);
+      leaf1 = ip4_fib_mtrie_lookup_step_one (mtrie1, dst_addr1);
+      leaf2 = ip4_fib_mtrie_lookup_step_one (mtrie2, dst_addr2);
+      leaf3 = ip4_fib_mtrie_lookup_step_one (mtrie3, dst_addr3);
+
+      leaf0 = ip4_fib_mtrie_lookup_step (mtrie0, leaf0, dst_addr0, 2);
+      leaf1 = ip4_fib_mtrie_lookup_step (mtrie1, leaf1, dst_addr1, 2);
+      leaf2 = ip4_fib_mtrie_lookup_step (mtrie2, leaf2, dst_addr2, 2);
+      leaf3 = ip4_fib_mtrie_lookup_step (mtrie3, leaf3, dst_addr3, 2);
+
+      leaf0 = ip4_fib_mtrie_lookup_step (mtrie0, leaf0, dst_addr0, 3);
+      leaf1 = ip4_fib_mtrie_lookup_step (mtrie1, leaf1, dst_addr1, 3);
+      leaf2 = ip4_fib_mtrie_lookup_step (mtrie2, leaf2, dst_addr2, 3);
+      leaf3 = ip4_fib_mtrie_lookup_step (mtrie3, leaf3, dst_addr3, 3);
+
+      lb_index0 = ip4_fib_mtrie_leaf_get_adj_index (leaf0);
+      lb_index1 = ip4_fib_mtrie_leaf_get_adj_index (leaf1);
+      lb_index2 = ip4_fib_mtrie_leaf_get_adj_index (leaf2);
+      lb_index3 = ip4_fib_mtrie_leaf_get_adj_index (leaf3);
+
+      ASSERT (lb_index0 && lb_index1 && lb_index2 && lb_index3);
+      lb0 = load_balance_get (lb_index0);
+      lb1 = load_balance_get (lb_index1);
+      lb2 = load_balance_get (lb_index2);
+      lb3 = load_balance_get (lb_index3);
+
+      ASSERT (lb0->lb_n_buckets > 0);
+      ASSERT (is_pow2 (lb0->lb_n_buckets));
+      ASSERT (lb1->lb_n_buckets > 0);
+      ASSERT (is_pow2 (lb1->lb_n_buckets));
+      ASSERT (lb2->lb_n_buckets > 0);
+      ASSERT (is_pow2 (lb2->lb_n_buckets));
+      ASSERT (lb3->lb_n_buckets > 0);
+      ASSERT (is_pow2 (lb3->lb_n_buckets));
+
+      matches += fwabf_input_ip4_finish (vm, node, b[0], lb0, &ctx,
+                                         &next[0]);
+      matches += fwabf_input_ip4_finish (vm, node, b[1], lb1, &ctx,
+                                         &next[1]);
+      matches += fwabf_input_ip4_finish (vm, node, b[2], lb2, &ctx,
+                                         &next[2]);
+      matches += fwabf_input_ip4_finish (vm, node, b[3], lb3, &ctx,
+                                         &next[3]);
+
+      b += 4;
+      next += 4;
+      n_left -= 4;
+    }
+#elif (CLIB_N_PREFETCHES >= 4)
+  while (n_left >= 2)
+    {
+      ip4_header_t *ip0, *ip1;
+      const load_balance_t *lb0, *lb1;
+      ip4_fib_mtrie_t *mtrie0, *mtrie1;
+      ip4_fib_mtrie_leaf_t leaf0, leaf1;
+      ip4_address_t *dst_addr0, *dst_addr1;
+      u32 lb_index0, lb_index1;
+
+      /* Prefetch next iteration. */
+      if (n_left >= 4)
         {
-          const u32*            attachments0;
-          const fwabf_itf_attach_t* fia0 = 0;
-          ip_lookup_next_t      next0 = IP_LOOKUP_NEXT_DROP;
-          vlib_buffer_t*        b0;
-          fa_5tuple_opaque_t    fa_5tuple0;
-          const dpo_id_t*       dpo0;
-          dpo_id_t              dpo0_policy;
-          u32 bi0;
-          u32 sw_if_index0;
-          u32 lc_index;
-          u32 match_acl_index   = ~0;
-          u32 match_acl_pos     = ~0;
-          u32 match_rule_index  = ~0;
-          u32 trace_bitmap      = 0;
-          u32 match0            = 0;
-          u8 action;
-          ip4_header_t*         ip40 = NULL;
-          u32                   hash_c0;
-          u32                   lbi0;
-          const load_balance_t* lb0;
-          flow_hash_config_t    flow_hash_config0;
-          ip4_main_t*           im = &ip4_main;
-          ip4_fib_mtrie_t*      mtrie0;
-          ip4_fib_mtrie_leaf_t  leaf0;
-
-          bi0 = from[0];
-          to_next[0] = bi0;
-          from += 1;
-          to_next += 1;
-          n_left_from -= 1;
-          n_left_to_next -= 1;
-
-          b0 = vlib_get_buffer (vm, bi0);
-          ip40 = vlib_buffer_get_current (b0);
-
-          /*
-           * The fwabf_input_inline node replaces the ip4_lookup_inline node.
-           * This is done to avoid FIB lookup twice in case, when packet does
-           * not match policy classification (ACL lookup failure).
-           * Therefore we have to reuse the ip4_lookup_inline code.
-           * The last is consist of two parts - lookup in FIB and fetching
-           * adjacency DPO out of found load balancing DPO.
-           * Note the FIB lookup always brings the load balancing DPO, even
-           * if it points to single adjacency DPO only.
-           * Below the first part comes - FIB lookup.
-           * It is used in both cases - either packet matches policy or not.
-           */
-          ip_lookup_set_buffer_fib_index (im->fib_index_by_sw_if_index, b0);
-          mtrie0 = &ip4_fib_get (vnet_buffer (b0)->ip.fib_index)->mtrie;
-          leaf0 = ip4_fib_mtrie_lookup_step_one (mtrie0, &ip40->dst_address);
-          leaf0 = ip4_fib_mtrie_lookup_step (mtrie0, leaf0, &ip40->dst_address, 2);
-          leaf0 = ip4_fib_mtrie_lookup_step (mtrie0, leaf0, &ip40->dst_address, 3);
-
-          lbi0  = ip4_fib_mtrie_leaf_get_adj_index (leaf0);
-          ASSERT (lbi0);
-          lb0 = load_balance_get(lbi0);
-          ASSERT (lb0->lb_n_buckets > 0);
-          ASSERT (is_pow2 (lb0->lb_n_buckets));
-
-          /*
-           * If FIB lookup brings not labeled DPO-s, the policy can't be applied,
-           * as it uses labels to choose DPO-s for forwarding.
-           * In this case there is no need to bother with ACL & Policy,
-           * go directly to deafult routing - use FIB lookup result.
-           * ASSUMPTION: if user wants policy, it labels all available tunnels,
-           *             so FIB lookup can't bring mix of labeled and not labeled
-           *             tunnels!
-           *
-           * The exception for this algorithm is DPO of default route.
-           * Even if it is not labeled, user might want to enforce the default
-           * route packets to go into policy tunnels on ACL & Policy match.
-           * This is needed for use case of Branch-to-HeadQuaters topology,
-           * where all traffic on the Branch VPP should go to the Head Quaters VPP,
-           * and there it should go to internet or to other tunnel.
-           */
-          match0 = 0;
-          if (fwabf_links_is_dpo_labeled_or_default_route (lb0, DPO_PROTO_IP4))
-            {
-              /*
-                * Perform ACL lookup and if found - apply policy.
-                */
-              sw_if_index0 = vnet_buffer (b0)->sw_if_index[VLIB_RX];
-
-              ASSERT (vec_len (fwabf_attach_per_itf[FIB_PROTOCOL_IP4]) > sw_if_index0);
-              attachments0 = fwabf_attach_per_itf[FIB_PROTOCOL_IP4][sw_if_index0];
-
-              ASSERT (vec_len (fwabf_acl_lc_per_itf[FIB_PROTOCOL_IP4]) > sw_if_index0);
-              lc_index = fwabf_acl_lc_per_itf[FIB_PROTOCOL_IP4][sw_if_index0];
-
-              /*
-                A non-inline version looks like this:
-
-                acl_plugin.fill_5tuple (lc_index, b0, (FIB_PROTOCOL_IP6 == fproto),
-                1, 0, &fa_5tuple0);
-                if (acl_plugin.match_5tuple
-                (lc_index, &fa_5tuple0, (FIB_PROTOCOL_IP6 == fproto), &action,
-                &match_acl_pos, &match_acl_index, &match_rule_index,
-                &trace_bitmap))
-                . . .
-              */
-              acl_plugin_fill_5tuple_inline (acl_plugin.p_acl_main, lc_index, b0,
-                    0, 1, 0, &fa_5tuple0);
-
-              if (acl_plugin_match_5tuple_inline
-                  (acl_plugin.p_acl_main, lc_index, &fa_5tuple0,
-                  0, &action, &match_acl_pos,
-                  &match_acl_index, &match_rule_index, &trace_bitmap))
-                {
-                  /*
-                  * match:
-                  *  follow the DPO chain if available. Otherwise fallback to feature arc.
-                  */
-                  acl_main_t *am = acl_plugin.p_acl_main;
-                  fwabf_quality_service_class_t sc = am->acls[match_acl_index].rules[match_rule_index].service_class;
-                  if (sc <= FWABF_QUALITY_SC_MIN || sc >= FWABF_QUALITY_SC_MAX) {
-                    clib_warning("wrong value for service class %d must be in range from %d to %d",
-                                sc, FWABF_QUALITY_SC_MIN, FWABF_QUALITY_SC_MAX);
-                    sc = FWABF_QUALITY_SC_STANDARD;
-                  }
-                  fia0 = fwabf_itf_attach_get (attachments0[match_acl_pos]);
-                  match0 = fwabf_policy_get_dpo_ip4 (fia0->fia_policy, b0, lb0, sc, &dpo0_policy);
-                  if (PREDICT_TRUE(match0))
-                    {
-                      next0 = dpo0_policy.dpoi_next_node;
-                      vnet_buffer (b0)->ip.adj_index[VLIB_TX] = dpo0_policy.dpoi_index;
-                    }
-
-		  /* Mark the packet with classification result */
-		  vnet_buffer2 (b0)->qos.service_class = sc;
-		  vnet_buffer2 (b0)->qos.importance =
-		    am->acls[match_acl_index].rules[match_rule_index].importance;
-		  vnet_buffer2 (b0)->qos.source = QOS_SOURCE_IP;
-		  b0->flags |= VNET_BUFFER_F_IS_CLASSIFIED;
-
-                  matches++;
-                }
-            } /*if (fwabf_links_is_dpo_labeled_or_default_route (lb0)*/
-
-          /*
-           * If policy was not applied, finish the ip4_lookup_inline logic -
-           * part two of ip4_lookup_inline code - use DPO found by FIB lookup.
-           */
-          if (match0==0)
-            {
-              hash_c0 = vnet_buffer (b0)->ip.flow_hash = 0;
-              if (PREDICT_FALSE (lb0->lb_n_buckets > 1))
-                {
-                  /* Use flow hash to compute multipath adjacency. */
-                  flow_hash_config0 = lb0->lb_hash_config;
-                  hash_c0 = vnet_buffer (b0)->ip.flow_hash =
-                            ip4_compute_flow_hash (ip40, flow_hash_config0);
-                  dpo0 = load_balance_get_fwd_bucket (lb0,
-                                  (hash_c0 & (lb0->lb_n_buckets_minus_1)));
-                }
-              else
-                {
-                  dpo0 = load_balance_get_bucket_i (lb0, 0);
-                }
-
-              next0 = dpo0->dpoi_next_node;
-              vnet_buffer (b0)->ip.adj_index[VLIB_TX] = dpo0->dpoi_index;
-            }
-
-
-          if (PREDICT_FALSE (b0->flags & VLIB_BUFFER_IS_TRACED))
-            {
-              fwabf_input_trace_t *tr;
-
-              tr = vlib_add_trace (vm, node, b0, sizeof (*tr));
-              tr->next   = next0;
-              tr->adj    = vnet_buffer (b0)->ip.adj_index[VLIB_TX];
-              tr->match  = match0;
-              tr->policy = fia0 ? fia0->fia_policy : -1;
-            }
-
-          /* verify speculative enqueue, maybe switch current next frame */
-          vlib_validate_buffer_enqueue_x1 (vm, node, next_index,
-                  to_next, n_left_to_next, bi0, next0);
+          vlib_prefetch_buffer_header (b[2], LOAD);
+          vlib_prefetch_buffer_header (b[3], LOAD);
+
+          CLIB_PREFETCH (b[2]->data, sizeof (ip0[0]), LOAD);
+          CLIB_PREFETCH (b[3]->data, sizeof (ip0[0]), LOAD);
         }
 
-      vlib_put_next_frame (vm, node, next_index, n_left_to_next);
+      ip0 = vlib_buffer_get_current (b[0]);
+      ip1 = vlib_buffer_get_current (b[1]);
+
+      dst_addr0 = &ip0->dst_address;
+      dst_addr1 = &ip1->dst_address;
+
+      ip_lookup_set_buffer_fib_index (im->fib_index_by_sw_if_index, b[0]);
+      ip_lookup_set_buffer_fib_index (im->fib_index_by_sw_if_index, b[1]);
+
+      mtrie0 = &ip4_fib_get (vnet_buffer (b[0])->ip.fib_index)->mtrie;
+      mtrie1 = &ip4_fib_get (vnet_buffer (b[1])->ip.fib_index)->mtrie;
+
+      leaf0 = ip4_fib_mtrie_lookup_step_one (mtrie0, dst_addr0);
+      leaf1 = ip4_fib_mtrie_lookup_step_one (mtrie1, dst_addr1);
+
+      leaf0 = ip4_fib_mtrie_lookup_step (mtrie0, leaf0, dst_addr0, 2);
+      leaf1 = ip4_fib_mtrie_lookup_step (mtrie1, leaf1, dst_addr1, 2);
+
+      leaf0 = ip4_fib_mtrie_lookup_step (mtrie0, leaf0, dst_addr0, 3);
+      leaf1 = ip4_fib_mtrie_lookup_step (mtrie1, leaf1, dst_addr1, 3);
+
+      lb_index0 = ip4_fib_mtrie_leaf_get_adj_index (leaf0);
+      lb_index1 = ip4_fib_mtrie_leaf_get_adj_index (leaf1);
+
+      ASSERT (lb_index0 && lb_index1);
+      lb0 = load_balance_get (lb_index0);
+      lb1 = load_balance_get (lb_index1);
+
+      ASSERT (lb0->lb_n_buckets > 0);
+      ASSERT (is_pow2 (lb0->lb_n_buckets));
+      ASSERT (lb1->lb_n_buckets > 0);
+      ASSERT (is_pow2 (lb1->lb_n_buckets));
+
+      matches += fwabf_input_ip4_finish (vm, node, b[0], lb0, &ctx,
+                                         &next[0]);
+      matches += fwabf_input_ip4_finish (vm, node, b[1], lb1, &ctx,
+                                         &next[1]);
+
+      b += 2;
+      next += 2;
+      n_left -= 2;
     }
+#endif
+  while (n_left > 0)
+    {
+      ip4_header_t*         ip40;
+      const load_balance_t* lb0;
+      ip4_fib_mtrie_t*      mtrie0;
+      ip4_fib_mtrie_leaf_t  leaf0;
+      u32                   lbi0;
+
+      ip40 = vlib_buffer_get_current (b[0]);
+
+      ip_lookup_set_buffer_fib_index (im->fib_index_by_sw_if_index, b[0]);
+      mtrie0 = &ip4_fib_get (vnet_buffer (b[0])->ip.fib_index)->mtrie;
+      leaf0 = ip4_fib_mtrie_lookup_step_one (mtrie0, &ip40->dst_address);
+      leaf0 = ip4_fib_mtrie_lookup_step (mtrie0, leaf0, &ip40->dst_address, 2);
+      leaf0 = ip4_fib_mtrie_lookup_step (mtrie0, leaf0, &ip40->dst_address, 3);
+
+      lbi0  = ip4_fib_mtrie_leaf_get_adj_index (leaf0);
+      ASSERT (lbi0);
+      lb0 = load_balance_get(lbi0);
+      ASSERT (lb0->lb_n_buckets > 0);
+      ASSERT (is_pow2 (lb0->lb_n_buckets));
+
+      matches += fwabf_input_ip4_finish (vm, node, b[0], lb0, &ctx,
+                                         &next[0]);
+
+      b += 1;
+      next += 1;
+      n_left -= 1;
+    }
+
+  vlib_buffer_enqueue_to_next (vm, node, from, nexts, frame->n_vectors);
 
   vlib_node_increment_counter (vm, fwabf_ip4_node.index, FWABF_ERROR_MATCHED, matches);
+  if (ctx.n_shared)
+    vlib_node_increment_counter (vm, fwabf_ip4_node.index, FWABF_ERROR_SHARED,
+                                 ctx.n_shared);
 
   return frame->n_vectors;
 }
 
+/**
+ * Completes handling of IPv6 packet, once the FIB lookup was done for it.
+ * See fwabf_input_ip4_finish() for details.
+ *
+ * @return 1 if packet matched policy ACL, 0 otherwise.
+ */
+static_always_inline u32
+fwabf_input_ip6_finish (vlib_main_t * vm, vlib_node_runtime_t * node,
+                        vlib_buffer_t * b0, const load_balance_t * lb0,
+                        fwabf_input_frame_ctx_t * ctx, u16 * next)
+{
+  ip_lookup_next_t          next0 = IP_LOOKUP_NEXT_DROP;
+  const dpo_id_t*           dpo0;
+  dpo_id_t                  dpo0_policy = DPO_INVALID;
+  u32 policy0           = INDEX_INVALID;
+  u32 match0            = 0;
+  u32 acl_matched0      = 0;
+  ip6_header_t*             ip60 = vlib_buffer_get_current (b0);
+  u32                       hash_c0;
+  flow_hash_config_t        flow_hash_config0;
+  ip6_main_t*               im = &ip6_main;
+
+  /*
+   * If FIB lookup brings not labeled DPO-s, the policy can't be applied,
+   * as it uses labels to choose DPO-s for forwarding.
+   * In this case there is no need to bother with ACL & Policy,
+   * go directly to deafult routing - use FIB lookup result.
+   * ASSUMPTION: if user wants policy, it labels all available tunnels,
+   *             so FIB lookup can't bring mix of labeled and not labeled
+   *             tunnels!
+   *
+   * The exception for this algorithm is DPO of default route. We have
+   * to enable policy on such DPO in order to drop specific DIA packets
+   * without DIA label! That means even if DPO is not labeled.
+   * This is for user convenience, so he could set policy without
+   * binding labels to interfaces.
+   */
+  if (fwabf_links_is_dpo_labeled_or_default_route (lb0, DPO_PROTO_IP6))
+    {
+      /*
+        * Perform ACL lookup and if found - apply policy.
+        */
+      acl_matched0 = fwabf_input_classify (vm, node, b0, lb0, FIB_PROTOCOL_IP6,
+                                           ctx,
+                                           &dpo0_policy, &policy0, &match0);
+      if (PREDICT_TRUE(match0))
+        {
+          next0 = dpo0_policy.dpoi_next_node;
+          vnet_buffer (b0)->ip.adj_index[VLIB_TX] = dpo0_policy.dpoi_index;
+        }
+    } /*if (fwabf_links_is_dpo_labeled_or_default_route (lb0)*/
+
+  /*
+   * If policy was not applied, finish the ip6_lookup_inline logic -
+   * part two of ip6_lookup_inline code - use DPO found by FIB lookup.
+   */
+  if (match0 == 0)
+    {
+      hash_c0 = vnet_buffer (b0)->ip.flow_hash = 0;
+      if (PREDICT_FALSE (lb0->lb_n_buckets > 1))
+        {
+          /* Use flow hash to compute multipath adjacency. */
+          flow_hash_config0 = lb0->lb_hash_config;
+          hash_c0 = vnet_buffer (b0)->ip.flow_hash =
+                    ip6_compute_flow_hash (ip60, flow_hash_config0);
+          dpo0 = load_balance_get_fwd_bucket (lb0,
+                          (hash_c0 & (lb0->lb_n_buckets_minus_1)));
+        }
+      else
+        {
+          dpo0 = load_balance_get_bucket_i (lb0, 0);
+        }
+
+      next0 = dpo0->dpoi_next_node;
+      vnet_buffer (b0)->ip.adj_index[VLIB_TX] = dpo0->dpoi_index;
+
+      /* Only process the HBH Option Header if explicitly configured to do so */
+      if (PREDICT_FALSE(ip60->protocol == IP_PROTOCOL_IP6_HOP_BY_HOP_OPTIONS))
+        {
+          next0 = (dpo_is_adj (dpo0) && im->hbh_enabled) ?
+                  (ip_lookup_next_t) IP6_LOOKUP_NEXT_HOP_BY_HOP : next0;
+        }
+    }
+
+  if (PREDICT_FALSE (b0->flags & VLIB_BUFFER_IS_TRACED))
+    {
+      fwabf_input_trace_t *tr;
+
+      tr = vlib_add_trace (vm, node, b0, sizeof (*tr));
+      tr->next   = next0;
+      tr->adj    = vnet_buffer (b0)->ip.adj_index[VLIB_TX];
+      tr->match  = match0;
+      tr->policy = policy0;
+    }
+
+  *next = next0;
+  return acl_matched0;
+}
+
 static uword
 fwabf_input_ip6 (vlib_main_t * vm, vlib_node_runtime_t * node, vlib_frame_t * frame)
 {
-  u32 n_left_from, *from, *to_next, next_index, matches;
+  ip6_main_t*             im = &ip6_main;
+  u32                     n_left, *from, matches;
+  vlib_buffer_t*          bufs[VLIB_FRAME_SIZE];
+  vlib_buffer_t**         b = bufs;
+  u16                     nexts[VLIB_FRAME_SIZE], *next;
+  fwabf_input_frame_ctx_t ctx;
 
   from = vlib_frame_vector_args (frame);
-  n_left_from = frame->n_vectors;
-  next_index = node->cached_next_index;
+  n_left = frame->n_vectors;
+  next = nexts;
   matches = 0;
+  vlib_get_buffers (vm, from, bufs, n_left);
 
-  while (n_left_from > 0)
+  fwabf_input_frame_ctx_init (vm, &ctx);
+
+  /*
+   * The fwabf_input_ip6 node replaces the ip6_lookup_inline node.
+   * See fwabf_input_ip4() for details. The IPv6 FIB lookup is hash based,
+   * so there are no lookup steps to interleave, but buffers and headers
+   * are still prefetched ahead.
+   */
+#if (CLIB_N_PREFETCHES >= 8)
+  while (n_left >= 4)
     {
-      u32 n_left_to_next;
+      ip6_header_t *ip0, *ip1, *ip2, *ip3;
+      const load_balance_t *lb0, *lb1, *lb2, *lb3;
+      u32 lb_index0, lb_index1, lb_index2, lb_index3;
+
+      /* Prefetch next iteration. */
+      if (n_left >= 8)
+        {
+          vlib_prefetch_buffer_header (b[4], LOAD);
+          vlib_prefetch_buffer_header (b[5], LOAD);
+          vlib_prefetch_buffer_header (b[6], LOAD);
+          vlib_prefetch_buffer_header (b[7], LOAD);
+
+          CLIB_PREFETCH (b[4]->data, sizeof (ip0[0]), LOAD);
+          CLIB_PREFETCH (b[5]->data, sizeof (ip0[0]), LOAD);
+          CLIB_PREFETCH (b[6]->data, sizeof (ip0[0]), LOAD);
+          CLIB_PREFETCH (b[7]->data, sizeof (ip0[0]), LOAD);
+        }
 
-      vlib_get_next_frame (vm, node, next_index, to_next, n_left_to_next);
+      ip0 = vlib_buffer_get_current (b[0]);
+      ip1 = vlib_buffer_get_current (b[1]);
+      ip2 = vlib_buffer_get_current (b[2]);
+      ip3 = vlib_buffer_get_current (b[3]);
+
+      ip_lookup_set_buffer_fib_index (im->fib_index_by_sw_if_index, b[0]);
+      ip_lookup_set_buffer_fib_index (im->fib_index_by_sw_if_index, b[1]);
+      ip_lookup_set_buffer_fib_index (im->fib_index_by_sw_if_index, b[2]);
+      ip_lookup_set_buffer_fib_index (im->fib_index_by_sw_if_index, b[3]);
+
+      lb_index0 = ip6_fib_table_fwding_lookup (vnet_buffer (b[0])->ip.fib_index,
+                                               &ip0->dst_address);
+      lb_index1 = ip6_fib_table_fwding_lookup (vnet_buffer (b[1])->ip.fib_index,
+                                               &ip1->dst_address);
+      lb_index2 = ip6_fib_table_fwding_lookup (vnet_buffer (b[2])->ip.fib_index,
+                                               &ip2->dst_address);
+      lb_index3 = ip6_fib_table_fwding_lookup (vnet_buffer (b[3])->ip.fib_index,
+                                               &ip3->dst_address);
+
+      ASSERT (lb_index0 && lb_index1 && lb_index2 && lb_index3);
+      lb0 = load_balance_get (lb_index0);
+      lb1 = load_balance_get (lb_index1);
+      lb2 = load_balance_get (lb_index2);
+      lb3 = load_balance_get (lb_index3);
+
+      ASSERT (lb0->lb_n_buckets > 0);
+      ASSERT (is_pow2 (lb0->lb_n_buckets));
+      ASSERT (lb1->lb_n_buckets > 0);
+      ASSERT (is_pow2 (lb1->lb_n_buckets));
+      ASSERT (lb2->lb_n_buckets > 0);
+      ASSERT (is_pow2 (lb2->lb_n_buckets));
+      ASSERT (lb3->lb_n_buckets > 0);
+      ASSERT (is_pow2 (lb3->lb_n_buckets));
+
+      matches += fwabf_input_ip6_finish (vm, node, b[0], lb0, &ctx,
+                                         &next[0]);
+      matches += fwabf_input_ip6_finish (vm, node, b[1], lb1, &ctx,
+                                         &next[1]);
+      matches += fwabf_input_ip6_finish (vm, node, b[2], lb2, &ctx,
+                                         &next[2]);
+      matches += fwabf_input_ip6_finish (vm, node, b[3], lb3, &ctx,
+                                         &next[3]);
+
+      b += 4;
+      next += 4;
+      n_left -= 4;
+    }
+#elif (CLIB_N_PREFETCHES >= 4)
+  while (n_left >= 2)
+    {
+      ip6_header_t *ip0, *ip1;
+      const load_balance_t *lb0, *lb1;
+      u32 lb_index0, lb_index1;
 
-      while (n_left_from > 0 && n_left_to_next > 0)
+      /* Prefetch next iteration. */
+      if (n_left >= 4)
         {
-          const u32*            attachments0;
-          const fwabf_itf_attach_t* fia0 = 0;
-          ip_lookup_next_t      next0 = IP_LOOKUP_NEXT_DROP;
-          vlib_buffer_t*        b0;
-          fa_5tuple_opaque_t    fa_5tuple0;
-          const dpo_id_t*       dpo0;
-          dpo_id_t              dpo0_policy;
-          u32 bi0;
-          u32 sw_if_index0;
-          u32 lc_index;
-          u32 match_acl_index   = ~0;
-          u32 match_acl_pos     = ~0;
-          u32 match_rule_index  = ~0;
-          u32 trace_bitmap      = 0;
-          u32 match0            = 0;
-          u8 action;
-          ip6_header_t*         ip60;
-          u32                   hash_c0;
-          u32                   lbi0;
-          const load_balance_t* lb0;
-          flow_hash_config_t    flow_hash_config0;
-          ip6_main_t* im        = &ip6_main;
-
-          bi0 = from[0];
-          to_next[0] = bi0;
-          from += 1;
-          to_next += 1;
-          n_left_from -= 1;
-          n_left_to_next -= 1;
-
-          b0 = vlib_get_buffer (vm, bi0);
-
-          /*
-           * The fwabf_input_inline node replaces the ip6_lookup_inline node.
-           * This is done to avoid FIB lookup twice in case, when packet does
-           * not match policy classification (ACL lookup failure).
-           * Therefore we have to resuse the ip6_lookup_inline code.
-           * The last is consist of two parts - lookup in FIB and fetching
-           * adjacency DPO out of found load balancing DPO.
-           * Note the FIB lookup always brings the load balancing DPO, even
-           * if it points to single adjacency DPO only.
-           * Below the first part comes - FIB lookup.
-           * It is used in both cases - either packet matches policy or not.
-           */
-          ip_lookup_set_buffer_fib_index (im->fib_index_by_sw_if_index, b0);
-          ip60 = vlib_buffer_get_current (b0);
-          lbi0 = ip6_fib_table_fwding_lookup (
-                    vnet_buffer (b0)->ip.fib_index, &ip60->dst_address);
-          ASSERT (lbi0);
-          lb0 = load_balance_get(lbi0);
-          ASSERT (lb0->lb_n_buckets > 0);
-          ASSERT (is_pow2 (lb0->lb_n_buckets));
-
-          /*
-           * If FIB lookup brings not labeled DPO-s, the policy can't be applied,
-           * as it uses labels to choose DPO-s for forwarding.
-           * In this case there is no need to bother with ACL & Policy,
-           * go directly to deafult routing - use FIB lookup result.
-           * ASSUMPTION: if user wants policy, it labels all available tunnels,
-           *             so FIB lookup can't bring mix of labeled and not labeled
-           *             tunnels!
-           *
-           * The exception for this algorithm is DPO of default route. We have
-           * to enable policy on such DPO in order to drop specific DIA packets
-           * without DIA label! That means even if DPO is not labeled.
-           * This is for user convenience, so he could set policy without
-           * binding labels to interfaces.
-           */
-          match0 = 0;
-          if (fwabf_links_is_dpo_labeled_or_default_route (lb0, DPO_PROTO_IP6))
-            {
-              /*
-                * Perform ACL lookup and if found - apply policy.
-                */
-              sw_if_index0 = vnet_buffer (b0)->sw_if_index[VLIB_RX];
-
-              ASSERT (vec_len (fwabf_attach_per_itf[FIB_PROTOCOL_IP6]) > sw_if_index0);
-              attachments0 = fwabf_attach_per_itf[FIB_PROTOCOL_IP6][sw_if_index0];
-
-              ASSERT (vec_len (fwabf_acl_lc_per_itf[FIB_PROTOCOL_IP6]) > sw_if_index0);
-              lc_index = fwabf_acl_lc_per_itf[FIB_PROTOCOL_IP6][sw_if_index0];
-
-              acl_plugin_fill_5tuple_inline (acl_plugin.p_acl_main, lc_index, b0,
-                    1, 1, 0, &fa_5tuple0);
-
-              if (acl_plugin_match_5tuple_inline
-                  (acl_plugin.p_acl_main, lc_index, &fa_5tuple0,
-                  1, &action, &match_acl_pos,
-                  &match_acl_index, &match_rule_index, &trace_bitmap))
-                {
-                  /*
-                  * match:
-                  *  follow the DPO chain if available. Otherwise fallback to feature arc.
-                  */
-                  acl_main_t *am = acl_plugin.p_acl_main;
-                  fwabf_quality_service_class_t sc = am->acls[match_acl_index].rules[match_rule_index].service_class;
-                  if (sc <= FWABF_QUALITY_SC_MIN || sc >= FWABF_QUALITY_SC_MAX) {
-                    clib_warning("wrong value for service class %d must be in range from %d to %d",
-                                sc, FWABF_QUALITY_SC_MIN, FWABF_QUALITY_SC_MAX);
-                    sc = FWABF_QUALITY_SC_STANDARD;
-                  }
-                  fia0 = fwabf_itf_attach_get (attachments0[match_acl_pos]);
-                  match0 = fwabf_policy_get_dpo_ip6 (fia0->fia_policy, b0, lb0, sc, &dpo0_policy);
-                  if (PREDICT_TRUE(match0))
-                    {
-                      next0 = dpo0_policy.dpoi_next_node;
-                      vnet_buffer (b0)->ip.adj_index[VLIB_TX] = dpo0_policy.dpoi_index;
-                    }
-
-		  /* Mark the packet with classification result */
-		  vnet_buffer2 (b0)->qos.service_class = sc;
-		  vnet_buffer2 (b0)->qos.importance =
-		    am->acls[match_acl_index].rules[match_rule_index].importance;
-		  vnet_buffer2 (b0)->qos.source = QOS_SOURCE_IP;
-		  b0->flags |= VNET_BUFFER_F_IS_CLASSIFIED;
-
-                  matches++;
-                }
-            } /*if (fwabf_links_is_dpo_labeled_or_default_route (lb0)*/
-
-          /*
-           * If policy was not applied, finish the ip4_lookup_inline logic -
-           * part two of ip4_lookup_inline code - use DPO found by FIB lookup.
-           */
-          if (match0 == 0)
-            {
-              hash_c0 = vnet_buffer (b0)->ip.flow_hash = 0;
-              if (PREDICT_FALSE (lb0->lb_n_buckets > 1))
-                {
-                  /* Use flow hash to compute multipath adjacency. */
-                  flow_hash_config0 = lb0->lb_hash_config;
-                  hash_c0 = vnet_buffer (b0)->ip.flow_hash =
-                            ip6_compute_flow_hash (ip60, flow_hash_config0);
-                  dpo0 = load_balance_get_fwd_bucket (lb0,
-                                  (hash_c0 & (lb0->lb_n_buckets_minus_1)));
-                }
-              else
-                {
-                  dpo0 = load_balance_get_bucket_i (lb0, 0);
-                }
-
-              next0 = dpo0->dpoi_next_node;
-              vnet_buffer (b0)->ip.adj_index[VLIB_TX] = dpo0->dpoi_index;
-
-              /* Only process the HBH Option Header if explicitly configured to do so */
-              if (PREDICT_FALSE(ip60->protocol == IP_PROTOCOL_IP6_HOP_BY_HOP_OPTIONS))
-                {
-                  next0 = (dpo_is_adj (dpo0) && im->hbh_enabled) ?
-                          (ip_lookup_next_t) IP6_LOOKUP_NEXT_HOP_BY_HOP : next0;
-                }
-            }
-
-          if (PREDICT_FALSE (b0->flags & VLIB_BUFFER_IS_TRACED))
-            {
-              fwabf_input_trace_t *tr;
-
-              tr = vlib_add_trace (vm, node, b0, sizeof (*tr));
-              tr->next   = next0;
-              tr->adj    = vnet_buffer (b0)->ip.adj_index[VLIB_TX];
-              tr->match  = match0;
-              tr->policy = fia0 ? fia0->fia_policy : -1;
-            }
-
-          /* verify speculative enqueue, maybe switch current next frame */
-          vlib_validate_buffer_enqueue_x1 (vm, node, next_index,
-                  to_next, n_left_to_next, bi0, next0);
+          vlib_prefetch_buffer_header (b[2], LOAD);
+          vlib_prefetch_buffer_header (b[3], LOAD);
+
+          CLIB_PREFETCH (b[2]->data, sizeof (ip0[0]), LOAD);
+          CLIB_PREFETCH (b[3]->data, sizeof (ip0[0]), LOAD);
         }
 
-      vlib_put_next_frame (vm, node, next_index, n_left_to_next);
+      ip0 = vlib_buffer_get_current (b[0]);
+      ip1 = vlib_buffer_get_current (b[1]);
+
+      ip_lookup_set_buffer_fib_index (im->fib_index_by_sw_if_index, b[0]);
+      ip_lookup_set_buffer_fib_index (im->fib_index_by_sw_if_index, b[1]);
+
+      lb_index0 = ip6_fib_table_fwding_lookup (vnet_buffer (b[0])->ip.fib_index,
+                                               &ip0->dst_address);
+      lb_index1 = ip6_fib_table_fwding_lookup (vnet_buffer (b[1])->ip.fib_index,
+                                               &ip1->dst_address);
+
+      ASSERT (lb_index0 && lb_index1);
+      lb0 = load_balance_get (lb_index0);
+      lb1 = load_balance_get (lb_index1);
+
+      ASSERT (lb0->lb_n_buckets > 0);
+      ASSERT (is_pow2 (lb0->lb_n_buckets));
+      ASSERT (lb1->lb_n_buckets > 0);
+      ASSERT (is_pow2 (lb1->lb_n_buckets));
+
+      matches += fwabf_input_ip6_finish (vm, node, b[0], lb0, &ctx,
+                                         &next[0]);
+      matches += fwabf_input_ip6_finish (vm, node, b[1], lb1, &ctx,
+                                         &next[1]);
+
+      b += 2;
+      next += 2;
+      n_left -= 2;
     }
+#endif
+  while (n_left > 0)
+    {
+      ip6_header_t*         ip60;
+      const load_balance_t* lb0;
+      u32                   lbi0;
+
+      ip_lookup_set_buffer_fib_index (im->fib_index_by_sw_if_index, b[0]);
+      ip60 = vlib_buffer_get_current (b[0]);
+      lbi0 = ip6_fib_table_fwding_lookup (
+                vnet_buffer (b[0])->ip.fib_index, &ip60->dst_address);
+      ASSERT (lbi0);
+      lb0 = load_balance_get(lbi0);
+      ASSERT (lb0->lb_n_buckets > 0);
+      ASSERT (is_pow2 (lb0->lb_n_buckets));
+
+      matches += fwabf_input_ip6_finish (vm, node, b[0], lb0, &ctx,
+                                         &next[0]);
+
+      b += 1;
+      next += 1;
+      n_left -= 1;
+    }
+
+  vlib_buffer_enqueue_to_next (vm, node, from, nexts, frame->n_vectors);
 
   vlib_node_increment_counter (vm, fwabf_ip6_node.index, FWABF_ERROR_MATCHED, matches);
+  if (ctx.n_shared)
+    vlib_node_increment_counter (vm, fwabf_ip6_node.index, FWABF_ERROR_SHARED,
+                                 ctx.n_shared);
 
   return frame->n_vectors;
 }
@@ -904,7 +1308,8 @@ VLIB_REGISTER_NODE (fwabf_ip6_node) =
   .vector_size = sizeof (u32),
   .format_trace = format_fwabf_input_trace,
   .type = VLIB_NODE_TYPE_INTERNAL,
-  .n_errors = 0,
+  .n_errors = FWABF_N_ERROR,
+  .error_strings = fwabf_error_strings,
   .n_next_nodes = IP6_LOOKUP_N_NEXT,
   .next_nodes = IP6_LOOKUP_NEXT_NODES,
 };
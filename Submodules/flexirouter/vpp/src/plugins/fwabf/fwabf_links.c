@@ -19,6 +19,9 @@
  */
 
 #include <plugins/fwabf/fwabf_links.h>
+#include <plugins/fwabf/fwabf_adj_map.h>
+#include <plugins/fwabf/fwabf_flow_cache.h>
+#include <plugins/fwabf/fwabf_probe.h>
 
 #include <vnet/dpo/drop_dpo.h>
 #include <vnet/dpo/load_balance_map.h>
@@ -84,8 +87,36 @@ typedef struct fwabf_link_t
    */
   fwabf_quality_t quality;
 
+  /*
+   * The quality level escalation step, on which the link satisfies
+   * requirements of service class. Indexed by service class.
+   * 0 means the link satisfies requirements as is,
+   * FWABF_QUALITY_STEP_NONE means it does not satisfy them even on the last step.
+   * It is calculated by control plane on quality update,
+   * see fwabf_link_update_quality_steps().
+   */
+  u8 quality_step[FWABF_QUALITY_SC_MAX];
+
+  /*
+   * The weight and the capacity of link used by the weighted link selection,
+   * see fwabf_weighted_candidates_t. The capacity is in Mbps, 0 means unknown.
+   * They are set by the 'fwabf weight' CLI.
+   */
+  u32 weight;
+  u32 bandwidth;
+
+  /*
+   * The transmit rate of link interface in bits per second.
+   * It is EWMA of rate sampled out of interface TX counter by the
+   * fwabf-links-weight-process, 'tx_bytes' keeps the last sample.
+   */
+  f64 tx_rate;
+  u64 tx_bytes;
+
 } fwabf_link_t;
 
+#define FWABF_QUALITY_STEP_NONE 0xFF
+
 
 /**
  * An auxiliary structure that unites various data related to label,
@@ -94,14 +125,93 @@ typedef struct fwabf_link_t
 typedef struct fwabf_label_data_t_
 {
   u32* interfaces;  /* indexes of vnet_sw_interface_t interfaces served by this object.*/
-  u32  counter_hits;
-  u32  counter_misses;
-  u32  counter_enforced_hits;
-  u32  counter_enforced_misses;
-  u32  counter_quality_hits;
-  u32  counter_quality_reduced_hits;
+
+  /*
+   * Per thread counters, see fwabf_label_counter_t.
+   * They are exported into stats segment as /fwabf/label/<label>.
+   * The counters are validated on first use of label by link or by policy,
+   * see fwabf_links_label_counters_validate().
+   */
+  vlib_simple_counter_main_t counters;
 } fwabf_label_data_t;
 
+typedef enum fwabf_label_counter_t_
+{
+  FWABF_LABEL_COUNTER_HITS,
+  FWABF_LABEL_COUNTER_MISSES,
+  FWABF_LABEL_COUNTER_ENFORCED_HITS,
+  FWABF_LABEL_COUNTER_ENFORCED_MISSES,
+  FWABF_LABEL_COUNTER_QUALITY_HITS,
+  FWABF_LABEL_COUNTER_QUALITY_REDUCED_HITS,
+  FWABF_LABEL_N_COUNTERS
+} fwabf_label_counter_t;
+
+#define FWABF_LABEL_COUNT(_fwlabel, _counter) \
+    vlib_increment_simple_counter (&fwabf_labels[(_fwlabel)].counters, \
+                      vlib_get_thread_index (), FWABF_LABEL_COUNTER_##_counter, 1)
+
+/**
+ * Candidates for quality based selection of link out of set of labels
+ * (the link group of policy). The candidates are precomputed by control plane
+ * on every change in link quality or reachability, so the datapath just picks
+ * one of them by flow hash with no allocations. See fwabf_links_get_quality_dpo().
+ */
+typedef struct fwabf_quality_candidates_t_
+{
+  fwabf_label_t* labels;      /* the set of labels in order of policy link group */
+  u64            label_mask[(FWABF_INVALID_LABEL + 63) / 64]; /* the same set as bitmask */
+
+  /*
+   * Links that best satisfy the service class, indexed by service class.
+   * They are used if FIB lookup brought the default route, so policy labels
+   * are enforced with no regard to FIB lookup result.
+   */
+  u32*           links[FWABF_QUALITY_SC_MAX];
+} fwabf_quality_candidates_t;
+
+/**
+ * Candidates for weighted selection of link out of set of labels
+ * (the link group of policy). The links are spread over table of buckets
+ * in proportion to their effective weights, the same way as load_balance
+ * spreads paths, so the datapath just picks bucket by flow hash.
+ * The effective weight is the configured weight of link multiplied by the
+ * available bandwidth of link - the capacity minus the current transmit rate,
+ * if the capacity is known for all reachable links of the group. Otherwise
+ * it is just the configured weight.
+ * The table is rebuilt by control plane on changes in link reachability and
+ * periodically on changes in link utilization. Rebuild moves minimal number
+ * of buckets, so most of flows stay on their links.
+ */
+typedef struct fwabf_weighted_candidates_t_
+{
+  fwabf_label_t* labels;      /* the set of labels in order of policy link group */
+  u64            label_mask[(FWABF_INVALID_LABEL + 63) / 64]; /* the same set as bitmask */
+  u32*           buckets;     /* sw_if_index-s of links, power of 2 length */
+} fwabf_weighted_candidates_t;
+
+#define FWABF_WEIGHTED_MIN_BUCKETS        64
+#define FWABF_WEIGHTED_MIN_HEADROOM       0.05  /*fraction of capacity considered available on saturated link*/
+#define FWABF_WEIGHTED_SAMPLE_INTERVAL    1.0   /*seconds*/
+#define FWABF_WEIGHTED_RATE_EWMA_ALPHA    0.5
+#define FWABF_LINK_DEFAULT_WEIGHT         1
+#define FWABF_LINK_MAX_WEIGHT             1000
+#define FWABF_LINK_MAX_BANDWIDTH          1000000 /*Mbps*/
+
+#define FWABF_LABEL_MASK_IS_SET(_mask, _label) \
+                ((_mask)[(_label) >> 6] & (1ULL << ((_label) & 63)))
+
+/**
+ * Pool of fwabf_quality_candidates_t objects.
+ * Index of object is kept by policy link group.
+ */
+static fwabf_quality_candidates_t* fwabf_quality_candidates_pool = NULL;
+
+/**
+ * Pool of fwabf_weighted_candidates_t objects.
+ * Index of object is kept by policy link group.
+ */
+static fwabf_weighted_candidates_t* fwabf_weighted_candidates_pool = NULL;
+
 /**
  * FIB node type for the fwabf_sw_interface object.
  */
@@ -126,16 +236,13 @@ static fwabf_label_data_t* fwabf_labels = NULL;
  * As any fwabf_link_t object stands for one tunnel or WAN interface,
  * and tunnel / WAN interafce might have one label only, relation between
  * adjacencies and labels are 1:1.
- * As adjacencies are identified by interfaces and VLIB graph nodes that use
- * these adjacencies, like ip4-rewrite, we assume number of adjacency objects
- * can't overcome the 0xFFFF. Thus 0xFFFF is considered to be a practical limit
- * for size of {interfaces x vlib graph nodes} set.
- * The 0xFFFF limit makes it possible to use array for adjacancy->label mapping,
- * which is best option for dapatplane path.
+ * The number of adjacencies is not limited, as hub deployments might have
+ * thousands of tunnels and neighbors, so the flat array, that grows on demand,
+ * is used for adjacancy->label mapping. It keeps O(1) lookup of flat array,
+ * which is best option for dapatplane path. See fwabf_adj_map.h.
  */
-static u32* adj_indexes_to_labels           = NULL;  // Lables of all links, either UP or DOWN
-static u32* adj_indexes_to_reachable_links = NULL;   // DPO-s of Links that are UP
-#define FWABF_MAX_ADJ_INDEX  0xFFFF
+static fwabf_adj_map_t adj_indexes_to_labels;           // Lables of all links, either UP or DOWN
+static fwabf_adj_map_t adj_indexes_to_reachable_links;  // DPO-s of Links that are UP
 
 
 /*
@@ -163,7 +270,7 @@ typedef struct fwabf_default_route_ip46_t_
   u32               sibling_index;    /* FWABF as a child of entry */
   fib_node_t        fib_node;         /* Linkage into FIB graph needed to get FIB updates by walk */
   u32*              adj_index_list;   /* List of current adjacencies */
-  u32*              adj_index_map;    /* Map of adjacencies into booleans: 1 - adjacency stand for default route */
+  fwabf_adj_map_t   adj_index_map;    /* Map of adjacencies into booleans: 1 - adjacency stand for default route */
 } fwabf_default_route_ip46_t;
 
 typedef struct fwabf_default_route_t_
@@ -242,7 +349,11 @@ static fwabf_quality_service_tolerance_t service_class_quality[] = {
  * Forward declarations
  */
 static void fwabf_link_refresh_dpo(fwabf_link_t* link);
+static void fwabf_link_update_quality_steps(fwabf_link_t* link);
+static void fwabf_quality_candidates_refresh_all();
+static void fwabf_weighted_candidates_refresh_all();
 static fwabf_link_t* fwabf_links_find_link(u32 sw_if_index);
+static u64 fwabf_link_get_tx_bytes(u32 sw_if_index);
 static void fwabf_default_route_init();
 static void fwabf_default_route_refresh_dpo(fib_protocol_t proto);
 
@@ -263,6 +374,20 @@ static void fwabf_default_route_refresh_dpo(fib_protocol_t proto);
                                       (_dpo).dpoi_type == DPO_ADJACENCY_MIDCHAIN)
 
 
+void fwabf_links_label_counters_validate (fwabf_label_t fwlabel)
+{
+  vlib_simple_counter_main_t* cm;
+
+  ASSERT(fwlabel <= FWABF_MAX_LABEL);
+  cm = &fwabf_labels[fwlabel].counters;
+  if (PREDICT_TRUE(cm->counters != NULL))
+    return;   /* Validated already */
+
+  cm->name              = "fwabf-label";
+  cm->stat_segment_name = (char *) format (0, "/fwabf/label/%d%c", fwlabel, 0);
+  vlib_validate_simple_counter (cm, FWABF_LABEL_N_COUNTERS - 1);
+}
+
 u32 fwabf_links_add_interface (
                         const u32               sw_if_index,
                         const fwabf_label_t     fwlabel,
@@ -307,6 +432,7 @@ u32 fwabf_links_add_interface (
    * Labels are preallocated on bootup. No need to allocate now.
    * Just go and update label>->interface mapping.
    */
+  fwabf_links_label_counters_validate (fwlabel);
   vec_add1 (fwabf_labels[fwlabel].interfaces, sw_if_index);
 
   /*
@@ -316,6 +442,9 @@ u32 fwabf_links_add_interface (
 
   link->fwlabel     = fwlabel;
   link->sw_if_index = sw_if_index;
+  link->weight      = FWABF_LINK_DEFAULT_WEIGHT;
+  link->tx_bytes    = fwabf_link_get_tx_bytes(sw_if_index);
+  fwabf_link_update_quality_steps(link);
 
   /*
    * Create pathlist object and become it's child, so we get updates when
@@ -350,6 +479,9 @@ u32 fwabf_links_add_interface (
       fwabf_default_route_init();
     }
 
+  fwabf_quality_candidates_refresh_all();
+  fwabf_weighted_candidates_refresh_all();
+  fwabf_flow_cache_invalidate ();
   return 0;
 }
 
@@ -383,7 +515,7 @@ u32 fwabf_links_del_interface (const u32 sw_if_index)
    */
   if (PREDICT_TRUE(link->dpo.dpoi_index != INDEX_INVALID))
     {
-      adj_indexes_to_labels[link->dpo.dpoi_index] = FWABF_INVALID_LABEL;
+      fwabf_adj_map_set (&adj_indexes_to_labels, link->dpo.dpoi_index, FWABF_INVALID_LABEL);
     }
 
   /*
@@ -405,104 +537,615 @@ u32 fwabf_links_del_interface (const u32 sw_if_index)
   fib_path_list_child_remove(old_pl, link->pathlist_sibling);
   link->pathlist_sibling = ~0;
 
+  fwabf_probe_link_del (sw_if_index);
+
+  fwabf_quality_candidates_refresh_all();
+  fwabf_weighted_candidates_refresh_all();
+  fwabf_flow_cache_invalidate ();
   return 0;
 }
 
+#define FWABF_GET_INDEX_BY_FLOWHASH(_flowhash, _vec_len_pow2_mask, _vec_len_minus_1, _res) \
+      (((_res = (_flowhash & (_vec_len_pow2_mask))) <= (_vec_len_minus_1)) ? _res : (_res & (_vec_len_minus_1)))
+
+/**
+ * Calculates the quality level escalation step, on which the link satisfies
+ * requirements of every service class. The escalation is the same as used
+ * for link selection: if no link satisfies requirements of the service class,
+ * both the loss and the delay requirements are reduced to the next level and
+ * links are checked again, until the last level is reached.
+ */
+static void fwabf_link_update_quality_steps(fwabf_link_t* link)
+{
+  fwabf_quality_level_t loss_level, delay_level;
+  u32                   sc;
+  u8                    step;
+
+  for (sc = 0; sc < FWABF_QUALITY_SC_MAX; sc++)
+    {
+      loss_level  = service_class_quality[sc].loss_level;
+      delay_level = service_class_quality[sc].delay_level;
+      step        = 0;
+      link->quality_step[sc] = FWABF_QUALITY_STEP_NONE;
+      do {
+          if ((link->quality.loss <= quality_levels[loss_level].loss) &&
+              (link->quality.delay <= quality_levels[delay_level].delay))
+            {
+              link->quality_step[sc] = step;
+              break;
+            }
+
+          if (loss_level < FWABF_QUALITY_LEVEL_YES)
+            loss_level++;
+
+          if (delay_level < FWABF_QUALITY_LEVEL_YES)
+            delay_level++;
+
+          step++;
+
+      } while (loss_level < FWABF_QUALITY_LEVEL_YES || delay_level < FWABF_QUALITY_LEVEL_YES);
+    }
+}
+
+/**
+ * Rebuilds list of candidate links for the default route case.
+ * The new lists are built aside and are swapped with the old ones under
+ * worker barrier if they were changed, as they are used by datapath.
+ */
+static void fwabf_quality_candidates_refresh(fwabf_quality_candidates_t* qc)
+{
+  u32*            new_links[FWABF_QUALITY_SC_MAX];
+  u32*            old_links;
+  u32*            reachable_links = 0;
+  u32*            p_sw_if_index;
+  fwabf_label_t*  label;
+  fwabf_link_t*   link;
+  u32             sc, changed = 0;
+  u8              min_step;
+
+  vec_foreach (label, qc->labels)
+    {
+      vec_foreach(p_sw_if_index, fwabf_labels[*label].interfaces)
+        {
+          link = &fwabf_links[*p_sw_if_index];
+          if (FWABF_DPO_ADJACENCY_UP(link->dpo) && link->quality.loss < 100)
+            vec_add1(reachable_links, *p_sw_if_index);
+        }
+    }
+
+  for (sc = 0; sc < FWABF_QUALITY_SC_MAX; sc++)
+    {
+      new_links[sc] = 0;
+
+      /* Single reachable link is used with no regard to it's quality */
+      if (vec_len(reachable_links) == 1)
+        {
+          vec_add1(new_links[sc], reachable_links[0]);
+        }
+      else if (vec_len(reachable_links) > 1)
+        {
+          min_step = FWABF_QUALITY_STEP_NONE;
+          vec_foreach (p_sw_if_index, reachable_links)
+            {
+              min_step = clib_min(min_step, fwabf_links[*p_sw_if_index].quality_step[sc]);
+            }
+          vec_foreach (p_sw_if_index, reachable_links)
+            {
+              if (min_step != FWABF_QUALITY_STEP_NONE &&
+                  fwabf_links[*p_sw_if_index].quality_step[sc] == min_step)
+                vec_add1(new_links[sc], *p_sw_if_index);
+            }
+        }
+
+      if (!vec_is_equal(new_links[sc], qc->links[sc]))
+        changed = 1;
+    }
+  vec_free(reachable_links);
+
+  if (changed)
+    {
+      vlib_worker_thread_barrier_sync (vlib_get_main());
+      for (sc = 0; sc < FWABF_QUALITY_SC_MAX; sc++)
+        {
+          old_links     = qc->links[sc];
+          qc->links[sc] = new_links[sc];
+          new_links[sc] = old_links;
+        }
+      vlib_worker_thread_barrier_release (vlib_get_main());
+    }
+
+  for (sc = 0; sc < FWABF_QUALITY_SC_MAX; sc++)
+    vec_free(new_links[sc]);
+}
+
+static void fwabf_quality_candidates_refresh_all()
+{
+  fwabf_quality_candidates_t* qc;
+
+  /* *INDENT-OFF* */
+  pool_foreach (qc, fwabf_quality_candidates_pool)
+    {
+      fwabf_quality_candidates_refresh(qc);
+    }
+  /* *INDENT-ON* */
+}
+
+u32 fwabf_links_quality_candidates_add (fwabf_label_t* labels)
+{
+  fwabf_quality_candidates_t* qc;
+  fwabf_label_t*              label;
+
+  vlib_worker_thread_barrier_sync (vlib_get_main());
+  pool_get_zero (fwabf_quality_candidates_pool, qc);
+  vlib_worker_thread_barrier_release (vlib_get_main());
+
+  qc->labels = vec_dup(labels);
+  vec_foreach (label, qc->labels)
+    {
+      ASSERT(*label < FWABF_INVALID_LABEL);
+      qc->label_mask[*label >> 6] |= (1ULL << (*label & 63));
+    }
+  fwabf_quality_candidates_refresh(qc);
+
+  return (qc - fwabf_quality_candidates_pool);
+}
+
+void fwabf_links_quality_candidates_del (u32 index)
+{
+  fwabf_quality_candidates_t* qc;
+  u32                         sc;
+
+  vlib_worker_thread_barrier_sync (vlib_get_main());
+  qc = pool_elt_at_index(fwabf_quality_candidates_pool, index);
+  vec_free(qc->labels);
+  for (sc = 0; sc < FWABF_QUALITY_SC_MAX; sc++)
+    vec_free(qc->links[sc]);
+  pool_put(fwabf_quality_candidates_pool, qc);
+  vlib_worker_thread_barrier_release (vlib_get_main());
+}
+
+/**
+ * Calculates number of buckets of every link in the weighted table of
+ * 'n_buckets' buckets in proportion to link weights. The largest remainder
+ * method is used to distribute the rounding leftover. Every link gets one
+ * bucket at least, so no link is starved. The caller ensures there are
+ * more buckets than links.
+ */
+static void fwabf_weighted_counts_calculate(
+                        u64* weights, u32 n_buckets, u32* counts)
+{
+  u64* remainders = 0;
+  u64  total = 0;
+  u32  n_assigned = 0;
+  u32  i, j, max_i;
+
+  vec_foreach_index (i, weights)
+    total += weights[i];
+
+  vec_validate (remainders, vec_len(weights) - 1);
+  vec_foreach_index (i, weights)
+    {
+      counts[i]     = (weights[i] * n_buckets) / total;
+      remainders[i] = (weights[i] * n_buckets) % total;
+      n_assigned   += counts[i];
+    }
+
+  while (n_assigned < n_buckets)
+    {
+      max_i = 0;
+      vec_foreach_index (i, remainders)
+        {
+          if (remainders[i] > remainders[max_i])
+            max_i = i;
+        }
+      counts[max_i]++;
+      remainders[max_i] = 0;
+      n_assigned++;
+    }
+
+  vec_foreach_index (i, weights)
+    {
+      if (counts[i] > 0)
+        continue;
+      max_i = 0;
+      vec_foreach_index (j, weights)
+        {
+          if (counts[j] > counts[max_i])
+            max_i = j;
+        }
+      counts[max_i]--;
+      counts[i] = 1;
+    }
+  vec_free (remainders);
+}
+
+/**
+ * Rebuilds the weighted table of buckets out of the current weights of
+ * reachable links. The buckets of the old table are preserved as long as
+ * the link they point to still deserves them, so only surplus buckets are
+ * moved to other links and flows that hash into preserved buckets stay on
+ * their links. To avoid moves on noise in the sampled transmit rates,
+ * the table is not rebuilt if the number of buckets of every link differs by
+ * one bucket at most from the current one, unless the set of links
+ * was changed. The new table is built aside and is swapped with the old one
+ * under worker barrier, as it is used by datapath.
+ */
+static void fwabf_weighted_candidates_refresh(fwabf_weighted_candidates_t* wc)
+{
+  u32*            links   = 0;
+  u64*            weights = 0;
+  u32*            counts  = 0;
+  u32*            current = 0;
+  u32*            new_buckets = 0;
+  u32*            old_buckets;
+  u32*            p_sw_if_index;
+  fwabf_label_t*  label;
+  fwabf_link_t*   link;
+  u32             i, j, n_buckets, n_kept, bandwidth_known = 1, changed = 0;
+  f64             available;
+
+  vec_foreach (label, wc->labels)
+    {
+      vec_foreach(p_sw_if_index, fwabf_labels[*label].interfaces)
+        {
+          link = &fwabf_links[*p_sw_if_index];
+          if (FWABF_DPO_ADJACENCY_UP(link->dpo) && link->quality.loss < 100)
+            {
+              vec_add1(links, *p_sw_if_index);
+              if (link->bandwidth == 0)
+                bandwidth_known = 0;
+            }
+        }
+    }
+
+  if (vec_len(links) > 0)
+    {
+      vec_foreach (p_sw_if_index, links)
+        {
+          link = &fwabf_links[*p_sw_if_index];
+          if (bandwidth_known)
+            {
+              available = (f64)link->bandwidth * 1e6 - link->tx_rate;
+              available = clib_max(available, (f64)link->bandwidth * 1e6 * FWABF_WEIGHTED_MIN_HEADROOM);
+              vec_add1(weights, (u64)link->weight * (u64)(available / 1e3)); /*kbps*/
+            }
+          else
+            {
+              vec_add1(weights, link->weight);
+            }
+          if (weights[vec_len(weights) - 1] == 0)
+            weights[vec_len(weights) - 1] = 1;
+        }
+
+      n_buckets = clib_max(FWABF_WEIGHTED_MIN_BUCKETS, 1 << max_log2(4 * vec_len(links)));
+      vec_validate (counts, vec_len(links) - 1);
+      fwabf_weighted_counts_calculate(weights, n_buckets, counts);
+
+      /*
+       * Find how many buckets every link has in the current table.
+       */
+      vec_validate (current, vec_len(links) - 1);
+      n_kept = 0;
+      if (vec_len(wc->buckets) == n_buckets)
+        {
+          vec_foreach_index (i, wc->buckets)
+            {
+              j = vec_search (links, wc->buckets[i]);
+              if (j != ~0)
+                {
+                  current[j]++;
+                  n_kept++;
+                }
+            }
+        }
+
+      changed = (n_kept != n_buckets);
+      vec_foreach_index (j, links)
+        {
+          if ((current[j] == 0) || (current[j] > counts[j] + 1) || (current[j] + 1 < counts[j]))
+            changed = 1;
+        }
+
+      if (changed)
+        {
+          vec_validate_init_empty (new_buckets, n_buckets - 1, INDEX_INVALID);
+          clib_memset (current, 0, vec_len(current) * sizeof(current[0]));
+          if (vec_len(wc->buckets) == n_buckets)
+            {
+              vec_foreach_index (i, wc->buckets)
+                {
+                  j = vec_search (links, wc->buckets[i]);
+                  if (j != ~0 && current[j] < counts[j])
+                    {
+                      new_buckets[i] = wc->buckets[i];
+                      current[j]++;
+                    }
+                }
+            }
+          j = 0;
+          vec_foreach_index (i, new_buckets)
+            {
+              if (new_buckets[i] != INDEX_INVALID)
+                continue;
+              while (current[j] >= counts[j])
+                j++;
+              new_buckets[i] = links[j];
+              current[j]++;
+            }
+        }
+    }
+  else
+    {
+      changed = (vec_len(wc->buckets) > 0);
+    }
+
+  vec_free(links);
+  vec_free(weights);
+  vec_free(counts);
+  vec_free(current);
+
+  if (changed)
+    {
+      vlib_worker_thread_barrier_sync (vlib_get_main());
+      old_buckets = wc->buckets;
+      wc->buckets = new_buckets;
+      new_buckets = old_buckets;
+      vlib_worker_thread_barrier_release (vlib_get_main());
+    }
+  vec_free(new_buckets);
+}
+
+static void fwabf_weighted_candidates_refresh_all()
+{
+  fwabf_weighted_candidates_t* wc;
+
+  /* *INDENT-OFF* */
+  pool_foreach (wc, fwabf_weighted_candidates_pool)
+    {
+      fwabf_weighted_candidates_refresh(wc);
+    }
+  /* *INDENT-ON* */
+}
+
+u32 fwabf_links_weighted_candidates_add (fwabf_label_t* labels)
+{
+  fwabf_weighted_candidates_t* wc;
+  fwabf_label_t*               label;
+
+  vlib_worker_thread_barrier_sync (vlib_get_main());
+  pool_get_zero (fwabf_weighted_candidates_pool, wc);
+  vlib_worker_thread_barrier_release (vlib_get_main());
+
+  wc->labels = vec_dup(labels);
+  vec_foreach (label, wc->labels)
+    {
+      ASSERT(*label < FWABF_INVALID_LABEL);
+      wc->label_mask[*label >> 6] |= (1ULL << (*label & 63));
+    }
+  fwabf_weighted_candidates_refresh(wc);
+
+  return (wc - fwabf_weighted_candidates_pool);
+}
+
+void fwabf_links_weighted_candidates_del (u32 index)
+{
+  fwabf_weighted_candidates_t* wc;
+
+  vlib_worker_thread_barrier_sync (vlib_get_main());
+  wc = pool_elt_at_index(fwabf_weighted_candidates_pool, index);
+  vec_free(wc->labels);
+  vec_free(wc->buckets);
+  pool_put(fwabf_weighted_candidates_pool, wc);
+  vlib_worker_thread_barrier_release (vlib_get_main());
+}
+
+dpo_id_t fwabf_links_get_weighted_dpo (
+                        u32                   candidates,
+                        const load_balance_t* lb,
+                        u32                   is_default_route_lb,
+                        u32                   flow_hash)
+{
+  dpo_id_t                     invalid_dpo = DPO_INVALID;
+  const dpo_id_t*              lookup_dpo;
+  fwabf_weighted_candidates_t* wc;
+  u32                          sw_if_index, prev_sw_if_index;
+  fwabf_label_t                fwlabel;
+  fwabf_link_t*                link;
+  u32                          i, k, n_buckets;
+
+  wc = pool_elt_at_index(fwabf_weighted_candidates_pool, candidates);
+  n_buckets = vec_len(wc->buckets);
+  if (PREDICT_FALSE(n_buckets == 0))
+    return invalid_dpo;
+
+  i = flow_hash & (n_buckets - 1);
+
+  /* If FIB lookup was resolved to default route (is_default_route_lb is true),
+     we ignore the interface pointed by FIB and just enforce policy tunnels.
+     The table has reachable links only, so the bucket link is used as is.
+  */
+  if (PREDICT_FALSE(is_default_route_lb))
+    {
+      link = &fwabf_links[wc->buckets[i]];
+      FWABF_LABEL_COUNT(link->fwlabel, ENFORCED_HITS);
+      return link->dpo;
+    }
+
+  if (PREDICT_FALSE (lb->lb_n_buckets == 1))
+    {
+      lookup_dpo = load_balance_get_bucket_i (lb, 0);
+      sw_if_index = fwabf_adj_map_get (&adj_indexes_to_reachable_links, lookup_dpo->dpoi_index);
+      fwlabel = fwabf_adj_map_get (&adj_indexes_to_labels, lookup_dpo->dpoi_index);
+
+      if (PREDICT_TRUE(sw_if_index != INDEX_INVALID) && PREDICT_TRUE(fwlabel != FWABF_INVALID_LABEL) &&
+          FWABF_LABEL_MASK_IS_SET(wc->label_mask, fwlabel))
+        {
+          FWABF_LABEL_COUNT(fwlabel, HITS);
+          return *lookup_dpo;
+        }
+      return invalid_dpo;
+    }
+
+  /*
+   * Intersect the FIB lookup DPO-s with the weighted table: walk the table
+   * starting from the flow bucket and use the first link that is found
+   * in FIB lookup result. This keeps the weighted distribution among the
+   * intersected links and it is sticky for the flow.
+   */
+  prev_sw_if_index = INDEX_INVALID;
+  for (k = 0; k < n_buckets; k++)
+    {
+      sw_if_index = wc->buckets[(i + k) & (n_buckets - 1)];
+      if (sw_if_index == prev_sw_if_index)
+        continue;
+      prev_sw_if_index = sw_if_index;
+
+      for (u32 j = 0; j < lb->lb_n_buckets; j++)
+        {
+          lookup_dpo = load_balance_get_fwd_bucket (lb, j);
+          if (fwabf_adj_map_get (&adj_indexes_to_reachable_links, lookup_dpo->dpoi_index) == sw_if_index)
+            {
+              link = &fwabf_links[sw_if_index];
+              FWABF_LABEL_COUNT(link->fwlabel, HITS);
+              return link->dpo;
+            }
+        }
+    }
+
+  return invalid_dpo;
+}
+
 #define FWABF_GET_INDEX_BY_FLOWHASH(_flowhash, _vec_len_pow2_mask, _vec_len_minus_1, _res) \
       (((_res = (_flowhash & (_vec_len_pow2_mask))) <= (_vec_len_minus_1)) ? _res : (_res & (_vec_len_minus_1)))
 
 dpo_id_t fwabf_links_get_quality_dpo (
-                        fwabf_label_t*                  policy_labels,
+                        u32                             candidates,
                         fwabf_quality_service_class_t   sc,
                         const load_balance_t*           lb,
                         u32                             is_default_route_lb,
                         u32                             flow_hash)
 {
-  dpo_id_t                  invalid_dpo = DPO_INVALID;
-  u32                       ret_sw_if_index = INDEX_INVALID;
-  const dpo_id_t*           lookup_dpo;
-  u32*                      reachable_links = 0;
-  u32*                      quality_links = 0;
-  u32*                      p_sw_if_index;
-  u32                       sw_if_index;
-  fwabf_label_t             fwlabel;
-  fwabf_label_t*            label;
-  fwabf_label_data_t*       label_data;
-  fwabf_link_t*             link;
-  fwabf_quality_level_t     loss_level, delay_level;
-  u32                       i, n_reachable_links, n_quality_links, n_links_pow2_mask;
-
-  if (PREDICT_FALSE(vec_len(policy_labels) == 0))
+  dpo_id_t                    invalid_dpo = DPO_INVALID;
+  u32                         ret_sw_if_index = INDEX_INVALID;
+  const dpo_id_t*             lookup_dpo;
+  fwabf_quality_candidates_t* qc;
+  u32*                        quality_links;
+  u32                         sw_if_index;
+  fwabf_label_t               fwlabel;
+  fwabf_link_t*               link;
+  u32                         i, n, n_reachable_links, n_quality_links, n_links_pow2_mask;
+  u8                          step, min_step;
+
+  qc = pool_elt_at_index(fwabf_quality_candidates_pool, candidates);
+  if (PREDICT_FALSE(vec_len(qc->labels) == 0))
     return invalid_dpo;
 
   /* If FIB lookup was resolved to default route (is_default_route_lb is true),
      we ignore the interface pointed by FIB and just enforce policy tunnels.
      This is to support scenario, where user wants all internet traffic to go into tunnel.
+     The candidate links for this case are precomputed by control plane.
   */
   if (PREDICT_FALSE(is_default_route_lb))
   {
-    reachable_links = vec_new(u32, 0);
-    vec_foreach (label, policy_labels)
-      {
-        label_data = &fwabf_labels[*label];
-        vec_foreach(p_sw_if_index, label_data->interfaces)
-          {
-            link = &fwabf_links[*p_sw_if_index];
-            if (PREDICT_TRUE(FWABF_DPO_ADJACENCY_UP(link->dpo) && link->quality.loss < 100))
-              {
-                vec_add1(reachable_links, *p_sw_if_index);
-              }
-          }
-      }
+    quality_links   = qc->links[sc];
+    n_quality_links = vec_len(quality_links);
+    if (PREDICT_TRUE(n_quality_links > 1))
+    {
+      n_links_pow2_mask = (n_quality_links <= 0xF) ? 0xF : 0xFF;
+      i = FWABF_GET_INDEX_BY_FLOWHASH(flow_hash, n_links_pow2_mask, n_quality_links - 1, i);
+      ret_sw_if_index = quality_links[i];
+    }
+    else if (PREDICT_TRUE(n_quality_links == 1))
+    {
+      ret_sw_if_index = quality_links[0];
+    }
   }
   else /* !is_default_route_lb */
   {
     if (PREDICT_FALSE (lb->lb_n_buckets == 1))
       {
         lookup_dpo = load_balance_get_bucket_i (lb, 0);
-        ASSERT(lookup_dpo->dpoi_index < FWABF_MAX_ADJ_INDEX);
-        sw_if_index = adj_indexes_to_reachable_links[lookup_dpo->dpoi_index];
-        fwlabel = adj_indexes_to_labels[lookup_dpo->dpoi_index];
+        sw_if_index = fwabf_adj_map_get (&adj_indexes_to_reachable_links, lookup_dpo->dpoi_index);
+        fwlabel = fwabf_adj_map_get (&adj_indexes_to_labels, lookup_dpo->dpoi_index);
 
-        if (PREDICT_TRUE(sw_if_index != INDEX_INVALID) && PREDICT_TRUE(fwlabel != FWABF_INVALID_LABEL))
+        if (PREDICT_TRUE(sw_if_index != INDEX_INVALID) && PREDICT_TRUE(fwlabel != FWABF_INVALID_LABEL) &&
+            FWABF_LABEL_MASK_IS_SET(qc->label_mask, fwlabel))
           {
-            vec_foreach (label, policy_labels)
+            FWABF_LABEL_COUNT(fwlabel, HITS);
+
+            link = &fwabf_links[sw_if_index];
+            if (link->quality_step[sc] == 0)
+              FWABF_LABEL_COUNT(link->fwlabel, QUALITY_HITS);
+            else
+              FWABF_LABEL_COUNT(link->fwlabel, QUALITY_REDUCED_HITS);
+
+            return *lookup_dpo;
+          }
+        return invalid_dpo;
+      }
+
+    /*
+     * Intersect the FIB lookup DPO-s with policy labels and find the best
+     * quality step among the intersected links. Then choose the link
+     * by flow hash out of links of the best quality.
+     * The lookup DPO-s are walked twice to avoid memory allocation for list
+     * of intersected links.
+     */
+    n_reachable_links = 0;
+    n_quality_links   = 0;
+    min_step          = FWABF_QUALITY_STEP_NONE;
+    for (i=0; i<lb->lb_n_buckets; i++)
+      {
+        lookup_dpo = load_balance_get_fwd_bucket (lb, i);
+        sw_if_index = fwabf_adj_map_get (&adj_indexes_to_reachable_links, lookup_dpo->dpoi_index);
+        fwlabel = fwabf_adj_map_get (&adj_indexes_to_labels, lookup_dpo->dpoi_index);
+
+        if (PREDICT_TRUE(sw_if_index != INDEX_INVALID) && PREDICT_TRUE(fwlabel != FWABF_INVALID_LABEL) &&
+            FWABF_LABEL_MASK_IS_SET(qc->label_mask, fwlabel))
+          {
+            if (n_reachable_links++ == 0)
+              ret_sw_if_index = sw_if_index;
+
+            step = fwabf_links[sw_if_index].quality_step[sc];
+            if (step < min_step)
               {
-                if (PREDICT_FALSE (*label == fwlabel))
-                  {
-                    fwabf_labels[fwlabel].counter_hits++;
-
-                    link = &fwabf_links[sw_if_index];
-                    loss_level = service_class_quality[sc].loss_level;
-                    delay_level = service_class_quality[sc].delay_level;
-                    if ((link->quality.loss <= quality_levels[loss_level].loss) &&
-                        (link->quality.delay <= quality_levels[delay_level].delay))
-                      fwabf_labels[link->fwlabel].counter_quality_hits++;
-                    else
-                      fwabf_labels[link->fwlabel].counter_quality_reduced_hits++;
-
-                    return *lookup_dpo;
-                  }
+                min_step        = step;
+                n_quality_links = 1;
+              }
+            else if (step == min_step && step != FWABF_QUALITY_STEP_NONE)
+              {
+                n_quality_links++;
               }
           }
       }
-    else
+
+    if (PREDICT_FALSE(n_reachable_links == 0))
+      return invalid_dpo;
+
+    /* Single reachable link is used with no regard to it's quality */
+    if (PREDICT_TRUE(n_reachable_links > 1))
       {
-        reachable_links = vec_new(u32, 0);
-        for (i=0; i<lb->lb_n_buckets; i++)
+        ret_sw_if_index = INDEX_INVALID;
+        if (PREDICT_TRUE(n_quality_links > 0))
           {
-            lookup_dpo = load_balance_get_fwd_bucket (lb, i);
-            ASSERT(lookup_dpo->dpoi_index < FWABF_MAX_ADJ_INDEX);
-            sw_if_index = adj_indexes_to_reachable_links[lookup_dpo->dpoi_index];
-            fwlabel = adj_indexes_to_labels[lookup_dpo->dpoi_index];
-
-            if (PREDICT_TRUE(sw_if_index != INDEX_INVALID) && PREDICT_TRUE(fwlabel != FWABF_INVALID_LABEL))
+            n = 0;
+            if (n_quality_links > 1)
+              {
+                n_links_pow2_mask = (n_quality_links <= 0xF) ? 0xF : 0xFF;
+                n = FWABF_GET_INDEX_BY_FLOWHASH(flow_hash, n_links_pow2_mask, n_quality_links - 1, n);
+              }
+            for (i=0; i<lb->lb_n_buckets; i++)
               {
-                vec_foreach (label, policy_labels)
+                lookup_dpo = load_balance_get_fwd_bucket (lb, i);
+                sw_if_index = fwabf_adj_map_get (&adj_indexes_to_reachable_links, lookup_dpo->dpoi_index);
+                fwlabel = fwabf_adj_map_get (&adj_indexes_to_labels, lookup_dpo->dpoi_index);
+                if (sw_if_index != INDEX_INVALID && fwlabel != FWABF_INVALID_LABEL &&
+                    FWABF_LABEL_MASK_IS_SET(qc->label_mask, fwlabel) &&
+                    fwabf_links[sw_if_index].quality_step[sc] == min_step)
                   {
-                    if (PREDICT_FALSE (*label == fwlabel))
+                    if (n-- == 0)
                       {
-                        vec_add1(reachable_links, sw_if_index);
+                        ret_sw_if_index = sw_if_index;
                         break;
                       }
                   }
@@ -511,76 +1154,18 @@ dpo_id_t fwabf_links_get_quality_dpo (
       }
   }
 
-  n_reachable_links = vec_len(reachable_links);
-  if (PREDICT_TRUE(n_reachable_links > 1))
-  {
-    quality_links = vec_new(u32, 0);
-
-    loss_level = service_class_quality[sc].loss_level;
-    delay_level = service_class_quality[sc].delay_level;
-
-    do {
-        vec_foreach (p_sw_if_index, reachable_links)
-          {
-            link = &fwabf_links[*p_sw_if_index];
-            if ((link->quality.loss <= quality_levels[loss_level].loss) &&
-                (link->quality.delay <= quality_levels[delay_level].delay))
-              vec_add1(quality_links, *p_sw_if_index);
-          }
-
-        if (loss_level < FWABF_QUALITY_LEVEL_YES)
-          loss_level++;
-
-        if (delay_level < FWABF_QUALITY_LEVEL_YES)
-          delay_level++;
-
-    } while ((vec_len(quality_links) == 0) &&
-            (loss_level < FWABF_QUALITY_LEVEL_YES || delay_level < FWABF_QUALITY_LEVEL_YES));
-
-    vec_free (reachable_links);
-    n_quality_links = vec_len(quality_links);
-    if (PREDICT_TRUE(n_quality_links > 1))
-    {
-      n_links_pow2_mask = (n_quality_links <= 0xF) ? 0xF : 0xFF;
-      i = FWABF_GET_INDEX_BY_FLOWHASH(flow_hash, n_links_pow2_mask, n_quality_links - 1, i);
-      ret_sw_if_index = quality_links[i];
-    }
-    else if (PREDICT_TRUE(n_quality_links == 1))
-    {
-      ret_sw_if_index = quality_links[0];
-    }
-    else /* n_quality_links == 0 */
-    {
-      vec_free (quality_links);
-    }
-    vec_free (quality_links);
-  }
-  else if (PREDICT_TRUE(n_reachable_links == 1))
-  {
-    ret_sw_if_index = reachable_links[0];
-    vec_free (reachable_links);
-  }
-  else /* n_reachable_links == 0 */
-  {
-    vec_free (reachable_links);
-    return invalid_dpo;
-  }
-
   if (ret_sw_if_index != INDEX_INVALID)
   {
     link = &fwabf_links[ret_sw_if_index];
     if (PREDICT_FALSE(is_default_route_lb))
-      fwabf_labels[link->fwlabel].counter_enforced_hits++;
+      FWABF_LABEL_COUNT(link->fwlabel, ENFORCED_HITS);
     else
-      fwabf_labels[link->fwlabel].counter_hits++;
+      FWABF_LABEL_COUNT(link->fwlabel, HITS);
 
-    loss_level = service_class_quality[sc].loss_level;
-    delay_level = service_class_quality[sc].delay_level;
-    if ((link->quality.loss <= quality_levels[loss_level].loss) &&
-        (link->quality.delay <= quality_levels[delay_level].delay))
-      fwabf_labels[link->fwlabel].counter_quality_hits++;
+    if (link->quality_step[sc] == 0)
+      FWABF_LABEL_COUNT(link->fwlabel, QUALITY_HITS);
     else
-      fwabf_labels[link->fwlabel].counter_quality_reduced_hits++;
+      FWABF_LABEL_COUNT(link->fwlabel, QUALITY_REDUCED_HITS);
 
     return link->dpo;
   }
@@ -637,8 +1222,7 @@ dpo_id_t fwabf_links_get_intersected_dpo (
        * and are managed by FWABF module. See fwabf_link_refresh_dpo()
        * for details.
        */
-      ASSERT(lookup_dpo->dpoi_index < FWABF_MAX_ADJ_INDEX);
-      sw_if_index = adj_indexes_to_reachable_links[lookup_dpo->dpoi_index];
+      sw_if_index = fwabf_adj_map_get (&adj_indexes_to_reachable_links, lookup_dpo->dpoi_index);
       if (PREDICT_TRUE(sw_if_index != INDEX_INVALID))
         {
           link = &fwabf_links[sw_if_index];
@@ -649,7 +1233,7 @@ dpo_id_t fwabf_links_get_intersected_dpo (
           */
           if (PREDICT_TRUE(link->fwlabel == fwlabel  &&  link->quality.loss < 100))
             {
-              fwabf_labels[fwlabel].counter_hits++;
+              FWABF_LABEL_COUNT(fwlabel, HITS);
               return *lookup_dpo;
             }
         }
@@ -663,14 +1247,13 @@ dpo_id_t fwabf_links_get_intersected_dpo (
       for (i=0; i<lb->lb_n_buckets; i++)
         {
           lookup_dpo = load_balance_get_fwd_bucket (lb, i);
-          ASSERT(lookup_dpo->dpoi_index < FWABF_MAX_ADJ_INDEX);
-          sw_if_index = adj_indexes_to_reachable_links[lookup_dpo->dpoi_index];
+          sw_if_index = fwabf_adj_map_get (&adj_indexes_to_reachable_links, lookup_dpo->dpoi_index);
           if (PREDICT_TRUE(sw_if_index != INDEX_INVALID))
             {
               link = &fwabf_links[sw_if_index];
               if (PREDICT_TRUE(link->fwlabel == fwlabel  &&  link->quality.loss < 100))
               {
-                fwabf_labels[fwlabel].counter_hits++;
+                FWABF_LABEL_COUNT(fwlabel, HITS);
                 return *lookup_dpo;
               }
             }
@@ -680,7 +1263,7 @@ dpo_id_t fwabf_links_get_intersected_dpo (
   /*
    * No match between lookup DPO and labeled DPO-s.
    */
-  fwabf_labels[fwlabel].counter_misses++;
+  FWABF_LABEL_COUNT(fwlabel, MISSES);
   return invalid_dpo;
 }
 
@@ -689,9 +1272,9 @@ int fwabf_links_is_dpo_labeled_or_default_route (
                             dpo_proto_t           proto)
 {
   dpo_id_t lookup_dpo;
-  u32*     default_route_adjacencies = (proto == DPO_PROTO_IP4) ?
-                            fwabf_default_route.dr4.adj_index_map :
-                            fwabf_default_route.dr6.adj_index_map;
+  fwabf_adj_map_t* default_route_adjacencies = (proto == DPO_PROTO_IP4) ?
+                            &fwabf_default_route.dr4.adj_index_map :
+                            &fwabf_default_route.dr6.adj_index_map;
 
   for (u32 i = 0; i < lb->lb_n_buckets; i++)
   {
@@ -703,10 +1286,9 @@ int fwabf_links_is_dpo_labeled_or_default_route (
      * In DPO_ADJACENCY/DPO_ADJACENCY_MIDCHAIN DPO-s it stands for adjacency
      * that reflects the link interface, either WAN interface or tunnel.
      */
-    ASSERT(lookup_dpo.dpoi_index < FWABF_MAX_ADJ_INDEX);
-    if (adj_indexes_to_labels[lookup_dpo.dpoi_index] != FWABF_INVALID_LABEL)
+    if (fwabf_adj_map_get (&adj_indexes_to_labels, lookup_dpo.dpoi_index) != FWABF_INVALID_LABEL)
         return 1;
-    if (default_route_adjacencies[lookup_dpo.dpoi_index] == 1)
+    if (fwabf_adj_map_get (default_route_adjacencies, lookup_dpo.dpoi_index) == 1)
         return 1;
   }
   return 0;  /*No even single labeled DPO was found*/
@@ -717,9 +1299,9 @@ int fwabf_links_is_dpo_default_route (
                             dpo_proto_t           proto)
 {
   dpo_id_t lookup_dpo;
-  u32*     default_route_adjacencies = (proto == DPO_PROTO_IP4) ?
-                            fwabf_default_route.dr4.adj_index_map :
-                            fwabf_default_route.dr6.adj_index_map;
+  fwabf_adj_map_t* default_route_adjacencies = (proto == DPO_PROTO_IP4) ?
+                            &fwabf_default_route.dr4.adj_index_map :
+                            &fwabf_default_route.dr6.adj_index_map;
 
   for (u32 i = 0; i < lb->lb_n_buckets; i++)
   {
@@ -727,8 +1309,7 @@ int fwabf_links_is_dpo_default_route (
     if (lookup_dpo.dpoi_type != DPO_ADJACENCY) /*usage of dpoi_index below dependens on type, we use DPO_ADJACENCY for links, so dpoi_index stands for adjacency*/
       return 0;   /*The routes takes us to local machine probably (dpoi_type is DPO_RECEIVE)*/
 
-    ASSERT(lookup_dpo.dpoi_index < FWABF_MAX_ADJ_INDEX);
-    if (default_route_adjacencies[lookup_dpo.dpoi_index] == 1)
+    if (fwabf_adj_map_get (default_route_adjacencies, lookup_dpo.dpoi_index) == 1)
         return 1;
   }
   return 0;  /*No even single labeled DPO was found*/
@@ -749,12 +1330,12 @@ dpo_id_t fwabf_links_get_labeled_dpo (fwabf_label_t fwlabel)
       link = &fwabf_links[*sw_if_index];
       if (PREDICT_TRUE(FWABF_DPO_ADJACENCY_UP(link->dpo) && link->quality.loss < 100))
         {
-          label->counter_enforced_hits++;
+          FWABF_LABEL_COUNT(fwlabel, ENFORCED_HITS);
           return link->dpo;
         }
     }
 
-  label->counter_enforced_misses++;
+  FWABF_LABEL_COUNT(fwlabel, ENFORCED_MISSES);
   return invalid_dpo;
 }
 
@@ -873,21 +1454,71 @@ VLIB_CLI_COMMAND (fwabf_link_cmd_node, static) = {
 };
 /* *INDENT-ON* */
 
+u32 fwabf_links_set_quality (u32 sw_if_index, u32 loss, u32 delay, u32 jitter)
+{
+  fwabf_link_t* link;
+  u8            old_steps[FWABF_QUALITY_SC_MAX];
+  u32           old_reachable;
+
+  link = fwabf_links_find_link(sw_if_index);
+  if (link == NULL)
+    return VNET_API_ERROR_NO_SUCH_ENTRY;
+
+  clib_memcpy_fast (old_steps, link->quality_step, sizeof(old_steps));
+  old_reachable = (link->quality.loss < 100);
+
+  if (loss != ~0)
+    link->quality.loss = loss;
+  if (delay != ~0)
+    link->quality.delay = delay;
+  if (jitter != ~0)
+    link->quality.jitter = jitter;
+  fwabf_link_update_quality_steps(link);
+
+  /* We ride on Quality-Based-Routing implementation to enable manual set of
+     UP/DOWN state of link for Ordered/Random Policies. This is instead of
+     automatic FIB based monitoring. We use LOSS quality parameter to indicate
+     UP/DOWN state.
+  */
+  if (loss != ~0)
+  {
+    u32 sw_if_index = (loss < 100) ? link->sw_if_index : INDEX_INVALID;
+    fwabf_adj_map_set (&adj_indexes_to_reachable_links, link->dpo.dpoi_index, sw_if_index);
+  }
+
+  /*
+   * Link quality affects selection of links by policy, so reset cache.
+   * Note the selection depends on quality steps and reachability only,
+   * so there is nothing to reset if they were not changed. That is important
+   * for the link prober that updates quality frequently, see fwabf_probe.h.
+   */
+  if (old_reachable != (link->quality.loss < 100) ||
+      memcmp (old_steps, link->quality_step, sizeof(old_steps)) != 0)
+    {
+      fwabf_quality_candidates_refresh_all();
+      fwabf_weighted_candidates_refresh_all();
+      fwabf_flow_cache_invalidate ();
+    }
+  return 0;
+}
+
 static
 clib_error_t * fwabf_quality_cmd (
                   vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * cmd)
 {
   vnet_main_t*     vnm  = vnet_get_main ();
-  fwabf_link_t*    link;
   u32  sw_if_index = INDEX_INVALID;
   u32  loss        = ~0;
   u32  delay       = ~0;
   u32  jitter      = ~0;
+  u8   is_auto     = 0;
 
   while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
     {
       if (unformat (input, "sw_if_index %d", &sw_if_index))
         ;
+      else if (unformat (input, "auto"))
+        is_auto = 1;
       else if (unformat (input, "%U",
                          unformat_vnet_sw_interface, vnm, &sw_if_index))
         ;
@@ -910,31 +1541,23 @@ clib_error_t * fwabf_quality_cmd (
       return (NULL);
     }
 
-  link = fwabf_links_find_link(sw_if_index);
-  if (link == NULL)
+  if (fwabf_links_find_link(sw_if_index) == NULL)
     {
       vlib_cli_output (vm, "link does not exist (sw_if_index=%d)", sw_if_index);
       return (NULL);
     }
 
-  if (loss != ~0)
-    link->quality.loss = loss;
-  if (delay != ~0)
-    link->quality.delay = delay;
-  if (jitter != ~0)
-    link->quality.jitter = jitter;
-
-  /* We ride on Quality-Based-Routing implementation to enable manual set of
-     UP/DOWN state of link for Ordered/Random Policies. This is instead of
-     automatic FIB based monitoring. We use LOSS quality parameter to indicate
-     UP/DOWN state.
-  */
-  if (loss != ~0)
-  {
-    u32 sw_if_index = (loss < 100) ? link->sw_if_index : INDEX_INVALID;
-    adj_indexes_to_reachable_links[link->dpo.dpoi_index] = sw_if_index;
-  }
-
+  /*
+   * The quality set by user overrides the quality measured by the link
+   * prober, until the 'auto' lets the prober push its quality again.
+   */
+  if (is_auto)
+    {
+      fwabf_probe_link_set_manual (sw_if_index, 0);
+      return (NULL);
+    }
+  fwabf_links_set_quality (sw_if_index, loss, delay, jitter);
+  fwabf_probe_link_set_manual (sw_if_index, 1);
   return (NULL);
 }
 
@@ -945,7 +1568,147 @@ clib_error_t * fwabf_quality_cmd (
 VLIB_CLI_COMMAND (fwabf_quality_cmd_node, static) = {
   .path = "fwabf quality",
   .function = fwabf_quality_cmd,
-  .short_help = "fwabf quality [sw_if_index <sw_if_index> | <if name>] loss <0..100> delay <value> jitter <value>",
+  .short_help = "fwabf quality [sw_if_index <sw_if_index> | <if name>] {loss <0..100> delay <value> jitter <value> | auto}",
+  .is_mp_safe = 1,
+};
+/* *INDENT-ON* */
+
+static u64 fwabf_link_get_tx_bytes(u32 sw_if_index)
+{
+  vnet_interface_main_t* im = &vnet_get_main()->interface_main;
+  vlib_counter_t         c;
+
+  vlib_get_combined_counter (
+    &im->combined_sw_if_counters[VNET_INTERFACE_COUNTER_TX], sw_if_index, &c);
+  return c.bytes;
+}
+
+u32 fwabf_links_set_weight (u32 sw_if_index, u32 weight, u32 bandwidth)
+{
+  fwabf_link_t* link;
+
+  link = fwabf_links_find_link(sw_if_index);
+  if (link == NULL)
+    return VNET_API_ERROR_NO_SUCH_ENTRY;
+
+  if (weight != ~0)
+    link->weight = weight;
+  if (bandwidth != ~0)
+    link->bandwidth = bandwidth;
+
+  /*
+   * No flow cache reset here: the weights affect new flows only,
+   * the existing flows stay on their links.
+   */
+  fwabf_weighted_candidates_refresh_all();
+  return 0;
+}
+
+/**
+ * Samples the transmit rate of links out of interface counters and rebuilds
+ * the weighted tables, as the available bandwidth of links was changed.
+ */
+static uword
+fwabf_links_weight_process (vlib_main_t * vm, vlib_node_runtime_t * rt,
+                            vlib_frame_t * f)
+{
+  fwabf_link_t* link;
+  f64           now, last_time = vlib_time_now (vm);
+  f64           rate;
+  u64           tx_bytes;
+
+  while (1)
+    {
+      vlib_process_suspend (vm, FWABF_WEIGHTED_SAMPLE_INTERVAL);
+
+      now = vlib_time_now (vm);
+      vec_foreach(link, fwabf_links)
+        {
+          if (link->sw_if_index == INDEX_INVALID)
+            continue;
+
+          /* The counters might be cleared, so take care of wrap */
+          tx_bytes = fwabf_link_get_tx_bytes(link->sw_if_index);
+          rate = (tx_bytes >= link->tx_bytes) ?
+                   (f64)(tx_bytes - link->tx_bytes) * 8 / (now - last_time) : 0;
+          link->tx_rate += (rate - link->tx_rate) * FWABF_WEIGHTED_RATE_EWMA_ALPHA;
+          link->tx_bytes = tx_bytes;
+        }
+      last_time = now;
+
+      if (pool_elts (fwabf_weighted_candidates_pool) > 0)
+        fwabf_weighted_candidates_refresh_all();
+    }
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_REGISTER_NODE (fwabf_links_weight_process_node, static) = {
+  .function = fwabf_links_weight_process,
+  .type = VLIB_NODE_TYPE_PROCESS,
+  .name = "fwabf-links-weight-process",
+};
+/* *INDENT-ON* */
+
+static
+clib_error_t * fwabf_weight_cmd (
+                  vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+  vnet_main_t*     vnm  = vnet_get_main ();
+  u32  sw_if_index = INDEX_INVALID;
+  u32  weight      = ~0;
+  u32  bandwidth   = ~0;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "sw_if_index %d", &sw_if_index))
+        ;
+      else if (unformat (input, "%U",
+                         unformat_vnet_sw_interface, vnm, &sw_if_index))
+        ;
+      else if (unformat (input, "weight %u", &weight))
+        ;
+      else if (unformat (input, "bandwidth %u", &bandwidth))
+        ;
+      else
+        {
+          return (clib_error_return (0, "unknown input '%U'",
+                                    format_unformat_error, input));
+        }
+    }
+
+  if (sw_if_index == INDEX_INVALID)
+    {
+      vlib_cli_output (vm, "specify interface of link");
+      return (NULL);
+    }
+  if (weight != ~0 && (weight == 0 || weight > FWABF_LINK_MAX_WEIGHT))
+    {
+      return (clib_error_return (0, "illegal weight %u, should be in range [1-%u]",
+                                 weight, FWABF_LINK_MAX_WEIGHT));
+    }
+  if (bandwidth != ~0 && bandwidth > FWABF_LINK_MAX_BANDWIDTH)
+    {
+      return (clib_error_return (0, "illegal bandwidth %u, should be in range [0-%u]",
+                                 bandwidth, FWABF_LINK_MAX_BANDWIDTH));
+    }
+
+  if (fwabf_links_set_weight (sw_if_index, weight, bandwidth) != 0)
+    {
+      vlib_cli_output (vm, "link does not exist (sw_if_index=%d)", sw_if_index);
+      return (NULL);
+    }
+  return (NULL);
+}
+
+/* *INDENT-OFF* */
+/**
+ * Set link weight and capacity for the weighted link selection.
+ */
+VLIB_CLI_COMMAND (fwabf_weight_cmd_node, static) = {
+  .path = "fwabf weight",
+  .function = fwabf_weight_cmd,
+  .short_help = "fwabf weight [sw_if_index <sw_if_index> | <if name>] [weight <1..1000>] [bandwidth <Mbps, 0 - unknown>]",
   .is_mp_safe = 1,
 };
 /* *INDENT-ON* */
@@ -960,6 +1723,11 @@ format_fwabf_link (u8 * s, va_list * args)
 	                  format_vnet_sw_if_index_name, vnm, link->sw_if_index,
                     link->sw_if_index, link->fwlabel, link->dpo.dpoi_index,
                     link->quality.loss, link->quality.delay, link->quality.jitter);
+  s = format (s, "   weight=%u, tx_rate=%.3fMbps", link->weight, link->tx_rate / 1e6);
+  if (link->bandwidth > 0)
+    s = format (s, ", bandwidth=%uMbps, utilization=%.1f%%",
+                link->bandwidth, link->tx_rate * 100 / ((f64)link->bandwidth * 1e6));
+  s = format (s, "\n");
   s = fib_path_list_format(link->pathlist_index, s);
   return (s);
 }
@@ -1040,10 +1808,14 @@ fwabf_link_show_labels_cmd (
       if (vec_len(fwabf_labels[i].interfaces) == 0)
         continue;
 
-      vlib_cli_output(vm, "%d (hits:%d misses:%d enforced_hits:%d enforced_misses:%d quality_hits:%d quality_reduced_hits:%d ):",
-          i, fwabf_labels[i].counter_hits, fwabf_labels[i].counter_misses,
-          fwabf_labels[i].counter_enforced_hits, fwabf_labels[i].counter_enforced_misses,
-          fwabf_labels[i].counter_quality_hits, fwabf_labels[i].counter_quality_reduced_hits);
+      vlib_simple_counter_main_t* cm = &fwabf_labels[i].counters;
+      vlib_cli_output(vm, "%d (hits:%Ld misses:%Ld enforced_hits:%Ld enforced_misses:%Ld quality_hits:%Ld quality_reduced_hits:%Ld ):",
+          i, vlib_get_simple_counter(cm, FWABF_LABEL_COUNTER_HITS),
+          vlib_get_simple_counter(cm, FWABF_LABEL_COUNTER_MISSES),
+          vlib_get_simple_counter(cm, FWABF_LABEL_COUNTER_ENFORCED_HITS),
+          vlib_get_simple_counter(cm, FWABF_LABEL_COUNTER_ENFORCED_MISSES),
+          vlib_get_simple_counter(cm, FWABF_LABEL_COUNTER_QUALITY_HITS),
+          vlib_get_simple_counter(cm, FWABF_LABEL_COUNTER_QUALITY_REDUCED_HITS));
       vec_foreach (sw_if_index, fwabf_labels[i].interfaces)
         {
           link = &fwabf_links[*sw_if_index];
@@ -1111,23 +1883,29 @@ void fwabf_link_refresh_dpo(fwabf_link_t * link)
    * The last is set, if the adjacency is not arp-resolved, which means
    * the tunnel / WAN nexthop is down.
    */
-  ASSERT(link->dpo.dpoi_index < FWABF_MAX_ADJ_INDEX);
   if (PREDICT_TRUE(FWABF_DPO_ADJACENCY_UP(link->dpo)))
     {
-      adj_indexes_to_reachable_links[link->dpo.dpoi_index] = link->sw_if_index;
+      fwabf_adj_map_set (&adj_indexes_to_reachable_links, link->dpo.dpoi_index, link->sw_if_index);
     }
   else
     {
-      adj_indexes_to_reachable_links[link->dpo.dpoi_index] = INDEX_INVALID;
+      fwabf_adj_map_set (&adj_indexes_to_reachable_links, link->dpo.dpoi_index, INDEX_INVALID);
     }
 
   /*
    * Update main adjacencies-to-labels map if not updated yet for this link.
    */
-  if (PREDICT_FALSE(adj_indexes_to_labels[link->dpo.dpoi_index] == FWABF_INVALID_LABEL))
+  if (PREDICT_FALSE(fwabf_adj_map_get (&adj_indexes_to_labels, link->dpo.dpoi_index) == FWABF_INVALID_LABEL))
     {
-      adj_indexes_to_labels[link->dpo.dpoi_index] = link->fwlabel;
+      fwabf_adj_map_set (&adj_indexes_to_labels, link->dpo.dpoi_index, link->fwlabel);
     }
+
+  fwabf_probe_link_update (link->sw_if_index, link->dpo_proto,
+                           &link->pathlist_rpath.frp_addr, &link->dpo);
+
+  fwabf_quality_candidates_refresh_all();
+  fwabf_weighted_candidates_refresh_all();
+  fwabf_flow_cache_invalidate ();
 }
 
 
@@ -1253,20 +2031,20 @@ static void fwabf_default_route_refresh_dpo(fib_protocol_t proto)
   fwabf_default_route_t*    dr = &fwabf_default_route;
   load_balance_t*           lb;
   u32**                     p_adj_index_list;
-  u32*                      adj_index_map;
+  fwabf_adj_map_t*          adj_index_map;
 
   if (proto == FIB_PROTOCOL_IP4)
     {
       fwd_chain_type    = FIB_FORW_CHAIN_TYPE_UNICAST_IP4;
       fib_entry_index   = dr->dr4.fib_entry_index;
-      adj_index_map     = dr->dr4.adj_index_map;
+      adj_index_map     = &dr->dr4.adj_index_map;
       p_adj_index_list  = &dr->dr4.adj_index_list;
     }
   else
     {
       fwd_chain_type    = FIB_FORW_CHAIN_TYPE_UNICAST_IP6;
       fib_entry_index   = dr->dr6.fib_entry_index;
-      adj_index_map     = dr->dr6.adj_index_map;
+      adj_index_map     = &dr->dr6.adj_index_map;
       p_adj_index_list  = &dr->dr6.adj_index_list;
     }
 
@@ -1278,7 +2056,7 @@ static void fwabf_default_route_refresh_dpo(fib_protocol_t proto)
   */
   vec_foreach(p_adj_index, *p_adj_index_list)
     {
-      adj_index_map[*p_adj_index] = 0;
+      fwabf_adj_map_set (adj_index_map, *p_adj_index, 0);
     }
   vec_free(*p_adj_index_list);
 
@@ -1295,13 +2073,14 @@ static void fwabf_default_route_refresh_dpo(fib_protocol_t proto)
       if (PREDICT_TRUE(FWABF_DPO_ADJACENCY_UP(dpo_i)))
       {
         adj_index = dpo_i.dpoi_index;
-        ASSERT(adj_index < FWABF_MAX_ADJ_INDEX);
         vec_add1(*p_adj_index_list, adj_index);
-        adj_index_map[adj_index] = 1;
+        fwabf_adj_map_set (adj_index_map, adj_index, 1);
       }
     }
   }
   dpo_reset (&dpo);
+
+  fwabf_flow_cache_invalidate ();
 }
 
 static void fwabf_default_route_init()
@@ -1416,11 +2195,11 @@ clib_error_t * fwabf_links_init (vlib_main_t * vm)
   }
 
   /*
-   * Initialize array of adjacencies, elements of which are labels.
-   * We preallocate it as number of adjacencies is limited by 0xFFFF.
+   * Initialize maps of adjacencies, elements of which are labels and links.
+   * The maps grow on demand, see fwabf_adj_map.h.
    */
-  vec_validate_init_empty(adj_indexes_to_labels,           FWABF_MAX_ADJ_INDEX, FWABF_INVALID_LABEL);
-  vec_validate_init_empty(adj_indexes_to_reachable_links, FWABF_MAX_ADJ_INDEX, INDEX_INVALID);
+  fwabf_adj_map_init(&adj_indexes_to_labels,          FWABF_INVALID_LABEL);
+  fwabf_adj_map_init(&adj_indexes_to_reachable_links, INDEX_INVALID);
 
   /*
    * Initialize default route adjacencies. They might be needed by Policy.
@@ -1436,10 +2215,10 @@ clib_error_t * fwabf_links_init (vlib_main_t * vm)
   fib_node_init (&dr->dr6.fib_node, dr->fib_node_type);
   dr->dr4.fib_entry_index        = ~0;
   dr->dr4.fib_prefix.fp_proto    = FIB_PROTOCOL_IP4;
-  vec_validate_init_empty(dr->dr4.adj_index_map, FWABF_MAX_ADJ_INDEX, 0);
+  fwabf_adj_map_init(&dr->dr4.adj_index_map, 0);
   dr->dr6.fib_entry_index        = ~0;
   dr->dr6.fib_prefix.fp_proto    = FIB_PROTOCOL_IP6;
-  vec_validate_init_empty(dr->dr6.adj_index_map, FWABF_MAX_ADJ_INDEX, 0);
+  fwabf_adj_map_init(&dr->dr6.adj_index_map, 0);
 
   return (NULL);
 }
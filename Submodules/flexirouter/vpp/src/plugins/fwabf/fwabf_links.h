@@ -101,6 +101,40 @@ extern u32 fwabf_links_add_interface (
                         const fwabf_label_t     fwlabel,
                         const fib_route_path_t* rpath);
 
+/**
+ * Creates per thread counters of label and exports them into stats segment
+ * as /fwabf/label/<label>. Should be called for every label that is used by
+ * links or by policies, before it is used by datapath.
+ *
+ * @param fwlabel   the label.
+ */
+extern void fwabf_links_label_counters_validate (fwabf_label_t fwlabel);
+
+/**
+ * Sets quality of link. Should be called by main thread.
+ * Used by the 'fwabf quality' CLI and by the link prober, see fwabf_probe.h.
+ *
+ * @param sw_if_index   index of VPP software interface associated with Link.
+ * @param loss          loss in percents, 100 means the link is down.
+ *                      ~0 if should not be changed.
+ * @param delay         delay in milliseconds, ~0 if should not be changed.
+ * @param jitter        jitter in milliseconds, ~0 if should not be changed.
+ * @return 0 on success, error code otherwise.
+ */
+extern u32 fwabf_links_set_quality (u32 sw_if_index, u32 loss, u32 delay, u32 jitter);
+
+/**
+ * Sets weight and capacity of link used by the weighted link selection.
+ * Should be called by main thread.
+ *
+ * @param sw_if_index   index of VPP software interface associated with Link.
+ * @param weight        relative weight of link, ~0 if should not be changed.
+ * @param bandwidth     capacity of link in Mbps, 0 if unknown,
+ *                      ~0 if should not be changed.
+ * @return 0 on success, error code otherwise.
+ */
+extern u32 fwabf_links_set_weight (u32 sw_if_index, u32 weight, u32 bandwidth);
+
 /**
  * Delets FWABF Link object.
  *
@@ -110,22 +144,83 @@ extern u32 fwabf_links_add_interface (
 extern u32 fwabf_links_del_interface (const u32 sw_if_index);
 
 /**
- * Verifies if link satisfies quality requirements according
- * to packet Service Class demands matched by ACL tag
+ * Creates object that keeps candidate links for quality based selection
+ * out of the set of labels. The candidates are recalculated on every change
+ * in quality or in reachability of links.
+ *
+ * @param labels  list of labels, e.g. labels of policy link group.
+ *                The list is copied.
+ * @return index of the created object.
+ */
+extern u32 fwabf_links_quality_candidates_add (fwabf_label_t* labels);
+
+/**
+ * Deletes object created by fwabf_links_quality_candidates_add().
  *
- * @param fwlabel      the label to be used to find labeled tunnel DPO-s
- * @param sc           traffic service class from ACL matched by packet
- * @param reduce_level if there is no available links which satisfy criteria for service class requirements
- *                     we reduce requirements to the next level and check again
- * @return 1 if link quality requirements are satisfied, 0 otherwise.
+ * @param index  index of the object.
+ */
+extern void fwabf_links_quality_candidates_del (u32 index);
+
+/**
+ * Selects link out of the set of labels that satisfies quality requirements
+ * according to packet Service Class demands matched by ACL tag.
+ * If there is no available links which satisfy criteria for service class
+ * requirements, the requirements are reduced to the next level and links are
+ * checked again.
+ *
+ * @param candidates    index of the candidates object created for the set of
+ *                      labels by fwabf_links_quality_candidates_add().
+ * @param sc            traffic service class from ACL matched by packet
+ * @param lb            the result of FIB lookup. It is DPO of Load Balance type.
+ * @param is_default_route_lb if true, the FIB lookup result is ignored and
+ *                      the link is selected out of all labeled links.
+ * @param flow_hash     the flow hash to choose between links of the same quality.
+ * @return DPO to be used for forwarding or DPO_INVALID if no link was found.
  */
 extern dpo_id_t fwabf_links_get_quality_dpo (
-                        fwabf_label_t*                  policy_labels,
+                        u32                             candidates,
                         fwabf_quality_service_class_t   sc,
                         const load_balance_t*           lb,
                         u32                             is_default_route_lb,
                         u32                             flow_hash);
 
+/**
+ * Creates object that keeps table of candidate links for weighted selection
+ * out of the set of labels. The table is recalculated on every change
+ * in reachability of links and periodically on change in their utilization.
+ *
+ * @param labels  list of labels, e.g. labels of policy link group.
+ *                The list is copied.
+ * @return index of the created object.
+ */
+extern u32 fwabf_links_weighted_candidates_add (fwabf_label_t* labels);
+
+/**
+ * Deletes object created by fwabf_links_weighted_candidates_add().
+ *
+ * @param index  index of the object.
+ */
+extern void fwabf_links_weighted_candidates_del (u32 index);
+
+/**
+ * Selects link out of the set of labels in proportion to link weights and
+ * available bandwidth. The selection is sticky for flow as long as the
+ * weights are not changed significantly.
+ *
+ * @param candidates    index of the candidates object created for the set of
+ *                      labels by fwabf_links_weighted_candidates_add().
+ * @param lb            the result of FIB lookup. It is DPO of Load Balance type.
+ * @param is_default_route_lb if true, the FIB lookup result is ignored and
+ *                      the link is selected out of all labeled links.
+ * @param flow_hash     the flow hash to choose the link.
+ * @return DPO to be used for forwarding or DPO_INVALID if no link was found.
+ */
+extern dpo_id_t fwabf_links_get_weighted_dpo (
+                        u32                   candidates,
+                        const load_balance_t* lb,
+                        u32                   is_default_route_lb,
+                        u32                   flow_hash);
+
 /**
  * Intersects DPO-s retrieved by FIB lookup with DPO-s that belong to labeled
  * tunnels. Only reachable tunnels are considered.
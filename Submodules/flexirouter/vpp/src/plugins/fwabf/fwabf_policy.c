@@ -67,6 +67,7 @@
 
 
 #include <plugins/fwabf/fwabf_policy.h>
+#include <plugins/fwabf/fwabf_flow_cache.h>
 
 #include <vlib/vlib.h>
 #include <vnet/dpo/dpo.h>
@@ -111,6 +112,10 @@ static fwabf_policy_t *abf_policy_db;
 
 static void fwabf_policy_action_delete (fwabf_policy_action_t* action);
 
+#define FWABF_POLICY_COUNT(_policy, _counter) \
+    vlib_increment_combined_counter ((_policy)->counters, thread_index, \
+                                     FWABF_POLICY_COUNTER_##_counter, 1, n_bytes)
+
 fwabf_policy_t *
 fwabf_policy_get (u32 index)
 {
@@ -148,6 +153,8 @@ u32
 fwabf_policy_add (u32 policy_id, u32 acl_index, fwabf_policy_action_t * action, u8 override_default_route)
 {
   fwabf_policy_t*            p;
+  fwabf_policy_link_group_t* group;
+  fwabf_label_t*             label;
   u32 pi;
 
   pi = fwabf_policy_find (policy_id);
@@ -165,17 +172,32 @@ fwabf_policy_add (u32 policy_id, u32 acl_index, fwabf_policy_action_t * action,
   p->action = *action;
   p->override_default_route = override_default_route;
 
+  vec_foreach (group, p->action.link_groups)
+    {
+      vec_foreach (label, group->links)
+        {
+          fwabf_links_label_counters_validate (*label);
+        }
+      group->quality_candidates = (group->alg == FWABF_SELECTION_QUALITY) ?
+                  fwabf_links_quality_candidates_add (group->links) : INDEX_INVALID;
+      group->weighted_candidates = (group->alg == FWABF_SELECTION_WEIGHTED) ?
+                  fwabf_links_weighted_candidates_add (group->links) : INDEX_INVALID;
+    }
+
   p->refCounter = 0;
 
-  p->counter_matched  = 0;
-  p->counter_applied  = 0;
-  p->counter_fallback = 0;
-  p->counter_dropped  = 0;
+  p->counters = clib_mem_alloc (sizeof (*p->counters));
+  clib_memset (p->counters, 0, sizeof (*p->counters));
+  p->counters->name               = "fwabf-policy";
+  p->counters->stat_segment_name  = (char *) format (0, "/fwabf/policy/%d%c", policy_id, 0);
+  vlib_validate_combined_counter (p->counters, FWABF_POLICY_N_COUNTERS - 1);
+  vlib_clear_combined_counters (p->counters);
 
   /*
     * add this new policy to the DB
     */
   hash_set (abf_policy_db, policy_id, pi);
+  fwabf_flow_cache_invalidate ();
   return 0;
 }
 
@@ -207,8 +229,19 @@ fwabf_policy_delete (u32 policy_id)
    */
   fwabf_policy_action_delete(&action);
 
+  /*
+   * Free counters under barrier, as workers might still use them.
+   */
+  vlib_worker_thread_barrier_sync (vlib_get_main ());
+  vlib_free_combined_counter (p->counters);
+  vec_free (p->counters->stat_segment_name);
+  clib_mem_free (p->counters);
+  p->counters = NULL;
+  vlib_worker_thread_barrier_release (vlib_get_main ());
+
   hash_unset (abf_policy_db, policy_id);
   pool_put (abf_policy_pool, p);
+  fwabf_flow_cache_invalidate ();
   return (0);
 }
 
@@ -218,6 +251,10 @@ static void fwabf_policy_action_delete (fwabf_policy_action_t* action)
 
   vec_foreach (group, action->link_groups)
     {
+      if (group->quality_candidates != INDEX_INVALID)
+        fwabf_links_quality_candidates_del (group->quality_candidates);
+      if (group->weighted_candidates != INDEX_INVALID)
+        fwabf_links_weighted_candidates_del (group->weighted_candidates);
       vec_free (group->links);
     }
   vec_free (action->link_groups);
@@ -308,8 +345,12 @@ u32 fwabf_policy_get_dpo_ip4 (
   u32                        i;
   u32                        flow_hash = 0;
   ip4_header_t*              ip = vlib_buffer_get_current (b);
+  u32                        thread_index = vlib_get_thread_index ();
+  u32                        n_bytes = vlib_buffer_length_in_chain (vlib_get_main (), b);
 
-  p->counter_matched++;  /*This function is called on ACL lookup hit only*/
+  /*This function is called on ACL lookup hit only*/
+  vlib_increment_combined_counter (p->counters, thread_index,
+                                   FWABF_POLICY_COUNTER_MATCHED, 1, n_bytes);
 
   /*
    * Find out if the FIB lookup result (lb) has the default route.
@@ -373,7 +414,7 @@ u32 fwabf_policy_get_dpo_ip4 (
             *dpo    = FWABF_POLICY_GET_DPO(p, fwlabel, lb, is_default_route_lb, DPO_PROTO_IP4);
             if (dpo_id_is_valid (dpo))
               {
-                p->counter_applied++;
+                FWABF_POLICY_COUNT(p, APPLIED);
                 return 1;
               }
           }
@@ -387,10 +428,26 @@ u32 fwabf_policy_get_dpo_ip4 (
           {
             if (!flow_hash)
               flow_hash = ip4_compute_flow_hash (ip, IP_FLOW_HASH_DEFAULT);
-            *dpo = fwabf_links_get_quality_dpo (group->links, sc, lb, is_default_route_lb, flow_hash);
+            *dpo = fwabf_links_get_quality_dpo (group->quality_candidates, sc, lb, is_default_route_lb, flow_hash);
             if (dpo_id_is_valid (dpo))
               {
-                p->counter_applied++;
+                FWABF_POLICY_COUNT(p, APPLIED);
+                return 1;
+              }
+          }
+
+        /*
+        * Weighted link selection.
+        * Select link in proportion to link weights and available bandwidth.
+        */
+        if (group->alg == FWABF_SELECTION_WEIGHTED)
+          {
+            if (!flow_hash)
+              flow_hash = ip4_compute_flow_hash (ip, IP_FLOW_HASH_DEFAULT);
+            *dpo = fwabf_links_get_weighted_dpo (group->weighted_candidates, lb, is_default_route_lb, flow_hash);
+            if (dpo_id_is_valid (dpo))
+              {
+                FWABF_POLICY_COUNT(p, APPLIED);
                 return 1;
               }
           }
@@ -406,7 +463,7 @@ u32 fwabf_policy_get_dpo_ip4 (
           *dpo = FWABF_POLICY_GET_DPO(p, *pfwlabel, lb, is_default_route_lb, DPO_PROTO_IP4);
           if (dpo_id_is_valid (dpo))
             {
-              p->counter_applied++;
+              FWABF_POLICY_COUNT(p, APPLIED);
               return 1;
             }
         }
@@ -436,7 +493,7 @@ u32 fwabf_policy_get_dpo_ip4 (
             *dpo    = FWABF_POLICY_GET_DPO(p, fwlabel, lb, is_default_route_lb, DPO_PROTO_IP4);
             if (dpo_id_is_valid (dpo))
               {
-                p->counter_applied++;
+                FWABF_POLICY_COUNT(p, APPLIED);
                 return 1;
               }
           }
@@ -449,10 +506,26 @@ u32 fwabf_policy_get_dpo_ip4 (
           {
             if (!flow_hash)
               flow_hash = ip4_compute_flow_hash (ip, IP_FLOW_HASH_DEFAULT);
-            *dpo = fwabf_links_get_quality_dpo (group->links, sc, lb, is_default_route_lb, flow_hash);
+            *dpo = fwabf_links_get_quality_dpo (group->quality_candidates, sc, lb, is_default_route_lb, flow_hash);
+            if (dpo_id_is_valid (dpo))
+              {
+                FWABF_POLICY_COUNT(p, APPLIED);
+                return 1;
+              }
+          }
+
+        /*
+        * Weighted link selection.
+        * Select link in proportion to link weights and available bandwidth.
+        */
+        if (group->alg == FWABF_SELECTION_WEIGHTED)
+          {
+            if (!flow_hash)
+              flow_hash = ip4_compute_flow_hash (ip, IP_FLOW_HASH_DEFAULT);
+            *dpo = fwabf_links_get_weighted_dpo (group->weighted_candidates, lb, is_default_route_lb, flow_hash);
             if (dpo_id_is_valid (dpo))
               {
-                p->counter_applied++;
+                FWABF_POLICY_COUNT(p, APPLIED);
                 return 1;
               }
           }
@@ -466,7 +539,7 @@ u32 fwabf_policy_get_dpo_ip4 (
           *dpo = FWABF_POLICY_GET_DPO(p, *pfwlabel, lb, is_default_route_lb, DPO_PROTO_IP4);
           if (dpo_id_is_valid (dpo))
             {
-              p->counter_applied++;
+              FWABF_POLICY_COUNT(p, APPLIED);
               return 1;
             }
         }
@@ -480,11 +553,11 @@ u32 fwabf_policy_get_dpo_ip4 (
    */
   if (PREDICT_TRUE(action->fallback==FWABF_FALLBACK_DEFAULT_ROUTE))
     {
-      p->counter_fallback++;
+      FWABF_POLICY_COUNT(p, FALLBACK);
       return 0;
     }
   dpo_copy(dpo, drop_dpo_get(DPO_PROTO_IP4));
-  p->counter_dropped++;
+  FWABF_POLICY_COUNT(p, DROPPED);
   return 1;
 }
 
@@ -516,8 +589,12 @@ u32 fwabf_policy_get_dpo_ip6 (
   u32                        i;
   u32                        flow_hash = 0;
   ip6_header_t*              ip = vlib_buffer_get_current (b);
+  u32                        thread_index = vlib_get_thread_index ();
+  u32                        n_bytes = vlib_buffer_length_in_chain (vlib_get_main (), b);
 
-  p->counter_matched++;  /*This function is called on ACL lookup hit only*/
+  /*This function is called on ACL lookup hit only*/
+  vlib_increment_combined_counter (p->counters, thread_index,
+                                   FWABF_POLICY_COUNTER_MATCHED, 1, n_bytes);
 
   /*
    * Find out if the FIB lookup result (lb) has the default route.
@@ -581,7 +658,7 @@ u32 fwabf_policy_get_dpo_ip6 (
             *dpo    = FWABF_POLICY_GET_DPO(p, fwlabel, lb, is_default_route_lb, DPO_PROTO_IP6);
             if (dpo_id_is_valid (dpo))
               {
-                p->counter_applied++;
+                FWABF_POLICY_COUNT(p, APPLIED);
                 return 1;
               }
           }
@@ -594,10 +671,26 @@ u32 fwabf_policy_get_dpo_ip6 (
           {
             if (!flow_hash)
               flow_hash = ip6_compute_flow_hash (ip, IP_FLOW_HASH_DEFAULT);
-            *dpo = fwabf_links_get_quality_dpo (group->links, sc, lb, is_default_route_lb, flow_hash);
+            *dpo = fwabf_links_get_quality_dpo (group->quality_candidates, sc, lb, is_default_route_lb, flow_hash);
             if (dpo_id_is_valid (dpo))
               {
-                p->counter_applied++;
+                FWABF_POLICY_COUNT(p, APPLIED);
+                return 1;
+              }
+          }
+
+        /*
+        * Weighted link selection.
+        * Select link in proportion to link weights and available bandwidth.
+        */
+        if (group->alg == FWABF_SELECTION_WEIGHTED)
+          {
+            if (!flow_hash)
+              flow_hash = ip6_compute_flow_hash (ip, IP_FLOW_HASH_DEFAULT);
+            *dpo = fwabf_links_get_weighted_dpo (group->weighted_candidates, lb, is_default_route_lb, flow_hash);
+            if (dpo_id_is_valid (dpo))
+              {
+                FWABF_POLICY_COUNT(p, APPLIED);
                 return 1;
               }
           }
@@ -613,7 +706,7 @@ u32 fwabf_policy_get_dpo_ip6 (
           *dpo = FWABF_POLICY_GET_DPO(p, *pfwlabel, lb, is_default_route_lb, DPO_PROTO_IP6);
           if (dpo_id_is_valid (dpo))
             {
-              p->counter_applied++;
+              FWABF_POLICY_COUNT(p, APPLIED);
               return 1;
             }
         }
@@ -643,7 +736,7 @@ u32 fwabf_policy_get_dpo_ip6 (
             *dpo    = FWABF_POLICY_GET_DPO(p, fwlabel, lb, is_default_route_lb, DPO_PROTO_IP6);
             if (dpo_id_is_valid (dpo))
               {
-                p->counter_applied++;
+                FWABF_POLICY_COUNT(p, APPLIED);
                 return 1;
               }
           }
@@ -657,10 +750,26 @@ u32 fwabf_policy_get_dpo_ip6 (
           {
             if (!flow_hash)
               flow_hash = ip6_compute_flow_hash (ip, IP_FLOW_HASH_DEFAULT);
-            *dpo = fwabf_links_get_quality_dpo (group->links, sc, lb, is_default_route_lb, flow_hash);
+            *dpo = fwabf_links_get_quality_dpo (group->quality_candidates, sc, lb, is_default_route_lb, flow_hash);
             if (dpo_id_is_valid (dpo))
               {
-                p->counter_applied++;
+                FWABF_POLICY_COUNT(p, APPLIED);
+                return 1;
+              }
+          }
+
+        /*
+        * Weighted link selection.
+        * Select link in proportion to link weights and available bandwidth.
+        */
+        if (group->alg == FWABF_SELECTION_WEIGHTED)
+          {
+            if (!flow_hash)
+              flow_hash = ip6_compute_flow_hash (ip, IP_FLOW_HASH_DEFAULT);
+            *dpo = fwabf_links_get_weighted_dpo (group->weighted_candidates, lb, is_default_route_lb, flow_hash);
+            if (dpo_id_is_valid (dpo))
+              {
+                FWABF_POLICY_COUNT(p, APPLIED);
                 return 1;
               }
           }
@@ -671,7 +780,7 @@ u32 fwabf_policy_get_dpo_ip6 (
           *dpo = FWABF_POLICY_GET_DPO(p, *pfwlabel, lb, is_default_route_lb, DPO_PROTO_IP6);
           if (dpo_id_is_valid (dpo))
             {
-              p->counter_applied++;
+              FWABF_POLICY_COUNT(p, APPLIED);
               return 1;
             }
         }
@@ -685,11 +794,11 @@ u32 fwabf_policy_get_dpo_ip6 (
    */
   if (PREDICT_TRUE(action->fallback==FWABF_FALLBACK_DEFAULT_ROUTE))
     {
-      p->counter_fallback++;
+      FWABF_POLICY_COUNT(p, FALLBACK);
       return 0;
     }
   dpo_copy(dpo, drop_dpo_get(DPO_PROTO_IP6));
-  p->counter_dropped++;
+  FWABF_POLICY_COUNT(p, DROPPED);
   return 1;
 }
 
@@ -747,6 +856,10 @@ unformat_link_group (unformat_input_t * input, va_list * args)
         {
           group->alg = FWABF_SELECTION_QUALITY;
         }
+      else if (unformat (input, "weighted"))
+        {
+          group->alg = FWABF_SELECTION_WEIGHTED;
+        }
       else if (unformat (input, "labels %U", unformat_labels, vm, &group->links))
         {
           break;
@@ -886,7 +999,7 @@ fwabf_policy_cmd (vlib_main_t * vm, unformat_input_t * main_input, vlib_cli_comm
 VLIB_CLI_COMMAND (fwabf_policy_cmd_node, static) = {
   .path = "fwabf policy",
   .function = fwabf_policy_cmd,
-  .short_help = "fwabf policy [add|del] id <index> acl <index> [override_default_route] action [select_group random] [fallback drop] [group <id>] [random|quality] labels <label1,label2,...> [group <id> [random|quality] labels <label1,label2,...>] ...",
+  .short_help = "fwabf policy [add|del] id <index> acl <index> [override_default_route] action [select_group random] [fallback drop] [group <id>] [random|quality|weighted] labels <label1,label2,...> [group <id> [random|quality|weighted] labels <label1,label2,...>] ...",
   .is_mp_safe = 1,
 };
 /* *INDENT-ON* */
@@ -906,6 +1019,9 @@ format_link_group (u8 * s, va_list * args)
     case FWABF_SELECTION_QUALITY:
       s_alg = "quality";
       break;
+    case FWABF_SELECTION_WEIGHTED:
+      s_alg = "weighted";
+      break;
     case FWABF_SELECTION_ORDERED:
       s_alg = "priority";
   }
@@ -952,11 +1068,17 @@ static u8 *
 format_abf (u8 * s, va_list * args)
 {
   fwabf_policy_t *p = va_arg (*args, fwabf_policy_t *);
+  vlib_counter_t matched, applied, fallback, dropped;
+
+  vlib_get_combined_counter (p->counters, FWABF_POLICY_COUNTER_MATCHED,  &matched);
+  vlib_get_combined_counter (p->counters, FWABF_POLICY_COUNTER_APPLIED,  &applied);
+  vlib_get_combined_counter (p->counters, FWABF_POLICY_COUNTER_FALLBACK, &fallback);
+  vlib_get_combined_counter (p->counters, FWABF_POLICY_COUNTER_DROPPED,  &dropped);
 
   s = format (s, "fwabf:[%d]: policy:%d acl:%d override_default_route:%d\n",
 	      p - abf_policy_pool, p->id, p->acl, p->override_default_route);
-  s = format (s, " counters: matched:%d applied:%d fallback:%d dropped:%d\n",
-	      p->counter_matched, p->counter_applied, p->counter_fallback, p->counter_dropped);
+  s = format (s, " counters: matched:%Ld applied:%Ld fallback:%Ld dropped:%Ld\n",
+	      matched.packets, applied.packets, fallback.packets, dropped.packets);
   s = format (s, "%U", format_action, &p->action);
   return s;
 }
@@ -56,7 +56,8 @@
 typedef enum fwabf_selection_alg_t_ {
     FWABF_SELECTION_RANDOM,
     FWABF_SELECTION_ORDERED,
-    FWABF_SELECTION_QUALITY
+    FWABF_SELECTION_QUALITY,
+    FWABF_SELECTION_WEIGHTED
 } fwabf_selection_alg_t;
 
 typedef struct fwabf_policy_link_group_t_ {
@@ -68,6 +69,8 @@ typedef struct fwabf_policy_link_group_t_ {
      */
     u32                   n_links_minus_1;
     u32                   n_links_pow2_mask;  /*0xFF...*/
+    u32                   quality_candidates; /*see fwabf_links_quality_candidates_add()*/
+    u32                   weighted_candidates; /*see fwabf_links_weighted_candidates_add()*/
 } fwabf_policy_link_group_t;
 
 typedef enum {
@@ -89,6 +92,19 @@ typedef struct fwabf_policy_action_t_
 
 } fwabf_policy_action_t;
 
+/**
+ * Policy counters. They are kept per thread and are exported into stats
+ * segment as /fwabf/policy/<policy id> combined counter (packets & bytes),
+ * where the counter index is one of the values below.
+ */
+typedef enum fwabf_policy_counter_t_ {
+    FWABF_POLICY_COUNTER_MATCHED,   /*ACL lookup hit*/
+    FWABF_POLICY_COUNTER_APPLIED,   /*Policy applied successfully*/
+    FWABF_POLICY_COUNTER_FALLBACK,  /*Policy failed so fallback to default routing*/
+    FWABF_POLICY_COUNTER_DROPPED,   /*Policy failed so drop the packet*/
+    FWABF_POLICY_N_COUNTERS
+} fwabf_policy_counter_t;
+
 typedef struct fwabf_policy_t_
 {
   /**
@@ -120,12 +136,9 @@ typedef struct fwabf_policy_t_
   u32 refCounter;
 
   /**
-   * Counters.
+   * Counters, see fwabf_policy_counter_t.
    */
-  u32 counter_matched;      /*ACL lookup hit*/
-  u32 counter_applied;      /*Policy applied successfully*/
-  u32 counter_fallback;     /*Policy failed so fallback to default routing*/
-  u32 counter_dropped;      /*Policy failed so drop the packet*/
+  vlib_combined_counter_main_t* counters;
 
 } fwabf_policy_t;
 
@@ -172,6 +185,36 @@ extern u32 fwabf_policy_get_dpo_ip6 (
                                 fwabf_quality_service_class_t   sc,
                                 dpo_id_t*                       dpo);
 
+/**
+ * Update policy counters for packet, the policy DPO of which was taken
+ * from the flow cache and not by fwabf_policy_get_dpo_ip4/ip6().
+ *
+ * @param index         index of fwabf_policy_t in pool.
+ * @param thread_index  the thread that handles the packet.
+ * @param n_bytes       the packet length.
+ * @param match         the cached fwabf_policy_get_dpo_ip4/ip6() return value.
+ * @param dpo           the cached DPO.
+ */
+always_inline void
+fwabf_policy_account_cached (index_t index, u32 thread_index, u32 n_bytes,
+                             u32 match, const dpo_id_t * dpo)
+{
+  fwabf_policy_t*        p = fwabf_policy_get (index);
+  fwabf_policy_counter_t counter;
+
+  if (PREDICT_FALSE (match == 0))
+    counter = FWABF_POLICY_COUNTER_FALLBACK;
+  else if (PREDICT_FALSE (dpo->dpoi_type == DPO_DROP))
+    counter = FWABF_POLICY_COUNTER_DROPPED;
+  else
+    counter = FWABF_POLICY_COUNTER_APPLIED;
+
+  vlib_increment_combined_counter (p->counters, thread_index,
+                                   FWABF_POLICY_COUNTER_MATCHED, 1, n_bytes);
+  vlib_increment_combined_counter (p->counters, thread_index,
+                                   counter, 1, n_bytes);
+}
+
 /**
  * Find a ABF object from the client's policy ID
  *
@@ -0,0 +1,736 @@
+/*
+ *  Copyright (C) 2023 flexiWAN Ltd.
+ *  This file is part of the FWABF plugin.
+ *  The FWABF plugin is fork of the FDIO VPP ABF plugin.
+ *  It enhances ABF with functionality required for Flexiwan Multi-Link feature.
+ *  For more details see official documentation on the Flexiwan Multi-Link.
+ */
+
+/*
+ * This file implements the active link quality prober: the probe sender and
+ * receiver nodes, the quality sync process and CLI. See fwabf_probe.h for
+ * details.
+ */
+
+#include <plugins/fwabf/fwabf_probe.h>
+#include <plugins/fwabf/fwabf_links.h>
+
+#include <vnet/ip/ip4.h>
+#include <vnet/udp/udp_local.h>
+#include <vnet/udp/udp_packet.h>
+
+fwabf_probe_main_t fwabf_probe_main;
+
+vlib_node_registration_t fwabf_probe_tx_node;
+vlib_node_registration_t fwabf_probe_input_node;
+vlib_node_registration_t fwabf_probe_process_node;
+
+#define foreach_fwabf_probe_error                          \
+_(SENT,       "probes sent")                               \
+_(NO_BUFFER,  "no buffers for probes")                     \
+_(REFLECTED,  "probe requests reflected")                  \
+_(REPLY,      "probe replies received")                    \
+_(LATE,       "late or unknown probe replies")             \
+_(INVALID,    "invalid probes")
+
+typedef enum {
+#define _(sym,str) FWABF_PROBE_ERROR_##sym,
+  foreach_fwabf_probe_error
+#undef _
+  FWABF_PROBE_N_ERROR,
+} fwabf_probe_error_t;
+
+static char * fwabf_probe_error_strings[] = {
+#define _(sym,string) string,
+  foreach_fwabf_probe_error
+#undef _
+};
+
+typedef enum {
+  FWABF_PROBE_INPUT_NEXT_DROP,
+  FWABF_PROBE_INPUT_NEXT_IP4_LOOKUP,
+  FWABF_PROBE_INPUT_N_NEXT,
+} fwabf_probe_input_next_t;
+
+typedef enum {
+  FWABF_PROBE_EVENT_LINK_STATE = 1,
+} fwabf_probe_event_t;
+
+typedef struct fwabf_probe_packet_t_ {
+  ip4_header_t         ip4;
+  udp_header_t         udp;
+  fwabf_probe_header_t probe;
+} __attribute__ ((packed)) fwabf_probe_packet_t;
+
+
+static void
+fwabf_probe_links_validate (u32 sw_if_index)
+{
+  fwabf_probe_main_t* pm = &fwabf_probe_main;
+  u32                 i, old_len = vec_len (pm->links);
+
+  if (PREDICT_TRUE (sw_if_index < old_len))
+    return;
+
+  /* Datapath threads access the vector, so realloc it under barrier */
+  vlib_worker_thread_barrier_sync (vlib_get_main ());
+  vec_validate_aligned (pm->links, sw_if_index, CLIB_CACHE_LINE_BYTES);
+  for (i = old_len; i < vec_len (pm->links); i++)
+    {
+      pm->links[i].sw_if_index  = INDEX_INVALID;
+      pm->links[i].timer_handle = ~0;
+      pm->links[i].dpo          = (dpo_id_t) DPO_INVALID;
+    }
+  vlib_worker_thread_barrier_release (vlib_get_main ());
+}
+
+static void
+fwabf_probe_link_refresh_src (fwabf_probe_link_t * pl)
+{
+  ip4_address_t* addr;
+
+  addr = ip4_interface_first_address (&ip4_main, pl->sw_if_index, NULL);
+  pl->src.as_u32 = addr ? addr->as_u32 : 0;
+}
+
+void fwabf_probe_link_update (u32 sw_if_index, dpo_proto_t dpo_proto,
+                              const ip46_address_t * via, const dpo_id_t * dpo)
+{
+  fwabf_probe_main_t* pm = &fwabf_probe_main;
+  fwabf_probe_link_t* pl;
+
+  if (dpo_proto != DPO_PROTO_IP4)
+    return;
+
+  fwabf_probe_links_validate (sw_if_index);
+  pl = vec_elt_at_index (pm->links, sw_if_index);
+
+  pl->via = via->ip4;
+  if (!pl->peer_configured)
+    pl->peer = via->ip4;
+  dpo_stack_from_node (fwabf_probe_tx_node.index, &pl->dpo, dpo);
+
+  pl->sw_if_index = sw_if_index;
+  fwabf_probe_link_refresh_src (pl);
+
+  CLIB_MEMORY_STORE_BARRIER ();
+  pm->config_epoch++;
+}
+
+void fwabf_probe_link_del (u32 sw_if_index)
+{
+  fwabf_probe_main_t* pm = &fwabf_probe_main;
+  fwabf_probe_link_t* pl;
+
+  if (sw_if_index >= vec_len (pm->links))
+    return;
+  pl = vec_elt_at_index (pm->links, sw_if_index);
+  if (pl->sw_if_index == INDEX_INVALID)
+    return;
+
+  /*
+   * The prober thread stops the link timer on the next run.
+   * It might be sending probe into the link DPO right now,
+   * so the DPO is released under barrier.
+   */
+  vlib_worker_thread_barrier_sync (vlib_get_main ());
+  pl->sw_if_index    = INDEX_INVALID;
+  pl->quality_manual = 0;
+  dpo_reset (&pl->dpo);
+  vlib_worker_thread_barrier_release (vlib_get_main ());
+  pm->config_epoch++;
+}
+
+void fwabf_probe_link_set_manual (u32 sw_if_index, u8 is_manual)
+{
+  fwabf_probe_main_t* pm = &fwabf_probe_main;
+
+  fwabf_probe_links_validate (sw_if_index);
+  pm->links[sw_if_index].quality_manual = is_manual;
+}
+
+/*
+ * Starts timers of new links and stops timers of removed links.
+ * Runs on the prober thread only, as the timer wheel is not thread safe.
+ */
+static void
+fwabf_probe_timers_sync (fwabf_probe_main_t * pm)
+{
+  fwabf_probe_link_t* pl;
+  u32                 ticks;
+
+  pm->timers_epoch = pm->config_epoch;
+  ticks = clib_max (1, (u32) (pm->interval / FWABF_PROBE_TIMER_TICK));
+
+  vec_foreach (pl, pm->links)
+    {
+      u32 sw_if_index = pl - pm->links;
+
+      if (pl->sw_if_index == INDEX_INVALID)
+        {
+          if (pl->timer_handle != ~0)
+            {
+              tw_timer_stop_2t_1w_2048sl (&pm->timer_wheel, pl->timer_handle);
+              pl->timer_handle = ~0;
+            }
+          continue;
+        }
+      if (pl->timer_handle != ~0)
+        continue;
+
+      pl->seq           = 0;
+      pl->n_lost_in_row = 0;
+      pl->is_up         = 1;
+      pl->loss          = 0;
+      pl->delay         = 0;
+      pl->jitter        = 0;
+      pl->last_rtt      = 0;
+      pl->n_sent        = 0;
+      pl->n_lost        = 0;
+      pl->rx_bitmap     = 0;
+      pl->timer_handle  =
+        tw_timer_start_2t_1w_2048sl (&pm->timer_wheel, sw_if_index, 0, ticks);
+    }
+}
+
+/*
+ * Evaluates the probe that was sent 'window' probes ago, as its reply
+ * should have been received by now, and updates the link quality.
+ * Returns 1 if the link went up or down, 0 otherwise.
+ */
+static int
+fwabf_probe_evaluate (fwabf_probe_main_t * pm, fwabf_probe_link_t * pl)
+{
+  u32 seq = pl->seq - pm->window;
+  u64 bit = 1ULL << (seq % FWABF_PROBE_RING_SIZE);
+  f64 rtt, d;
+  u8  was_up = pl->is_up;
+
+  if (pl->n_sent < pm->window)
+    return 0;
+
+  if (pl->rx_bitmap & bit)
+    {
+      rtt = pl->rtt[seq % FWABF_PROBE_RING_SIZE];
+      if (pl->last_rtt == 0)   /*first reply*/
+        {
+          pl->delay = rtt;
+        }
+      else
+        {
+          d = (rtt > pl->last_rtt) ? rtt - pl->last_rtt : pl->last_rtt - rtt;
+          pl->delay  += (rtt - pl->delay) / (1 << FWABF_PROBE_EWMA_SHIFT);
+          pl->jitter += (d - pl->jitter) / (1 << FWABF_PROBE_JITTER_EWMA_SHIFT);
+        }
+      pl->last_rtt      = rtt;
+      pl->loss         -= pl->loss / (1 << FWABF_PROBE_EWMA_SHIFT);
+      pl->n_lost_in_row = 0;
+      pl->is_up         = 1;
+    }
+  else
+    {
+      pl->loss += (100.0 - pl->loss) / (1 << FWABF_PROBE_EWMA_SHIFT);
+      pl->n_lost++;
+      pl->n_lost_in_row++;
+      if (pl->n_lost_in_row >= FWABF_PROBE_DOWN_COUNT)
+        pl->is_up = 0;
+    }
+  return (was_up != pl->is_up);
+}
+
+static void
+fwabf_probe_build (fwabf_probe_main_t * pm, fwabf_probe_link_t * pl,
+                   vlib_buffer_t * b, f64 now)
+{
+  fwabf_probe_packet_t* p = vlib_buffer_get_current (b);
+
+  clib_memset (p, 0, sizeof (*p));
+  p->ip4.ip_version_and_header_length = 0x45;
+  p->ip4.ttl              = 64;
+  p->ip4.protocol         = IP_PROTOCOL_UDP;
+  p->ip4.length           = clib_host_to_net_u16 (sizeof (*p));
+  p->ip4.src_address      = pl->src;
+  p->ip4.dst_address      = pl->peer;
+  p->ip4.checksum         = ip4_header_checksum (&p->ip4);
+  p->udp.src_port         = clib_host_to_net_u16 (pm->udp_port);
+  p->udp.dst_port         = clib_host_to_net_u16 (pm->udp_port);
+  p->udp.length           = clib_host_to_net_u16 (sizeof (*p) - sizeof (p->ip4));
+  p->probe.version        = FWABF_PROBE_VERSION;
+  p->probe.type           = FWABF_PROBE_TYPE_REQUEST;
+  p->probe.link_id        = clib_host_to_net_u32 (pl->sw_if_index);
+  p->probe.seq            = clib_host_to_net_u32 (pl->seq);
+  p->probe.timestamp      = now;
+
+  b->current_length = sizeof (*p);
+  b->flags |= VNET_BUFFER_F_LOCALLY_ORIGINATED;
+  vnet_buffer (b)->sw_if_index[VLIB_RX] = pl->sw_if_index;
+  vnet_buffer (b)->sw_if_index[VLIB_TX] = ~0;
+  vnet_buffer (b)->ip.adj_index[VLIB_TX] = pl->dpo.dpoi_index;
+}
+
+/*
+ * The probe sender. It is polled on the prober thread only.
+ * It runs the timer wheel of links and sends probes of links with expired
+ * timers directly into the link DPO.
+ */
+static uword
+fwabf_probe_tx_node_fn (vlib_main_t * vm, vlib_node_runtime_t * node,
+                        vlib_frame_t * frame)
+{
+  fwabf_probe_main_t* pm  = &fwabf_probe_main;
+  f64                 now = vlib_time_now (vm);
+  fwabf_probe_link_t* pl;
+  vlib_buffer_t*      b;
+  u32*                handle;
+  u32                 sw_if_index, bi, ticks;
+  u32                 n_no_buffer = 0;
+
+  if (PREDICT_FALSE (pm->timers_epoch != pm->config_epoch))
+    fwabf_probe_timers_sync (pm);
+
+  vec_reset_length (pm->expired);
+  pm->expired = tw_timer_expire_timers_vec_2t_1w_2048sl (&pm->timer_wheel, now,
+                                                         pm->expired);
+  if (PREDICT_TRUE (vec_len (pm->expired) == 0))
+    return 0;
+
+  vec_reset_length (pm->buffers);
+  vec_reset_length (pm->nexts);
+  ticks = clib_max (1, (u32) (pm->interval / FWABF_PROBE_TIMER_TICK));
+
+  vec_foreach (handle, pm->expired)
+    {
+      sw_if_index = *handle & 0x7FFFFFFF;
+      if (sw_if_index >= vec_len (pm->links))
+        continue;
+      pl = vec_elt_at_index (pm->links, sw_if_index);
+      pl->timer_handle = ~0;
+      if (pl->sw_if_index == INDEX_INVALID)
+        continue;     /*link was removed*/
+
+      pl->timer_handle =
+        tw_timer_start_2t_1w_2048sl (&pm->timer_wheel, sw_if_index, 0, ticks);
+
+      if (PREDICT_FALSE (pl->peer.as_u32 == 0 || pl->src.as_u32 == 0 ||
+                         !dpo_id_is_valid (&pl->dpo)))
+        continue;
+
+      if (PREDICT_FALSE (vlib_buffer_alloc (vm, &bi, 1) != 1))
+        {
+          n_no_buffer++;
+          continue;
+        }
+
+      if (fwabf_probe_evaluate (pm, pl))
+        vlib_process_signal_event_mt (vm, fwabf_probe_process_node.index,
+                                      FWABF_PROBE_EVENT_LINK_STATE, sw_if_index);
+
+      /* The slot of the new probe is free, as the probe that used it
+         was evaluated long ago */
+      clib_atomic_fetch_and (&pl->rx_bitmap,
+                             ~(1ULL << (pl->seq % FWABF_PROBE_RING_SIZE)));
+
+      b = vlib_get_buffer (vm, bi);
+      fwabf_probe_build (pm, pl, b, now);
+      vec_add1 (pm->buffers, bi);
+      vec_add1 (pm->nexts, pl->dpo.dpoi_next_node);
+      pl->seq++;
+      pl->n_sent++;
+    }
+
+  if (vec_len (pm->buffers))
+    vlib_buffer_enqueue_to_next (vm, node, pm->buffers, pm->nexts,
+                                 vec_len (pm->buffers));
+
+  vlib_node_increment_counter (vm, node->node_index, FWABF_PROBE_ERROR_SENT,
+                               vec_len (pm->buffers));
+  if (n_no_buffer)
+    vlib_node_increment_counter (vm, node->node_index,
+                                 FWABF_PROBE_ERROR_NO_BUFFER, n_no_buffer);
+  return vec_len (pm->buffers);
+}
+
+/*
+ * Records reply to probe sent by this node. Called by any thread.
+ */
+static_always_inline int
+fwabf_probe_reply_record (fwabf_probe_main_t * pm, fwabf_probe_header_t * h,
+                          f64 now)
+{
+  fwabf_probe_link_t* pl;
+  u32                 sw_if_index = clib_net_to_host_u32 (h->link_id);
+  u32                 seq         = clib_net_to_host_u32 (h->seq);
+  u32                 age;
+
+  if (PREDICT_FALSE (sw_if_index >= vec_len (pm->links)))
+    return 0;
+  pl = vec_elt_at_index (pm->links, sw_if_index);
+  if (PREDICT_FALSE (pl->sw_if_index == INDEX_INVALID))
+    return 0;
+
+  /* Accept replies to probes that were not evaluated yet only */
+  age = pl->seq - seq;
+  if (PREDICT_FALSE (age == 0 || age > pm->window))
+    return 0;
+
+  pl->rtt[seq % FWABF_PROBE_RING_SIZE] = (now - h->timestamp) * 1000.0;
+  CLIB_MEMORY_STORE_BARRIER ();
+  clib_atomic_fetch_or (&pl->rx_bitmap, 1ULL << (seq % FWABF_PROBE_RING_SIZE));
+  return 1;
+}
+
+/*
+ * The probe receiver. It gets packets on the probe UDP port with buffer
+ * current data pointing to the UDP payload. Requests are reflected back to
+ * sender, replies are recorded and freed.
+ */
+static uword
+fwabf_probe_input_node_fn (vlib_main_t * vm, vlib_node_runtime_t * node,
+                           vlib_frame_t * frame)
+{
+  fwabf_probe_main_t*   pm  = &fwabf_probe_main;
+  f64                   now = vlib_time_now (vm);
+  vlib_buffer_t*        bufs[VLIB_FRAME_SIZE];
+  u16                   nexts[VLIB_FRAME_SIZE];
+  u32                   to_free[VLIB_FRAME_SIZE];
+  u32                   to_next[VLIB_FRAME_SIZE];
+  u32*                  from = vlib_frame_vector_args (frame);
+  u32                   n_left = frame->n_vectors;
+  u32                   n_next = 0, n_free = 0;
+  u32                   n_reflected = 0, n_reply = 0, n_late = 0, n_invalid = 0;
+  u32                   i;
+
+  vlib_get_buffers (vm, from, bufs, n_left);
+
+  for (i = 0; i < n_left; i++)
+    {
+      vlib_buffer_t*        b = bufs[i];
+      fwabf_probe_header_t* h = vlib_buffer_get_current (b);
+      ip4_header_t*         ip4;
+      udp_header_t*         udp;
+      ip4_address_t         tmp;
+
+      if (PREDICT_FALSE (b->current_length < sizeof (*h) ||
+                         h->version != FWABF_PROBE_VERSION))
+        {
+          n_invalid++;
+          b->error = node->errors[FWABF_PROBE_ERROR_INVALID];
+          nexts[n_next] = FWABF_PROBE_INPUT_NEXT_DROP;
+          to_next[n_next++] = from[i];
+          continue;
+        }
+
+      if (h->type == FWABF_PROBE_TYPE_REPLY)
+        {
+          if (fwabf_probe_reply_record (pm, h, now))
+            n_reply++;
+          else
+            n_late++;
+          to_free[n_free++] = from[i];
+          continue;
+        }
+
+      if (PREDICT_FALSE (h->type != FWABF_PROBE_TYPE_REQUEST))
+        {
+          n_invalid++;
+          b->error = node->errors[FWABF_PROBE_ERROR_INVALID];
+          nexts[n_next] = FWABF_PROBE_INPUT_NEXT_DROP;
+          to_next[n_next++] = from[i];
+          continue;
+        }
+
+      /* Request - reflect it back. ip4-local keeps offset of IP header. */
+      vlib_buffer_advance (b, vnet_buffer (b)->l3_hdr_offset - b->current_data);
+      ip4 = vlib_buffer_get_current (b);
+      udp = ip4_next_header (ip4);
+
+      tmp              = ip4->src_address;
+      ip4->src_address = ip4->dst_address;
+      ip4->dst_address = tmp;
+      ip4->ttl         = 64;
+      ip4->checksum    = ip4_header_checksum (ip4);
+      udp->checksum    = 0;
+      h->type          = FWABF_PROBE_TYPE_REPLY;
+
+      b->flags |= VNET_BUFFER_F_LOCALLY_ORIGINATED;
+      vnet_buffer (b)->sw_if_index[VLIB_TX] = ~0;
+      nexts[n_next] = FWABF_PROBE_INPUT_NEXT_IP4_LOOKUP;
+      to_next[n_next++] = from[i];
+      n_reflected++;
+    }
+
+  if (n_next)
+    vlib_buffer_enqueue_to_next (vm, node, to_next, nexts, n_next);
+  if (n_free)
+    vlib_buffer_free (vm, to_free, n_free);
+
+  vlib_node_increment_counter (vm, node->node_index,
+                               FWABF_PROBE_ERROR_REFLECTED, n_reflected);
+  vlib_node_increment_counter (vm, node->node_index,
+                               FWABF_PROBE_ERROR_REPLY, n_reply);
+  vlib_node_increment_counter (vm, node->node_index,
+                               FWABF_PROBE_ERROR_LATE, n_late);
+  vlib_node_increment_counter (vm, node->node_index,
+                               FWABF_PROBE_ERROR_INVALID, n_invalid);
+  return frame->n_vectors;
+}
+
+/*
+ * Pushes the measured quality of links into the link database.
+ * Note the fwabf_links_set_quality() refreshes policy decisions only if
+ * quality crossed the service class thresholds.
+ */
+static void
+fwabf_probe_quality_sync (fwabf_probe_main_t * pm)
+{
+  fwabf_probe_link_t* pl;
+  u32                 loss;
+
+  vec_foreach (pl, pm->links)
+    {
+      if (pl->sw_if_index == INDEX_INVALID)
+        continue;
+
+      fwabf_probe_link_refresh_src (pl);
+
+      if (pl->quality_manual)
+        continue;     /*operator's quality wins over the measured one*/
+      if (pl->n_sent < pm->window)
+        continue;     /*nothing was evaluated yet*/
+
+      loss = pl->is_up ? clib_min ((u32) (pl->loss + 0.5), 99) : 100;
+      fwabf_links_set_quality (pl->sw_if_index, loss,
+                               (u32) (pl->delay + 0.5), (u32) (pl->jitter + 0.5));
+    }
+}
+
+static uword
+fwabf_probe_process (vlib_main_t * vm, vlib_node_runtime_t * rt,
+                     vlib_frame_t * f)
+{
+  fwabf_probe_main_t* pm = &fwabf_probe_main;
+  uword*              event_data = 0;
+
+  while (1)
+    {
+      vlib_process_wait_for_event_or_clock (vm, FWABF_PROBE_SYNC_INTERVAL);
+      vlib_process_get_events (vm, &event_data);
+      vec_reset_length (event_data);
+
+      /* Link state change or periodic sync - push quality of all links */
+      if (pm->enabled)
+        fwabf_probe_quality_sync (pm);
+    }
+  return 0;
+}
+
+static clib_error_t *
+fwabf_probe_set_cmd (vlib_main_t * vm,
+                     unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+  fwabf_probe_main_t* pm       = &fwabf_probe_main;
+  vlib_thread_main_t* tm       = vlib_get_thread_main ();
+  u32                 enabled  = pm->enabled;
+  u32                 interval = pm->interval * 1000;
+  u32                 timeout  = pm->timeout * 1000;
+  u32                 port     = pm->udp_port;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "enable"))
+        enabled = 1;
+      else if (unformat (input, "disable"))
+        enabled = 0;
+      else if (unformat (input, "interval %u", &interval))
+        ;
+      else if (unformat (input, "timeout %u", &timeout))
+        ;
+      else if (unformat (input, "port %u", &port))
+        ;
+      else
+        return (clib_error_return (0, "unknown input '%U'",
+                                   format_unformat_error, input));
+    }
+
+  if (interval < FWABF_PROBE_TIMER_TICK * 1000 || timeout < interval)
+    return (clib_error_return (0, "interval should be at least %d ms, "
+                               "timeout should be not less than interval",
+                               (u32) (FWABF_PROBE_TIMER_TICK * 1000)));
+  if (port == 0 || port > 0xFFFF)
+    return (clib_error_return (0, "invalid port %u", port));
+
+  /* The command is not mp safe, so workers are stopped by barrier */
+
+  if (pm->port_registered && (!enabled || port != pm->udp_port))
+    {
+      udp_unregister_dst_port (vm, pm->udp_port, 1 /*is_ip4*/);
+      pm->port_registered = 0;
+    }
+  if (enabled && !pm->port_registered)
+    {
+      udp_register_dst_port (vm, port, fwabf_probe_input_node.index, 1 /*is_ip4*/);
+      pm->port_registered = 1;
+    }
+
+  if (enabled && pm->thread_index == ~0)
+    {
+      pm->thread_index = (tm->n_vlib_mains > 1) ? 1 : 0;
+      tw_timer_wheel_init_2t_1w_2048sl (&pm->timer_wheel, NULL,
+                                        FWABF_PROBE_TIMER_TICK, ~0);
+    }
+
+  pm->udp_port = port;
+  pm->interval = (f64) interval / 1000.0;
+  pm->timeout  = (f64) timeout / 1000.0;
+  pm->window   = clib_min ((timeout + interval - 1) / interval,
+                           FWABF_PROBE_RING_SIZE - 1);
+  pm->enabled  = enabled;
+  pm->config_epoch++;
+
+  if (pm->thread_index != ~0)
+    vlib_node_set_state (vlib_mains[pm->thread_index], fwabf_probe_tx_node.index,
+                         enabled ? VLIB_NODE_STATE_POLLING : VLIB_NODE_STATE_DISABLED);
+  return (NULL);
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (fwabf_probe_set_cmd_node, static) = {
+  .path = "set fwabf probe",
+  .function = fwabf_probe_set_cmd,
+  .short_help = "set fwabf probe [enable|disable] [interval <ms>] [timeout <ms>] [port <n>]",
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+fwabf_probe_link_cmd (vlib_main_t * vm,
+                      unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+  fwabf_probe_main_t* pm  = &fwabf_probe_main;
+  vnet_main_t*        vnm = vnet_get_main ();
+  fwabf_probe_link_t* pl;
+  ip4_address_t       peer;
+  u32                 sw_if_index = INDEX_INVALID;
+  u8                  peer_configured = 0;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "peer %U", unformat_ip4_address, &peer))
+        peer_configured = 1;
+      else if (unformat (input, "%U",
+                         unformat_vnet_sw_interface, vnm, &sw_if_index))
+        ;
+      else
+        return (clib_error_return (0, "unknown input '%U'",
+                                   format_unformat_error, input));
+    }
+
+  if (sw_if_index == INDEX_INVALID)
+    return (clib_error_return (0, "specify interface of link"));
+
+  fwabf_probe_links_validate (sw_if_index);
+  pl = vec_elt_at_index (pm->links, sw_if_index);
+  pl->peer_configured = peer_configured;
+  pl->peer            = peer_configured ? peer : pl->via;
+  return (NULL);
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (fwabf_probe_link_cmd_node, static) = {
+  .path = "set fwabf probe link",
+  .function = fwabf_probe_link_cmd,
+  .short_help = "set fwabf probe link <if name> [peer <address>]",
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+fwabf_probe_show_cmd (vlib_main_t * vm,
+                      unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+  fwabf_probe_main_t* pm  = &fwabf_probe_main;
+  vnet_main_t*        vnm = vnet_get_main ();
+  fwabf_probe_link_t* pl;
+
+  vlib_cli_output (vm, "probe: %s, port: %d, interval: %.0f ms, timeout: %.0f ms, thread: %d",
+                   pm->enabled ? "enabled" : "disabled", pm->udp_port,
+                   pm->interval * 1000, pm->timeout * 1000,
+                   pm->thread_index == ~0 ? 0 : pm->thread_index);
+
+  vec_foreach (pl, pm->links)
+    {
+      if (pl->sw_if_index == INDEX_INVALID)
+        continue;
+      vlib_cli_output (vm, " %U: %U -> %U%s: %s loss:%.1f%% delay:%.1fms jitter:%.1fms sent:%lld lost:%lld%s",
+                       format_vnet_sw_if_index_name, vnm, pl->sw_if_index,
+                       format_ip4_address, &pl->src, format_ip4_address, &pl->peer,
+                       pl->peer_configured ? " (configured)" : "",
+                       pl->is_up ? "up" : "down", pl->loss, pl->delay, pl->jitter,
+                       pl->n_sent, pl->n_lost,
+                       pl->quality_manual ? " (manual quality)" : "");
+    }
+  return (NULL);
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (fwabf_probe_show_cmd_node, static) = {
+  .path = "show fwabf probe",
+  .function = fwabf_probe_show_cmd,
+  .short_help = "show fwabf probe",
+  .is_mp_safe = 1,
+};
+
+VLIB_REGISTER_NODE (fwabf_probe_tx_node) =
+{
+  .function = fwabf_probe_tx_node_fn,
+  .name = "fwabf-probe-tx",
+  .type = VLIB_NODE_TYPE_INPUT,
+  .state = VLIB_NODE_STATE_DISABLED,
+  .n_errors = FWABF_PROBE_N_ERROR,
+  .error_strings = fwabf_probe_error_strings,
+};
+
+VLIB_REGISTER_NODE (fwabf_probe_input_node) =
+{
+  .function = fwabf_probe_input_node_fn,
+  .name = "fwabf-probe-input",
+  .vector_size = sizeof (u32),
+  .type = VLIB_NODE_TYPE_INTERNAL,
+  .n_errors = FWABF_PROBE_N_ERROR,
+  .error_strings = fwabf_probe_error_strings,
+  .n_next_nodes = FWABF_PROBE_INPUT_N_NEXT,
+  .next_nodes = {
+    [FWABF_PROBE_INPUT_NEXT_DROP] = "error-drop",
+    [FWABF_PROBE_INPUT_NEXT_IP4_LOOKUP] = "ip4-lookup",
+  },
+};
+
+VLIB_REGISTER_NODE (fwabf_probe_process_node) =
+{
+  .function = fwabf_probe_process,
+  .type = VLIB_NODE_TYPE_PROCESS,
+  .name = "fwabf-probe-process",
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+fwabf_probe_init (vlib_main_t * vm)
+{
+  fwabf_probe_main_t* pm = &fwabf_probe_main;
+
+  pm->enabled      = 0;
+  pm->udp_port     = FWABF_PROBE_DEFAULT_UDP_PORT;
+  pm->interval     = FWABF_PROBE_DEFAULT_INTERVAL;
+  pm->timeout      = FWABF_PROBE_DEFAULT_TIMEOUT;
+  pm->window       = (u32) (FWABF_PROBE_DEFAULT_TIMEOUT / FWABF_PROBE_DEFAULT_INTERVAL + 0.5);
+  pm->thread_index = ~0;   /*chosen on enable, when workers are known*/
+  return (NULL);
+}
+
+VLIB_INIT_FUNCTION (fwabf_probe_init);
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
@@ -0,0 +1,186 @@
+/*
+ *  Copyright (C) 2023 flexiWAN Ltd.
+ *  This file is part of the FWABF plugin.
+ *  The FWABF plugin is fork of the FDIO VPP ABF plugin.
+ *  It enhances ABF with functionality required for Flexiwan Multi-Link feature.
+ *  For more details see official documentation on the Flexiwan Multi-Link.
+ */
+
+/*
+ * This file implements the active link quality prober.
+ *
+ * The quality of links (loss, delay and jitter), used by the Quality Based
+ * Routing, can be set by the 'fwabf quality' CLI by external agent.
+ * As an alternative, the prober measures it in datapath: it sends timestamped
+ * UDP probes over every link to the remote end of the link, the remote end
+ * reflects them back, and the prober calculates the link quality out of
+ * the reflected probes.
+ *
+ * The probes are sent by the fwabf-probe-tx input node on one thread only,
+ * the first worker if there are workers, or the main thread otherwise.
+ * The node runs the timer wheel of links, on timer expiration it sends the
+ * next probe of link directly into the link DPO, so the probe goes out through
+ * the link regardless of routing. The probes are received by the
+ * fwabf-probe-input node registered on the probe UDP port. If the probe is
+ * a request, it is reflected back to the sender through FIB lookup. If it is
+ * a reply, the round trip time is recorded for the sender thread.
+ *
+ * The sender thread evaluates every probe once its timeout expires:
+ *   - loss is EWMA of per probe loss in percents.
+ *   - delay is EWMA of round trip time in milliseconds.
+ *   - jitter is EWMA of round trip time variation in milliseconds (RFC 3550).
+ *   - link is down if FWABF_PROBE_DOWN_COUNT probes in a row were lost,
+ *     in which case the loss is reported as 100.
+ * The calculated quality is pushed into link database by the
+ * fwabf-probe-process on the main thread: immediately on link state change
+ * and periodically otherwise. See fwabf_links_set_quality().
+ * The quality set by the 'fwabf quality' CLI overrides the measured one, so
+ * the link forced down by operator stays down, until the override is removed
+ * by the 'fwabf quality <if name> auto' CLI.
+ *
+ * Only IPv4 links are probed.
+ */
+
+#ifndef __FWABF_PROBE_H__
+#define __FWABF_PROBE_H__
+
+#include <vnet/dpo/dpo.h>
+#include <vnet/ip/ip46_address.h>
+#include <vppinfra/tw_timer_2t_1w_2048sl.h>
+
+#define FWABF_PROBE_DEFAULT_UDP_PORT    4797
+#define FWABF_PROBE_DEFAULT_INTERVAL    0.1    /*seconds*/
+#define FWABF_PROBE_DEFAULT_TIMEOUT     0.3    /*seconds*/
+#define FWABF_PROBE_TIMER_TICK          0.01   /*seconds*/
+#define FWABF_PROBE_SYNC_INTERVAL       1.0    /*seconds*/
+#define FWABF_PROBE_DOWN_COUNT          3      /*lost probes in a row*/
+#define FWABF_PROBE_RING_SIZE           64     /*probes in flight*/
+#define FWABF_PROBE_EWMA_SHIFT          3      /*alpha = 1/8 for loss and delay*/
+#define FWABF_PROBE_JITTER_EWMA_SHIFT   4      /*alpha = 1/16 for jitter*/
+
+#define FWABF_PROBE_VERSION             1
+
+typedef enum fwabf_probe_type_t_ {
+  FWABF_PROBE_TYPE_REQUEST = 1,
+  FWABF_PROBE_TYPE_REPLY   = 2,
+} fwabf_probe_type_t;
+
+/*
+ * The probe payload. It is carried in UDP packet.
+ * The peer changes the type to reply and sends it back as is,
+ * so 'link_id' and 'timestamp' are meaningful for the sender only.
+ */
+typedef CLIB_PACKED (struct fwabf_probe_header_t_ {
+  u8  version;
+  u8  type;
+  u16 __unused;
+  u32 link_id;    /*sw_if_index of link on sender*/
+  u32 seq;
+  u32 __unused2;
+  f64 timestamp;  /*sender time*/
+}) fwabf_probe_header_t;
+
+typedef struct fwabf_probe_link_t_ {
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+
+  /*
+   * Configuration, written by the main thread.
+   */
+  u32             sw_if_index;      /*INDEX_INVALID if link is not probed*/
+  ip4_address_t   via;              /*remote end of link*/
+  ip4_address_t   peer;             /*probe destination*/
+  ip4_address_t   src;              /*probe source, address of link interface*/
+  u8              peer_configured;  /*1 if peer was set by user, 0 if it is the link 'via'*/
+  u8              quality_manual;   /*1 if quality was set by user, so it is not pushed*/
+  dpo_id_t        dpo;              /*link DPO stacked on the fwabf-probe-tx node*/
+
+  /*
+   * The prober state, written by the prober thread only.
+   */
+  u32  timer_handle;
+  u32  seq;                 /*sequence number of the next probe*/
+  u32  n_lost_in_row;
+  u8   is_up;
+  f64  loss;                /*percents*/
+  f64  delay;               /*milliseconds*/
+  f64  jitter;              /*milliseconds*/
+  f64  last_rtt;            /*milliseconds*/
+  u64  n_sent;
+  u64  n_lost;
+
+  /*
+   * Replies, written by thread that receives them.
+   * The bit 'seq % FWABF_PROBE_RING_SIZE' of 'rx_bitmap' is set when reply
+   * is received, the 'rtt' of the same index keeps the round trip time.
+   */
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline1);
+  volatile u64    rx_bitmap;
+  f32             rtt[FWABF_PROBE_RING_SIZE];   /*milliseconds*/
+} fwabf_probe_link_t;
+
+typedef struct fwabf_probe_main_t_ {
+  fwabf_probe_link_t*  links;           /*indexed by sw_if_index*/
+  u8                   enabled;
+  u16                  udp_port;
+  f64                  interval;        /*seconds*/
+  f64                  timeout;         /*seconds*/
+  u32                  window;          /*number of probes sent within timeout*/
+  u32                  thread_index;    /*the prober thread*/
+  u8                   port_registered;
+
+  /*
+   * Bumped by main thread on configuration change, so the prober thread
+   * can sync timers of links on the next run.
+   */
+  volatile u32         config_epoch;
+
+  /*
+   * Prober thread data.
+   */
+  u32                  timers_epoch;
+  tw_timer_wheel_2t_1w_2048sl_t timer_wheel;
+  u32*                 expired;
+  u32*                 buffers;
+  u16*                 nexts;
+} fwabf_probe_main_t;
+
+extern fwabf_probe_main_t fwabf_probe_main;
+
+/**
+ * Updates the probing data of the link on link creation or on change in link
+ * forwarding. Should be called by main thread.
+ *
+ * @param sw_if_index   the link interface.
+ * @param dpo_proto     the link protocol, only IPv4 links are probed.
+ * @param via           the link remote end, the default probe destination.
+ * @param dpo           the link DPO.
+ */
+extern void fwabf_probe_link_update (u32 sw_if_index, dpo_proto_t dpo_proto,
+                                     const ip46_address_t * via,
+                                     const dpo_id_t * dpo);
+
+/**
+ * Stops probing of the link on link removal. Should be called by main thread.
+ *
+ * @param sw_if_index   the link interface.
+ */
+extern void fwabf_probe_link_del (u32 sw_if_index);
+
+/**
+ * Stops or resumes pushing of the measured quality of the link into link
+ * database, as the quality was set manually. Should be called by main thread.
+ *
+ * @param sw_if_index   the link interface.
+ * @param is_manual     1 if the link quality was set manually, 0 otherwise.
+ */
+extern void fwabf_probe_link_set_manual (u32 sw_if_index, u8 is_manual);
+
+#endif /*__FWABF_PROBE_H__*/
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
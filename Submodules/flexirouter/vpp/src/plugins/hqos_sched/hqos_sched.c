@@ -0,0 +1,684 @@
+/*
+ * Copyright (c) 2023 FlexiWAN
+ *
+ * List of features made for FlexiWAN (denoted by FLEXIWAN_FEATURE flag):
+ *  - native_hqos_sched: VPP native hierarchical QoS scheduler. Unlike the
+ *  DPDK rte_sched based HQoS (see plugins/dpdk/hqos/hqos.c), it does not
+ *  depend on the interface driver, so it can be used on tap, af_packet,
+ *  vmxnet3, tun and other non-DPDK WAN interfaces.
+ *
+ * This file is added by the Flexiwan feature: native_hqos_sched.
+ */
+
+/*
+ * Configuration of the native HQoS scheduler. See hqos_sched.h for the
+ * scheduler description.
+ */
+
+#include <vnet/vnet.h>
+#include <vnet/plugin/plugin.h>
+#include <vnet/feature/feature.h>
+#include <vpp/app/version.h>
+#include <hqos_sched/hqos_sched.h>
+
+hqos_sched_main_t hqos_sched_main;
+
+static f64
+hqos_sched_default_tb_size (f64 rate)
+{
+  return clib_max ((HQOS_SCHED_DEFAULT_TB_SIZE_MS * rate) / 1000,
+		   HQOS_SCHED_MIN_TB_SIZE_BYTES);
+}
+
+static void
+hqos_sched_pipe_init (hqos_sched_port_t * port, hqos_sched_pipe_t * pipe,
+		      f64 now)
+{
+  f64 rate = port->tb.rate;
+  f64 size = hqos_sched_default_tb_size (rate);
+  u32 i;
+
+  hqos_sched_tb_init (&pipe->tb, rate, size, now);
+  for (i = 0; i < HQOS_SCHED_TRAFFIC_CLASSES; i++)
+    hqos_sched_tb_init (&pipe->tc_tb[i], rate, size, now);
+
+  /* Default weights Q0 : 4, Q1: 3, Q2: 2, Q3: 1 as DPDK HQoS uses */
+  for (i = 0; i < HQOS_SCHED_BE_QUEUES; i++)
+    pipe->wrr_weights[i] = HQOS_SCHED_BE_QUEUES - i;
+
+  for (i = 0; i < HQOS_SCHED_QUEUES_PER_PIPE; i++)
+    {
+      vec_validate (pipe->queues[i].buffers, port->queue_size - 1);
+      vec_validate (pipe->queues[i].lengths, port->queue_size - 1);
+    }
+}
+
+static void
+hqos_sched_port_free (vlib_main_t * vm, hqos_sched_port_t * port)
+{
+  hqos_sched_pipe_t *pipe;
+  hqos_sched_queue_t *q;
+  u32 i;
+
+  vec_foreach (pipe, port->pipes)
+  {
+    for (i = 0; i < HQOS_SCHED_QUEUES_PER_PIPE; i++)
+      {
+	q = &pipe->queues[i];
+	while (hqos_sched_queue_len (q) > 0)
+	  {
+	    vlib_buffer_free_one (vm, q->buffers[q->head & (port->queue_size - 1)]);
+	    q->head++;
+	  }
+	vec_free (q->buffers);
+	vec_free (q->lengths);
+      }
+  }
+  vec_free (port->pipes);
+  vec_free (port->subports);
+  vec_free (port->active_pipes);
+}
+
+static void
+hqos_sched_output_node_refresh (void)
+{
+  hqos_sched_main_t *hsm = &hqos_sched_main;
+  u32 i;
+
+  for (i = 0; i < vec_len (vlib_mains); i++)
+    {
+      u32 n = (i < vec_len (hsm->ports_by_thread)) ?
+	vec_len (hsm->ports_by_thread[i]) : 0;
+      vlib_node_set_state (vlib_mains[i], hqos_sched_output_node.index,
+			   n ? VLIB_NODE_STATE_POLLING :
+			   VLIB_NODE_STATE_DISABLED);
+    }
+}
+
+int
+hqos_sched_enable (u32 sw_if_index, u64 rate, u32 n_subports, u32 n_pipes,
+		   u32 queue_size, u32 thread_index)
+{
+  hqos_sched_main_t *hsm = &hqos_sched_main;
+  vlib_main_t *vm = vlib_get_main ();
+  vnet_main_t *vnm = hsm->vnet_main;
+  vlib_thread_main_t *tm = vlib_get_thread_main ();
+  vnet_hw_interface_t *hw;
+  hqos_sched_port_t *port;
+  u32 i, n_total_pipes;
+  f64 now = vlib_time_now (vm);
+
+  if (pool_is_free_index (vnm->interface_main.sw_interfaces, sw_if_index))
+    return VNET_API_ERROR_INVALID_SW_IF_INDEX;
+  if (hqos_sched_port_get_by_sw_if_index (sw_if_index))
+    return VNET_API_ERROR_VALUE_EXIST;
+
+  n_subports = n_subports ? n_subports : HQOS_SCHED_DEFAULT_SUBPORTS;
+  n_pipes = n_pipes ? n_pipes : HQOS_SCHED_DEFAULT_PIPES;
+  queue_size = queue_size ? queue_size : HQOS_SCHED_DEFAULT_QUEUE_SIZE;
+  rate = rate ? rate : HQOS_SCHED_DEFAULT_PORT_RATE;
+  if (n_subports > HQOS_SCHED_MAX_SUBPORTS || n_pipes > HQOS_SCHED_MAX_PIPES
+      || !is_pow2 (queue_size))
+    return VNET_API_ERROR_INVALID_VALUE;
+
+  hw = vnet_get_sup_hw_interface (vnm, sw_if_index);
+
+  /*
+   * The port is owned by the thread that polls the first RX queue of the
+   * interface, if the thread was not configured explicitly, as packets
+   * are sent back on the same interface often, e.g. by tunnels.
+   * Otherwise it is owned by the first worker.
+   */
+  if (thread_index == ~0)
+    {
+      if (vec_len (hw->input_node_thread_index_by_queue) > 0)
+	thread_index = hw->input_node_thread_index_by_queue[0];
+      else
+	thread_index = (tm->n_vlib_mains > 1) ? 1 : 0;
+    }
+  if (thread_index >= tm->n_vlib_mains)
+    return VNET_API_ERROR_INVALID_WORKER;
+
+  vlib_worker_thread_barrier_sync (vm);
+
+  pool_get_zero (hsm->ports, port);
+  port->sw_if_index = sw_if_index;
+  port->tx_node_index = hw->tx_node_index;
+  port->thread_index = thread_index;
+  port->n_subports = n_subports;
+  port->n_pipes = n_pipes;
+  port->queue_size = queue_size;
+  hqos_sched_tb_init (&port->tb, rate, hqos_sched_default_tb_size (rate),
+		      now);
+
+  vec_validate (port->subports, n_subports - 1);
+  for (i = 0; i < n_subports; i++)
+    hqos_sched_tb_init (&port->subports[i].tb, rate,
+			hqos_sched_default_tb_size (rate), now);
+
+  n_total_pipes = n_subports * n_pipes;
+  vec_validate (port->pipes, n_total_pipes - 1);
+  for (i = 0; i < n_total_pipes; i++)
+    hqos_sched_pipe_init (port, &port->pipes[i], now);
+  vec_validate (port->active_pipes, (n_total_pipes - 1) / 64);
+
+  for (i = 0; i < HQOS_SCHED_TC_TABLE_SIZE; i++)
+    port->tc_table[i] = (HQOS_SCHED_TC_BE << 2) | (HQOS_SCHED_BE_QUEUES - 1);
+
+  vec_validate_init_empty (hsm->port_index_by_sw_if_index, sw_if_index, ~0);
+  hsm->port_index_by_sw_if_index[sw_if_index] = port - hsm->ports;
+  vec_validate (hsm->ports_by_thread, tm->n_vlib_mains - 1);
+  vec_add1 (hsm->ports_by_thread[thread_index], port - hsm->ports);
+
+  vnet_feature_enable_disable ("interface-output", "hqos-sched",
+			       sw_if_index, 1, 0, 0);
+  hqos_sched_output_node_refresh ();
+
+  vlib_worker_thread_barrier_release (vm);
+  return 0;
+}
+
+int
+hqos_sched_disable (u32 sw_if_index)
+{
+  hqos_sched_main_t *hsm = &hqos_sched_main;
+  vlib_main_t *vm = vlib_get_main ();
+  hqos_sched_port_t *port;
+  u32 port_index, i;
+
+  port = hqos_sched_port_get_by_sw_if_index (sw_if_index);
+  if (port == NULL)
+    return VNET_API_ERROR_NO_SUCH_ENTRY;
+  port_index = port - hsm->ports;
+
+  vlib_worker_thread_barrier_sync (vm);
+
+  vnet_feature_enable_disable ("interface-output", "hqos-sched",
+			       sw_if_index, 0, 0, 0);
+
+  i = vec_search (hsm->ports_by_thread[port->thread_index], port_index);
+  ASSERT (i != ~0);
+  vec_del1 (hsm->ports_by_thread[port->thread_index], i);
+  hqos_sched_output_node_refresh ();
+
+  hsm->port_index_by_sw_if_index[sw_if_index] = ~0;
+  hqos_sched_port_free (vm, port);
+  pool_put (hsm->ports, port);
+
+  vlib_worker_thread_barrier_release (vm);
+  return 0;
+}
+
+int
+hqos_sched_set_port (u32 sw_if_index, u64 rate, u64 tb_size)
+{
+  hqos_sched_port_t *port;
+
+  port = hqos_sched_port_get_by_sw_if_index (sw_if_index);
+  if (port == NULL)
+    return VNET_API_ERROR_NO_SUCH_ENTRY;
+
+  if (rate)
+    {
+      port->tb.rate = rate;
+      port->tb.size = hqos_sched_default_tb_size (rate);
+    }
+  if (tb_size)
+    port->tb.size = clib_max (tb_size, HQOS_SCHED_MIN_TB_SIZE_BYTES);
+  return 0;
+}
+
+int
+hqos_sched_set_subport (u32 sw_if_index, u32 subport_id, u64 rate,
+			u64 tb_size)
+{
+  hqos_sched_port_t *port;
+  hqos_sched_subport_t *subport;
+
+  port = hqos_sched_port_get_by_sw_if_index (sw_if_index);
+  if (port == NULL)
+    return VNET_API_ERROR_NO_SUCH_ENTRY;
+  if (subport_id >= port->n_subports)
+    return VNET_API_ERROR_INVALID_VALUE;
+
+  subport = &port->subports[subport_id];
+  if (rate)
+    {
+      subport->tb.rate = rate;
+      subport->tb.size = hqos_sched_default_tb_size (rate);
+    }
+  if (tb_size)
+    subport->tb.size = clib_max (tb_size, HQOS_SCHED_MIN_TB_SIZE_BYTES);
+  return 0;
+}
+
+int
+hqos_sched_set_pipe (u32 sw_if_index, u32 subport_id, u32 pipe_id,
+		     u64 rate, u64 tb_size, u64 * tc_rates, u32 * wrr_weights)
+{
+  hqos_sched_port_t *port;
+  hqos_sched_pipe_t *pipe;
+  u32 i;
+
+  port = hqos_sched_port_get_by_sw_if_index (sw_if_index);
+  if (port == NULL)
+    return VNET_API_ERROR_NO_SUCH_ENTRY;
+  if (subport_id >= port->n_subports || pipe_id >= port->n_pipes)
+    return VNET_API_ERROR_INVALID_VALUE;
+
+  pipe = &port->pipes[subport_id * port->n_pipes + pipe_id];
+
+  /*
+   * The pipe rate limits the traffic classes as well,
+   * unless their rates are set explicitly.
+   */
+  if (rate)
+    {
+      pipe->tb.rate = rate;
+      pipe->tb.size = hqos_sched_default_tb_size (rate);
+      for (i = 0; i < HQOS_SCHED_TRAFFIC_CLASSES; i++)
+	{
+	  pipe->tc_tb[i].rate = rate;
+	  pipe->tc_tb[i].size = pipe->tb.size;
+	}
+    }
+  if (tb_size)
+    {
+      pipe->tb.size = clib_max (tb_size, HQOS_SCHED_MIN_TB_SIZE_BYTES);
+      for (i = 0; i < HQOS_SCHED_TRAFFIC_CLASSES; i++)
+	pipe->tc_tb[i].size = pipe->tb.size;
+    }
+  for (i = 0; tc_rates && i < HQOS_SCHED_TRAFFIC_CLASSES; i++)
+    {
+      if (tc_rates[i])
+	pipe->tc_tb[i].rate = tc_rates[i];
+    }
+  for (i = 0; wrr_weights && i < HQOS_SCHED_BE_QUEUES; i++)
+    {
+      if (wrr_weights[i])
+	pipe->wrr_weights[i] = wrr_weights[i];
+    }
+  return 0;
+}
+
+int
+hqos_sched_set_tc_table (u32 sw_if_index, u32 entry, u32 tc, u32 queue)
+{
+  hqos_sched_port_t *port;
+
+  port = hqos_sched_port_get_by_sw_if_index (sw_if_index);
+  if (port == NULL)
+    return VNET_API_ERROR_NO_SUCH_ENTRY;
+  if (entry >= HQOS_SCHED_TC_TABLE_SIZE || tc >= HQOS_SCHED_TRAFFIC_CLASSES)
+    return VNET_API_ERROR_INVALID_VALUE;
+  if ((tc == HQOS_SCHED_TC_BE && queue >= HQOS_SCHED_BE_QUEUES) ||
+      (tc != HQOS_SCHED_TC_BE && queue != 0))
+    return VNET_API_ERROR_INVALID_VALUE;
+
+  port->tc_table[entry] = (tc << 2) | queue;
+  return 0;
+}
+
+static clib_error_t *
+hqos_sched_rv_to_error (int rv, const char *what)
+{
+  switch (rv)
+    {
+    case 0:
+      return NULL;
+    case VNET_API_ERROR_NO_SUCH_ENTRY:
+      return clib_error_return (0, "hqos-sched is not enabled on interface");
+    case VNET_API_ERROR_VALUE_EXIST:
+      return clib_error_return (0, "hqos-sched is enabled on interface already");
+    case VNET_API_ERROR_INVALID_SW_IF_INDEX:
+      return clib_error_return (0, "invalid interface");
+    case VNET_API_ERROR_INVALID_WORKER:
+      return clib_error_return (0, "invalid thread");
+    case VNET_API_ERROR_INVALID_VALUE:
+      return clib_error_return (0, "invalid %s", what);
+    default:
+      return clib_error_return (0, "%s failed: %d", what, rv);
+    }
+}
+
+static clib_error_t *
+hqos_sched_interface_command_fn (vlib_main_t * vm, unformat_input_t * input,
+				 vlib_cli_command_t * cmd)
+{
+  hqos_sched_main_t *hsm = &hqos_sched_main;
+  u32 sw_if_index = ~0, thread_index = ~0;
+  u32 n_subports = 0, n_pipes = 0, queue_size = 0;
+  u64 rate = 0, tb_size = 0;
+  u8 is_del = 0;
+  int rv;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "%U", unformat_vnet_sw_interface,
+		    hsm->vnet_main, &sw_if_index))
+	;
+      else if (unformat (input, "rate %llu", &rate))
+	;
+      else if (unformat (input, "bktsize %llu", &tb_size))
+	;
+      else if (unformat (input, "subports %u", &n_subports))
+	;
+      else if (unformat (input, "pipes %u", &n_pipes))
+	;
+      else if (unformat (input, "queue-size %u", &queue_size))
+	;
+      else if (unformat (input, "thread %u", &thread_index))
+	;
+      else if (unformat (input, "del"))
+	is_del = 1;
+      else
+	return clib_error_return (0, "unknown input '%U'",
+				  format_unformat_error, input);
+    }
+
+  if (sw_if_index == ~0)
+    return clib_error_return (0, "Please specify a valid interface");
+
+  if (is_del)
+    return hqos_sched_rv_to_error (hqos_sched_disable (sw_if_index),
+				   "interface");
+
+  /* Update rate of enabled port, or enable scheduler on interface */
+  if (hqos_sched_port_get_by_sw_if_index (sw_if_index))
+    rv = hqos_sched_set_port (sw_if_index, rate, tb_size);
+  else
+    {
+      rv = hqos_sched_enable (sw_if_index, rate, n_subports, n_pipes,
+			      queue_size, thread_index);
+      if (rv == 0 && tb_size)
+	rv = hqos_sched_set_port (sw_if_index, 0, tb_size);
+    }
+  return hqos_sched_rv_to_error (rv, "parameters");
+}
+
+/* *INDENT-OFF* */
+/*
+ * Enables the native HQoS scheduler on interface or updates port rate of
+ * interface it was enabled on. Rates are in bytes per second.
+ * The queue size should be power of 2.
+ */
+VLIB_CLI_COMMAND (hqos_sched_interface_command, static) =
+{
+  .path = "set hqos-sched interface",
+  .short_help = "set hqos-sched interface <interface-name> [rate <n>] "
+                "[bktsize <n>] [subports <n>] [pipes <n>] [queue-size <n>] "
+                "[thread <n>] [del]",
+  .function = hqos_sched_interface_command_fn,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+hqos_sched_subport_command_fn (vlib_main_t * vm, unformat_input_t * input,
+			       vlib_cli_command_t * cmd)
+{
+  hqos_sched_main_t *hsm = &hqos_sched_main;
+  u32 sw_if_index = ~0, subport_id = ~0;
+  u64 rate = 0, tb_size = 0;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "%U", unformat_vnet_sw_interface,
+		    hsm->vnet_main, &sw_if_index))
+	;
+      else if (unformat (input, "subport %u", &subport_id))
+	;
+      else if (unformat (input, "rate %llu", &rate))
+	;
+      else if (unformat (input, "bktsize %llu", &tb_size))
+	;
+      else
+	return clib_error_return (0, "unknown input '%U'",
+				  format_unformat_error, input);
+    }
+
+  if (sw_if_index == ~0)
+    return clib_error_return (0, "Please specify a valid interface");
+
+  return hqos_sched_rv_to_error (hqos_sched_set_subport (sw_if_index,
+							  subport_id, rate,
+							  tb_size),
+				 "subport");
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (hqos_sched_subport_command, static) =
+{
+  .path = "set hqos-sched subport",
+  .short_help = "set hqos-sched subport <interface-name> subport <id> "
+                "[rate <n>] [bktsize <n>]",
+  .function = hqos_sched_subport_command_fn,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+hqos_sched_pipe_command_fn (vlib_main_t * vm, unformat_input_t * input,
+			    vlib_cli_command_t * cmd)
+{
+  hqos_sched_main_t *hsm = &hqos_sched_main;
+  u32 sw_if_index = ~0, subport_id = ~0, pipe_id = ~0;
+  u64 rate = 0, tb_size = 0, tc_rate;
+  u64 tc_rates[HQOS_SCHED_TRAFFIC_CLASSES] = { 0 };
+  u32 wrr_weights[HQOS_SCHED_BE_QUEUES] = { 0 };
+  u32 tc, queue, weight;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "%U", unformat_vnet_sw_interface,
+		    hsm->vnet_main, &sw_if_index))
+	;
+      else if (unformat (input, "subport %u", &subport_id))
+	;
+      else if (unformat (input, "pipe %u", &pipe_id))
+	;
+      else if (unformat (input, "rate %llu", &rate))
+	;
+      else if (unformat (input, "bktsize %llu", &tb_size))
+	;
+      else if (unformat (input, "tc%u-rate %llu", &tc, &tc_rate))
+	{
+	  if (tc >= HQOS_SCHED_TRAFFIC_CLASSES)
+	    return clib_error_return (0, "invalid traffic class %u", tc);
+	  tc_rates[tc] = tc_rate;
+	}
+      else if (unformat (input, "wrr%u %u", &queue, &weight))
+	{
+	  if (queue >= HQOS_SCHED_BE_QUEUES)
+	    return clib_error_return (0, "invalid queue %u", queue);
+	  wrr_weights[queue] = weight;
+	}
+      else
+	return clib_error_return (0, "unknown input '%U'",
+				  format_unformat_error, input);
+    }
+
+  if (sw_if_index == ~0)
+    return clib_error_return (0, "Please specify a valid interface");
+
+  return hqos_sched_rv_to_error (hqos_sched_set_pipe (sw_if_index, subport_id,
+						       pipe_id, rate, tb_size,
+						       tc_rates, wrr_weights),
+				 "pipe");
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (hqos_sched_pipe_command, static) =
+{
+  .path = "set hqos-sched pipe",
+  .short_help = "set hqos-sched pipe <interface-name> subport <id> pipe <id> "
+                "[rate <n>] [bktsize <n>] [tc0-rate <n>] ... [tc12-rate <n>] "
+                "[wrr0 <n>] ... [wrr3 <n>]",
+  .function = hqos_sched_pipe_command_fn,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+hqos_sched_tctbl_command_fn (vlib_main_t * vm, unformat_input_t * input,
+			     vlib_cli_command_t * cmd)
+{
+  hqos_sched_main_t *hsm = &hqos_sched_main;
+  u32 sw_if_index = ~0, entry = ~0, tc = ~0, queue = ~0;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "%U", unformat_vnet_sw_interface,
+		    hsm->vnet_main, &sw_if_index))
+	;
+      else if (unformat (input, "entry %u", &entry))
+	;
+      else if (unformat (input, "tc %u", &tc))
+	;
+      else if (unformat (input, "queue %u", &queue))
+	;
+      else
+	return clib_error_return (0, "unknown input '%U'",
+				  format_unformat_error, input);
+    }
+
+  if (sw_if_index == ~0)
+    return clib_error_return (0, "Please specify a valid interface");
+
+  return hqos_sched_rv_to_error (hqos_sched_set_tc_table (sw_if_index, entry,
+							   tc, queue),
+				 "entry, traffic class or queue");
+}
+
+/* *INDENT-OFF* */
+/*
+ * Maps qos.bits of classified packets (0-63) to one of thirteen traffic
+ * classes and queue, as 'set dpdk interface hqos tctbl' does.
+ */
+VLIB_CLI_COMMAND (hqos_sched_tctbl_command, static) =
+{
+  .path = "set hqos-sched tctbl",
+  .short_help = "set hqos-sched tctbl <interface-name> entry <map_val> "
+                "tc <tc_id> queue <queue_id>",
+  .function = hqos_sched_tctbl_command_fn,
+};
+/* *INDENT-ON* */
+
+static u8 *
+format_hqos_sched_tb (u8 * s, va_list * args)
+{
+  hqos_sched_tb_t *tb = va_arg (*args, hqos_sched_tb_t *);
+
+  return format (s, "rate %.0f bytes/s, bktsize %.0f bytes", tb->rate,
+		 tb->size);
+}
+
+static u8 *
+format_hqos_sched_port (u8 * s, va_list * args)
+{
+  hqos_sched_port_t *port = va_arg (*args, hqos_sched_port_t *);
+  int verbose = va_arg (*args, int);
+  hqos_sched_pipe_t *pipe;
+  u32 i, j, pos;
+
+  s = format (s, "%U: thread %u, %U\n",
+	      format_vnet_sw_if_index_name, hqos_sched_main.vnet_main,
+	      port->sw_if_index, port->thread_index,
+	      format_hqos_sched_tb, &port->tb);
+  s = format (s, "  subports %u, pipes %u, queue-size %u, queued %u, "
+	      "active pipes %u\n", port->n_subports, port->n_pipes,
+	      port->queue_size, port->n_queued, port->n_active_pipes);
+  for (i = 0; i < port->n_subports; i++)
+    s = format (s, "  subport %u: %U\n", i, format_hqos_sched_tb,
+		&port->subports[i].tb);
+
+  if (!verbose)
+    return s;
+
+  s = format (s, "  tc table (entry: tc/queue):");
+  for (i = 0; i < HQOS_SCHED_TC_TABLE_SIZE; i++)
+    s = format (s, "%s%2u: %u/%u", (i % 8) ? ", " : "\n    ", i,
+		port->tc_table[i] >> 2, port->tc_table[i] & 0x3);
+  s = format (s, "\n");
+
+  for (pos = 0; pos < vec_len (port->pipes); pos++)
+    {
+      pipe = &port->pipes[pos];
+      if (pipe->active_queues == 0)
+	continue;
+      s = format (s, "  subport %u pipe %u: %U, queue depths:",
+		  pos / port->n_pipes, pos % port->n_pipes,
+		  format_hqos_sched_tb, &pipe->tb);
+      for (j = 0; j < HQOS_SCHED_QUEUES_PER_PIPE; j++)
+	s = format (s, " %u", hqos_sched_queue_len (&pipe->queues[j]));
+      s = format (s, "\n");
+    }
+  return s;
+}
+
+static clib_error_t *
+hqos_sched_show_command_fn (vlib_main_t * vm, unformat_input_t * input,
+			    vlib_cli_command_t * cmd)
+{
+  hqos_sched_main_t *hsm = &hqos_sched_main;
+  hqos_sched_port_t *port;
+  u32 sw_if_index = ~0;
+  int verbose = 0;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "%U", unformat_vnet_sw_interface,
+		    hsm->vnet_main, &sw_if_index))
+	;
+      else if (unformat (input, "verbose"))
+	verbose = 1;
+      else
+	return clib_error_return (0, "unknown input '%U'",
+				  format_unformat_error, input);
+    }
+
+  /* *INDENT-OFF* */
+  pool_foreach (port, hsm->ports)
+    {
+      if (sw_if_index == ~0 || sw_if_index == port->sw_if_index)
+        vlib_cli_output (vm, "%U", format_hqos_sched_port, port, verbose);
+    }
+  /* *INDENT-ON* */
+  return NULL;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (hqos_sched_show_command, static) =
+{
+  .path = "show hqos-sched",
+  .short_help = "show hqos-sched [<interface-name>] [verbose]",
+  .function = hqos_sched_show_command_fn,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+hqos_sched_init (vlib_main_t * vm)
+{
+  hqos_sched_main_t *hsm = &hqos_sched_main;
+
+  hsm->vlib_main = vm;
+  hsm->vnet_main = vnet_get_main ();
+  hsm->frame_queue_index =
+    vlib_frame_queue_main_init (hqos_sched_node.index, 0);
+  return NULL;
+}
+
+VLIB_INIT_FUNCTION (hqos_sched_init);
+
+/* *INDENT-OFF* */
+VLIB_PLUGIN_REGISTER () =
+{
+  .version = VPP_BUILD_VER,
+  .description = "hqos_sched plugin - VPP native hierarchical QoS scheduler",
+};
+/* *INDENT-ON* */
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
@@ -0,0 +1,376 @@
+/*
+ * Copyright (c) 2023 FlexiWAN
+ *
+ * List of features made for FlexiWAN (denoted by FLEXIWAN_FEATURE flag):
+ *  - native_hqos_sched: VPP native hierarchical QoS scheduler. Unlike the
+ *  DPDK rte_sched based HQoS (see plugins/dpdk/hqos/hqos.c), it does not
+ *  depend on the interface driver, so it can be used on tap, af_packet,
+ *  vmxnet3, tun and other non-DPDK WAN interfaces.
+ *
+ * This file is added by the Flexiwan feature: native_hqos_sched.
+ */
+
+/*
+ * The scheduler runs as the 'hqos-sched' feature on the interface-output arc.
+ * It has the same hierarchy as the DPDK scheduler:
+ *
+ *   port -> subports -> pipes -> traffic classes -> queues
+ *
+ * Port, subports and pipes are shaped by token buckets. Every traffic class
+ * of pipe has its own token bucket as well. Traffic classes of pipe are
+ * served in strict priority order, the class 0 is the highest one. The best
+ * effort class has four queues served by packet based WRR. Pipes are served
+ * round robin, one packet per visit.
+ *
+ * The packets are classified exactly as dpdk_hqos_metadata_set() does:
+ * the subport and the pipe are taken out of the qos.id buffer metadata
+ * (higher 16 bits - subport, lower 16 bits - pipe), the traffic class and
+ * the queue are found by lookup of qos.bits in the traffic class table of port
+ * if the packet was classified, the unclassified packets go to the last best
+ * effort queue.
+ *
+ * The port is owned by one thread, by default the thread that polls the first
+ * RX queue of the interface. The feature node enqueues packets into the port
+ * on the owner thread and the 'hqos-sched-output' input node dequeues them
+ * on the same thread directly into the interface TX node, so no dedicated
+ * scheduler thread is needed and the port state (queues, token buckets,
+ * credits) is touched by one thread only, without locks.
+ *
+ * Packets that reach the feature node on any other thread are handed off to
+ * the owner thread through a VPP frame queue (vlib_buffer_enqueue_to_thread),
+ * which is a ring of frames per thread. The owner thread runs the feature
+ * node again for them and enqueues them into the port. When the frame queue
+ * is full the packets are dropped and counted as 'handoff congestion drops'.
+ * The handoff costs a frame queue round trip for those packets only, which is
+ * cheaper than taking a port lock for every enqueue and dequeue. To avoid it,
+ * place the port on the thread that receives the bulk of its traffic.
+ */
+
+#ifndef __included_hqos_sched_h__
+#define __included_hqos_sched_h__
+
+#include <vnet/vnet.h>
+
+#define HQOS_SCHED_TRAFFIC_CLASSES      13  /* as RTE_SCHED_TRAFFIC_CLASSES_PER_PIPE */
+#define HQOS_SCHED_TC_BE                12  /* the best effort class */
+#define HQOS_SCHED_BE_QUEUES            4
+#define HQOS_SCHED_QUEUES_PER_PIPE      (HQOS_SCHED_TC_BE + HQOS_SCHED_BE_QUEUES)
+#define HQOS_SCHED_TC_TABLE_SIZE        64
+
+#define HQOS_SCHED_DEFAULT_SUBPORTS     4
+#define HQOS_SCHED_DEFAULT_PIPES        128
+#define HQOS_SCHED_DEFAULT_QUEUE_SIZE   64
+#define HQOS_SCHED_DEFAULT_PORT_RATE    1250000000 /* bytes per second, 10GbE */
+#define HQOS_SCHED_DEFAULT_TB_SIZE_MS   5          /* 5ms of rate */
+#define HQOS_SCHED_MTU_BYTES            (1500 + 18)
+#define HQOS_SCHED_MIN_TB_SIZE_BYTES    (4 * HQOS_SCHED_MTU_BYTES)
+#define HQOS_SCHED_FRAME_OVERHEAD       24         /* preamble, IFG and FCS */
+#define HQOS_SCHED_BURST_DEQ            VLIB_FRAME_SIZE
+#define HQOS_SCHED_MAX_SUBPORTS         0xFFFF
+#define HQOS_SCHED_MAX_PIPES            0xFFFF
+
+typedef struct
+{
+  f64 rate;         /* bytes per second */
+  f64 size;         /* bucket depth in bytes */
+  f64 credits;      /* bytes */
+  f64 last_update;  /* seconds */
+} hqos_sched_tb_t;
+
+typedef struct
+{
+  u32 *buffers;     /* ring of buffer indices, power of 2 size */
+  u32 *lengths;     /* lengths of packets on ring including frame overhead */
+  u32 head;         /* free running read position */
+  u32 tail;         /* free running write position */
+} hqos_sched_queue_t;
+
+typedef struct
+{
+  hqos_sched_tb_t tb;
+  hqos_sched_tb_t tc_tb[HQOS_SCHED_TRAFFIC_CLASSES];
+  u32 wrr_weights[HQOS_SCHED_BE_QUEUES];
+  u32 wrr_queue;    /* the best effort queue served now */
+  u32 wrr_left;     /* packets left to serve from the wrr_queue */
+  u32 active_queues;/* bitmask of non empty queues */
+  hqos_sched_queue_t queues[HQOS_SCHED_QUEUES_PER_PIPE];
+} hqos_sched_pipe_t;
+
+typedef struct
+{
+  hqos_sched_tb_t tb;
+} hqos_sched_subport_t;
+
+typedef struct
+{
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+
+  u32 sw_if_index;
+  u32 tx_node_index;    /* TX node of the interface */
+  u32 thread_index;     /* the owner thread */
+
+  u32 n_subports;
+  u32 n_pipes;          /* pipes per subport */
+  u32 queue_size;
+
+  hqos_sched_tb_t tb;
+  hqos_sched_subport_t *subports;
+  hqos_sched_pipe_t *pipes;   /* indexed by subport * n_pipes + pipe */
+
+  /*
+   * Bitmap of pipes with packets, indexed as 'pipes'.
+   * Fixed size array of words, so it is never reallocated by datapath.
+   */
+  u64 *active_pipes;
+  u32 n_active_pipes;
+  u32 next_pipe;        /* round robin position */
+  u32 n_queued;
+
+  /*
+   * Maps qos.bits of classified packet into traffic class and queue:
+   * (tc << 2) | queue, the same as hqos_tc_table of DPDK HQoS.
+   */
+  u32 tc_table[HQOS_SCHED_TC_TABLE_SIZE];
+} hqos_sched_port_t;
+
+typedef struct
+{
+  /* Pool of ports */
+  hqos_sched_port_t *ports;
+
+  /* Map of sw_if_index to port index */
+  u32 *port_index_by_sw_if_index;
+
+  /* Per thread vector of ports owned by thread */
+  u32 **ports_by_thread;
+
+  /* Frame queue to hand off packets to the port owner thread */
+  u32 frame_queue_index;
+
+  /* convenience */
+  vlib_main_t *vlib_main;
+  vnet_main_t *vnet_main;
+} hqos_sched_main_t;
+
+extern hqos_sched_main_t hqos_sched_main;
+extern vlib_node_registration_t hqos_sched_node;
+extern vlib_node_registration_t hqos_sched_output_node;
+
+/*
+ * Control plane API, should be called by main thread.
+ * Rates are in bytes per second, token bucket sizes are in bytes,
+ * zero rate or size means default or not changed.
+ */
+int hqos_sched_enable (u32 sw_if_index, u64 rate, u32 n_subports,
+		       u32 n_pipes, u32 queue_size, u32 thread_index);
+int hqos_sched_disable (u32 sw_if_index);
+int hqos_sched_set_port (u32 sw_if_index, u64 rate, u64 tb_size);
+int hqos_sched_set_subport (u32 sw_if_index, u32 subport_id, u64 rate,
+			    u64 tb_size);
+int hqos_sched_set_pipe (u32 sw_if_index, u32 subport_id, u32 pipe_id,
+			 u64 rate, u64 tb_size, u64 * tc_rates,
+			 u32 * wrr_weights);
+int hqos_sched_set_tc_table (u32 sw_if_index, u32 entry, u32 tc, u32 queue);
+
+always_inline hqos_sched_port_t *
+hqos_sched_port_get_by_sw_if_index (u32 sw_if_index)
+{
+  hqos_sched_main_t *hsm = &hqos_sched_main;
+
+  if (sw_if_index >= vec_len (hsm->port_index_by_sw_if_index) ||
+      hsm->port_index_by_sw_if_index[sw_if_index] == ~0)
+    return NULL;
+  return pool_elt_at_index (hsm->ports,
+			    hsm->port_index_by_sw_if_index[sw_if_index]);
+}
+
+always_inline void
+hqos_sched_tb_init (hqos_sched_tb_t * tb, f64 rate, f64 size, f64 now)
+{
+  tb->rate = rate;
+  tb->size = size;
+  tb->credits = size;
+  tb->last_update = now;
+}
+
+always_inline void
+hqos_sched_tb_update (hqos_sched_tb_t * tb, f64 now)
+{
+  tb->credits += (now - tb->last_update) * tb->rate;
+  if (tb->credits > tb->size)
+    tb->credits = tb->size;
+  tb->last_update = now;
+}
+
+always_inline u32
+hqos_sched_queue_len (hqos_sched_queue_t * q)
+{
+  return q->tail - q->head;
+}
+
+/*
+ * Finds the next pipe with packets starting at position 'pos', wrapping
+ * around the end of the bitmap. Returns ~0 if there are no such pipes.
+ */
+always_inline u32
+hqos_sched_next_active_pipe (hqos_sched_port_t * port, u32 pos)
+{
+  u32 n_words = vec_len (port->active_pipes);
+  u32 w = pos >> 6, i;
+  u64 word;
+
+  if (w >= n_words)
+    w = pos = 0;
+
+  word = port->active_pipes[w] & (~0ULL << (pos & 63));
+  for (i = 0; i <= n_words; i++)
+    {
+      if (word)
+	return (w << 6) + count_trailing_zeros (word);
+      w = (w + 1 < n_words) ? w + 1 : 0;
+      word = port->active_pipes[w];
+    }
+  return ~0;
+}
+
+/*
+ * Selects the queue of pipe to be served next: the highest priority
+ * traffic class with packets and with credits, and the WRR queue for the best
+ * effort class. Returns ~0 if no queue can be served.
+ */
+always_inline u32
+hqos_sched_pipe_select_queue (hqos_sched_pipe_t * pipe, f64 now)
+{
+  hqos_sched_queue_t *q;
+  hqos_sched_tb_t *tb;
+  u32 active, be_active, qi, i;
+
+  active = pipe->active_queues & ((1 << HQOS_SCHED_TC_BE) - 1);
+  while (active)
+    {
+      qi = count_trailing_zeros (active);
+      active &= active - 1;
+
+      q = &pipe->queues[qi];
+      tb = &pipe->tc_tb[qi];
+      hqos_sched_tb_update (tb, now);
+      if (tb->credits >= q->lengths[q->head & (vec_len (q->lengths) - 1)])
+	return qi;
+    }
+
+  be_active = pipe->active_queues >> HQOS_SCHED_TC_BE;
+  if (be_active == 0)
+    return ~0;
+
+  tb = &pipe->tc_tb[HQOS_SCHED_TC_BE];
+  hqos_sched_tb_update (tb, now);
+
+  if (pipe->wrr_left == 0 || !(be_active & (1 << pipe->wrr_queue)))
+    {
+      for (i = 1; i <= HQOS_SCHED_BE_QUEUES; i++)
+	{
+	  qi = (pipe->wrr_queue + i) % HQOS_SCHED_BE_QUEUES;
+	  if (be_active & (1 << qi))
+	    break;
+	}
+      pipe->wrr_queue = qi;
+      pipe->wrr_left = pipe->wrr_weights[qi];
+    }
+
+  q = &pipe->queues[HQOS_SCHED_TC_BE + pipe->wrr_queue];
+  if (tb->credits >= q->lengths[q->head & (vec_len (q->lengths) - 1)])
+    return HQOS_SCHED_TC_BE + pipe->wrr_queue;
+  return ~0;
+}
+
+/*
+ * Dequeues up to 'n_max' packets out of port in scheduling order.
+ * Should be called by the port owner thread.
+ */
+always_inline u32
+hqos_sched_port_dequeue (hqos_sched_port_t * port, f64 now, u32 * buffers,
+			 u32 n_max)
+{
+  hqos_sched_subport_t *subport;
+  hqos_sched_pipe_t *pipe;
+  hqos_sched_queue_t *q;
+  u32 n = 0, n_idle = 0;
+  u32 pos, qi, len, slot, tc;
+
+  if (port->n_queued == 0)
+    return 0;
+
+  hqos_sched_tb_update (&port->tb, now);
+
+  pos = port->next_pipe;
+  while (n < n_max)
+    {
+      pos = hqos_sched_next_active_pipe (port, pos);
+      if (pos == ~0)
+	break;
+
+      pipe = &port->pipes[pos];
+      subport = &port->subports[pos / port->n_pipes];
+      hqos_sched_tb_update (&pipe->tb, now);
+      hqos_sched_tb_update (&subport->tb, now);
+
+      qi = hqos_sched_pipe_select_queue (pipe, now);
+      if (qi != ~0)
+	{
+	  q = &pipe->queues[qi];
+	  slot = q->head & (vec_len (q->buffers) - 1);
+	  len = q->lengths[slot];
+
+	  if (port->tb.credits < len)
+	    break;		/* the port is out of credits, nothing can go */
+
+	  if (pipe->tb.credits >= len && subport->tb.credits >= len)
+	    {
+	      tc = (qi < HQOS_SCHED_TC_BE) ? qi : HQOS_SCHED_TC_BE;
+	      buffers[n++] = q->buffers[slot];
+	      q->head++;
+	      port->tb.credits -= len;
+	      subport->tb.credits -= len;
+	      pipe->tb.credits -= len;
+	      pipe->tc_tb[tc].credits -= len;
+	      if (tc == HQOS_SCHED_TC_BE)
+		pipe->wrr_left--;
+
+	      port->n_queued--;
+	      if (hqos_sched_queue_len (q) == 0)
+		{
+		  pipe->active_queues &= ~(1 << qi);
+		  if (pipe->active_queues == 0)
+		    {
+		      port->active_pipes[pos >> 6] &= ~(1ULL << (pos & 63));
+		      port->n_active_pipes--;
+		    }
+		}
+	      n_idle = 0;
+	    }
+	  else
+	    n_idle++;
+	}
+      else
+	n_idle++;
+
+      /* Stop once every active pipe was visited with no packet sent */
+      if (n_idle > port->n_active_pipes)
+	break;
+
+      pos++;
+    }
+
+  port->next_pipe = (pos == ~0) ? 0 : pos;
+  return n;
+}
+
+#endif /* __included_hqos_sched_h__ */
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2023 FlexiWAN
+ *
+ * List of features made for FlexiWAN (denoted by FLEXIWAN_FEATURE flag):
+ *  - native_hqos_sched: VPP native hierarchical QoS scheduler. Unlike the
+ *  DPDK rte_sched based HQoS (see plugins/dpdk/hqos/hqos.c), it does not
+ *  depend on the interface driver, so it can be used on tap, af_packet,
+ *  vmxnet3, tun and other non-DPDK WAN interfaces.
+ *
+ * This file is added by the Flexiwan feature: native_hqos_sched.
+ */
+
+#include <vlib/vlib.h>
+#include <vnet/vnet.h>
+#include <vnet/feature/feature.h>
+#include <vppinfra/error.h>
+#include <hqos_sched/hqos_sched.h>
+
+typedef struct
+{
+  u32 sw_if_index;
+  u32 subport;
+  u32 pipe;
+  u8 tc;
+  u8 queue;
+  u8 handoff;
+} hqos_sched_trace_t;
+
+#ifndef CLIB_MARCH_VARIANT
+
+/* packet trace format function */
+static u8 *
+format_hqos_sched_trace (u8 * s, va_list * args)
+{
+  CLIB_UNUSED (vlib_main_t * vm) = va_arg (*args, vlib_main_t *);
+  CLIB_UNUSED (vlib_node_t * node) = va_arg (*args, vlib_node_t *);
+  hqos_sched_trace_t *t = va_arg (*args, hqos_sched_trace_t *);
+
+  if (t->handoff)
+    s = format (s, "HQOS_SCHED: sw_if_index: %u, handoff to owner thread",
+		t->sw_if_index);
+  else
+    s = format (s, "HQOS_SCHED: sw_if_index: %u, subport: %u, pipe: %u, "
+		"tc: %u, queue: %u", t->sw_if_index, t->subport, t->pipe,
+		t->tc, t->queue);
+  return s;
+}
+
+#endif /* CLIB_MARCH_VARIANT */
+
+#define foreach_hqos_sched_error \
+_(ENQUEUED, "packets enqueued") \
+_(QUEUE_FULL, "queue full drops") \
+_(INVALID_ID, "subport/pipe out of range, default used") \
+_(HANDOFF, "packets handed off to owner thread") \
+_(CONGESTION_DROP, "handoff congestion drops") \
+_(NO_PORT, "scheduler not enabled on interface")
+
+typedef enum
+{
+#define _(sym,str) HQOS_SCHED_ERROR_##sym,
+  foreach_hqos_sched_error
+#undef _
+    HQOS_SCHED_N_ERROR,
+} hqos_sched_error_t;
+
+#ifndef CLIB_MARCH_VARIANT
+static char *hqos_sched_error_strings[] = {
+#define _(sym,string) string,
+  foreach_hqos_sched_error
+#undef _
+};
+#endif /* CLIB_MARCH_VARIANT */
+
+typedef enum
+{
+  HQOS_SCHED_NEXT_DROP,
+  HQOS_SCHED_N_NEXT,
+} hqos_sched_next_t;
+
+/*
+ * Enqueues packet into the port queue selected by the packet metadata,
+ * see dpdk_hqos_metadata_set(). Returns the drop error or ~0 on success.
+ */
+static_always_inline u32
+hqos_sched_enqueue_one (vlib_main_t * vm, hqos_sched_port_t * port,
+			vlib_buffer_t * b, u32 bi, hqos_sched_trace_t * t,
+			u32 * n_invalid_id)
+{
+  hqos_sched_pipe_t *pipe;
+  hqos_sched_queue_t *q;
+  u32 subport_id, pipe_id, tc_q, tc, qi, pos, slot;
+
+  if (b->flags & VNET_BUFFER_F_IS_CLASSIFIED)
+    tc_q = port->tc_table[vnet_buffer2 (b)->qos.bits];
+  else
+    tc_q = (HQOS_SCHED_TC_BE << 2) | (HQOS_SCHED_BE_QUEUES - 1);
+
+  /*
+   * The lower 16 bits of qos.id represent the pipe id and the higher
+   * 16 bits represent the subport id.
+   */
+  subport_id = vnet_buffer2 (b)->qos.id >> 16;
+  pipe_id = vnet_buffer2 (b)->qos.id & 0xFFFF;
+  if (PREDICT_FALSE (subport_id >= port->n_subports ||
+		     pipe_id >= port->n_pipes))
+    {
+      subport_id = pipe_id = 0;
+      (*n_invalid_id)++;
+    }
+
+  /* Reset QoS the identifier field */
+  vnet_buffer2 (b)->qos.id = 0;
+
+  tc = tc_q >> 2;
+  qi = (tc < HQOS_SCHED_TC_BE) ? tc : HQOS_SCHED_TC_BE + (tc_q & 0x3);
+  pos = subport_id * port->n_pipes + pipe_id;
+  pipe = &port->pipes[pos];
+  q = &pipe->queues[qi];
+
+  if (t)
+    {
+      t->subport = subport_id;
+      t->pipe = pipe_id;
+      t->tc = tc;
+      t->queue = tc_q & 0x3;
+    }
+
+  if (PREDICT_FALSE (hqos_sched_queue_len (q) >= port->queue_size))
+    return HQOS_SCHED_ERROR_QUEUE_FULL;
+
+  slot = q->tail & (port->queue_size - 1);
+  q->buffers[slot] = bi;
+  q->lengths[slot] = vlib_buffer_length_in_chain (vm, b) +
+    HQOS_SCHED_FRAME_OVERHEAD;
+  q->tail++;
+  port->n_queued++;
+
+  if (pipe->active_queues == 0)
+    {
+      port->active_pipes[pos >> 6] |= 1ULL << (pos & 63);
+      port->n_active_pipes++;
+    }
+  pipe->active_queues |= 1 << qi;
+  return ~0;
+}
+
+VLIB_NODE_FN (hqos_sched_node) (vlib_main_t * vm,
+				vlib_node_runtime_t * node,
+				vlib_frame_t * frame)
+{
+  hqos_sched_main_t *hsm = &hqos_sched_main;
+  u32 thread_index = vm->thread_index;
+  u32 n_left_from, *from, bi;
+  u32 drops[VLIB_FRAME_SIZE], handoffs[VLIB_FRAME_SIZE];
+  u16 thread_indices[VLIB_FRAME_SIZE];
+  u32 n_drops = 0, n_handoffs = 0, n_enqueued = 0, n_invalid_id = 0;
+  u32 n_handed_off, error, sw_if_index;
+  hqos_sched_port_t *port = NULL;
+  hqos_sched_trace_t *t;
+  vlib_buffer_t *b;
+
+  from = vlib_frame_vector_args (frame);
+  n_left_from = frame->n_vectors;
+
+  while (n_left_from > 0)
+    {
+      if (n_left_from > 1)
+	vlib_prefetch_buffer_header (vlib_get_buffer (vm, from[1]), LOAD);
+
+      bi = from[0];
+      b = vlib_get_buffer (vm, bi);
+      sw_if_index = vnet_buffer (b)->sw_if_index[VLIB_TX];
+      t = NULL;
+
+      if (PREDICT_FALSE (b->flags & VLIB_BUFFER_IS_TRACED))
+	{
+	  t = vlib_add_trace (vm, node, b, sizeof (*t));
+	  clib_memset (t, 0, sizeof (*t));
+	  t->sw_if_index = sw_if_index;
+	}
+
+      /* The frame has packets of the same interface usually */
+      if (PREDICT_FALSE (port == NULL || port->sw_if_index != sw_if_index))
+	port = hqos_sched_port_get_by_sw_if_index (sw_if_index);
+
+      if (PREDICT_FALSE (port == NULL))
+	{
+	  b->error = node->errors[HQOS_SCHED_ERROR_NO_PORT];
+	  drops[n_drops++] = bi;
+	}
+      else if (PREDICT_FALSE (port->thread_index != thread_index))
+	{
+	  if (t)
+	    t->handoff = 1;
+	  thread_indices[n_handoffs] = port->thread_index;
+	  handoffs[n_handoffs++] = bi;
+	}
+      else
+	{
+	  error = hqos_sched_enqueue_one (vm, port, b, bi, t, &n_invalid_id);
+	  if (PREDICT_FALSE (error != ~0))
+	    {
+	      b->error = node->errors[error];
+	      drops[n_drops++] = bi;
+	    }
+	  else
+	    n_enqueued++;
+	}
+
+      from += 1;
+      n_left_from -= 1;
+    }
+
+  if (n_handoffs)
+    {
+      n_handed_off = vlib_buffer_enqueue_to_thread (vm, hsm->frame_queue_index,
+						    handoffs, thread_indices,
+						    n_handoffs, 1);
+      vlib_node_increment_counter (vm, node->node_index,
+				   HQOS_SCHED_ERROR_HANDOFF, n_handed_off);
+      if (n_handed_off < n_handoffs)
+	vlib_node_increment_counter (vm, node->node_index,
+				     HQOS_SCHED_ERROR_CONGESTION_DROP,
+				     n_handoffs - n_handed_off);
+    }
+
+  if (n_drops)
+    vlib_buffer_enqueue_to_single_next (vm, node, drops,
+					HQOS_SCHED_NEXT_DROP, n_drops);
+
+  vlib_node_increment_counter (vm, node->node_index,
+			       HQOS_SCHED_ERROR_ENQUEUED, n_enqueued);
+  if (n_invalid_id)
+    vlib_node_increment_counter (vm, node->node_index,
+				 HQOS_SCHED_ERROR_INVALID_ID, n_invalid_id);
+  return frame->n_vectors;
+}
+
+/*
+ * Dequeues packets out of ports owned by the thread and sends them directly
+ * into the interface TX node, as the interface-tx node does.
+ */
+VLIB_NODE_FN (hqos_sched_output_node) (vlib_main_t * vm,
+				       vlib_node_runtime_t * node,
+				       vlib_frame_t * frame)
+{
+  hqos_sched_main_t *hsm = &hqos_sched_main;
+  u32 thread_index = vm->thread_index;
+  u32 buffers[HQOS_SCHED_BURST_DEQ];
+  u32 *port_index, *to_next, n, n_total = 0;
+  hqos_sched_port_t *port;
+  vlib_frame_t *to_frame;
+  f64 now;
+
+  if (PREDICT_FALSE (thread_index >= vec_len (hsm->ports_by_thread)))
+    return 0;
+
+  now = vlib_time_now (vm);
+  vec_foreach (port_index, hsm->ports_by_thread[thread_index])
+  {
+    port = pool_elt_at_index (hsm->ports, *port_index);
+    n = hqos_sched_port_dequeue (port, now, buffers, HQOS_SCHED_BURST_DEQ);
+    if (n == 0)
+      continue;
+
+    to_frame = vlib_get_frame_to_node (vm, port->tx_node_index);
+    to_next = vlib_frame_vector_args (to_frame);
+    clib_memcpy_fast (to_next, buffers, n * sizeof (buffers[0]));
+    to_frame->n_vectors = n;
+    vlib_put_frame_to_node (vm, port->tx_node_index, to_frame);
+    n_total += n;
+  }
+  return n_total;
+}
+
+/* *INDENT-OFF* */
+#ifndef CLIB_MARCH_VARIANT
+VLIB_REGISTER_NODE (hqos_sched_node) =
+{
+  .name = "hqos-sched",
+  .vector_size = sizeof (u32),
+  .format_trace = format_hqos_sched_trace,
+  .type = VLIB_NODE_TYPE_INTERNAL,
+
+  .n_errors = ARRAY_LEN(hqos_sched_error_strings),
+  .error_strings = hqos_sched_error_strings,
+
+  .n_next_nodes = HQOS_SCHED_N_NEXT,
+
+  .next_nodes = {
+    [HQOS_SCHED_NEXT_DROP] = "error-drop",
+  },
+};
+
+VLIB_REGISTER_NODE (hqos_sched_output_node) =
+{
+  .name = "hqos-sched-output",
+  .type = VLIB_NODE_TYPE_INPUT,
+  .state = VLIB_NODE_STATE_DISABLED,
+};
+
+/*
+ * The scheduler should be the last feature on arc, so the features that
+ * change or replicate packets, like IPsec or SPAN, see packets before they
+ * are shaped.
+ */
+VNET_FEATURE_INIT (hqos_sched_feature, static) =
+{
+  .arc_name = "interface-output",
+  .node_name = "hqos-sched",
+  .runs_after = VNET_FEATURES ("span-output", "ipsec-if-output"),
+  .runs_before = VNET_FEATURES ("interface-tx"),
+};
+#endif /* CLIB_MARCH_VARIANT */
+/* *INDENT-ON* */
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
@@ -0,0 +1,309 @@
+/*
+ * Copyright (c) 2023 FlexiWAN
+ *
+ * List of features made for FlexiWAN (denoted by FLEXIWAN_FEATURE flag):
+ *  - acl_based_classification: Feature to provide traffic classification using
+ *  ACL plugin. Matching ACLs provide the service class and importance
+ *  attribute. The classification result is marked in the packet and can be
+ *  made use of in other functions like scheduling, policing, marking etc.
+ *
+ * This file is added by the Flexiwan feature: acl_based_classification.
+ */
+
+/*
+ * Microbenchmark of the classifier-acls ACL lookup. It compares the cost in
+ * CPU clocks per packet of the packet by packet lookup, as it was done by the
+ * classifier-acls node, with the batched lookup implemented by
+ * classifier_acls_match_batch(), for ACL-s of 1, 16 and 1000 rules.
+ *
+ * Note the ACL-s created by the test are not removed, as the ACL plugin
+ * provides no CLI to remove them.
+ */
+
+#include <vlib/vlib.h>
+#include <vnet/ip/ip4_packet.h>
+#include <vnet/udp/udp_packet.h>
+#include <vppinfra/random.h>
+#include <plugins/classifier_acls/inlines.h>
+
+typedef struct
+{
+  acl_plugin_methods_t acl_plugin;
+  u32 acl_user_id;
+  u8 initialized;
+} classifier_acls_test_main_t;
+
+static classifier_acls_test_main_t classifier_acls_test_main;
+
+/*
+ * Collects output of the ACL create CLI, that reports index of the new ACL.
+ */
+static void
+classifier_acls_test_cli_output (uword arg, u8 * buffer, uword buffer_bytes)
+{
+  u8 **output = (u8 **) arg;
+  vec_add (*output, buffer, buffer_bytes);
+}
+
+/*
+ * Creates ACL of 'n_rules' rules, the rule i matches UDP packets from the
+ * 10.<i/256>.<i%256>.0/24 network. Returns the ACL index or ~0 on failure.
+ */
+static u32
+classifier_acls_test_acl_create (vlib_main_t * vm, u32 n_rules)
+{
+  unformat_input_t input;
+  u8 *cmd = 0, *output = 0;
+  u32 acl_index = ~0;
+  u32 i;
+
+  cmd = format (cmd, "set acl-plugin acl");
+  for (i = 0; i < n_rules; i++)
+    cmd = format (cmd, "%s permit src 10.%u.%u.0/24 proto 17 class %u",
+		  i ? "," : "", (i >> 8) & 0xff, i & 0xff, 1 + (i % 10));
+
+  unformat_init_string (&input, (char *) cmd, vec_len (cmd));
+  vlib_cli_input (vm, &input, classifier_acls_test_cli_output,
+		  (uword) & output);
+  unformat_free (&input);
+
+  unformat_init_vector (&input, output);
+  if (!unformat (&input, "ACL index:%u", &acl_index))
+    acl_index = ~0;
+  unformat_free (&input);	/* frees the output vector */
+
+  vec_free (cmd);
+  return acl_index;
+}
+
+/*
+ * Fills buffer with UDP packet. 7 of 8 packets match one of rules.
+ */
+static void
+classifier_acls_test_packet_init (vlib_buffer_t * b, u32 n_rules, u32 * seed)
+{
+  ip4_header_t *ip4;
+  udp_header_t *udp;
+  u32 rule = random_u32 (seed) % n_rules;
+
+  b->current_data = 0;
+  b->current_length = 64;
+  ip4 = vlib_buffer_get_current (b);
+  clib_memset (ip4, 0, b->current_length);
+  ip4->ip_version_and_header_length = 0x45;
+  ip4->ttl = 64;
+  ip4->protocol = IP_PROTOCOL_UDP;
+  ip4->length = clib_host_to_net_u16 (b->current_length);
+  if ((random_u32 (seed) & 7) == 0)
+    ip4->src_address.as_u32 = clib_host_to_net_u32 (0xac100001);
+  else
+    ip4->src_address.as_u32 =
+      clib_host_to_net_u32 (0x0a000000 | (rule << 8) | 1);
+  ip4->dst_address.as_u32 = clib_host_to_net_u32 (0x08080808);
+  ip4->checksum = ip4_header_checksum (ip4);
+
+  udp = (udp_header_t *) (ip4 + 1);
+  udp->src_port = clib_host_to_net_u16 (1024 + (random_u32 (seed) & 0xfff));
+  udp->dst_port = clib_host_to_net_u16 (53);
+  udp->length = clib_host_to_net_u16 (b->current_length - sizeof (*ip4));
+}
+
+static clib_error_t *
+classifier_acls_test_run (vlib_main_t * vm, u32 n_rules, u32 n_packets,
+			  u32 n_iterations, u32 * seed)
+{
+  classifier_acls_test_main_t *ctm = &classifier_acls_test_main;
+  acl_main_t *am = ctm->acl_plugin.p_acl_main;
+  vlib_buffer_t *bufs[VLIB_FRAME_SIZE];
+  u32 lc_indexes[VLIB_FRAME_SIZE];
+  u32 acl_pos[VLIB_FRAME_SIZE];
+  u32 acl_index[VLIB_FRAME_SIZE];
+  u32 rule_index[VLIB_FRAME_SIZE];
+  u32 *single_rule_index = 0;
+  u32 *buffers = 0, *acls = 0;
+  fa_5tuple_opaque_t fa_5tuple;
+  clib_error_t *error = 0;
+  u64 t0, clocks_single = 0, clocks_batch = 0;
+  u32 trace_bitmap, pos, acl, match_acl, rule;
+  u32 n_alloc = 0;
+  u32 matches_single = 0, matches_batch = 0;
+  u32 i, j, k, n;
+  int lc_index;
+  u8 action;
+
+  acl = classifier_acls_test_acl_create (vm, n_rules);
+  if (acl == ~0)
+    return clib_error_return (0, "failed to create ACL of %u rules", n_rules);
+
+  lc_index = ctm->acl_plugin.get_lookup_context_index (ctm->acl_user_id,
+						       n_rules, 0);
+  if (lc_index < 0)
+    return clib_error_return (0, "failed to get lookup context: %d",
+			      lc_index);
+  vec_add1 (acls, acl);
+  ctm->acl_plugin.set_acl_vec_for_context (lc_index, acls);
+
+  vec_validate (buffers, n_packets - 1);
+  vec_validate (single_rule_index, n_packets - 1);
+  n_alloc = vlib_buffer_alloc (vm, buffers, n_packets);
+  if (n_alloc != n_packets)
+    {
+      error = clib_error_return (0, "buffer allocation failure");
+      goto done;
+    }
+  for (i = 0; i < n_packets; i++)
+    classifier_acls_test_packet_init (vlib_get_buffer (vm, buffers[i]),
+				      n_rules, seed);
+
+  for (i = 0; i < VLIB_FRAME_SIZE; i++)
+    lc_indexes[i] = lc_index;
+
+  /*
+   * The packet by packet and the batched lookups run over all packets one
+   * after another, so if the packets do not fit the cache, both find the
+   * packet data out of cache, as it is in real traffic.
+   */
+  for (j = 0; j < n_iterations; j++)
+    {
+      /* packet by packet, as classifier-acls node did before */
+      for (i = 0; i < n_packets; i += n)
+	{
+	  n = clib_min (n_packets - i, VLIB_FRAME_SIZE);
+	  vlib_get_buffers (vm, buffers + i, bufs, n);
+
+	  t0 = clib_cpu_time_now ();
+	  for (k = 0; k < n; k++)
+	    {
+	      acl_plugin_fill_5tuple_inline (am, lc_index, bufs[k], 0, 1, 0,
+					     &fa_5tuple);
+	      if (acl_plugin_match_5tuple_inline (am, lc_index, &fa_5tuple, 0,
+						  &action, &pos, &match_acl, &rule,
+						  &trace_bitmap))
+		{
+		  matches_single++;
+		  single_rule_index[i + k] = rule;
+		}
+	      else
+		single_rule_index[i + k] = ~0;
+	    }
+	  clocks_single += clib_cpu_time_now () - t0;
+	}
+
+      for (i = 0; i < n_packets; i += n)
+	{
+	  n = clib_min (n_packets - i, VLIB_FRAME_SIZE);
+	  vlib_get_buffers (vm, buffers + i, bufs, n);
+
+	  t0 = clib_cpu_time_now ();
+	  matches_batch += classifier_acls_match_batch (am, bufs, lc_indexes,
+							n, 0 /* is_ip6 */,
+							acl_pos, acl_index,
+							rule_index);
+	  clocks_batch += clib_cpu_time_now () - t0;
+
+	  for (k = 0; k < n; k++)
+	    {
+	      rule = (acl_pos[k] == ~0) ? ~0 : rule_index[k];
+	      if (rule != single_rule_index[i + k])
+		{
+		  error = clib_error_return (0, "%u rules: packet %u matched "
+					     "rule %d by batch, %d by single",
+					     n_rules, i + k, rule,
+					     single_rule_index[i + k]);
+		  goto done;
+		}
+	    }
+	}
+    }
+
+  ASSERT (matches_single == matches_batch);
+
+  vlib_cli_output (vm, "%5u rules: %.2f clocks/pkt single, %.2f clocks/pkt "
+		   "batch, %u of %u matched", n_rules,
+		   (f64) clocks_single / (f64) (n_packets * n_iterations),
+		   (f64) clocks_batch / (f64) (n_packets * n_iterations),
+		   matches_batch / n_iterations, n_packets);
+
+done:
+  if (n_alloc)
+    vlib_buffer_free (vm, buffers, n_alloc);
+  ctm->acl_plugin.put_lookup_context_index (lc_index);
+  vec_free (buffers);
+  vec_free (single_rule_index);
+  vec_free (acls);
+  return error;
+}
+
+static clib_error_t *
+test_classifier_acls_batch_command_fn (vlib_main_t * vm,
+				       unformat_input_t * input,
+				       vlib_cli_command_t * cmd)
+{
+  classifier_acls_test_main_t *ctm = &classifier_acls_test_main;
+  u32 rules[] = { 1, 16, 1000 };
+  u32 n_rules = 0;
+  u32 n_packets = VLIB_FRAME_SIZE;
+  u32 n_iterations = 1000;
+  u32 seed = 0xdeadbeef;
+  clib_error_t *error;
+  u32 i;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "rules %u", &n_rules))
+	;
+      else if (unformat (input, "packets %u", &n_packets))
+	;
+      else if (unformat (input, "iterations %u", &n_iterations))
+	;
+      else if (unformat (input, "seed %u", &seed))
+	;
+      else
+	return clib_error_return (0, "unknown input '%U'",
+				  format_unformat_error, input);
+    }
+
+  if (n_packets == 0 || n_iterations == 0 || n_rules > 0xffff)
+    return clib_error_return (0, "invalid parameters");
+
+  if (!ctm->initialized)
+    {
+      error = acl_plugin_exports_init (&ctm->acl_plugin);
+      if (error)
+	return error;
+      ctm->acl_user_id = ctm->acl_plugin.register_user_module
+	("Classifier ACLs test", "n_rules", NULL);
+      ctm->initialized = 1;
+    }
+
+  if (n_rules)
+    return classifier_acls_test_run (vm, n_rules, n_packets, n_iterations,
+				     &seed);
+
+  for (i = 0; i < ARRAY_LEN (rules); i++)
+    {
+      error = classifier_acls_test_run (vm, rules[i], n_packets,
+					n_iterations, &seed);
+      if (error)
+	return error;
+    }
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (test_classifier_acls_batch_command, static) =
+{
+  .path = "test classifier-acls batch",
+  .short_help = "test classifier-acls batch [rules <n>] [packets <n>] "
+                "[iterations <n>] [seed <n>]",
+  .function = test_classifier_acls_batch_command_fn,
+};
+/* *INDENT-ON* */
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
@@ -0,0 +1,354 @@
+/*
+ *  Copyright (C) 2023 flexiWAN Ltd.
+ *  This file is part of the FWABF plugin.
+ *  The FWABF plugin is fork of the FDIO VPP ABF plugin.
+ *  It enhances ABF with functionality required for Flexiwan Multi-Link feature.
+ *  For more details see official documentation on the Flexiwan Multi-Link.
+ */
+
+/*
+ * Tests of the FWABF plugin.
+ *
+ * Scale test of the FWABF adjacency map (see fwabf_adj_map.h).
+ * It fills the map and the flat array, that was used before the map,
+ * with the same random values for the given number of adjacencies,
+ * verifies that lookups bring the same results and compares the lookup
+ * cost in CPU clocks.
+ */
+
+#include <vlib/vlib.h>
+#include <vnet/ethernet/ethernet.h>
+#include <vppinfra/random.h>
+#include <plugins/acl/exports.h>
+#include <plugins/fwabf/fwabf_adj_map.h>
+
+#define FWABF_TEST_INVALID_LABEL 0xFF
+#define FWABF_TEST_ROUNDS 5
+
+static clib_error_t *
+test_fwabf_adj_map_command_fn (vlib_main_t * vm,
+			       unformat_input_t * input,
+			       vlib_cli_command_t * cmd)
+{
+  fwabf_adj_map_t map;
+  u32 n_adjs = 200000;
+  u32 n_lookups = 10 << 20;
+  u32 seed = 0xdeadbeef;
+  u32 *flat = 0, *indexes = 0;
+  u32 i, j, r, n_indexes, sum_flat, sum_map;
+  u64 t0, clocks, clocks_flat = ~0ULL, clocks_map = ~0ULL;
+  clib_error_t *error = 0;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "count %u", &n_adjs))
+	;
+      else if (unformat (input, "lookups %u", &n_lookups))
+	;
+      else if (unformat (input, "seed %u", &seed))
+	;
+      else
+	return clib_error_return (0, "unknown input '%U'",
+				  format_unformat_error, input);
+    }
+
+  if (n_adjs == 0 || n_lookups == 0)
+    return clib_error_return (0, "count and lookups should be positive");
+
+  /*
+   * Fill the flat array and the map with the same values.
+   * Every fourth adjacency has no label, like adjacencies of not labeled
+   * interfaces.
+   */
+  fwabf_adj_map_init (&map, FWABF_TEST_INVALID_LABEL);
+  vec_validate_init_empty (flat, n_adjs - 1, FWABF_TEST_INVALID_LABEL);
+  for (i = 0; i < n_adjs; i++)
+    {
+      if ((random_u32 (&seed) & 3) == 0)
+	continue;
+      flat[i] = random_u32 (&seed) % FWABF_TEST_INVALID_LABEL;
+      fwabf_adj_map_set (&map, i, flat[i]);
+    }
+
+  /* Random adjacencies to lookup, as packets of different flows bring */
+  n_indexes = clib_min (n_lookups, 1 << 20);
+  vec_validate (indexes, n_indexes - 1);
+  for (i = 0; i < n_indexes; i++)
+    indexes[i] = random_u32 (&seed) % n_adjs;
+
+  for (i = 0; i < n_indexes; i++)
+    {
+      if (flat[indexes[i]] != fwabf_adj_map_get (&map, indexes[i]))
+	{
+	  error = clib_error_return (0, "adjacency %d: map %d != flat %d",
+				     indexes[i],
+				     fwabf_adj_map_get (&map, indexes[i]),
+				     flat[indexes[i]]);
+	  goto done;
+	}
+    }
+  if (fwabf_adj_map_get (&map, n_adjs << 1) != FWABF_TEST_INVALID_LABEL)
+    {
+      error = clib_error_return (0, "not set adjacency %d has label",
+				 n_adjs << 1);
+      goto done;
+    }
+
+  /*
+   * The flat array and the map are measured in turns, the best round of
+   * every one is reported, so the noise of other processes does not bias
+   * the comparison.
+   */
+  for (r = 0; r < FWABF_TEST_ROUNDS; r++)
+    {
+      sum_flat = 0;
+      t0 = clib_cpu_time_now ();
+      for (i = 0, j = 0; i < n_lookups;
+	   i++, j = (j + 1 == n_indexes) ? 0 : j + 1)
+	sum_flat += flat[indexes[j]];
+      clocks = clib_cpu_time_now () - t0;
+      clocks_flat = clib_min (clocks_flat, clocks);
+
+      sum_map = 0;
+      t0 = clib_cpu_time_now ();
+      for (i = 0, j = 0; i < n_lookups;
+	   i++, j = (j + 1 == n_indexes) ? 0 : j + 1)
+	sum_map += fwabf_adj_map_get (&map, indexes[j]);
+      clocks = clib_cpu_time_now () - t0;
+      clocks_map = clib_min (clocks_map, clocks);
+
+      if (sum_flat != sum_map)
+	{
+	  error = clib_error_return (0, "checksum mismatch: map %u != flat %u",
+				     sum_map, sum_flat);
+	  goto done;
+	}
+    }
+
+  vlib_cli_output (vm, "%u adjacencies, %u lookups, map of %u values",
+		   n_adjs, n_lookups, vec_len (map.values));
+  vlib_cli_output (vm, "  flat array: %.2f clocks/lookup",
+		   (f64) clocks_flat / (f64) n_lookups);
+  vlib_cli_output (vm, "  adj map:    %.2f clocks/lookup",
+		   (f64) clocks_map / (f64) n_lookups);
+
+done:
+  fwabf_adj_map_free (&map);
+  vec_free (flat);
+  vec_free (indexes);
+  return error;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (test_fwabf_adj_map_command, static) =
+{
+  .path = "test fwabf adj-map",
+  .short_help = "test fwabf adj-map [count <n>] [lookups <n>] [seed <n>]",
+  .function = test_fwabf_adj_map_command_fn,
+};
+/* *INDENT-ON* */
+
+/*
+ * Attachment order test. It attaches policies of priorities 10, 20, 30 and
+ * 40 to loopback interface, detaches the policy of the given priority and
+ * verifies that the ACL lookup context of the interface, that is looked up
+ * by fwabf-input nodes, keeps ACL-s of the remaining policies in order of
+ * priority. The ACL-s of the policies match the same packets, so the first
+ * one in the lookup context decides.
+ */
+#define FWABF_TEST_N_POLICIES 4
+#define FWABF_TEST_POLICY_ID  0x7e570
+
+/*
+ * Collects output of CLI run by the test.
+ */
+static void
+fwabf_test_cli_output (uword arg, u8 * buffer, uword buffer_bytes)
+{
+  u8 **output = (u8 **) arg;
+  vec_add (*output, buffer, buffer_bytes);
+}
+
+/*
+ * Runs CLI command. Returns the command output, that should be freed
+ * by caller.
+ */
+static u8 *
+fwabf_test_cli (vlib_main_t * vm, char *fmt, ...)
+{
+  unformat_input_t input;
+  u8 *cmd, *output = 0;
+  va_list va;
+
+  va_start (va, fmt);
+  cmd = va_format (0, fmt, &va);
+  va_end (va);
+
+  unformat_init_string (&input, (char *) cmd, vec_len (cmd));
+  vlib_cli_input (vm, &input, fwabf_test_cli_output, (uword) & output);
+  unformat_free (&input);
+  vec_free (cmd);
+  return output;
+}
+
+/*
+ * Returns ACL-s of the FWABF lookup context of the interface, NULL if
+ * there is no context.
+ */
+static u32 *
+fwabf_test_lookup_context_acls (acl_main_t * am, u32 sw_if_index)
+{
+  acl_lookup_context_user_t *user;
+  acl_lookup_context_t *acontext;
+
+  /* *INDENT-OFF* */
+  pool_foreach (acontext, am->acl_lookup_contexts)
+   {
+    user = pool_elt_at_index (am->acl_users, acontext->context_user_id);
+    if (!strcmp (user->user_module_name, "FWABF plugin") &&
+        acontext->user_val1 == sw_if_index)
+      return acontext->acl_indices;
+   }
+  /* *INDENT-ON* */
+  return NULL;
+}
+
+static clib_error_t *
+test_fwabf_attach_order_command_fn (vlib_main_t * vm,
+				    unformat_input_t * input,
+				    vlib_cli_command_t * cmd)
+{
+  vnet_main_t *vnm = vnet_get_main ();
+  acl_plugin_methods_t acl_plugin;
+  unformat_input_t output_input;
+  u32 acls[FWABF_TEST_N_POLICIES];
+  u32 *expected = 0, *lc_acls;
+  u32 detach_priority = 20;
+  u32 sw_if_index = ~0;
+  u8 attached[FWABF_TEST_N_POLICIES] = { };
+  u8 mac[6] = { 0x02, 0xfe, 0x57, 0, 0, 1 };
+  clib_error_t *error = 0;
+  u32 i, n_policies = 0;
+  u8 *output;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "detach %u", &detach_priority))
+	;
+      else
+	return clib_error_return (0, "unknown input '%U'",
+				  format_unformat_error, input);
+    }
+
+  if (detach_priority % 10 || detach_priority == 0 ||
+      detach_priority > 10 * FWABF_TEST_N_POLICIES)
+    return clib_error_return (0, "detach priority should be one of "
+			      "10, 20, 30, 40");
+
+  error = acl_plugin_exports_init (&acl_plugin);
+  if (error)
+    return error;
+
+  if (vnet_create_loopback_interface (&sw_if_index, mac, 0, 0,
+				      VNET_INTERFACE_FLEXIWAN_FLAG_NONE))
+    return clib_error_return (0, "failed to create loopback");
+
+  /*
+   * Note the ACL-s created by the test are not removed, as the ACL plugin
+   * provides no CLI to remove them.
+   */
+  for (i = 0; i < FWABF_TEST_N_POLICIES; i++)
+    {
+      output = fwabf_test_cli (vm, "set acl-plugin acl permit src 10.0.0.0/8");
+      unformat_init_vector (&output_input, output);
+      if (!unformat (&output_input, "ACL index:%u", &acls[i]))
+	error = clib_error_return (0, "failed to create ACL");
+      unformat_free (&output_input);	/* frees the output vector */
+      if (error)
+	goto done;
+
+      output = fwabf_test_cli (vm, "fwabf policy add id %u acl %u "
+			       "action labels 1", FWABF_TEST_POLICY_ID + i,
+			       acls[i]);
+      vec_free (output);
+      n_policies++;
+    }
+
+  /* Attach in reverse order, so the vector is built by inserts */
+  for (i = FWABF_TEST_N_POLICIES; i > 0; i--)
+    {
+      output = fwabf_test_cli (vm, "fwabf attach ip4 policy %u priority %u "
+			       "%U", FWABF_TEST_POLICY_ID + i - 1, 10 * i,
+			       format_vnet_sw_if_index_name, vnm, sw_if_index);
+      attached[i - 1] = (vec_len (output) == 0);
+      vec_free (output);
+      if (!attached[i - 1])
+	{
+	  error = clib_error_return (0, "failed to attach policy %u",
+				     FWABF_TEST_POLICY_ID + i - 1);
+	  goto done;
+	}
+    }
+
+  i = detach_priority / 10 - 1;
+  output = fwabf_test_cli (vm, "fwabf attach ip4 del policy %u %U",
+			   FWABF_TEST_POLICY_ID + i,
+			   format_vnet_sw_if_index_name, vnm, sw_if_index);
+  vec_free (output);
+  attached[i] = 0;
+
+  for (i = 0; i < FWABF_TEST_N_POLICIES; i++)
+    if (attached[i])
+      vec_add1 (expected, acls[i]);
+
+  lc_acls = fwabf_test_lookup_context_acls (acl_plugin.p_acl_main,
+					    sw_if_index);
+  if (vec_len (lc_acls) != vec_len (expected) ||
+      memcmp (lc_acls, expected, vec_len (expected) * sizeof (u32)))
+    {
+      error = clib_error_return (0, "lookup order of ACL-s [%U], "
+				 "expected [%U]", format_vec32, lc_acls,
+				 "%d", format_vec32, expected, "%d");
+      goto done;
+    }
+
+  vlib_cli_output (vm, "detach priority %u: lookup order of ACL-s [%U]",
+		   detach_priority, format_vec32, lc_acls, "%d");
+
+done:
+  for (i = 0; i < n_policies; i++)
+    {
+      if (attached[i])
+	{
+	  output = fwabf_test_cli (vm, "fwabf attach ip4 del policy %u %U",
+				   FWABF_TEST_POLICY_ID + i,
+				   format_vnet_sw_if_index_name, vnm,
+				   sw_if_index);
+	  vec_free (output);
+	}
+      output = fwabf_test_cli (vm, "fwabf policy del id %u acl %u "
+			       "action labels 1", FWABF_TEST_POLICY_ID + i,
+			       acls[i]);
+      vec_free (output);
+    }
+  vnet_delete_loopback_interface (sw_if_index);
+  vec_free (expected);
+  return error;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (test_fwabf_attach_order_command, static) =
+{
+  .path = "test fwabf attach-order",
+  .short_help = "test fwabf attach-order [detach <10|20|30|40>]",
+  .function = test_fwabf_attach_order_command_fn,
+};
+/* *INDENT-ON* */
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
@@ -15,6 +15,8 @@
 
 #include <vnet/ipsec/ipsec.h>
 #include <vnet/ipsec/ipsec_sa.h>
+#include <vnet/ipsec/esp.h>
+#include <vppinfra/random.h>
 
 static clib_error_t *
 test_ipsec_command_fn (vlib_main_t * vm,
@@ -68,6 +70,646 @@ VLIB_CLI_COMMAND (test_ipsec_command, static) =
 };
 /* *INDENT-ON* */
 
+/*
+ * Anti-replay window benchmark. It runs the per packet anti-replay work of
+ * the ESP decrypt nodes, the check before decryption and the advance after
+ * it, on a synthetic stream of sequence numbers for window lengths from 64
+ * to 8192, and compares the ring window of ipsec_sa.h with the bitmap
+ * shifted on every in-order packet, as the window was implemented before.
+ * The crypto work does not depend on the window, so it is not included.
+ */
+static_always_inline int
+test_ipsec_anti_replay_shift_check (uword * bmp, u32 last_seq, u32 seq)
+{
+  u32 diff;
+
+  if (seq > last_seq)
+    return 0;
+  diff = last_seq - seq;
+  return diff < vec_len (bmp) * BITS (uword) ?
+    clib_bitmap_get (bmp, diff) : 1;
+}
+
+static_always_inline void
+test_ipsec_anti_replay_shift_advance (uword * bmp, u32 * last_seq, u32 seq)
+{
+  u32 pos;
+
+  if (seq > *last_seq)
+    {
+      pos = seq - *last_seq;
+      if (pos < vec_len (bmp) * BITS (uword))
+	clib_bitmap_shift_left (bmp, pos);
+      else
+	clib_bitmap_zero (bmp);
+      clib_bitmap_set (bmp, 0, 1);
+      *last_seq = seq;
+    }
+  else
+    clib_bitmap_set (bmp, *last_seq - seq, 1);
+}
+
+static clib_error_t *
+test_ipsec_anti_replay_one (vlib_main_t * vm, u32 window_len, u32 * seqs,
+			    u32 n_iterations, u8 is_esn)
+{
+  ipsec_sa_t sa;
+  uword *bmp = 0;
+  u64 t0, clocks_ring = 0, clocks_shift = 0;
+  u32 n_packets = vec_len (seqs);
+  u32 n_drops_ring = 0, n_drops_shift = 0, n_replays = 0, n_replayed;
+  u32 i, j, last_seq;
+
+  clib_memset (&sa, 0, sizeof (sa));
+  sa.flags = IPSEC_SA_FLAG_USE_ANTI_REPLAY;
+  if (is_esn)
+    sa.flags |= IPSEC_SA_FLAG_USE_ESN;
+  clib_bitmap_alloc (sa.replay_window_bmp, window_len);
+  clib_bitmap_alloc (bmp, window_len);
+
+  for (j = 0; j < n_iterations; j++)
+    {
+      clib_bitmap_zero (sa.replay_window_bmp);
+      sa.last_seq = sa.last_seq_hi = sa.seq_hi = 0;
+      t0 = clib_cpu_time_now ();
+      for (i = 0; i < n_packets; i++)
+	{
+	  if (ipsec_sa_anti_replay_check (&sa, seqs[i]))
+	    n_drops_ring++;
+	  else
+	    ipsec_sa_anti_replay_advance (&sa, seqs[i]);
+	}
+      clocks_ring += clib_cpu_time_now () - t0;
+
+      clib_bitmap_zero (bmp);
+      last_seq = 0;
+      t0 = clib_cpu_time_now ();
+      for (i = 0; i < n_packets; i++)
+	{
+	  if (test_ipsec_anti_replay_shift_check (bmp, last_seq, seqs[i]))
+	    n_drops_shift++;
+	  else
+	    test_ipsec_anti_replay_shift_advance (bmp, &last_seq, seqs[i]);
+	}
+      clocks_shift += clib_cpu_time_now () - t0;
+    }
+
+  /* Every packet within the window should be detected as replay now */
+  n_replayed = clib_min (n_packets, window_len / 2);
+  for (i = n_packets - n_replayed; i < n_packets; i++)
+    n_replays += ipsec_sa_anti_replay_check (&sa, seqs[i]);
+
+  vlib_cli_output (vm, "window %5u: %.2f clocks/pkt ring, %.2f clocks/pkt "
+		   "shift, %u/%u drops, %u of %u replays detected",
+		   window_len,
+		   (f64) clocks_ring / (f64) (n_packets * n_iterations),
+		   (f64) clocks_shift / (f64) (n_packets * n_iterations),
+		   n_drops_ring / n_iterations, n_drops_shift / n_iterations,
+		   n_replays, n_replayed);
+
+  clib_bitmap_free (sa.replay_window_bmp);
+  clib_bitmap_free (bmp);
+
+  if (n_replays != n_replayed)
+    return clib_error_return (0, "window %u: %u replays not detected",
+			      window_len, n_replayed - n_replays);
+  return NULL;
+}
+
+/*
+ * In order sequence numbers, if 'reorder' is set every packet is swapped
+ * with one of the next 'reorder' packets, as multi-path links do.
+ */
+static u32 *
+test_ipsec_anti_replay_seqs (u32 n_packets, u32 reorder)
+{
+  u32 seed = 0xdeadbeef;
+  u32 *seqs = 0, i, j, tmp;
+
+  vec_validate (seqs, n_packets - 1);
+  for (i = 0; i < n_packets; i++)
+    seqs[i] = i + 1;
+  for (i = 0; reorder && i < n_packets; i++)
+    {
+      j = i + random_u32 (&seed) % (reorder + 1);
+      if (j >= n_packets)
+	continue;
+      tmp = seqs[i];
+      seqs[i] = seqs[j];
+      seqs[j] = tmp;
+    }
+  return seqs;
+}
+
+static clib_error_t *
+test_ipsec_anti_replay_command_fn (vlib_main_t * vm,
+				   unformat_input_t * input,
+				   vlib_cli_command_t * cmd)
+{
+  u32 window_len = 0, n_packets = 100000, n_iterations = 10, reorder = 0;
+  clib_error_t *error = NULL;
+  u8 is_esn = 0;
+  u32 *seqs;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "window %u", &window_len))
+	;
+      else if (unformat (input, "packets %u", &n_packets))
+	;
+      else if (unformat (input, "iterations %u", &n_iterations))
+	;
+      else if (unformat (input, "reorder %u", &reorder))
+	;
+      else if (unformat (input, "esn"))
+	is_esn = 1;
+      else
+	return clib_error_return (0, "unknown input '%U'",
+				  format_unformat_error, input);
+    }
+
+  if (n_packets == 0 || n_iterations == 0 ||
+      window_len > IPSEC_SA_ANTI_REPLAY_WINDOW_MAX_SIZE ||
+      (window_len && (window_len < BITS (uword) || !is_pow2 (window_len))))
+    return clib_error_return (0, "invalid parameters");
+
+  seqs = test_ipsec_anti_replay_seqs (n_packets, reorder);
+
+  if (window_len)
+    error = test_ipsec_anti_replay_one (vm, window_len, seqs, n_iterations,
+					is_esn);
+  else
+    for (window_len = BITS (uword);
+	 !error && window_len <= IPSEC_SA_ANTI_REPLAY_WINDOW_MAX_SIZE;
+	 window_len <<= 1)
+      error = test_ipsec_anti_replay_one (vm, window_len, seqs, n_iterations,
+					  is_esn);
+
+  vec_free (seqs);
+  return error;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (test_ipsec_anti_replay_command, static) =
+{
+  .path = "test ipsec anti-replay",
+  .short_help = "test ipsec anti-replay [window <n>] [packets <n>] "
+                "[iterations <n>] [reorder <n>] [esn]",
+  .function = test_ipsec_anti_replay_command_fn,
+};
+/* *INDENT-ON* */
+
+/*
+ * ESP decrypt benchmark. It sends the packets of an inbound tunnel SA with
+ * null crypto and integrity through the esp4-decrypt node, so the cost
+ * reported by the node is the ESP processing and the anti-replay window,
+ * for window lengths from 64 to 8192. The decrypted packets are dropped by
+ * ip4 lookup, as there is no route for them.
+ */
+#define TEST_IPSEC_ESP_DECRYPT_SA_ID 0x7e57
+#define TEST_IPSEC_ESP_DECRYPT_N_FRAMES 16
+#define TEST_IPSEC_ESP_DECRYPT_PAYLOAD_LEN 44
+
+typedef CLIB_PACKED (struct
+{
+  ip4_header_t ip4;
+  esp_header_t esp;
+  ip4_header_t inner_ip4;
+  u8 payload[TEST_IPSEC_ESP_DECRYPT_PAYLOAD_LEN];
+  u8 pad[2];
+  esp_footer_t footer;
+}) test_ipsec_esp_packet_t;
+
+static void
+test_ipsec_esp_decrypt_template (test_ipsec_esp_packet_t * pkt)
+{
+  clib_memset (pkt, 0, sizeof (*pkt));
+
+  pkt->ip4.ip_version_and_header_length = 0x45;
+  pkt->ip4.ttl = 64;
+  pkt->ip4.protocol = IP_PROTOCOL_IPSEC_ESP;
+  pkt->ip4.length = clib_host_to_net_u16 (sizeof (*pkt));
+  pkt->ip4.src_address.as_u32 = clib_host_to_net_u32 (0xc0000202);
+  pkt->ip4.dst_address.as_u32 = clib_host_to_net_u32 (0xc0000201);
+  pkt->ip4.checksum = ip4_header_checksum (&pkt->ip4);
+
+  pkt->esp.spi = clib_host_to_net_u32 (TEST_IPSEC_ESP_DECRYPT_SA_ID);
+
+  pkt->inner_ip4.ip_version_and_header_length = 0x45;
+  pkt->inner_ip4.ttl = 64;
+  pkt->inner_ip4.protocol = IP_PROTOCOL_UDP;
+  pkt->inner_ip4.length =
+    clib_host_to_net_u16 (sizeof (ip4_header_t) +
+			  TEST_IPSEC_ESP_DECRYPT_PAYLOAD_LEN);
+  pkt->inner_ip4.src_address.as_u32 = clib_host_to_net_u32 (0xc6336402);
+  pkt->inner_ip4.dst_address.as_u32 = clib_host_to_net_u32 (0xc6336401);
+  pkt->inner_ip4.checksum = ip4_header_checksum (&pkt->inner_ip4);
+
+  pkt->pad[0] = 1;
+  pkt->pad[1] = 2;
+  pkt->footer.pad_length = sizeof (pkt->pad);
+  pkt->footer.next_header = IP_PROTOCOL_IP_IN_IP;
+}
+
+static clib_error_t *
+test_ipsec_esp_decrypt_one (vlib_main_t * vm, u32 window_len, u32 * seqs,
+			    u32 n_iterations)
+{
+  vlib_node_t *node = vlib_get_node_by_name (vm, (u8 *) "esp4-decrypt");
+  test_ipsec_esp_packet_t template, *pkt;
+  ip46_address_t tun_src = { }, tun_dst = { };
+  ipsec_key_t key = { };
+  clib_error_t *error = NULL;
+  vlib_frame_t *f;
+  vlib_buffer_t *b;
+  ipsec_sa_t *sa;
+  u32 n_packets = vec_len (seqs);
+  u32 n_replays = 0, n_replayed;
+  u32 *buffers = 0;
+  u32 sa_index, i, j, k, n, n_alloc, n_vectors;
+  u64 clocks, vectors;
+  int rv;
+
+  test_ipsec_esp_decrypt_template (&template);
+  tun_src.ip4.as_u32 = template.ip4.src_address.as_u32;
+  tun_dst.ip4.as_u32 = template.ip4.dst_address.as_u32;
+
+  rv = ipsec_sa_add_and_lock (TEST_IPSEC_ESP_DECRYPT_SA_ID,
+			      TEST_IPSEC_ESP_DECRYPT_SA_ID,
+			      IPSEC_PROTOCOL_ESP, IPSEC_CRYPTO_ALG_NONE, &key,
+			      IPSEC_INTEG_ALG_NONE, &key,
+			      IPSEC_SA_FLAG_USE_ANTI_REPLAY |
+			      IPSEC_SA_FLAG_IS_TUNNEL |
+			      IPSEC_SA_FLAG_IS_INBOUND, window_len, 0, 0,
+			      &tun_src, &tun_dst,
+			      TUNNEL_ENCAP_DECAP_FLAG_NONE, IP_DSCP_CS0,
+			      &sa_index, IPSEC_UDP_PORT_NONE,
+			      IPSEC_UDP_PORT_NONE);
+  if (rv)
+    return clib_error_return (0, "failed to add SA: %d", rv);
+  sa = pool_elt_at_index (ipsec_main.sad, sa_index);
+
+  vec_validate (buffers, TEST_IPSEC_ESP_DECRYPT_N_FRAMES * VLIB_FRAME_SIZE - 1);
+
+  vlib_node_sync_stats (vm, node);
+  clocks = node->stats_total.clocks;
+  vectors = node->stats_total.vectors;
+
+  for (j = 0; j < n_iterations; j++)
+    {
+      clib_bitmap_zero (sa->replay_window_bmp);
+      sa->last_seq = sa->last_seq_hi = sa->seq_hi = 0;
+
+      for (i = 0; i < n_packets; i += n)
+	{
+	  n = clib_min (n_packets - i, vec_len (buffers));
+	  n_alloc = vlib_buffer_alloc (vm, buffers, n);
+	  if (n_alloc != n)
+	    {
+	      vlib_buffer_free (vm, buffers, n_alloc);
+	      error = clib_error_return (0, "failed to allocate %u buffers",
+					 n);
+	      goto done;
+	    }
+
+	  for (k = 0; k < n; k++)
+	    {
+	      b = vlib_get_buffer (vm, buffers[k]);
+	      b->current_data = sizeof (ip4_header_t);
+	      b->current_length = sizeof (template) - sizeof (ip4_header_t);
+	      pkt = (test_ipsec_esp_packet_t *) b->data;
+	      clib_memcpy_fast (pkt, &template, sizeof (template));
+	      pkt->esp.seq = clib_host_to_net_u32 (seqs[i + k]);
+	      vnet_buffer (b)->l3_hdr_offset = 0;
+	      vnet_buffer (b)->sw_if_index[VLIB_RX] = 0;
+	      vnet_buffer (b)->sw_if_index[VLIB_TX] = ~0;
+	      vnet_buffer (b)->ipsec.sad_index = sa_index;
+	    }
+
+	  for (k = 0; k < n; k += n_vectors)
+	    {
+	      n_vectors = clib_min (n - k, VLIB_FRAME_SIZE);
+	      f = vlib_get_frame_to_node (vm, node->index);
+	      clib_memcpy_fast (vlib_frame_vector_args (f), buffers + k,
+				n_vectors * sizeof (u32));
+	      f->n_vectors = n_vectors;
+	      vlib_put_frame_to_node (vm, node->index, f);
+	    }
+
+	  /* The frames are dispatched by the main loop while suspended */
+	  vlib_process_suspend (vm, 1e-5);
+	}
+    }
+
+  vlib_node_sync_stats (vm, node);
+  clocks = node->stats_total.clocks - clocks;
+  vectors = node->stats_total.vectors - vectors;
+
+  /* Every packet within the window should be detected as replay now */
+  n_replayed = clib_min (n_packets, window_len / 2);
+  for (i = n_packets - n_replayed; i < n_packets; i++)
+    n_replays += ipsec_sa_anti_replay_check (sa, seqs[i]);
+
+  vlib_cli_output (vm, "window %5u: %.2f clocks/pkt esp4-decrypt, "
+		   "%llu packets, %u of %u replays detected",
+		   window_len, vectors ? (f64) clocks / (f64) vectors : 0.0,
+		   vectors, n_replays, n_replayed);
+
+  if (n_replays != n_replayed)
+    error = clib_error_return (0, "window %u: %u replays not detected",
+			       window_len, n_replayed - n_replays);
+done:
+  vec_free (buffers);
+  ipsec_sa_unlock (sa_index);
+  return error;
+}
+
+static clib_error_t *
+test_ipsec_esp_decrypt_command_fn (vlib_main_t * vm,
+				   unformat_input_t * input,
+				   vlib_cli_command_t * cmd)
+{
+  u32 window_len = 0, n_packets = 100000, n_iterations = 10, reorder = 0;
+  clib_error_t *error = NULL;
+  u32 *seqs;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "window %u", &window_len))
+	;
+      else if (unformat (input, "packets %u", &n_packets))
+	;
+      else if (unformat (input, "iterations %u", &n_iterations))
+	;
+      else if (unformat (input, "reorder %u", &reorder))
+	;
+      else
+	return clib_error_return (0, "unknown input '%U'",
+				  format_unformat_error, input);
+    }
+
+  if (n_packets == 0 || n_iterations == 0 ||
+      window_len > IPSEC_SA_ANTI_REPLAY_WINDOW_MAX_SIZE ||
+      (window_len && (window_len < BITS (uword) || !is_pow2 (window_len))))
+    return clib_error_return (0, "invalid parameters");
+
+  seqs = test_ipsec_anti_replay_seqs (n_packets, reorder);
+
+  if (window_len)
+    error = test_ipsec_esp_decrypt_one (vm, window_len, seqs, n_iterations);
+  else
+    for (window_len = BITS (uword);
+	 !error && window_len <= IPSEC_SA_ANTI_REPLAY_WINDOW_MAX_SIZE;
+	 window_len <<= 1)
+      error = test_ipsec_esp_decrypt_one (vm, window_len, seqs,
+					  n_iterations);
+
+  vec_free (seqs);
+  return error;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (test_ipsec_esp_decrypt_command, static) =
+{
+  .path = "test ipsec esp-decrypt",
+  .short_help = "test ipsec esp-decrypt [window <n>] [packets <n>] "
+                "[iterations <n>] [reorder <n>]",
+  .function = test_ipsec_esp_decrypt_command_fn,
+};
+/* *INDENT-ON* */
+
+#ifdef FLEXIWAN_FEATURE /* ipsec_multi_worker_sa */
+/*
+ * Multi-worker SA tests. The first one sends the packets of an outbound
+ * tunnel SA with null crypto and integrity through the esp4-encrypt node in
+ * frames of the given size, and checks that the SA used one sequence number
+ * per packet, with no gaps. The second one runs the sequence number
+ * reservation of esp4-encrypt for several workers, that process their frames
+ * in random interleaving, and checks that every sequence number is used
+ * exactly once.
+ */
+#define TEST_IPSEC_MULTI_WORKER_SA_ID 0x7e58
+#define TEST_IPSEC_MULTI_WORKER_MAX_WORKERS 16
+#define TEST_IPSEC_MULTI_WORKER_MAX_PENDING 4096
+
+static clib_error_t *
+test_ipsec_multi_worker_frames (vlib_main_t * vm, u32 sa_index,
+				u32 n_packets, u32 frame_size)
+{
+  vlib_node_t *node = vlib_get_node_by_name (vm, (u8 *) "esp4-encrypt");
+  ipsec_sa_t *sa = pool_elt_at_index (ipsec_main.sad, sa_index);
+  u32 len = sizeof (ip4_header_t) + TEST_IPSEC_ESP_DECRYPT_PAYLOAD_LEN;
+  test_ipsec_esp_packet_t template;
+  u32 buffers[VLIB_FRAME_SIZE];
+  u32 i, k, n, n_alloc, n_pending = 0;
+  vlib_frame_t *f;
+  vlib_buffer_t *b;
+
+  test_ipsec_esp_decrypt_template (&template);
+  sa->seq = 0;
+
+  for (i = 0; i < n_packets; i += n)
+    {
+      n = clib_min (n_packets - i, frame_size);
+      n_alloc = vlib_buffer_alloc (vm, buffers, n);
+      if (n_alloc != n)
+	{
+	  vlib_buffer_free (vm, buffers, n_alloc);
+	  return clib_error_return (0, "failed to allocate %u buffers", n);
+	}
+
+      for (k = 0; k < n; k++)
+	{
+	  b = vlib_get_buffer (vm, buffers[k]);
+	  b->current_data = 0;
+	  b->current_length = len;
+	  /* the inner packet of the ESP template is the packet to encrypt */
+	  clib_memcpy_fast (vlib_buffer_get_current (b), &template.inner_ip4,
+			    len);
+	  vnet_buffer (b)->sw_if_index[VLIB_RX] = 0;
+	  vnet_buffer (b)->sw_if_index[VLIB_TX] = ~0;
+	  vnet_buffer (b)->ipsec.sad_index = sa_index;
+	}
+
+      f = vlib_get_frame_to_node (vm, node->index);
+      clib_memcpy_fast (vlib_frame_vector_args (f), buffers,
+			n * sizeof (u32));
+      f->n_vectors = n;
+      vlib_put_frame_to_node (vm, node->index, f);
+
+      /* The frames are dispatched by the main loop while suspended */
+      n_pending += n;
+      if (n_pending >= TEST_IPSEC_MULTI_WORKER_MAX_PENDING)
+	{
+	  vlib_process_suspend (vm, 1e-5);
+	  n_pending = 0;
+	}
+    }
+  vlib_process_suspend (vm, 1e-5);
+
+  vlib_cli_output (vm, "frame size %3u: %u packets encrypted with %u "
+		   "sequence numbers", frame_size, n_packets, sa->seq);
+
+  if (sa->seq != n_packets)
+    return clib_error_return (0, "frame size %u: %u sequence numbers "
+			      "used by %u packets", frame_size, sa->seq,
+			      n_packets);
+  return NULL;
+}
+
+static clib_error_t *
+test_ipsec_multi_worker_reserve (vlib_main_t * vm, u32 sa_index,
+				 u32 n_packets, u32 n_workers)
+{
+  ipsec_per_thread_data_t ptds[TEST_IPSEC_MULTI_WORKER_MAX_WORKERS], *ptd;
+  u32 n_left[TEST_IPSEC_MULTI_WORKER_MAX_WORKERS] = { };
+  ipsec_sa_t *sa = pool_elt_at_index (ipsec_main.sad, sa_index);
+  clib_error_t *error = NULL;
+  u32 seed = 0xdeadbeef;
+  u32 i, w, seq, n_framed = 0;
+  uword *used = 0;
+
+  clib_memset (ptds, 0, sizeof (ptds));
+  sa->seq = 0;
+
+  for (i = 0; i < n_packets; i++)
+    {
+      /* the workers with no frame are idle once all packets are framed */
+      do
+	w = random_u32 (&seed) % n_workers;
+      while (n_left[w] == 0 && n_framed == n_packets);
+      ptd = &ptds[w];
+
+      if (n_left[w] == 0)
+	{
+	  /* the next frame of the worker, see esp_encrypt_inline() */
+	  ptd->mw_sa_index = ~0;
+	  n_left[w] = clib_min (1 + random_u32 (&seed) % VLIB_FRAME_SIZE,
+				n_packets - n_framed);
+	  n_framed += n_left[w];
+	}
+
+      if (esp_seq_multi_worker_is_empty (ptd, sa_index) &&
+	  esp_seq_reserve_multi_worker (ptd, sa, sa_index,
+					clib_min (n_left[w],
+						  IPSEC_SA_MULTI_WORKER_SEQ_BLOCK)))
+	{
+	  error = clib_error_return (0, "sequence numbers exhausted");
+	  goto done;
+	}
+      seq = esp_seq_next_multi_worker (ptd);
+      n_left[w]--;
+
+      if (seq == 0 || seq > n_packets || clib_bitmap_get (used, seq))
+	{
+	  error = clib_error_return (0, "%u workers: sequence number %u "
+				     "used twice or out of range", n_workers,
+				     seq);
+	  goto done;
+	}
+      used = clib_bitmap_set (used, seq, 1);
+    }
+
+  vlib_cli_output (vm, "%2u workers: %u packets encrypted with %u unique "
+		   "sequence numbers", n_workers, n_packets, sa->seq);
+
+  if (sa->seq != n_packets)
+    error = clib_error_return (0, "%u workers: %u sequence numbers used by "
+			       "%u packets", n_workers, sa->seq, n_packets);
+done:
+  clib_bitmap_free (used);
+  return error;
+}
+
+static clib_error_t *
+test_ipsec_multi_worker_command_fn (vlib_main_t * vm,
+				    unformat_input_t * input,
+				    vlib_cli_command_t * cmd)
+{
+  static const u32 frame_sizes[] = { 1, 2, 31, 32, 33, VLIB_FRAME_SIZE };
+  static const u32 workers[] = { 1, 2, 4, 8 };
+  ip46_address_t tun_src = { }, tun_dst = { };
+  u32 n_packets = 10000, frame_size = 0, n_workers = 0;
+  ipsec_key_t key = { };
+  clib_error_t *error = NULL;
+  u32 sa_index, i;
+  int rv;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "packets %u", &n_packets))
+	;
+      else if (unformat (input, "frame-size %u", &frame_size))
+	;
+      else if (unformat (input, "workers %u", &n_workers))
+	;
+      else
+	return clib_error_return (0, "unknown input '%U'",
+				  format_unformat_error, input);
+    }
+
+  if (n_packets == 0 || frame_size > VLIB_FRAME_SIZE ||
+      n_workers > TEST_IPSEC_MULTI_WORKER_MAX_WORKERS)
+    return clib_error_return (0, "invalid parameters");
+
+  tun_src.ip4.as_u32 = clib_host_to_net_u32 (0xc0000201);
+  tun_dst.ip4.as_u32 = clib_host_to_net_u32 (0xc0000202);
+
+  rv = ipsec_sa_add_and_lock (TEST_IPSEC_MULTI_WORKER_SA_ID,
+			      TEST_IPSEC_MULTI_WORKER_SA_ID,
+			      IPSEC_PROTOCOL_ESP, IPSEC_CRYPTO_ALG_NONE, &key,
+			      IPSEC_INTEG_ALG_NONE, &key,
+			      IPSEC_SA_FLAG_USE_ANTI_REPLAY |
+			      IPSEC_SA_FLAG_IS_TUNNEL, 0, 0, 0,
+			      &tun_src, &tun_dst,
+			      TUNNEL_ENCAP_DECAP_FLAG_NONE, IP_DSCP_CS0,
+			      &sa_index, IPSEC_UDP_PORT_NONE,
+			      IPSEC_UDP_PORT_NONE);
+  if (rv)
+    return clib_error_return (0, "failed to add SA: %d", rv);
+
+  rv = ipsec_sa_set_multi_worker (TEST_IPSEC_MULTI_WORKER_SA_ID, 1);
+  if (rv)
+    {
+      error = clib_error_return (0, "failed to set multi-worker SA: %d", rv);
+      goto done;
+    }
+
+  if (frame_size)
+    error = test_ipsec_multi_worker_frames (vm, sa_index, n_packets,
+					    frame_size);
+  else
+    for (i = 0; !error && i < ARRAY_LEN (frame_sizes); i++)
+      error = test_ipsec_multi_worker_frames (vm, sa_index, n_packets,
+					      frame_sizes[i]);
+
+  if (error)
+    goto done;
+
+  if (n_workers)
+    error = test_ipsec_multi_worker_reserve (vm, sa_index, n_packets,
+					     n_workers);
+  else
+    for (i = 0; !error && i < ARRAY_LEN (workers); i++)
+      error = test_ipsec_multi_worker_reserve (vm, sa_index, n_packets,
+					       workers[i]);
+
+done:
+  ipsec_sa_unlock (sa_index);
+  return error;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (test_ipsec_multi_worker_command, static) =
+{
+  .path = "test ipsec multi-worker",
+  .short_help = "test ipsec multi-worker [packets <n>] [frame-size <n>] "
+                "[workers <n>]",
+  .function = test_ipsec_multi_worker_command_fn,
+};
+/* *INDENT-ON* */
+#endif /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
+
 /*
  * fd.io coding-style-patch-verification: ON
  *
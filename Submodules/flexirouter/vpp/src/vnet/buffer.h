@@ -56,6 +56,10 @@
  *  In such cases, the already de-NATed packet gets dropped in NAT due to
  *  lookup failure. The fix validates re_entry packets and prevents nat drop
  *
+ *  - single_pass_classification: the ACL classification result of the
+ *  classifier-acls node is stored in buffer metadata, so the downstream
+ *  nodes, like fwabf, can reuse it instead of running ACL lookup again.
+ *
  */
 
 #ifndef included_vnet_buffer_h
@@ -68,7 +72,8 @@
  *
  */
 #ifdef FLEXIWAN_FEATURE /* acl_based_classification,
-                           fix_nat_drop_for_re_entered_packets*/
+                           fix_nat_drop_for_re_entered_packets,
+                           single_pass_classification */
 /* Adding flag to indicate if a packet has been classified or not */
 #define foreach_vnet_buffer_flag                        \
   _( 1, L4_CHECKSUM_COMPUTED, "l4-cksum-computed", 1)	\
@@ -93,11 +98,11 @@
   _(20, GSO, "gso", 0)                                  \
   _(21, IS_CLASSIFIED, "is-classified", 1)              \
   _(22, CHECK_NAT_RE_ENTRY, "check-nat-re-entry", 1)    \
-  _(23, AVAIL1, "avail1", 1)                            \
-  _(24, AVAIL2, "avail2", 1)                            \
-  _(25, AVAIL3, "avail3", 1)                            \
-  _(26, AVAIL4, "avail4", 1)                            \
-  _(27, AVAIL5, "avail5", 1)
+  _(23, CLASSIFY_RESULT_VALID, "classify-result-valid", 1) \
+  _(24, AVAIL1, "avail1", 1)                            \
+  _(25, AVAIL2, "avail2", 1)                            \
+  _(26, AVAIL3, "avail3", 1)                            \
+  _(27, AVAIL4, "avail4", 1)
 
 /*
  * Please allocate the FIRST available bit, redefine
@@ -107,10 +112,11 @@
 
 #define VNET_BUFFER_FLAGS_ALL_AVAIL                                     \
   (VNET_BUFFER_F_AVAIL1 | VNET_BUFFER_F_AVAIL2 | VNET_BUFFER_F_AVAIL3 | \
-   VNET_BUFFER_F_AVAIL4 | VNET_BUFFER_F_AVAIL5)
+   VNET_BUFFER_F_AVAIL4)
 
 #else  /* FLEXIWAN_FEATURE - acl_based_classification,
-          fix_nat_drop_for_re_entered_packets */
+          fix_nat_drop_for_re_entered_packets,
+          single_pass_classification */
 #define foreach_vnet_buffer_flag                        \
   _( 1, L4_CHECKSUM_COMPUTED, "l4-cksum-computed", 1)	\
   _( 2, L4_CHECKSUM_CORRECT, "l4-cksum-correct", 1)	\
@@ -572,6 +578,29 @@ typedef struct
       u64 pg_replay_timestamp;
     };
 #ifdef FLEXIWAN_FEATURE /* acl_based_classification */
+#ifdef FLEXIWAN_FEATURE /* single_pass_classification */
+    /*
+     * ACL classification result stored by the classifier-acls node.
+     * Valid if VNET_BUFFER_F_CLASSIFY_RESULT_VALID flag is set.
+     * See plugins/classifier_acls/classify_result.h.
+     */
+    /*
+     * It shares the pg_replay_timestamp bytes, that are not used in this tree,
+     * and does not overlap with trajectory_trace.
+     */
+    struct
+    {
+      u64 __pad[1];
+      struct
+      {
+	u32 sw_if_index;	/* RX interface the packet was classified on */
+	u32 lc_index;		/* ACL plugin lookup context */
+	u32 rule_index;		/* matched rule */
+	u16 acl_pos;		/* matched ACL position in context, ~0 - no match */
+	u16 __unused;
+      } classify;
+    };
+#endif /* FLEXIWAN_FEATURE - single_pass_classification */
     u32 unused[6];
 #else   /* FLEXIWAN_FEATURE - acl_based_classification */
     u32 unused[8];
@@ -12,6 +12,15 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+
+/*
+ *  List of features made for FlexiWAN (denoted by FLEXIWAN_FEATURE flag):
+ *
+ *   - ipsec_multi_worker_sa : Let ESP SA be processed by any worker instead of
+ *     the single worker it is bound to. The outbound sequence numbers and GCM
+ *     IVs of such SA are reserved by workers in blocks.
+ */
+
 #ifndef __ESP_H__
 #define __ESP_H__
 
@@ -105,6 +114,73 @@ esp_seq_advance (ipsec_sa_t * sa)
   return 0;
 }
 
+#ifdef FLEXIWAN_FEATURE /* ipsec_multi_worker_sa */
+/*
+ * Reserves the next n_packets sequence numbers (and GCM IVs) of multi-worker
+ * SA for the thread, n_packets should be the number of packets of the SA
+ * pending in the frame, so no sequence number is left unused. The block is
+ * reserved by CAS, so the sequence number never wraps if anti-replay is used.
+ * Returns 1 if sequence numbers are exhausted. The ESN is not supported by
+ * multi-worker SA.
+ */
+always_inline int
+esp_seq_reserve_multi_worker (ipsec_per_thread_data_t * ptd, ipsec_sa_t * sa,
+			      u32 sa_index, u32 n_packets)
+{
+  u32 last;
+
+  do
+    {
+      last = sa->seq;
+      if (PREDICT_FALSE (ipsec_sa_is_set_USE_ANTI_REPLAY (sa) &&
+			 last > ESP_SEQ_MAX - n_packets))
+	return 1;
+    }
+  while (!clib_atomic_bool_cmp_and_swap (&sa->seq, last, last + n_packets));
+
+  if (ipsec_sa_is_set_IS_AEAD (sa))
+    ptd->mw_iv = clib_atomic_fetch_add (&sa->gcm_iv_counter, n_packets);
+  ptd->mw_sa_index = sa_index;
+  ptd->mw_seq = last;
+  ptd->mw_n_left = n_packets;
+  return 0;
+}
+
+/*
+ * Returns 1 if the thread has no sequence numbers of multi-worker SA left,
+ * so esp_seq_reserve_multi_worker() should be called before
+ * esp_seq_next_multi_worker().
+ */
+always_inline int
+esp_seq_multi_worker_is_empty (ipsec_per_thread_data_t * ptd, u32 sa_index)
+{
+  return ptd->mw_sa_index != sa_index || ptd->mw_n_left == 0;
+}
+
+/*
+ * Takes the next sequence number of multi-worker SA out of the block the
+ * thread reserved.
+ */
+always_inline u32
+esp_seq_next_multi_worker (ipsec_per_thread_data_t * ptd)
+{
+  ptd->mw_n_left--;
+  return ++ptd->mw_seq;
+}
+
+/*
+ * Returns the next GCM IV of SA. The IV of multi-worker SA is taken out of
+ * the block reserved together with the sequence number of the packet.
+ */
+always_inline u64
+esp_gcm_iv_next (ipsec_per_thread_data_t * ptd, ipsec_sa_t * sa)
+{
+  if (PREDICT_FALSE (sa->multi_worker))
+    return ptd->mw_iv++;
+  return sa->gcm_iv_counter++;
+}
+#endif /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
+
 always_inline u16
 esp_aad_fill (u8 * data, const esp_header_t * esp, const ipsec_sa_t * sa)
 {
@@ -23,6 +23,11 @@
  *   - fix_crypto_worker_assignment : Crypto worker thread assignment need to
  *   include only the cpu.corelist-workers and exclude feature-specific worker
  *   threads like cpu.corelist-hqos-threads
+ *
+ *  List of features made for FlexiWAN (denoted by FLEXIWAN_FEATURE flag):
+ *   - ipsec_multi_worker_sa : The multi-worker SA is decrypted by the worker
+ *     that received the packet, with no handoff. The anti-replay window is
+ *     checked and advanced under the SA lock after decryption.
  */
 
 
@@ -813,6 +818,32 @@ esp_decrypt_post_crypto (vlib_main_t * vm, vlib_node_runtime_t * node,
    * a sequence s, s+1, s+2, s+3, ... s+n and nothing will prevent any
    * implementation, sequential or batching, from decrypting these.
    */
+#ifdef FLEXIWAN_FEATURE /* ipsec_multi_worker_sa */
+  if (PREDICT_FALSE (sa0->multi_worker))
+    {
+      clib_spinlock_lock (&sa0->replay_window_lock);
+      if (ipsec_sa_anti_replay_check (sa0, pd->seq))
+	{
+	  clib_spinlock_unlock (&sa0->replay_window_lock);
+	  b->error = node->errors[ESP_DECRYPT_ERROR_REPLAY];
+	  next[0] = ESP_DECRYPT_NEXT_DROP;
+	  return;
+	}
+      ipsec_sa_anti_replay_advance (sa0, pd->seq);
+      clib_spinlock_unlock (&sa0->replay_window_lock);
+    }
+  else
+    {
+      if (ipsec_sa_anti_replay_check (sa0, pd->seq))
+	{
+	  b->error = node->errors[ESP_DECRYPT_ERROR_REPLAY];
+	  next[0] = ESP_DECRYPT_NEXT_DROP;
+	  return;
+	}
+
+      ipsec_sa_anti_replay_advance (sa0, pd->seq);
+    }
+#else /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
   if (ipsec_sa_anti_replay_check (sa0, pd->seq))
     {
       b->error = node->errors[ESP_DECRYPT_ERROR_REPLAY];
@@ -821,6 +852,7 @@ esp_decrypt_post_crypto (vlib_main_t * vm, vlib_node_runtime_t * node,
     }
 
   ipsec_sa_anti_replay_advance (sa0, pd->seq);
+#endif /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
 
   if (pd->is_chain)
     {
@@ -1156,6 +1188,11 @@ esp_decrypt_inline (vlib_main_t * vm,
 #endif /*FLEXIWAN_FIX */
 	}
 
+#ifdef FLEXIWAN_FEATURE /* ipsec_multi_worker_sa */
+      if (PREDICT_FALSE (sa0->multi_worker))
+	goto skip_handoff;
+#endif /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
+
       if (PREDICT_FALSE (~0 == sa0->decrypt_thread_index))
 	{
 	  /* this is the first packet to use this SA, claim the SA
@@ -1180,6 +1217,9 @@ esp_decrypt_inline (vlib_main_t * vm,
 	  goto next;
 	}
 
+#ifdef FLEXIWAN_FEATURE /* ipsec_multi_worker_sa */
+    skip_handoff:
+#endif /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
       /* store packet data for next round for easier prefetch */
       pd->sa_data = cpd.sa_data;
       pd->current_data = b[0]->current_data;
@@ -1205,7 +1245,15 @@ esp_decrypt_inline (vlib_main_t * vm,
       pd->current_length = b[0]->current_length;
 
       /* anti-reply check */
+#ifdef FLEXIWAN_FEATURE /* ipsec_multi_worker_sa */
+      /*
+       * The window of multi-worker SA is advanced by other workers
+       * concurrently, so it is checked after decryption only, under lock.
+       */
+      if (!sa0->multi_worker && ipsec_sa_anti_replay_check (sa0, pd->seq))
+#else /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
       if (ipsec_sa_anti_replay_check (sa0, pd->seq))
+#endif /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
 	{
 	  b[0]->error = node->errors[ESP_DECRYPT_ERROR_REPLAY];
 	  esp_set_next_index (is_async, from, nexts, from[b - bufs],
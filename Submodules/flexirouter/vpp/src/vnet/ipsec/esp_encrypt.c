@@ -26,6 +26,15 @@
  *   - fix_crypto_worker_assignment : Crypto worker thread assignment need to
  *   include only the cpu.corelist-workers and exclude feature-specific worker
  *   threads like cpu.corelist-hqos-threads
+ *
+ *  List of features made for FlexiWAN (denoted by FLEXIWAN_FEATURE flag):
+ *   - ipsec_multi_worker_sa : The multi-worker SA is encrypted by the worker
+ *     that received the packet, with no handoff. The sequence numbers and
+ *     GCM IVs are taken out of the blocks reserved by the worker for the
+ *     packets of the SA pending in the frame.
+ *
+ *   - vxlan_esp_fastpath : The vxlan4-esp-encap node builds the VXLAN headers
+ *     and encrypts the whole frame in one node, see vnet_vxlan_set_esp_sa().
  */
 
 #include <vnet/vnet.h>
@@ -38,6 +47,9 @@
 #include <vnet/ipsec/ipsec_tun.h>
 #include <vnet/ipsec/esp.h>
 #include <vnet/tunnel/tunnel_dp.h>
+#ifdef FLEXIWAN_FEATURE /* vxlan_esp_fastpath */
+#include <vnet/vxlan/vxlan.h>
+#endif /* FLEXIWAN_FEATURE - vxlan_esp_fastpath */
 
 #define foreach_esp_encrypt_next                   \
 _(DROP4, "ip4-drop")                               \
@@ -428,7 +440,11 @@ esp_prepare_sync_op (vlib_main_t * vm, ipsec_per_thread_data_t * ptd,
 
 	  u64 *iv = (u64 *) (payload - iv_sz);
 	  nonce->salt = sa0->salt;
+#ifdef FLEXIWAN_FEATURE /* ipsec_multi_worker_sa */
+	  nonce->iv = *iv = clib_host_to_net_u64 (esp_gcm_iv_next (ptd, sa0));
+#else /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
 	  nonce->iv = *iv = clib_host_to_net_u64 (sa0->gcm_iv_counter++);
+#endif /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
 	  op->iv = (u8 *) nonce;
 	}
       else
@@ -514,7 +530,11 @@ esp_prepare_async_frame (vlib_main_t * vm, ipsec_per_thread_data_t * ptd,
       esp_aad_fill (aad, esp, sa);
       nonce = (esp_gcm_nonce_t *) (aad - sizeof (*nonce));
       nonce->salt = sa->salt;
+#ifdef FLEXIWAN_FEATURE /* ipsec_multi_worker_sa */
+      nonce->iv = *pkt_iv = clib_host_to_net_u64 (esp_gcm_iv_next (ptd, sa));
+#else /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
       nonce->iv = *pkt_iv = clib_host_to_net_u64 (sa->gcm_iv_counter++);
+#endif /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
       iv = (u8 *) nonce;
       key_index = sa->crypto_key_index;
 
@@ -567,6 +587,34 @@ out:
 					 iv, tag, aad, flag);
 }
 
+#ifdef FLEXIWAN_FEATURE /* ipsec_multi_worker_sa */
+/*
+ * Returns the number of packets of the SA at the head of the buffers, up to
+ * IPSEC_SA_MULTI_WORKER_SEQ_BLOCK. The sequence numbers are reserved for
+ * these packets only, so no sequence number is wasted by small frames.
+ */
+static_always_inline u32
+esp_encrypt_n_packets_of_sa (vlib_buffer_t ** b, u32 n_left, u32 sa_index,
+			     int is_tun)
+{
+  u32 n = 1, sai;
+
+  n_left = clib_min (n_left, IPSEC_SA_MULTI_WORKER_SEQ_BLOCK);
+  while (n < n_left)
+    {
+      if (is_tun)
+	sai = ipsec_tun_protect_get_sa_out
+	  (vnet_buffer (b[n])->ip.adj_index[VLIB_TX]);
+      else
+	sai = vnet_buffer (b[n])->ipsec.sad_index;
+      if (sai != sa_index)
+	break;
+      n++;
+    }
+  return n;
+}
+#endif /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
+
 always_inline uword
 esp_encrypt_inline (vlib_main_t * vm, vlib_node_runtime_t * node,
 		    vlib_frame_t * frame, int is_ip6, int is_tun,
@@ -603,10 +651,21 @@ esp_encrypt_inline (vlib_main_t * vm, vlib_node_runtime_t * node,
       vec_reset_length (ptd->chained_integ_ops);
     }
   vec_reset_length (ptd->chunks);
+#ifdef FLEXIWAN_FEATURE /* ipsec_multi_worker_sa */
+  /*
+   * The block is used up by the frame, unless packets were dropped. Don't
+   * keep the rest, it might be too old for the anti-replay window of peer.
+   */
+  ptd->mw_sa_index = ~0;
+#endif /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
 
   while (n_left > 0)
     {
       u32 sa_index0;
+#ifdef FLEXIWAN_FEATURE /* ipsec_multi_worker_sa */
+      u32 seq0 = 0;
+      int seq_err;
+#endif /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
       dpo_id_t *dpo;
       esp_header_t *esp;
       u8 *payload, *next_hdr_ptr;
@@ -701,6 +760,11 @@ esp_encrypt_inline (vlib_main_t * vm, vlib_node_runtime_t * node,
 	    }
 	}
 
+#ifdef FLEXIWAN_FEATURE /* ipsec_multi_worker_sa */
+      if (PREDICT_FALSE (sa0->multi_worker))
+	goto skip_handoff;
+#endif /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
+
       if (PREDICT_FALSE (~0 == sa0->encrypt_thread_index))
 	{
 	  /* this is the first packet to use this SA, claim the SA
@@ -726,6 +790,9 @@ esp_encrypt_inline (vlib_main_t * vm, vlib_node_runtime_t * node,
 	  goto trace;
 	}
 
+#ifdef FLEXIWAN_FEATURE /* ipsec_multi_worker_sa */
+    skip_handoff:
+#endif /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
       lb = b[0];
       n_bufs = vlib_buffer_chain_linearize (vm, b[0]);
       if (n_bufs == 0)
@@ -743,7 +810,26 @@ esp_encrypt_inline (vlib_main_t * vm, vlib_node_runtime_t * node,
 	    lb = vlib_get_buffer (vm, lb->next_buffer);
 	}
 
+#ifdef FLEXIWAN_FEATURE /* ipsec_multi_worker_sa */
+      if (PREDICT_FALSE (sa0->multi_worker))
+	{
+	  seq_err = 0;
+	  if (esp_seq_multi_worker_is_empty (ptd, sa_index0))
+	    seq_err = esp_seq_reserve_multi_worker
+	      (ptd, sa0, sa_index0,
+	       esp_encrypt_n_packets_of_sa (b, n_left, sa_index0, is_tun));
+	  if (PREDICT_TRUE (!seq_err))
+	    seq0 = esp_seq_next_multi_worker (ptd);
+	}
+      else
+	{
+	  seq_err = esp_seq_advance (sa0);
+	  seq0 = sa0->seq;
+	}
+      if (PREDICT_FALSE (seq_err))
+#else /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
       if (PREDICT_FALSE (esp_seq_advance (sa0)))
+#endif /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
 	{
 	  b[0]->error = node->errors[ESP_ENCRYPT_ERROR_SEQ_CYCLED];
 	  esp_set_next_index (is_async, from, nexts, from[b - bufs],
@@ -958,7 +1044,11 @@ esp_encrypt_inline (vlib_main_t * vm, vlib_node_runtime_t * node,
 	}
 
       esp->spi = spi;
+#ifdef FLEXIWAN_FEATURE /* ipsec_multi_worker_sa */
+      esp->seq = clib_net_to_host_u32 (seq0);
+#else /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
       esp->seq = clib_net_to_host_u32 (sa0->seq);
+#endif /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
 
       if (is_async)
 	{
@@ -1004,7 +1094,11 @@ esp_encrypt_inline (vlib_main_t * vm, vlib_node_runtime_t * node,
 						    sizeof (*tr));
 	  tr->sa_index = sa_index0;
 	  tr->spi = sa0->spi;
+#ifdef FLEXIWAN_FEATURE /* ipsec_multi_worker_sa */
+	  tr->seq = sa0->multi_worker ? seq0 : sa0->seq;
+#else /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
 	  tr->seq = sa0->seq;
+#endif /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
 	  tr->sa_seq_hi = sa0->seq_hi;
 	  tr->udp_encap = ipsec_sa_is_set_UDP_ENCAP (sa0);
 	  tr->crypto_alg = sa0->crypto_alg;
@@ -1203,6 +1297,78 @@ VLIB_REGISTER_NODE (esp4_encrypt_post_node) = {
 };
 /* *INDENT-ON* */
 
+#ifdef FLEXIWAN_FEATURE /* vxlan_esp_fastpath */
+/*
+ * The output node of VXLAN tunnel bound to the outbound ESP tunnel SA.
+ * It replaces the vxlan4-encap -> underlay lookup -> tunnel midchain ->
+ * esp4-encrypt-tun chain: the VXLAN header of every packet is built and
+ * the whole frame is encrypted by the same node, with sync or async crypto,
+ * and then it goes to the SA adjacency, as esp4-encrypt does for the tunnel
+ * SA. The node is sibling of esp4-encrypt, so it shares the SA adjacency
+ * next nodes and the handoff next of esp4-encrypt.
+ */
+VLIB_NODE_FN (vxlan4_esp_encap_node) (vlib_main_t * vm,
+				      vlib_node_runtime_t * node,
+				      vlib_frame_t * from_frame)
+{
+  vxlan_main_t *vxm = &vxlan_main;
+  vnet_main_t *vnm = vnet_get_main ();
+  vlib_combined_counter_main_t *tx_counter =
+    vnm->interface_main.combined_sw_if_counters + VNET_INTERFACE_COUNTER_TX;
+  u32 *from = vlib_frame_vector_args (from_frame);
+  u32 n_left = from_frame->n_vectors;
+  vlib_buffer_t *bufs[VLIB_FRAME_SIZE], **b = bufs;
+  u32 thread_index = vm->thread_index;
+  u32 sw_if_index = ~0, len;
+  vnet_hw_interface_t *hi;
+  vxlan_tunnel_t *t = 0;
+
+  vlib_get_buffers (vm, from, bufs, n_left);
+
+  while (n_left > 0)
+    {
+      if (n_left > 2)
+	{
+	  vlib_prefetch_buffer_header (b[2], STORE);
+	  CLIB_PREFETCH (b[1]->data, CLIB_CACHE_LINE_BYTES, STORE);
+	}
+
+      if (PREDICT_FALSE (sw_if_index !=
+			 vnet_buffer (b[0])->sw_if_index[VLIB_TX]))
+	{
+	  sw_if_index = vnet_buffer (b[0])->sw_if_index[VLIB_TX];
+	  hi = vnet_get_sup_hw_interface (vnm, sw_if_index);
+	  t = &vxm->tunnels[hi->dev_instance];
+	}
+
+      len = vxlan4_esp_encap_rewrite (vm, vxm, t, b[0]);
+      vnet_buffer (b[0])->ipsec.sad_index = t->esp_sa_index;
+      vlib_increment_combined_counter (tx_counter, thread_index,
+				       sw_if_index, 1, len);
+
+      b += 1;
+      n_left -= 1;
+    }
+
+  return esp_encrypt_inline (vm, node, from_frame, 0 /* is_ip6 */ , 0,
+			     esp_encrypt_async_next.esp4_post_next);
+}
+
+/* *INDENT-OFF* */
+VLIB_REGISTER_NODE (vxlan4_esp_encap_node) = {
+  .name = "vxlan4-esp-encap",
+  .vector_size = sizeof (u32),
+  .format_trace = format_esp_encrypt_trace,
+  .type = VLIB_NODE_TYPE_INTERNAL,
+
+  .n_errors = ARRAY_LEN(esp_encrypt_error_strings),
+  .error_strings = esp_encrypt_error_strings,
+
+  .sibling_of = "esp4-encrypt",
+};
+/* *INDENT-ON* */
+#endif /* FLEXIWAN_FEATURE - vxlan_esp_fastpath */
+
 VLIB_NODE_FN (esp6_encrypt_node) (vlib_main_t * vm,
 				  vlib_node_runtime_t * node,
 				  vlib_frame_t * from_frame)
@@ -21,6 +21,14 @@
  *   threads like cpu.corelist-hqos-threads
  */
 
+/*
+ *  List of features made for FlexiWAN (denoted by FLEXIWAN_FEATURE flag):
+ *
+ *   - ipsec_multi_worker_sa : Let ESP SA be processed by any worker instead of
+ *     the single worker it is bound to. The worker keeps the block of sequence
+ *     numbers it reserved of the SA in the per thread data.
+ */
+
 #ifndef __IPSEC_H__
 #define __IPSEC_H__
 
@@ -110,6 +118,16 @@ typedef struct
   vnet_crypto_op_t *chained_crypto_ops;
   vnet_crypto_op_t *chained_integ_ops;
   vnet_crypto_op_chunk_t *chunks;
+#ifdef FLEXIWAN_FEATURE /* ipsec_multi_worker_sa */
+  /*
+   * Sequence numbers and GCM IVs reserved by the thread of multi-worker SA,
+   * see esp_seq_reserve_multi_worker(). Valid within one frame only.
+   */
+  u32 mw_sa_index;
+  u32 mw_seq;
+  u32 mw_n_left;
+  u64 mw_iv;
+#endif /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
 } ipsec_per_thread_data_t;
 
 typedef struct
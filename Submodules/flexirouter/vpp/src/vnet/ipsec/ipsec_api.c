@@ -29,6 +29,8 @@
  *     length is needed in systems where packet reordering is expected due to
  *     features like QoS. A low window length can lead to the wrong dropping of
  *     out-of-order packets that are outside the window as replayed packets.
+ *     The window is kept as ring bitmap indexed by sequence number, so
+ *     advancing it does not depend on the window length.
  */
 
 #include <vnet/vnet.h>
@@ -992,7 +994,7 @@ send_ipsec_sa_details (ipsec_sa_t * sa, void *arg)
     }
   if (ipsec_sa_is_set_USE_ANTI_REPLAY (sa))
 #ifdef FLEXIWAN_FEATURE /* configurable_anti_replay_window_len */
-    ipsec_replay_window_encode (sa->replay_window_bmp, &mp->replay_window);
+    ipsec_replay_window_encode (sa, &mp->replay_window);
 #else /*FLEXIWAN_FEATURE - configurable_anti_replay_window_len */
     mp->replay_window = clib_host_to_net_u64 (sa->replay_window);
 #endif /*FLEXIWAN_FEATURE - configurable_anti_replay_window_len */
@@ -1091,7 +1093,7 @@ send_ipsec_sa_v2_details (ipsec_sa_t * sa, void *arg)
     }
   if (ipsec_sa_is_set_USE_ANTI_REPLAY (sa))
 #ifdef FLEXIWAN_FEATURE /* configurable_anti_replay_window_len */
-    ipsec_replay_window_encode (sa->replay_window_bmp, &mp->replay_window);
+    ipsec_replay_window_encode (sa, &mp->replay_window);
 #else /*FLEXIWAN_FEATURE - configurable_anti_replay_window_len */
     mp->replay_window = clib_host_to_net_u64 (sa->replay_window);
 #endif /*FLEXIWAN_FEATURE - configurable_anti_replay_window_len */
@@ -27,6 +27,9 @@
  *     length is needed in systems where packet reordering is expected due to
  *     features like QoS. A low window length can lead to the wrong dropping of
  *     out-of-order packets that are outside the window as replayed packets.
+ *
+ *   - ipsec_multi_worker_sa : Let ESP SA be processed by any worker instead of
+ *     the single worker it is bound to, see 'set ipsec sa multi-worker'.
  */
 
 #include <vnet/vnet.h>
@@ -1192,6 +1195,84 @@ VLIB_CLI_COMMAND (set_async_mode_command, static) = {
 };
 /* *INDENT-ON* */
 
+#ifdef FLEXIWAN_FEATURE /* ipsec_multi_worker_sa */
+static clib_error_t *
+set_ipsec_sa_multi_worker_command_fn (vlib_main_t * vm,
+				      unformat_input_t * input,
+				      vlib_cli_command_t * cmd)
+{
+  unformat_input_t _line_input, *line_input = &_line_input;
+  clib_error_t *error = NULL;
+  u32 id = ~0;
+  u8 enable = 1;
+  int rv;
+
+  if (!unformat_user (input, unformat_line_input, line_input))
+    return 0;
+
+  while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (line_input, "%u", &id))
+	;
+      else if (unformat (line_input, "multi-worker"))
+	;
+      else if (unformat (line_input, "disable"))
+	enable = 0;
+      else
+	{
+	  error = clib_error_return (0, "unknown input '%U'",
+				     format_unformat_error, line_input);
+	  goto done;
+	}
+    }
+
+  if (~0 == id)
+    {
+      error = clib_error_return (0, "SA ID not set");
+      goto done;
+    }
+
+  rv = ipsec_sa_set_multi_worker (id, enable);
+  switch (rv)
+    {
+    case 0:
+      break;
+    case VNET_API_ERROR_NO_SUCH_ENTRY:
+      error = clib_error_return (0, "no such SA %u", id);
+      break;
+    case VNET_API_ERROR_UNSUPPORTED:
+      error = clib_error_return (0, "only ESP SA without ESN can be "
+				 "processed by multiple workers");
+      break;
+    default:
+      error = clib_error_return (0, "failed: %d", rv);
+      break;
+    }
+
+done:
+  unformat_free (line_input);
+  return error;
+}
+
+/*?
+ * Lets the SA be processed by all workers in parallel instead of the worker
+ * the SA is bound to. Use it for the tunnel that carries more traffic than
+ * one worker can encrypt or decrypt. The peer should have large enough
+ * anti-replay window, as the packets of the SA become reordered slightly.
+ *
+ * @cliexpar
+ * @cliexcmd{set ipsec sa 10 multi-worker}
+ * @cliexcmd{set ipsec sa 10 multi-worker disable}
+?*/
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (set_ipsec_sa_multi_worker_command, static) = {
+    .path = "set ipsec sa",
+    .short_help = "set ipsec sa <id> multi-worker [disable]",
+    .function = set_ipsec_sa_multi_worker_command_fn,
+};
+/* *INDENT-ON* */
+#endif /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
+
 /*
  * fd.io coding-style-patch-verification: ON
  *
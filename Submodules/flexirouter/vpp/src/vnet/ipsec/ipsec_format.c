@@ -24,6 +24,11 @@
  *     length is needed in systems where packet reordering is expected due to
  *     features like QoS. A low window length can lead to the wrong dropping of
  *     out-of-order packets that are outside the window as replayed packets.
+ *     The window is kept as ring bitmap indexed by sequence number, so
+ *     advancing it does not depend on the window length.
+ *
+ *   - ipsec_multi_worker_sa : Let ESP SA be processed by any worker instead of
+ *     the single worker it is bound to. Show it in SA details.
  */
 
 #include <vnet/vnet.h>
@@ -286,6 +291,9 @@ format_ipsec_sa (u8 * s, va_list * args)
   vlib_counter_t counts;
   u32 tx_table_id;
   ipsec_sa_t *sa;
+#ifdef FLEXIWAN_FEATURE /* configurable_anti_replay_window_len */
+  uword *window;
+#endif /* FLEXIWAN_FEATURE - configurable_anti_replay_window_len */
 
   if (pool_is_free_index (im->sad, sai))
     {
@@ -304,14 +312,20 @@ format_ipsec_sa (u8 * s, va_list * args)
 
   s = format (s, "\n   locks %d", sa->node.fn_locks);
   s = format (s, "\n   salt 0x%x", clib_net_to_host_u32 (sa->salt));
+#ifdef FLEXIWAN_FEATURE /* ipsec_multi_worker_sa */
+  if (sa->multi_worker)
+    s = format (s, "\n   thread-indices [multi-worker]");
+  else
+#endif /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
   s = format (s, "\n   thread-indices [encrypt:%d decrypt:%d]",
 	      sa->encrypt_thread_index, sa->decrypt_thread_index);
   s = format (s, "\n   seq %u seq-hi %u", sa->seq, sa->seq_hi);
 #ifdef FLEXIWAN_FEATURE /* configurable_anti_replay_window_len */
   s = format (s, "\n   last-seq %u last-seq-hi %u",
 	      sa->last_seq, sa->last_seq_hi);
-  s = format (s, "\n   anti-replay-window %U",
-	      format_bitmap_hex, sa->replay_window_bmp);
+  window = ipsec_sa_anti_replay_window_linearize (sa, ~0);
+  s = format (s, "\n   anti-replay-window %U", format_bitmap_hex, window);
+  clib_bitmap_free (window);
 #else /* FLEXIWAN_FEATURE - configurable_anti_replay_window_len */
   s = format (s, "\n   last-seq %u last-seq-hi %u window %U",
 	      sa->last_seq, sa->last_seq_hi,
@@ -22,6 +22,11 @@
  *     length is needed in systems where packet reordering is expected due to
  *     features like QoS. A low window length can lead to the wrong dropping of
  *     out-of-order packets that are outside the window as replayed packets.
+ *     The window is kept as ring bitmap indexed by sequence number, so
+ *     advancing it does not depend on the window length.
+ *
+ *   - ipsec_multi_worker_sa : Let ESP SA be processed by any worker instead of
+ *     the single worker it is bound to, see ipsec_sa_set_multi_worker().
  */
 
 #include <vnet/vnet.h>
@@ -373,6 +378,9 @@ ipsec_sa_add_and_lock (u32 id,
       else if (anti_replay_window_len > IPSEC_SA_ANTI_REPLAY_WINDOW_MAX_SIZE)
         anti_replay_window_len = IPSEC_SA_ANTI_REPLAY_WINDOW_MAX_SIZE;
 
+      /* The ring window length should be power of two, see ipsec_sa.h */
+      anti_replay_window_len =
+        max_pow2 (clib_max (anti_replay_window_len, BITS (uword)));
       clib_bitmap_alloc (sa->replay_window_bmp, anti_replay_window_len);
   }
 #endif /* FLEXIWAN_FEATURE - configurable_anti_replay_window_len */
@@ -415,6 +423,9 @@ ipsec_sa_del (ipsec_sa_t * sa)
       clib_bitmap_free (sa->replay_window_bmp);
     }
 #endif /* FLEXIWAN_FEATURE - configurable_anti_replay_window_len */
+#ifdef FLEXIWAN_FEATURE /* ipsec_multi_worker_sa */
+  clib_spinlock_free (&sa->replay_window_lock);
+#endif /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
   pool_put (im->sad, sa);
 }
 
@@ -481,6 +492,65 @@ ipsec_sa_unlock_id (u32 id)
   return (0);
 }
 
+#ifdef FLEXIWAN_FEATURE /* configurable_anti_replay_window_len */
+uword *
+ipsec_sa_anti_replay_window_linearize (const ipsec_sa_t * sa, u32 max_len)
+{
+  u32 anti_replay_window_len = ipsec_sa_anti_replay_window_len (sa);
+  uword *bmp = NULL;
+  u32 i;
+
+  if (anti_replay_window_len == 0)
+    return NULL;
+
+  max_len = clib_min (max_len, anti_replay_window_len);
+  clib_bitmap_alloc (bmp, max_len);
+  for (i = 0; i < max_len; i++)
+    if (ipsec_sa_anti_replay_window_get (sa, sa->last_seq - i,
+					 anti_replay_window_len))
+      bmp = clib_bitmap_set (bmp, i, 1);
+  return bmp;
+}
+#endif /* FLEXIWAN_FEATURE - configurable_anti_replay_window_len */
+
+#ifdef FLEXIWAN_FEATURE /* ipsec_multi_worker_sa */
+int
+ipsec_sa_set_multi_worker (u32 id, u8 enable)
+{
+  ipsec_main_t *im = &ipsec_main;
+  ipsec_sa_t *sa;
+  uword *p;
+
+  p = hash_get (im->sa_index_by_sa_id, id);
+  if (!p)
+    return VNET_API_ERROR_NO_SUCH_ENTRY;
+
+  sa = pool_elt_at_index (im->sad, p[0]);
+  if (!enable)
+    {
+      /*
+       * The barrier is held, so no worker uses the SA. The SA is bound to
+       * the worker again by the next packet, see ipsec_sa_assign_thread().
+       */
+      sa->multi_worker = 0;
+      clib_spinlock_free (&sa->replay_window_lock);
+      return 0;
+    }
+
+  /*
+   * The ESN high bits are shared by the sequence number space of the SA,
+   * so they can't be advanced by several workers without global lock.
+   */
+  if (sa->protocol != IPSEC_PROTOCOL_ESP || ipsec_sa_is_set_USE_ESN (sa))
+    return VNET_API_ERROR_UNSUPPORTED;
+
+  if (!sa->replay_window_lock)
+    clib_spinlock_init (&sa->replay_window_lock);
+  sa->multi_worker = 1;
+  return 0;
+}
+#endif /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
+
 void
 ipsec_sa_clear (index_t sai)
 {
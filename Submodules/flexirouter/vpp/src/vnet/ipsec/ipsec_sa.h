@@ -30,6 +30,18 @@
  *     length is needed in systems where packet reordering is expected due to
  *     features like QoS. A low window length can lead to the wrong dropping of
  *     out-of-order packets that are outside the window as replayed packets.
+ *     The window is kept as ring bitmap indexed by sequence number, so
+ *     advancing it does not depend on the window length.
+ *
+ *   - ipsec_multi_worker_sa : Let ESP SA be processed by any worker instead of
+ *     the single worker it is bound to, so one heavy tunnel is not limited by
+ *     the capacity of one core. The outbound sequence numbers are reserved by
+ *     workers in blocks and the inbound anti-replay window is updated under
+ *     the SA lock. Enabled per SA by the 'set ipsec sa multi-worker' CLI.
+ *
+ *   - ipsec_sa_placement : Place new SA on the least loaded worker instead of
+ *     the random one, and move SAs off overloaded workers periodically.
+ *     See ipsec_sa_placement.c.
  */
 
 #ifndef __IPSEC_SPD_SA_H__
@@ -43,6 +55,9 @@
 #ifdef FLEXIWAN_FEATURE /* configurable_anti_replay_window_len */
 #include <vppinfra/bitmap.h>
 #endif /* FLEXIWAN_FEATURE - configurable_anti_replay_window_len */
+#ifdef FLEXIWAN_FEATURE /* ipsec_multi_worker_sa */
+#include <vppinfra/lock.h>
+#endif /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
 
 #define foreach_ipsec_crypto_alg    \
   _ (0, NONE, "none")               \
@@ -193,7 +208,12 @@ typedef struct
   ipsec_protocol_t protocol;
   tunnel_encap_decap_flags_t tunnel_flags;
   ip_dscp_t dscp;
+#ifdef FLEXIWAN_FEATURE /* ipsec_multi_worker_sa */
+  /* processed by any worker, see ipsec_sa_set_multi_worker() */
+  u8 multi_worker;
+#else  /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
   u8 __pad[1];
+#endif /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
 
   /* data accessed by dataplane code should be above this comment */
     CLIB_CACHE_LINE_ALIGN_MARK (cacheline2);
@@ -242,6 +262,10 @@ typedef struct
 
   ipsec_key_t integ_key;
   ipsec_key_t crypto_key;
+#ifdef FLEXIWAN_FEATURE /* ipsec_multi_worker_sa */
+  /* protects anti-replay window of multi-worker SA */
+  clib_spinlock_t replay_window_lock;
+#endif /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
 } ipsec_sa_t;
 
 STATIC_ASSERT_OFFSET_OF (ipsec_sa_t, cacheline1, CLIB_CACHE_LINE_BYTES);
@@ -303,6 +327,23 @@ extern void ipsec_sa_set_crypto_alg (ipsec_sa_t * sa,
 				     ipsec_crypto_alg_t crypto_alg);
 extern void ipsec_sa_set_integ_alg (ipsec_sa_t * sa,
 				    ipsec_integ_alg_t integ_alg);
+#ifdef FLEXIWAN_FEATURE /* ipsec_multi_worker_sa */
+/*
+ * Maximum number of outbound sequence numbers (and GCM IVs) the worker
+ * reserves of multi-worker SA at once, the worker reserves as many as there
+ * are packets of the SA pending in the frame. The reserved block is used
+ * within one frame only, so the receiver sees at most about (number of
+ * workers x block) reordering, that should fit into its anti-replay window.
+ */
+#define IPSEC_SA_MULTI_WORKER_SEQ_BLOCK 32
+
+/**
+ * Enables or disables processing of SA by all workers in parallel instead
+ * of the worker the SA is bound to. Only ESP SAs without ESN are supported.
+ * Should be called with the worker barrier held.
+ */
+extern int ipsec_sa_set_multi_worker (u32 id, u8 enable);
+#endif /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
 
 typedef walk_rc_t (*ipsec_sa_walk_cb_t) (ipsec_sa_t * sa, void *ctx);
 extern void ipsec_sa_walk (ipsec_sa_walk_cb_t cd, void *ctx);
@@ -338,11 +379,82 @@ extern uword unformat_ipsec_key (unformat_input_t * input, va_list * args);
 
 /*
  * Below changes are modification of existing replay check functions to make
- * use of a configurable anti-replay window length
+ * use of a configurable anti-replay window length.
+ *
+ * The window is a ring: the bit of sequence number 'seq' is the bit
+ * 'seq & (window_len - 1)' of 'replay_window_bmp', so the window length is
+ * power of two. Advancing the window clears the bits of skipped sequence
+ * numbers only, instead of shifting the whole bitmap, so the in-order packet
+ * costs the same regardless of the window length. As the window length
+ * divides 2^32, the bit position of sequence number does not change when
+ * the lower 32 bits of ESN wrap.
  */
-#define IPSEC_SA_ANTI_REPLAY_WINDOW_MAX_SIZE (1024)
+#define IPSEC_SA_ANTI_REPLAY_WINDOW_MAX_SIZE (8192)
 #define IPSEC_SA_ANTI_REPLAY_WINDOW_START(_tl, _anti_replay_window_len) (_tl - _anti_replay_window_len + 1)
 
+always_inline u32
+ipsec_sa_anti_replay_window_len (const ipsec_sa_t * sa)
+{
+  return vec_len (sa->replay_window_bmp) * BITS (sa->replay_window_bmp[0]);
+}
+
+always_inline int
+ipsec_sa_anti_replay_window_get (const ipsec_sa_t * sa, u32 seq,
+				 u32 anti_replay_window_len)
+{
+  return clib_bitmap_get_no_check (sa->replay_window_bmp,
+				   seq & (anti_replay_window_len - 1));
+}
+
+always_inline void
+ipsec_sa_anti_replay_window_set (ipsec_sa_t * sa, u32 seq,
+				 u32 anti_replay_window_len)
+{
+  u32 i = seq & (anti_replay_window_len - 1);
+
+  sa->replay_window_bmp[i / BITS (uword)] |= (uword) 1 << (i % BITS (uword));
+}
+
+/*
+ * Moves the window top from the last sequence number to 'seq' that is 'pos'
+ * numbers ahead of it: the bits of sequence numbers in between become clear
+ * and the bit of 'seq' is set.
+ */
+always_inline void
+ipsec_sa_anti_replay_window_shift (ipsec_sa_t * sa, u32 seq, u32 pos,
+				   u32 anti_replay_window_len)
+{
+  u32 mask = anti_replay_window_len - 1;
+  u32 i, len;
+  uword bits;
+
+  if (PREDICT_FALSE (pos >= anti_replay_window_len))
+    clib_bitmap_zero (sa->replay_window_bmp);
+  else
+    {
+      i = (sa->last_seq + 1) & mask;
+      while (pos)
+	{
+	  len = clib_min (pos, BITS (uword) - (i % BITS (uword)));
+	  bits = (len == BITS (uword)) ? ~(uword) 0 : ((uword) 1 << len) - 1;
+	  sa->replay_window_bmp[i / BITS (uword)] &=
+	    ~(bits << (i % BITS (uword)));
+	  i = (i + len) & mask;
+	  pos -= len;
+	}
+    }
+  ipsec_sa_anti_replay_window_set (sa, seq, anti_replay_window_len);
+  sa->last_seq = seq;
+}
+
+/**
+ * Returns the window as bitmap relative to the last sequence number, i.e. bit
+ * 'i' is set if 'last_seq - i' was received, truncated to 'max_len' bits.
+ * The caller should free the returned bitmap.
+ */
+extern uword *ipsec_sa_anti_replay_window_linearize (const ipsec_sa_t * sa,
+						     u32 max_len);
+
 always_inline int
 ipsec_sa_anti_replay_check (ipsec_sa_t * sa, u32 seq)
 {
@@ -350,8 +462,7 @@ ipsec_sa_anti_replay_check (ipsec_sa_t * sa, u32 seq)
 
   if ((sa->flags & IPSEC_SA_FLAG_USE_ANTI_REPLAY) == 0)
     return 0;
-  u32 anti_replay_window_len =
-    vec_len (sa->replay_window_bmp) * BITS (sa->replay_window_bmp[0]);
+  u32 anti_replay_window_len = ipsec_sa_anti_replay_window_len (sa);
 
   if (!ipsec_sa_is_set_USE_ESN (sa))
     {
@@ -361,7 +472,8 @@ ipsec_sa_anti_replay_check (ipsec_sa_t * sa, u32 seq)
       diff = sa->last_seq - seq;
 
       if (anti_replay_window_len > diff)
-	return clib_bitmap_get (sa->replay_window_bmp, diff);
+	return ipsec_sa_anti_replay_window_get (sa, seq,
+						anti_replay_window_len);
       else
 	return 1;
 
@@ -402,7 +514,8 @@ ipsec_sa_anti_replay_check (ipsec_sa_t * sa, u32 seq)
 	     * The recieved seq number is within bounds of the window
 	     * check if it's a duplicate
 	     */
-	    return clib_bitmap_get (sa->replay_window_bmp, diff);
+	    return ipsec_sa_anti_replay_window_get (sa, seq,
+						    anti_replay_window_len);
 	  else
 	    /*
 	     * The received sequence number is greater than the window
@@ -434,7 +547,8 @@ ipsec_sa_anti_replay_check (ipsec_sa_t * sa, u32 seq)
 	       * check for duplicates.
 	       */
 	      sa->seq_hi = th;
-	      return clib_bitmap_get (sa->replay_window_bmp, diff);
+	      return ipsec_sa_anti_replay_window_get (sa, seq,
+						      anti_replay_window_len);
 	    }
 	  else
 	    {
@@ -461,7 +575,8 @@ ipsec_sa_anti_replay_check (ipsec_sa_t * sa, u32 seq)
 	   * packet, the SA has moved on to a higher sequence number.
 	   */
 	  sa->seq_hi = th - 1;
-	  return clib_bitmap_get (sa->replay_window_bmp, diff);
+	  return ipsec_sa_anti_replay_window_get (sa, seq,
+						  anti_replay_window_len);
 	}
     }
 
@@ -475,81 +590,41 @@ ipsec_sa_anti_replay_check (ipsec_sa_t * sa, u32 seq)
 always_inline void
 ipsec_sa_anti_replay_advance (ipsec_sa_t * sa, u32 seq)
 {
-  u32 pos;
   if (PREDICT_TRUE (sa->flags & IPSEC_SA_FLAG_USE_ANTI_REPLAY) == 0)
     return;
 
-  u32 anti_replay_window_len =
-    vec_len (sa->replay_window_bmp) * BITS (sa->replay_window_bmp[0]);
+  u32 anti_replay_window_len = ipsec_sa_anti_replay_window_len (sa);
   if (PREDICT_TRUE (sa->flags & IPSEC_SA_FLAG_USE_ESN))
     {
       int wrap = sa->seq_hi - sa->last_seq_hi;
 
       if (wrap == 0 && seq > sa->last_seq)
 	{
-	  pos = seq - sa->last_seq;
-	  if (pos < anti_replay_window_len)
-	    {
-	      clib_bitmap_shift_left (sa->replay_window_bmp, pos);
-	      clib_bitmap_set (sa->replay_window_bmp, 0, 1);
-	    }
-	  else
-	    {
-	      clib_bitmap_zero (sa->replay_window_bmp);
-	      clib_bitmap_set (sa->replay_window_bmp, 0, 1);
-	    }
-	  sa->last_seq = seq;
+	  ipsec_sa_anti_replay_window_shift (sa, seq, seq - sa->last_seq,
+					     anti_replay_window_len);
 	}
       else if (wrap > 0)
 	{
-	  pos = ~seq + sa->last_seq + 1;
-	  if (pos < anti_replay_window_len)
-	    {
-	      clib_bitmap_shift_left (sa->replay_window_bmp, pos);
-	      clib_bitmap_set (sa->replay_window_bmp, 0, 1);
-	    }
-	  else
-	    {
-	      clib_bitmap_zero (sa->replay_window_bmp);
-	      clib_bitmap_set (sa->replay_window_bmp, 0, 1);
-
-	    }
-	  sa->last_seq = seq;
+	  /* the distance is modulo 2^32, as the lower bits wrapped */
+	  ipsec_sa_anti_replay_window_shift (sa, seq, seq - sa->last_seq,
+					     anti_replay_window_len);
 	  sa->last_seq_hi = sa->seq_hi;
 	}
-      else if (wrap < 0)
-	{
-	  pos = ~seq + sa->last_seq + 1;
-	  clib_bitmap_set (sa->replay_window_bmp, pos, 1);
-	}
       else
 	{
-	  pos = sa->last_seq - seq;
-	  clib_bitmap_set (sa->replay_window_bmp, pos, 1);
+	  ipsec_sa_anti_replay_window_set (sa, seq, anti_replay_window_len);
 	}
     }
   else
     {
       if (seq > sa->last_seq)
 	{
-	  pos = seq - sa->last_seq;
-	  if (pos < anti_replay_window_len)
-	    {
-	      clib_bitmap_shift_left (sa->replay_window_bmp, pos);
-	      clib_bitmap_set (sa->replay_window_bmp, 0, 1);
-	    }
-	  else
-	    {
-	      clib_bitmap_zero (sa->replay_window_bmp);
-	      clib_bitmap_set (sa->replay_window_bmp, 0, 1);
-
-	    }
-	  sa->last_seq = seq;
+	  ipsec_sa_anti_replay_window_shift (sa, seq, seq - sa->last_seq,
+					     anti_replay_window_len);
 	}
       else
 	{
-	  pos = sa->last_seq - seq;
-	  clib_bitmap_set (sa->replay_window_bmp, pos, 1);
+	  ipsec_sa_anti_replay_window_set (sa, seq, anti_replay_window_len);
 	}
     }
 }
@@ -754,9 +829,19 @@ ipsec_sa_anti_replay_advance (ipsec_sa_t * sa, u32 seq)
  *  if input ~0, gets random worker_id based on unix_time_now_nsec
 */
 #ifdef FLEXIWAN_FEATURE  /* fix_crypto_worker_assignment */
+#ifdef FLEXIWAN_FEATURE /* ipsec_sa_placement */
+extern u32 ipsec_sa_placement_pick (u32 thread_id, u32 first_worker_index,
+				    u32 num_workers);
+#endif /* FLEXIWAN_FEATURE - ipsec_sa_placement */
+
 always_inline u32
 ipsec_sa_assign_thread (u32 thread_id, u32 first_worker_index, u32 num_workers)
 {
+#ifdef FLEXIWAN_FEATURE /* ipsec_sa_placement */
+  if (num_workers)
+    return ipsec_sa_placement_pick (thread_id, first_worker_index,
+				    num_workers);
+#endif /* FLEXIWAN_FEATURE - ipsec_sa_placement */
   return ((thread_id) ? thread_id
 	  : ((num_workers) ? (first_worker_index + (unix_time_now_nsec () % num_workers)) : thread_id));
 }
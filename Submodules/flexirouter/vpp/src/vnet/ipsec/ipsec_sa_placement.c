@@ -0,0 +1,576 @@
+/*
+ *  Copyright (C) 2023 flexiWAN Ltd.
+ *  List of features made for FlexiWAN (denoted by FLEXIWAN_FEATURE flag):
+ *
+ *   - ipsec_sa_placement : Place new SA on the least loaded worker instead of
+ *     the random one, and move SAs off overloaded workers periodically.
+ *
+ *  This file is added by the Flexiwan feature: ipsec_sa_placement.
+ */
+
+/*
+ * The SA is processed by the single worker, the one that is written into
+ * the encrypt_thread_index / decrypt_thread_index of SA on the first packet,
+ * other workers hand the SA packets off to it. As the SA is bound to worker
+ * for its life, several heavy tunnels can land on one worker, while others
+ * sit idle.
+ *
+ * The ipsec-sa-placement-process samples the SA counters every interval and
+ * calculates the packet rate of every SA and the load of every worker, which
+ * is the sum of rates of SAs bound to it.
+ *   - Placement: the new SA is bound to the least loaded worker. The SAs that
+ *     were placed since the last sample are accounted as SAs of average rate,
+ *     so burst of new SAs is spread over workers. The worker that received
+ *     the first packet wins the tie, so there is no handoff on idle system.
+ *   - Rebalancing: if the gap between the most and the least loaded workers
+ *     is above the threshold, the SA that brings the loads closest to each
+ *     other is moved from the most loaded worker to the least loaded one.
+ *     Up to IPSEC_SA_PLACEMENT_MAX_MOVES SAs are moved every interval.
+ *
+ * The SA is moved under the worker barrier, so no worker processes it in the
+ * middle. Before that the handoff queues of the old worker are drained, so
+ * the packets handed off to it before the move don't get behind the packets
+ * sent to the new worker. If the queues are not drained after
+ * IPSEC_SA_PLACEMENT_DRAIN_TRIES, the SA is moved anyway: the old worker
+ * hands such packets off to the new one, as the SA thread index is checked
+ * by the ESP/AH nodes on every packet.
+ *
+ * The multi-worker SAs (see ipsec_sa_set_multi_worker()) are not placed.
+ */
+
+#include <vnet/vnet.h>
+#include <vnet/ipsec/ipsec.h>
+
+#define IPSEC_SA_PLACEMENT_DEFAULT_INTERVAL   5.0    /*seconds*/
+#define IPSEC_SA_PLACEMENT_DEFAULT_THRESHOLD  25     /*percents of max load*/
+#define IPSEC_SA_PLACEMENT_MIN_LOAD           10000  /*pps, not rebalanced below*/
+#define IPSEC_SA_PLACEMENT_MAX_MOVES          4      /*SAs moved per interval*/
+#define IPSEC_SA_PLACEMENT_HOLD_INTERVALS     3      /*SA is not moved again within*/
+#define IPSEC_SA_PLACEMENT_DRAIN_TRIES        10
+#define IPSEC_SA_PLACEMENT_DRAIN_WAIT         1e-3   /*seconds*/
+
+typedef enum
+{
+  IPSEC_SA_PLACEMENT_EVENT_CONFIG = 1,
+} ipsec_sa_placement_event_t;
+
+typedef struct
+{
+  u32 sa_index;
+  u32 from;
+  u32 to;
+} ipsec_sa_placement_move_t;
+
+typedef struct
+{
+  /*
+   * Configuration.
+   */
+  u8 least_loaded;		/*0 - random placement as before */
+  f64 interval;			/*seconds */
+  u8 rebalance;
+  u32 threshold;		/*percents */
+
+  /*
+   * Read by workers on SA placement, indexed by thread index.
+   */
+  f64 *worker_load;		/*packets per second */
+  u32 *n_placed;		/*SAs placed since the last sample */
+  f64 sa_avg_rate;		/*packets per second */
+
+  /*
+   * Sampler data, indexed by SA index.
+   */
+  u64 *sa_last_packets;
+  f64 *sa_rate;			/*packets per second */
+  f64 *sa_last_move;		/*time */
+  f64 last_sample;
+
+  ipsec_sa_placement_move_t *moves;
+
+  /*
+   * Statistics.
+   */
+  u64 n_moves;
+  u64 n_undrained_moves;
+} ipsec_sa_placement_main_t;
+
+ipsec_sa_placement_main_t ipsec_sa_placement_main;
+
+vlib_node_registration_t ipsec_sa_placement_process_node;
+
+/*
+ * Returns the worker that processes SA or ~0 if it is not bound yet.
+ */
+static_always_inline u32
+ipsec_sa_placement_thread (const ipsec_sa_t * sa)
+{
+#ifdef FLEXIWAN_FEATURE /* ipsec_multi_worker_sa */
+  if (sa->multi_worker)
+    return ~0;
+#endif /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
+  if (sa->encrypt_thread_index != ~0)
+    return sa->encrypt_thread_index;
+  return sa->decrypt_thread_index;
+}
+
+u32
+ipsec_sa_placement_pick (u32 thread_id, u32 first_worker_index,
+			 u32 num_workers)
+{
+  ipsec_sa_placement_main_t *pm = &ipsec_sa_placement_main;
+  u32 last_worker_index = first_worker_index + num_workers - 1;
+  u32 ti, best = ~0;
+  f64 score, best_score = 0;
+
+  if (!pm->least_loaded || last_worker_index >= vec_len (pm->worker_load))
+    return ((thread_id) ? thread_id
+	    : (first_worker_index + (unix_time_now_nsec () % num_workers)));
+
+  for (ti = first_worker_index; ti <= last_worker_index; ti++)
+    {
+      score = pm->worker_load[ti] + pm->n_placed[ti] * pm->sa_avg_rate;
+      if (best == ~0 || score < best_score ||
+	  (score == best_score && ti == thread_id))
+	{
+	  best = ti;
+	  best_score = score;
+	}
+    }
+
+  clib_atomic_fetch_add (&pm->n_placed[best], 1);
+  return best;
+}
+
+/*
+ * Updates the rate of SAs and the load of workers out of the SA counters.
+ */
+static void
+ipsec_sa_placement_sample (vlib_main_t * vm)
+{
+  ipsec_sa_placement_main_t *pm = &ipsec_sa_placement_main;
+  ipsec_main_t *im = &ipsec_main;
+  vlib_counter_t count;
+  f64 now, dt, total = 0;
+  u32 sai, ti, n_active = 0;
+  u64 packets;
+  ipsec_sa_t *sa;
+  f64 *load = 0;
+
+  now = vlib_time_now (vm);
+  dt = pm->last_sample ? now - pm->last_sample : 0;
+  pm->last_sample = now;
+
+  vec_validate_init_empty (load, vec_len (pm->worker_load) - 1, 0);
+  if (pool_len (im->sad))
+    {
+      vec_validate_init_empty (pm->sa_last_packets, pool_len (im->sad) - 1,
+			       0);
+      vec_validate_init_empty (pm->sa_rate, pool_len (im->sad) - 1, 0);
+      vec_validate_init_empty (pm->sa_last_move, pool_len (im->sad) - 1, 0);
+    }
+
+  /* *INDENT-OFF* */
+  pool_foreach (sa, im->sad)
+   {
+    sai = sa - im->sad;
+    vlib_get_combined_counter (&ipsec_sa_counters, sai, &count);
+
+    /* the counters of SA are zeroed on SA index reuse */
+    packets = count.packets >= pm->sa_last_packets[sai] ?
+      count.packets - pm->sa_last_packets[sai] : count.packets;
+    pm->sa_last_packets[sai] = count.packets;
+    pm->sa_rate[sai] = dt > 0 ? packets / dt : 0;
+
+    ti = ipsec_sa_placement_thread (sa);
+    if (ti >= vec_len (load) || pm->sa_rate[sai] == 0)
+      continue;
+    load[ti] += pm->sa_rate[sai];
+    total += pm->sa_rate[sai];
+    n_active++;
+  }
+  /* *INDENT-ON* */
+
+  /* the workers read it on SA placement, no need to be consistent */
+  for (ti = 0; ti < vec_len (load); ti++)
+    {
+      pm->worker_load[ti] = load[ti];
+      pm->n_placed[ti] = 0;
+    }
+  pm->sa_avg_rate = n_active ? clib_max (total / n_active, 1.0) : 1.0;
+  vec_free (load);
+}
+
+static int
+ipsec_sa_placement_handoff_drained (u32 thread_index)
+{
+  ipsec_main_t *im = &ipsec_main;
+  vlib_thread_main_t *tm = vlib_get_thread_main ();
+  vlib_frame_queue_main_t *fqm;
+  vlib_frame_queue_t *fq;
+  u32 i;
+  u32 fq_indices[] = {
+    im->esp4_enc_fq_index, im->esp4_dec_fq_index,
+    im->esp6_enc_fq_index, im->esp6_dec_fq_index,
+    im->esp4_enc_tun_fq_index, im->esp4_dec_tun_fq_index,
+    im->esp6_enc_tun_fq_index, im->esp6_dec_tun_fq_index,
+    im->ah4_enc_fq_index, im->ah4_dec_fq_index,
+    im->ah6_enc_fq_index, im->ah6_dec_fq_index,
+  };
+
+  for (i = 0; i < ARRAY_LEN (fq_indices); i++)
+    {
+      fqm = vec_elt_at_index (tm->frame_queue_mains, fq_indices[i]);
+      fq = fqm->vlib_frame_queues[thread_index];
+      if (fq->head != fq->tail)
+	return 0;
+    }
+  return 1;
+}
+
+/*
+ * Moves SAs under the worker barrier, once the handoff queues of the old
+ * workers are drained.
+ */
+static void
+ipsec_sa_placement_migrate (vlib_main_t * vm)
+{
+  ipsec_sa_placement_main_t *pm = &ipsec_sa_placement_main;
+  ipsec_main_t *im = &ipsec_main;
+  ipsec_sa_placement_move_t *move;
+  ipsec_sa_t *sa;
+  int drained;
+  u32 try;
+
+  for (try = 1;; try++)
+    {
+      vlib_worker_thread_barrier_sync (vm);
+
+      drained = 1;
+      vec_foreach (move, pm->moves)
+	drained = drained && ipsec_sa_placement_handoff_drained (move->from);
+
+      if (drained || try == IPSEC_SA_PLACEMENT_DRAIN_TRIES)
+	break;
+
+      vlib_worker_thread_barrier_release (vm);
+      vlib_process_suspend (vm, IPSEC_SA_PLACEMENT_DRAIN_WAIT);
+    }
+
+  vec_foreach (move, pm->moves)
+  {
+    /* the SA might be deleted or moved while the process was suspended */
+    if (pool_is_free_index (im->sad, move->sa_index))
+      continue;
+    sa = pool_elt_at_index (im->sad, move->sa_index);
+    if (ipsec_sa_placement_thread (sa) != move->from)
+      continue;
+
+    if (sa->encrypt_thread_index == move->from)
+      sa->encrypt_thread_index = move->to;
+    if (sa->decrypt_thread_index == move->from)
+      sa->decrypt_thread_index = move->to;
+    pm->sa_last_move[move->sa_index] = vlib_time_now (vm);
+    pm->n_moves++;
+    if (!drained)
+      pm->n_undrained_moves++;
+  }
+
+  vlib_worker_thread_barrier_release (vm);
+}
+
+/*
+ * Picks SAs to be moved from the most loaded workers to the least loaded
+ * ones and moves them.
+ */
+static void
+ipsec_sa_placement_rebalance (vlib_main_t * vm)
+{
+  ipsec_sa_placement_main_t *pm = &ipsec_sa_placement_main;
+  ipsec_main_t *im = &ipsec_main;
+  ipsec_sa_placement_move_t *move;
+  u32 ti, max_ti, min_ti, sai, best_sai, n;
+  f64 gap, diff, best_diff, hold, now;
+  ipsec_sa_t *sa;
+  f64 *load;
+
+  if (im->num_workers < 2)
+    return;
+
+  load = vec_dup (pm->worker_load);
+  now = vlib_time_now (vm);
+  hold = IPSEC_SA_PLACEMENT_HOLD_INTERVALS * pm->interval;
+  vec_reset_length (pm->moves);
+
+  for (n = 0; n < IPSEC_SA_PLACEMENT_MAX_MOVES; n++)
+    {
+      max_ti = min_ti = im->first_worker_index;
+      for (ti = im->first_worker_index;
+	   ti < im->first_worker_index + im->num_workers; ti++)
+	{
+	  if (load[ti] > load[max_ti])
+	    max_ti = ti;
+	  if (load[ti] < load[min_ti])
+	    min_ti = ti;
+	}
+
+      gap = load[max_ti] - load[min_ti];
+      if (load[max_ti] < IPSEC_SA_PLACEMENT_MIN_LOAD ||
+	  gap * 100 < load[max_ti] * pm->threshold)
+	break;
+
+      /*
+       * Moving SA of rate r changes the gap to |gap - 2r|, so the SA of rate
+       * closest to gap/2 is the best.
+       */
+      best_sai = ~0;
+      best_diff = gap;
+      /* *INDENT-OFF* */
+      pool_foreach (sa, im->sad)
+       {
+        sai = sa - im->sad;
+        if (sai >= vec_len (pm->sa_rate) ||
+            ipsec_sa_placement_thread (sa) != max_ti ||
+            pm->sa_rate[sai] == 0 ||
+            (pm->sa_last_move[sai] && now - pm->sa_last_move[sai] < hold))
+          continue;
+        diff = gap - 2 * pm->sa_rate[sai];
+        diff = diff < 0 ? -diff : diff;
+        if (diff < best_diff)
+          {
+            best_diff = diff;
+            best_sai = sai;
+          }
+      }
+      /* *INDENT-ON* */
+      if (best_sai == ~0)
+	break;
+
+      vec_add2 (pm->moves, move, 1);
+      move->sa_index = best_sai;
+      move->from = max_ti;
+      move->to = min_ti;
+      load[max_ti] -= pm->sa_rate[best_sai];
+      load[min_ti] += pm->sa_rate[best_sai];
+      /* don't pick it again in this round */
+      pm->sa_last_move[best_sai] = now;
+    }
+
+  if (vec_len (pm->moves))
+    ipsec_sa_placement_migrate (vm);
+  vec_free (load);
+}
+
+static uword
+ipsec_sa_placement_process (vlib_main_t * vm,
+			    vlib_node_runtime_t * rt, vlib_frame_t * f)
+{
+  ipsec_sa_placement_main_t *pm = &ipsec_sa_placement_main;
+  uword *event_data = 0;
+
+  while (1)
+    {
+      if (pm->least_loaded || pm->rebalance)
+	vlib_process_wait_for_event_or_clock (vm, pm->interval);
+      else
+	vlib_process_wait_for_event (vm);
+
+      /* the configuration change just restarts the wait */
+      if (vlib_process_get_events (vm, &event_data) != ~0)
+	{
+	  vec_reset_length (event_data);
+	  continue;
+	}
+
+      ipsec_sa_placement_sample (vm);
+      if (pm->rebalance)
+	ipsec_sa_placement_rebalance (vm);
+    }
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_REGISTER_NODE (ipsec_sa_placement_process_node) = {
+  .function = ipsec_sa_placement_process,
+  .type = VLIB_NODE_TYPE_PROCESS,
+  .name = "ipsec-sa-placement-process",
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+set_ipsec_sa_placement_command_fn (vlib_main_t * vm,
+				   unformat_input_t * input,
+				   vlib_cli_command_t * cmd)
+{
+  ipsec_sa_placement_main_t *pm = &ipsec_sa_placement_main;
+  unformat_input_t _line_input, *line_input = &_line_input;
+  clib_error_t *error = NULL;
+  f64 interval = pm->interval;
+  u32 threshold = pm->threshold;
+  u8 least_loaded = pm->least_loaded;
+  u8 rebalance = pm->rebalance;
+
+  if (!unformat_user (input, unformat_line_input, line_input))
+    return 0;
+
+  while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (line_input, "least-loaded"))
+	least_loaded = 1;
+      else if (unformat (line_input, "random"))
+	least_loaded = 0;
+      else if (unformat (line_input, "rebalance on"))
+	rebalance = 1;
+      else if (unformat (line_input, "rebalance off"))
+	rebalance = 0;
+      else if (unformat (line_input, "interval %f", &interval))
+	;
+      else if (unformat (line_input, "threshold %u", &threshold))
+	;
+      else
+	{
+	  error = clib_error_return (0, "unknown input '%U'",
+				     format_unformat_error, line_input);
+	  goto done;
+	}
+    }
+
+  if (interval < 0.1)
+    {
+      error = clib_error_return (0, "interval should be 0.1 sec at least");
+      goto done;
+    }
+  if (threshold == 0 || threshold > 100)
+    {
+      error = clib_error_return (0, "threshold should be 1-100 percents");
+      goto done;
+    }
+
+  pm->least_loaded = least_loaded;
+  pm->rebalance = rebalance;
+  pm->interval = interval;
+  pm->threshold = threshold;
+  vlib_process_signal_event (vm, ipsec_sa_placement_process_node.index,
+			     IPSEC_SA_PLACEMENT_EVENT_CONFIG, 0);
+
+done:
+  unformat_free (line_input);
+  return error;
+}
+
+/*?
+ * Configures placement of SAs on workers. The 'least-loaded' policy binds
+ * new SA to the least loaded worker, the 'random' one binds it to the worker
+ * that received the first packet of SA. The rebalancer moves SAs from the
+ * most loaded worker to the least loaded one, if the gap between them is
+ * above 'threshold' percents of the most loaded worker. The load is sampled
+ * every 'interval' seconds.
+ *
+ * @cliexpar
+ * @cliexcmd{set ipsec sa-placement least-loaded rebalance on interval 5 threshold 25}
+?*/
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (set_ipsec_sa_placement_command, static) = {
+    .path = "set ipsec sa-placement",
+    .short_help = "set ipsec sa-placement [least-loaded|random] "
+                  "[rebalance on|off] [interval <sec>] [threshold <percent>]",
+    .function = set_ipsec_sa_placement_command_fn,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+show_ipsec_sa_placement_command_fn (vlib_main_t * vm,
+				    unformat_input_t * input,
+				    vlib_cli_command_t * cmd)
+{
+  ipsec_sa_placement_main_t *pm = &ipsec_sa_placement_main;
+  ipsec_main_t *im = &ipsec_main;
+  u32 ti, sai, *n_sas = 0;
+  ipsec_sa_t *sa;
+
+  vlib_cli_output (vm, "policy %s, rebalance %s, interval %.2f sec, "
+		   "threshold %u%%",
+		   pm->least_loaded ? "least-loaded" : "random",
+		   pm->rebalance ? "on" : "off", pm->interval, pm->threshold);
+  vlib_cli_output (vm, "moves %llu, undrained moves %llu",
+		   pm->n_moves, pm->n_undrained_moves);
+
+  vec_validate_init_empty (n_sas, vec_len (pm->worker_load), 0);
+  /* *INDENT-OFF* */
+  pool_foreach (sa, im->sad)
+   {
+    ti = ipsec_sa_placement_thread (sa);
+    if (ti < vec_len (pm->worker_load))
+      n_sas[ti]++;
+  }
+  /* *INDENT-ON* */
+
+  vlib_cli_output (vm, "%-8s%-20s%-16s%-8s", "Thread", "Name", "Load(pps)",
+		   "SAs");
+  for (ti = im->first_worker_index;
+       ti < im->first_worker_index + im->num_workers &&
+       ti < vec_len (pm->worker_load); ti++)
+    vlib_cli_output (vm, "%-8u%-20s%-16.0f%-8u", ti,
+		     vlib_worker_threads[ti].name, pm->worker_load[ti],
+		     n_sas[ti]);
+
+  vlib_cli_output (vm, "\n%-12s%-12s%-8s%-16s", "SA", "SPI", "Thread",
+		   "Rate(pps)");
+  /* *INDENT-OFF* */
+  pool_foreach (sa, im->sad)
+   {
+    sai = sa - im->sad;
+    ti = ipsec_sa_placement_thread (sa);
+    if (ti == ~0)
+      vlib_cli_output (vm, "%-12u0x%-10x%-8s%-16.0f", sa->id, sa->spi,
+#ifdef FLEXIWAN_FEATURE /* ipsec_multi_worker_sa */
+                       sa->multi_worker ? "all" :
+#endif /* FLEXIWAN_FEATURE - ipsec_multi_worker_sa */
+                       "-",
+                       sai < vec_len (pm->sa_rate) ? pm->sa_rate[sai] : 0);
+    else
+      vlib_cli_output (vm, "%-12u0x%-10x%-8u%-16.0f", sa->id, sa->spi, ti,
+                       sai < vec_len (pm->sa_rate) ? pm->sa_rate[sai] : 0);
+  }
+  /* *INDENT-ON* */
+
+  vec_free (n_sas);
+  return NULL;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (show_ipsec_sa_placement_command, static) = {
+    .path = "show ipsec sa-placement",
+    .short_help = "show ipsec sa-placement",
+    .function = show_ipsec_sa_placement_command_fn,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+ipsec_sa_placement_init (vlib_main_t * vm)
+{
+  ipsec_sa_placement_main_t *pm = &ipsec_sa_placement_main;
+  u32 n_threads = vlib_num_workers () + 1;
+
+  pm->least_loaded = 1;
+  pm->rebalance = 1;
+  pm->interval = IPSEC_SA_PLACEMENT_DEFAULT_INTERVAL;
+  pm->threshold = IPSEC_SA_PLACEMENT_DEFAULT_THRESHOLD;
+
+  /* never resized, as the workers read it without barrier */
+  vec_validate_init_empty_aligned (pm->worker_load, n_threads - 1, 0,
+				   CLIB_CACHE_LINE_BYTES);
+  vec_validate_init_empty_aligned (pm->n_placed, n_threads - 1, 0,
+				   CLIB_CACHE_LINE_BYTES);
+  return 0;
+}
+
+VLIB_INIT_FUNCTION (ipsec_sa_placement_init);
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
@@ -23,6 +23,8 @@
  *     length is needed in systems where packet reordering is expected due to
  *     features like QoS. A low window length can lead to the wrong dropping of
  *     out-of-order packets that are outside the window as replayed packets.
+ *     The window is kept as ring bitmap indexed by sequence number, so
+ *     advancing it does not depend on the window length.
  */
 
 #include <vnet/ipsec/ipsec_types_api.h>
@@ -185,10 +187,15 @@ ipsec_sad_flags_encode (const ipsec_sa_t * sa)
 
 #ifdef FLEXIWAN_FEATURE /* configurable_anti_replay_window_len */
 void
-ipsec_replay_window_encode (const uword * in, vl_api_key_t * out)
+ipsec_replay_window_encode (const ipsec_sa_t * sa, vl_api_key_t * out)
 {
-  out->length = vec_len (in) * sizeof(uword);
-  clib_memcpy (out->data, in, out->length);
+  uword *bmp;
+
+  /* The most recent sequence numbers that fit into the message */
+  bmp = ipsec_sa_anti_replay_window_linearize (sa, sizeof (out->data) * 8);
+  out->length = vec_len (bmp) * sizeof(uword);
+  clib_memcpy (out->data, bmp, out->length);
+  clib_bitmap_free (bmp);
 }
 #endif /*FLEXIWAN_FEATURE - configurable_anti_replay_window_len */
 
@@ -22,6 +22,8 @@
  *     length is needed in systems where packet reordering is expected due to
  *     features like QoS. A low window length can lead to the wrong dropping of
  *     out-of-order packets that are outside the window as replayed packets.
+ *     The window is kept as ring bitmap indexed by sequence number, so
+ *     advancing it does not depend on the window length.
  */
 
 /**
@@ -53,7 +55,8 @@ extern ipsec_sa_flags_t ipsec_sa_flags_decode (vl_api_ipsec_sad_flags_t in);
 extern vl_api_ipsec_sad_flags_t ipsec_sad_flags_encode (const ipsec_sa_t *
 							sa);
 #ifdef FLEXIWAN_FEATURE /* configurable_anti_replay_window_len */
-extern void ipsec_replay_window_encode (const uword * in, vl_api_key_t * out);
+extern void ipsec_replay_window_encode (const ipsec_sa_t * sa,
+					vl_api_key_t * out);
 #endif /*FLEXIWAN_FEATURE - configurable_anti_replay_window_len */
 
 #endif
@@ -25,6 +25,10 @@
  *  ACL plugin. Matching ACLs provide the service class and importance
  *  attribute. The classification result is marked in the packet and can be
  *  made use of in other functions like scheduling, policing, marking etc.
+ *
+ *  - vxlan_esp_fastpath: Fused VXLAN + ESP encapsulation of packets sent on
+ *  VXLAN tunnel bound to the outbound ESP tunnel SA.
+ *  See 'set vxlan tunnel esp' CLI.
  */
 
 #include <vnet/vxlan/vxlan.h>
@@ -39,6 +43,9 @@
 #include <vnet/flow/flow.h>
 #include <vnet/udp/udp_local.h>
 #include <vlib/vlib.h>
+#ifdef FLEXIWAN_FEATURE /* vxlan_esp_fastpath */
+#include <vnet/ipsec/ipsec.h>
+#endif /* FLEXIWAN_FEATURE - vxlan_esp_fastpath */
 
 /**
  * @file
@@ -107,6 +114,11 @@ format_vxlan_tunnel (u8 * s, va_list * args)
 #ifdef FLEXIWAN_FEATURE
   s = format(s, "%U", format_fib_gateway, "", &t->rpath, t->fib_pl_index, &t->next_dpo);
 #endif /* FLEXIWAN_FEATURE */
+#ifdef FLEXIWAN_FEATURE /* vxlan_esp_fastpath */
+  if (t->esp_sa_index != INDEX_INVALID)
+    s = format (s, " esp-sa %u",
+		pool_elt_at_index (ipsec_main.sad, t->esp_sa_index)->id);
+#endif /* FLEXIWAN_FEATURE - vxlan_esp_fastpath */
 
   return s;
 }
@@ -469,6 +481,9 @@ int vnet_vxlan_add_del_tunnel
 #define _(x) t->x = a->x;
       foreach_copy_field;
 #undef _
+#ifdef FLEXIWAN_FEATURE /* vxlan_esp_fastpath */
+      t->esp_sa_index = INDEX_INVALID;
+#endif /* FLEXIWAN_FEATURE - vxlan_esp_fastpath */
 
       vxlan_rewrite (t, is_ip6);
       /*
@@ -711,6 +726,9 @@ int vnet_vxlan_add_del_tunnel
 	  mcast_shared_remove (&t->dst);
 	}
 
+#ifdef FLEXIWAN_FEATURE /* vxlan_esp_fastpath */
+      ipsec_sa_unlock (t->esp_sa_index);
+#endif /* FLEXIWAN_FEATURE - vxlan_esp_fastpath */
       vnet_delete_hw_interface (vnm, t->hw_if_index);
       hash_unset (vxm->instance_used, t->user_instance);
 
@@ -1407,6 +1425,156 @@ VLIB_CLI_COMMAND (set_vxlan_default_port_command, static) = {
 /* *INDENT-ON* */
 #endif /* #ifdef FLEXIWAN_FEATURE */
 
+#ifdef FLEXIWAN_FEATURE /* vxlan_esp_fastpath */
+int
+vnet_vxlan_set_esp_sa (u32 sw_if_index, u32 sa_id)
+{
+  vxlan_main_t *vxm = &vxlan_main;
+  vnet_main_t *vnm = vxm->vnet_main;
+  vxlan_tunnel_t *t;
+  ipsec_sa_t *sa;
+  index_t sai;
+  u32 ti;
+
+  ti = vnet_vxlan_get_tunnel_index (sw_if_index);
+  if (ti == ~0)
+    return VNET_API_ERROR_INVALID_SW_IF_INDEX;
+  t = pool_elt_at_index (vxm->tunnels, ti);
+
+  if (sa_id == ~0)
+    {
+      if (t->esp_sa_index == INDEX_INVALID)
+	return 0;
+      vnet_set_interface_output_node (vnm, t->hw_if_index,
+				      vxlan4_encap_node.index);
+      ipsec_sa_unlock (t->esp_sa_index);
+      t->esp_sa_index = INDEX_INVALID;
+      return 0;
+    }
+
+  if (!ip46_address_is_ip4 (&t->dst) ||
+      ip46_address_is_multicast (&t->dst))
+    return VNET_API_ERROR_INVALID_DST_ADDRESS;
+
+  sai = ipsec_sa_find_and_lock (sa_id);
+  if (sai == INDEX_INVALID)
+    return VNET_API_ERROR_NO_SUCH_ENTRY;
+
+  /*
+   * The SA should provide the outer IPv4 header and adjacency of packet,
+   * as vxlan4-esp-encap sends packets to the SA adjacency directly.
+   */
+  sa = pool_elt_at_index (ipsec_main.sad, sai);
+  if (sa->protocol != IPSEC_PROTOCOL_ESP ||
+      !ipsec_sa_is_set_IS_TUNNEL (sa) || ipsec_sa_is_set_IS_TUNNEL_V6 (sa) ||
+      ipsec_sa_is_set_IS_INBOUND (sa))
+    {
+      ipsec_sa_unlock (sai);
+      return VNET_API_ERROR_UNSUPPORTED;
+    }
+
+  ipsec_sa_unlock (t->esp_sa_index);
+  t->esp_sa_index = sai;
+  vnet_set_interface_output_node (vnm, t->hw_if_index,
+				  vxlan4_esp_encap_node.index);
+  return 0;
+}
+
+static clib_error_t *
+set_vxlan_tunnel_esp_command_fn (vlib_main_t * vm,
+				 unformat_input_t * input,
+				 vlib_cli_command_t * cmd)
+{
+  unformat_input_t _line_input, *line_input = &_line_input;
+  vnet_main_t *vnm = vnet_get_main ();
+  clib_error_t *error = NULL;
+  u32 sw_if_index = ~0;
+  u32 sa_id = ~0;
+  u8 is_del = 0;
+  int rv;
+
+  if (!unformat_user (input, unformat_line_input, line_input))
+    return 0;
+
+  while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (line_input, "%U", unformat_vnet_sw_interface,
+		    vnm, &sw_if_index))
+	;
+      else if (unformat (line_input, "sa %u", &sa_id))
+	;
+      else if (unformat (line_input, "del"))
+	is_del = 1;
+      else
+	{
+	  error = clib_error_return (0, "parse error: '%U'",
+				     format_unformat_error, line_input);
+	  goto done;
+	}
+    }
+
+  if (sw_if_index == ~0)
+    {
+      error = clib_error_return (0, "vxlan tunnel interface is not set");
+      goto done;
+    }
+  if (is_del)
+    sa_id = ~0;
+  else if (sa_id == ~0)
+    {
+      error = clib_error_return (0, "sa is not set");
+      goto done;
+    }
+
+  rv = vnet_vxlan_set_esp_sa (sw_if_index, sa_id);
+  switch (rv)
+    {
+    case 0:
+      break;
+    case VNET_API_ERROR_INVALID_SW_IF_INDEX:
+      error = clib_error_return (0, "not a vxlan tunnel interface");
+      break;
+    case VNET_API_ERROR_INVALID_DST_ADDRESS:
+      error = clib_error_return (0, "only unicast IPv4 tunnels are "
+				 "supported");
+      break;
+    case VNET_API_ERROR_NO_SUCH_ENTRY:
+      error = clib_error_return (0, "no such SA %u", sa_id);
+      break;
+    case VNET_API_ERROR_UNSUPPORTED:
+      error = clib_error_return (0, "only outbound ESP SA in IPv4 tunnel "
+				 "mode is supported");
+      break;
+    default:
+      error = clib_error_return (0, "vnet_vxlan_set_esp_sa failed: %d", rv);
+      break;
+    }
+
+done:
+  unformat_free (line_input);
+  return error;
+}
+
+/*?
+ * Binds the VXLAN tunnel to the outbound ESP tunnel SA. The packets sent
+ * on the tunnel are encapsulated into VXLAN and encrypted by the single
+ * vxlan4-esp-encap node and go out through the SA adjacency. Use it for
+ * the tunnel that is routed through the IPsec tunnel of the same SA only,
+ * as the VXLAN underlay route is not looked at.
+ *
+ * @cliexpar
+ * @cliexcmd{set vxlan tunnel esp vxlan_tunnel0 sa 10}
+ * @cliexcmd{set vxlan tunnel esp vxlan_tunnel0 del}
+?*/
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (set_vxlan_tunnel_esp_command, static) = {
+  .path = "set vxlan tunnel esp",
+  .function = set_vxlan_tunnel_esp_command_fn,
+  .short_help = "set vxlan tunnel esp <interface> sa <id> | del",
+};
+/* *INDENT-ON* */
+#endif /* FLEXIWAN_FEATURE - vxlan_esp_fastpath */
+
 #define VXLAN_HASH_NUM_BUCKETS (2 * 1024)
 #define VXLAN_HASH_MEMORY_SIZE (1 << 20)
 
@@ -30,6 +30,11 @@
  *  attribute. The classification result is marked in the packet and can be
  *  made use of in other functions like scheduling, policing, marking etc.
  *
+ *  - vxlan_esp_fastpath: Fused VXLAN + ESP encapsulation of packets sent on
+ *  VXLAN tunnel bound to the outbound ESP tunnel SA. The VXLAN and ESP headers
+ *  are built by one node and the packets go directly to the SA adjacency.
+ *  See vxlan4_esp_encap_node.
+ *
  *  List of fixes made for FlexiWAN (demoted by FLEXIWAN_FIX flag):
  *  - For none vxlan packet received on port 4789, add ipx_punt node to next_nodes.
  */
@@ -57,6 +62,11 @@
 #ifdef FLEXIWAN_FEATURE
 #include <vnet/fib/fib_path_list.h>
 #endif
+#ifdef FLEXIWAN_FEATURE /* vxlan_esp_fastpath */
+#include <vnet/interface_output.h>
+#include <vnet/adj/rewrite.h>
+#include <vnet/qos/qos_types.h>
+#endif /* FLEXIWAN_FEATURE - vxlan_esp_fastpath */
 
 /* *INDENT-OFF* */
 typedef CLIB_PACKED (struct {
@@ -172,6 +182,10 @@ typedef struct
 #ifdef FLEXIWAN_FEATURE         /* acl_based_classification */
   u32 qos_id;
 #endif /* FLEXIWAN_FEATURE - acl_based_classification */
+#ifdef FLEXIWAN_FEATURE /* vxlan_esp_fastpath */
+  /* outbound ESP SA the tunnel packets are encrypted with, or INDEX_INVALID */
+  u32 esp_sa_index;
+#endif /* FLEXIWAN_FEATURE - vxlan_esp_fastpath */
     VNET_DECLARE_REWRITE;
 } vxlan_tunnel_t;
 
@@ -248,6 +262,9 @@ extern vlib_node_registration_t vxlan6_input_node;
 extern vlib_node_registration_t vxlan4_encap_node;
 extern vlib_node_registration_t vxlan6_encap_node;
 extern vlib_node_registration_t vxlan4_flow_input_node;
+#ifdef FLEXIWAN_FEATURE /* vxlan_esp_fastpath */
+extern vlib_node_registration_t vxlan4_esp_encap_node;
+#endif /* FLEXIWAN_FEATURE - vxlan_esp_fastpath */
 
 u8 *format_vxlan_encap_trace (u8 * s, va_list * args);
 
@@ -286,6 +303,78 @@ int vnet_vxlan_add_del_rx_flow (u32 hw_if_index, u32 t_imdex, int is_add);
 
 u32 vnet_vxlan_get_tunnel_index (u32 sw_if_index);
 
+#ifdef FLEXIWAN_FEATURE /* vxlan_esp_fastpath */
+/**
+ * Binds the IPv4 VXLAN tunnel to the outbound ESP tunnel SA, so the tunnel
+ * packets are encrypted by the fused vxlan4-esp-encap node and sent directly
+ * to the SA adjacency. The VXLAN underlay route is not used then.
+ *
+ * @param sw_if_index   the VXLAN tunnel interface.
+ * @param sa_id         the SA to bind the tunnel to, ~0 to unbind it.
+ */
+int vnet_vxlan_set_esp_sa (u32 sw_if_index, u32 sa_id);
+
+/*
+ * Builds the IP4/UDP/VXLAN header of packet, as vxlan4-encap does without
+ * checksum offload. The packet is encrypted right after, so the inner
+ * checksums to be offloaded are calculated here too.
+ * Returns the packet length.
+ */
+always_inline u32
+vxlan4_esp_encap_rewrite (vlib_main_t * vm, vxlan_main_t * vxm,
+			  vxlan_tunnel_t * t, vlib_buffer_t * b)
+{
+  u32 const inner_packet_csum_offload_flags =
+    VNET_BUFFER_F_OFFLOAD_IP_CKSUM | VNET_BUFFER_F_OFFLOAD_UDP_CKSUM |
+    VNET_BUFFER_F_OFFLOAD_TCP_CKSUM;
+  u32 const inner_packet_removed_flags =
+    VNET_BUFFER_F_IS_IP4 | VNET_BUFFER_F_IS_IP6 |
+    VNET_BUFFER_F_L2_HDR_OFFSET_VALID | VNET_BUFFER_F_L3_HDR_OFFSET_VALID |
+    VNET_BUFFER_F_L4_HDR_OFFSET_VALID;
+  ip4_vxlan_header_t *hdr;
+  qos_bits_t tos = 0;
+  u32 flow_hash, len;
+  ip_csum_t sum;
+
+  if (PREDICT_FALSE (b->flags & inner_packet_csum_offload_flags))
+    {
+      vnet_calc_checksums_inline (vm, b, b->flags & VNET_BUFFER_F_IS_IP4,
+				  b->flags & VNET_BUFFER_F_IS_IP6);
+      b->flags &= ~inner_packet_removed_flags;
+    }
+
+  flow_hash = vnet_l2_compute_flow_hash (b);
+
+  vnet_rewrite_one_header (*t, vlib_buffer_get_current (b),
+			   sizeof (ip4_vxlan_header_t));
+  vlib_buffer_advance (b, -(word) sizeof (ip4_vxlan_header_t));
+  hdr = vlib_buffer_get_current (b);
+  len = vlib_buffer_length_in_chain (vm, b);
+
+  hdr->ip4.length = clib_host_to_net_u16 (len);
+  if (PREDICT_FALSE (b->flags & VNET_BUFFER_F_QOS_DATA_VALID))
+    {
+      tos = vnet_buffer2 (b)->qos.bits;
+      hdr->ip4.tos = tos;
+    }
+  sum = ip_csum_update (hdr->ip4.checksum, 0, hdr->ip4.length, ip4_header_t,
+			length /* changed member */ );
+  if (PREDICT_FALSE (tos))
+    sum = ip_csum_update (sum, 0, tos, ip4_header_t, tos /* changed member */ );
+  hdr->ip4.checksum = ip_csum_fold (sum);
+
+  hdr->udp.length = clib_host_to_net_u16 (len - sizeof (ip4_header_t));
+  hdr->udp.src_port = clib_host_to_net_u16 (vxm->vxlan_port);
+  hdr->udp.dst_port = clib_host_to_net_u16 (t->dest_port);
+
+  /* see vxlan4-encap */
+  vnet_buffer (b)->escape_feature_groups |= VNET_FEATURE_GROUP_NAT;
+  vnet_buffer2 (b)->qos.id = t->qos_id;
+  vnet_buffer (b)->ip.flow_hash = flow_hash;
+  return len;
+}
+#endif /* FLEXIWAN_FEATURE - vxlan_esp_fastpath */
+
 #ifdef FLEXIWAN_FEATURE
 typedef vxlan4_tunnel_key_t last_tunnel_cache4;
 
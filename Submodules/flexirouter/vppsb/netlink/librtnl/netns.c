@@ -23,9 +23,26 @@
  *     duplicated entries in VPP FIB and out of think between VPP FIB and kernel.
  *   - fix handling RTM_NEWNEIGH messages to prevent duplicated entries in VPP
  *   - when link goes down, routes are deleted on linux side, we need to delete them on VPP side too
+ *   - RTA_MULTIPATH next hops are allocated on demand, so routes without
+ *     multipath do not take 8KB each.
+ *
+ *  List of features made for FlexiWAN (denoted by FLEXIWAN_FEATURE flag):
+ *   - netns_hash_index: links, routes, addresses and neighbors are indexed by
+ *     hashes keyed on the values that identify an entry, so the lookup done
+ *     for every netlink message does not walk the whole pool. Mirroring of a
+ *     full BGP table is not quadratic anymore.
+ *   - rtnl_overflow_resync: after the netlink socket overflow the dumped
+ *     objects are compared against the database. Only new, changed and
+ *     vanished objects are notified to subscribers, the rest of the data
+ *     plane state is left untouched. Only the families that were dumped
+ *     are checked for vanished objects. The dump interrupted by a change
+ *     in the kernel (NLM_F_DUMP_INTR) is repeated.
  */
 
 #include <librtnl/netns.h>
+#ifdef FLEXIWAN_FEATURE /* netns_hash_index */
+#include <vppinfra/mhash.h>
+#endif /* FLEXIWAN_FEATURE */
 
 #include <vnet/ip/format.h>
 #include <vnet/ethernet/ethernet.h>
@@ -258,8 +275,58 @@ typedef struct {
   netns_t netns;
   u32 rtnl_handle;
   u32 subscriber_count;
+#ifdef FLEXIWAN_FEATURE /* netns_hash_index */
+  uword *link_by_ifindex;
+  mhash_t route_by_key;
+  mhash_t addr_by_key;
+  mhash_t neigh_by_key;
+#endif /* FLEXIWAN_FEATURE */
+#ifdef FLEXIWAN_FEATURE /* rtnl_overflow_resync */
+  f64 resync_start;
+  u8 resync_active;
+  u8 resync_dirty;  /* the kernel flagged the dump as interrupted */
+  u32 resync_n_added;
+  u32 resync_n_changed;
+  u32 resync_n_removed;
+#endif /* FLEXIWAN_FEATURE */
 } netns_p;
 
+#ifdef FLEXIWAN_FEATURE /* netns_hash_index */
+/*
+ * The hash keys hold exactly the values compared by ns_get_xxx() functions:
+ * the masked fields of the netlink message header and the 'unique'
+ * attributes of the mapping tables. The keys are zeroed before they are
+ * filled, so the padding does not break the hash.
+ */
+typedef struct {
+  u8 family;
+  u8 dst_len;
+  u8 src_len;
+  u8 table;
+  u8 protocol;
+  u8 type;
+  u16 pad;
+  u32 priority;
+  u8 dst[16];
+  struct mpls_label encap[MPLS_STACK_DEPTH];
+} ns_route_key_t;
+
+typedef struct {
+  u8 family;
+  u8 prefixlen;
+  u16 pad;
+  u8 addr[16];
+  u8 local[16];
+} ns_addr_key_t;
+
+typedef struct {
+  u8 family;
+  u8 pad[3];
+  i32 ifindex;
+  u8 dst[16];
+} ns_neigh_key_t;
+#endif /* FLEXIWAN_FEATURE */
+
 typedef struct {
   netns_p *netnss;
   netns_handle_t *handles;
@@ -315,6 +382,25 @@ rtnl_entry_check(struct rtattr *rtas[],
 }
 #endif
 
+#ifdef FLEXIWAN_FIX
+static void
+ns_multipath_free(multipath_t *multipath)
+{
+  if (multipath->nhops)
+    clib_mem_free(multipath->nhops);
+  multipath->nhops = NULL;
+  multipath->length = 0;
+}
+#endif /* FLEXIWAN_FIX */
+
+void
+rtnl_ns_route_free(ns_route_t *route)
+{
+#ifdef FLEXIWAN_FIX
+  ns_multipath_free(&route->multipath);
+#endif /* FLEXIWAN_FIX */
+}
+
 /*
  * Check if the provided entry matches the parsed and unique rtas
  */
@@ -333,7 +419,8 @@ rtnl_entry_match(void *entry,
     if (map->type == RTA_MULTIPATH && rta) {
         multipath_t *multipath = (multipath_t*)(entry + map->offset);
 
-        if (memcmp(RTA_DATA(rta), multipath->nhops, rta_len))
+        if (multipath->length != rta_len ||
+            memcmp(RTA_DATA(rta), multipath->nhops, rta_len))
           return 0;
         else
           return 1;
@@ -373,12 +460,22 @@ rtnl_entry_set(void *entry,
       memcpy(entry + map->offset, RTA_DATA(rta), map->size);
       memset(entry + map->offset + map->size, 0, 0);
     }
-    else if (map->type == RTA_MULTIPATH && rta) {
+    else if (map->type == RTA_MULTIPATH) {
         multipath_t *multipath = (multipath_t*)(entry + map->offset);
-        if (RTA_PAYLOAD(rta) > sizeof(multipath->nhops)) {
-          clib_warning("rta (type=%d len=%d) too long (max %d)", rta->rta_type, rta->rta_len, map->size);
+        if (!rta) {
+          if (init)
+            ns_multipath_free(multipath);
+          continue;
+        }
+        if (RTA_PAYLOAD(rta) > MULTIPATH_NEXTHOP_MAX * sizeof(struct rtnexthop)) {
+          clib_warning("rta (type=%d len=%d) too long (max %d)", rta->rta_type, rta->rta_len,
+                       (int)(MULTIPATH_NEXTHOP_MAX * sizeof(struct rtnexthop)));
           return -1;
         }
+        if (multipath->length != RTA_PAYLOAD(rta)) {
+          ns_multipath_free(multipath);
+          multipath->nhops = clib_mem_alloc(RTA_PAYLOAD(rta));
+        }
         memcpy(multipath->nhops, RTA_DATA(rta), RTA_PAYLOAD(rta));
         multipath->length = RTA_PAYLOAD(rta);
       }
@@ -420,15 +517,176 @@ mask_match(void *a, void *b, void *mask, size_t len)
   return 1;
 }
 
+#ifdef FLEXIWAN_FEATURE /* netns_hash_index */
+static void
+ns_index_init(netns_p *ns)
+{
+  /* mhash_init() frees the old vectors, netns_p comes from pool non-zeroed */
+  memset(&ns->route_by_key, 0, sizeof(ns->route_by_key));
+  memset(&ns->addr_by_key, 0, sizeof(ns->addr_by_key));
+  memset(&ns->neigh_by_key, 0, sizeof(ns->neigh_by_key));
+  ns->link_by_ifindex = hash_create(0, sizeof(uword));
+  mhash_init(&ns->route_by_key, sizeof(uword), sizeof(ns_route_key_t));
+  mhash_init(&ns->addr_by_key, sizeof(uword), sizeof(ns_addr_key_t));
+  mhash_init(&ns->neigh_by_key, sizeof(uword), sizeof(ns_neigh_key_t));
+}
+
+static void
+ns_index_free(netns_p *ns)
+{
+  hash_free(ns->link_by_ifindex);
+  mhash_free(&ns->route_by_key);
+  mhash_free(&ns->addr_by_key);
+  mhash_free(&ns->neigh_by_key);
+}
+
+/*
+ * Copies the attribute payload into the zeroed key field,
+ * the same way rtnl_entry_set() stores it in the entry.
+ */
+static int
+ns_key_set_rta(void *field, size_t size, struct rtattr *rta)
+{
+  if (!rta)
+    return 0;
+  if (RTA_PAYLOAD(rta) > size)
+    return -1;
+  memcpy(field, RTA_DATA(rta), RTA_PAYLOAD(rta));
+  return 0;
+}
+
+static void
+ns_route_key_from_entry(ns_route_key_t *key, ns_route_t *route)
+{
+  memset(key, 0, sizeof(*key));
+  key->family = route->rtm.rtm_family;
+  key->dst_len = route->rtm.rtm_dst_len;
+  key->src_len = route->rtm.rtm_src_len;
+  key->table = route->rtm.rtm_table;
+  key->protocol = route->rtm.rtm_protocol;
+  key->type = route->rtm.rtm_type;
+  key->priority = route->priority;
+  memcpy(key->dst, route->dst, sizeof(key->dst));
+  memcpy(key->encap, route->encap, sizeof(key->encap));
+}
+
+static int
+ns_route_key_from_msg(ns_route_key_t *key, struct rtmsg *rtm, struct rtattr *rtas[])
+{
+  struct rtattr *rta;
+
+  memset(key, 0, sizeof(*key));
+  key->family = rtm->rtm_family;
+  key->dst_len = rtm->rtm_dst_len;
+  key->src_len = rtm->rtm_src_len;
+  key->table = rtm->rtm_table;
+  key->protocol = rtm->rtm_protocol;
+  key->type = rtm->rtm_type;
+  if (ns_key_set_rta(key->dst, sizeof(key->dst), rtas[RTA_DST]) ||
+      ns_key_set_rta(&key->priority, sizeof(key->priority), rtas[RTA_PRIORITY]))
+    return -1;
+
+  /* RTA_ENCAP keeps the MPLS labels in the nested attribute */
+  if ((rta = rtas[RTA_ENCAP])) {
+    rta = (struct rtattr*)RTA_DATA(rta);
+    if (RTA_PAYLOAD(rta) > sizeof(key->encap))
+      return -1;
+    memcpy(key->encap, RTA_DATA(rta), sizeof(key->encap));
+  }
+  return 0;
+}
+
+static void
+ns_route_index_add(netns_p *ns, ns_route_t *route)
+{
+  ns_route_key_t key;
+  ns_route_key_from_entry(&key, route);
+  mhash_set(&ns->route_by_key, &key, route - ns->netns.routes, NULL);
+}
+
+static void
+ns_route_index_del(netns_p *ns, ns_route_t *route)
+{
+  ns_route_key_t key;
+  uword *p;
+  ns_route_key_from_entry(&key, route);
+  p = mhash_get(&ns->route_by_key, &key);
+  if (p && p[0] == route - ns->netns.routes)
+    mhash_unset(&ns->route_by_key, &key, NULL);
+}
+
+static void
+ns_addr_key_from_entry(ns_addr_key_t *key, ns_addr_t *addr)
+{
+  memset(key, 0, sizeof(*key));
+  key->family = addr->ifaddr.ifa_family;
+  key->prefixlen = addr->ifaddr.ifa_prefixlen;
+  memcpy(key->addr, addr->addr, sizeof(key->addr));
+  memcpy(key->local, addr->local, sizeof(key->local));
+}
+
+static void
+ns_addr_index_add(netns_p *ns, ns_addr_t *addr)
+{
+  ns_addr_key_t key;
+  ns_addr_key_from_entry(&key, addr);
+  mhash_set(&ns->addr_by_key, &key, addr - ns->netns.addresses, NULL);
+}
+
+static void
+ns_addr_index_del(netns_p *ns, ns_addr_t *addr)
+{
+  ns_addr_key_t key;
+  uword *p;
+  ns_addr_key_from_entry(&key, addr);
+  p = mhash_get(&ns->addr_by_key, &key);
+  if (p && p[0] == addr - ns->netns.addresses)
+    mhash_unset(&ns->addr_by_key, &key, NULL);
+}
+
+static void
+ns_neigh_key_from_entry(ns_neigh_key_t *key, ns_neigh_t *neigh)
+{
+  memset(key, 0, sizeof(*key));
+  key->family = neigh->nd.ndm_family;
+  key->ifindex = neigh->nd.ndm_ifindex;
+  memcpy(key->dst, neigh->dst, sizeof(key->dst));
+}
+
+static void
+ns_neigh_index_add(netns_p *ns, ns_neigh_t *neigh)
+{
+  ns_neigh_key_t key;
+  ns_neigh_key_from_entry(&key, neigh);
+  mhash_set(&ns->neigh_by_key, &key, neigh - ns->netns.neighbors, NULL);
+}
+
+static void
+ns_neigh_index_del(netns_p *ns, ns_neigh_t *neigh)
+{
+  ns_neigh_key_t key;
+  uword *p;
+  ns_neigh_key_from_entry(&key, neigh);
+  p = mhash_get(&ns->neigh_by_key, &key);
+  if (p && p[0] == neigh - ns->netns.neighbors)
+    mhash_unset(&ns->neigh_by_key, &key, NULL);
+}
+#endif /* FLEXIWAN_FEATURE */
+
 static ns_link_t *
 ns_get_link(netns_p *ns, struct ifinfomsg *ifi, struct rtattr *rtas[])
 {
+#ifdef FLEXIWAN_FEATURE /* netns_hash_index */
+  uword *p = hash_get(ns->link_by_ifindex, ifi->ifi_index);
+  return p ? pool_elt_at_index(ns->netns.links, p[0]) : NULL;
+#else /* FLEXIWAN_FEATURE */
   ns_link_t *link;
   pool_foreach(link, ns->netns.links) {
       if(ifi->ifi_index == link->ifi.ifi_index)
         return link;
     };
   return NULL;
+#endif /* FLEXIWAN_FEATURE */
 }
 
 static int
@@ -462,8 +720,12 @@ ns_rcv_link(netns_p *ns, struct nlmsghdr *hdr)
     ns_route_t *route;
     pool_foreach(route, ns->netns.routes) {
         if (route->oif == ifi->ifi_index) {
+#ifdef FLEXIWAN_FEATURE /* netns_hash_index */
+          ns_route_index_del(ns, route);
+#endif /* FLEXIWAN_FEATURE */
           pool_put(ns->netns.routes, route);
           netns_notify(ns, route, NETNS_TYPE_ROUTE, NETNS_F_DEL);
+          rtnl_ns_route_free(route);
         };
     };
   }
@@ -474,6 +736,9 @@ ns_rcv_link(netns_p *ns, struct nlmsghdr *hdr)
   if (hdr->nlmsg_type == RTM_DELLINK) {
     if (!link)
       return -3;
+#ifdef FLEXIWAN_FEATURE /* netns_hash_index */
+    hash_unset(ns->link_by_ifindex, link->ifi.ifi_index);
+#endif /* FLEXIWAN_FEATURE */
     pool_put(ns->netns.links, link);
     netns_notify(ns, link, NETNS_TYPE_LINK, NETNS_F_DEL);
     return 0;
@@ -487,6 +752,9 @@ ns_rcv_link(netns_p *ns, struct nlmsghdr *hdr)
   }
 
   link->ifi = *ifi;
+#ifdef FLEXIWAN_FEATURE /* netns_hash_index */
+  hash_set(ns->link_by_ifindex, ifi->ifi_index, link - ns->netns.links);
+#endif /* FLEXIWAN_FEATURE */
   link->last_updated = vlib_time_now(vlib_get_main());
   netns_notify(ns, link, NETNS_TYPE_LINK, NETNS_F_ADD);
   return 0;
@@ -507,6 +775,23 @@ ns_get_route(netns_p *ns, struct rtmsg *rtm, struct rtattr *rtas[], rtnl_mapping
     .rtm_type = 0xff
   };
 
+#ifdef FLEXIWAN_FEATURE /* netns_hash_index */
+  /*
+   * The hash is keyed on the default mapping. The strict mapping is used
+   * only for new static routes that were not found by the default one,
+   * see ns_rcv_route(), so it still walks the pool.
+   */
+  if (map == NULL) {
+    ns_route_key_t key;
+    uword *p;
+
+    if (ns_route_key_from_msg(&key, rtm, rtas))
+      return NULL;
+    p = mhash_get(&ns->route_by_key, &key);
+    return p ? pool_elt_at_index(ns->netns.routes, p[0]) : NULL;
+  }
+#endif /* FLEXIWAN_FEATURE */
+
   if (map == NULL)
     map = ns_routemap;
 
@@ -547,8 +832,12 @@ ns_rcv_route(netns_p *ns, struct nlmsghdr *hdr)
       return -3;
     }
 
+#ifdef FLEXIWAN_FEATURE /* netns_hash_index */
+    ns_route_index_del(ns, route);
+#endif /* FLEXIWAN_FEATURE */
     pool_put(ns->netns.routes, route);
     netns_notify(ns, route, NETNS_TYPE_ROUTE, NETNS_F_DEL);
+    rtnl_ns_route_free(route);
     return 0;
   }
 
@@ -558,7 +847,11 @@ ns_rcv_route(netns_p *ns, struct nlmsghdr *hdr)
     if (hdr->nlmsg_flags & NLM_F_REPLACE)
     {
       netns_notify(ns, route, NETNS_TYPE_ROUTE, NETNS_F_DEL);
+#ifdef FLEXIWAN_FEATURE /* netns_hash_index */
+      ns_route_index_del(ns, route);
+#endif /* FLEXIWAN_FEATURE */
       pool_put(ns->netns.routes, route);
+      rtnl_ns_route_free(route);
       route = 0;
     }
     else
@@ -591,7 +884,11 @@ ns_rcv_route(netns_p *ns, struct nlmsghdr *hdr)
     if (route)
     {
       netns_notify(ns, route, NETNS_TYPE_ROUTE, NETNS_F_DEL);
+#ifdef FLEXIWAN_FEATURE /* netns_hash_index */
+      ns_route_index_del(ns, route);
+#endif /* FLEXIWAN_FEATURE */
       pool_put(ns->netns.routes, route);
+      rtnl_ns_route_free(route);
       route = 0;
     }
   }
@@ -607,6 +904,9 @@ ns_rcv_route(netns_p *ns, struct nlmsghdr *hdr)
   }
 
   route->rtm = *rtm;
+#ifdef FLEXIWAN_FEATURE /* netns_hash_index */
+  ns_route_index_add(ns, route);
+#endif /* FLEXIWAN_FEATURE */
   route->last_updated = vlib_time_now(vlib_get_main());
   netns_notify(ns, route, NETNS_TYPE_ROUTE, NETNS_F_ADD);
   return 0;
@@ -615,6 +915,19 @@ ns_rcv_route(netns_p *ns, struct nlmsghdr *hdr)
 static ns_addr_t *
 ns_get_addr(netns_p *ns, struct ifaddrmsg *ifaddr, struct rtattr *rtas[])
 {
+#ifdef FLEXIWAN_FEATURE /* netns_hash_index */
+  ns_addr_key_t key;
+  uword *p;
+
+  memset(&key, 0, sizeof(key));
+  key.family = ifaddr->ifa_family;
+  key.prefixlen = ifaddr->ifa_prefixlen;
+  if (ns_key_set_rta(key.addr, sizeof(key.addr), rtas[IFA_ADDRESS]) ||
+      ns_key_set_rta(key.local, sizeof(key.local), rtas[IFA_LOCAL]))
+    return NULL;
+  p = mhash_get(&ns->addr_by_key, &key);
+  return p ? pool_elt_at_index(ns->netns.addresses, p[0]) : NULL;
+#else /* FLEXIWAN_FEATURE */
   ns_addr_t *addr;
 
   //This describes the values which uniquely identify a route
@@ -629,6 +942,7 @@ ns_get_addr(netns_p *ns, struct ifaddrmsg *ifaddr, struct rtattr *rtas[])
         return addr;
     };
   return NULL;
+#endif /* FLEXIWAN_FEATURE */
 }
 
 static int
@@ -656,6 +970,9 @@ ns_rcv_addr(netns_p *ns, struct nlmsghdr *hdr)
   if (hdr->nlmsg_type == RTM_DELADDR) {
     if (!addr)
       return -3;
+#ifdef FLEXIWAN_FEATURE /* netns_hash_index */
+    ns_addr_index_del(ns, addr);
+#endif /* FLEXIWAN_FEATURE */
     pool_put(ns->netns.addresses, addr);
     netns_notify(ns, addr, NETNS_TYPE_ADDR, NETNS_F_DEL);
     return 0;
@@ -670,6 +987,9 @@ ns_rcv_addr(netns_p *ns, struct nlmsghdr *hdr)
   }
 
   addr->ifaddr = *ifaddr;
+#ifdef FLEXIWAN_FEATURE /* netns_hash_index */
+  ns_addr_index_add(ns, addr);
+#endif /* FLEXIWAN_FEATURE */
   addr->last_updated = vlib_time_now(vlib_get_main());
   netns_notify(ns, addr, NETNS_TYPE_ADDR, NETNS_F_ADD);
   return 0;
@@ -678,6 +998,18 @@ ns_rcv_addr(netns_p *ns, struct nlmsghdr *hdr)
 static ns_neigh_t *
 ns_get_neigh(netns_p *ns, struct ndmsg *nd, struct rtattr *rtas[])
 {
+#ifdef FLEXIWAN_FEATURE /* netns_hash_index */
+  ns_neigh_key_t key;
+  uword *p;
+
+  memset(&key, 0, sizeof(key));
+  key.family = nd->ndm_family;
+  key.ifindex = nd->ndm_ifindex;
+  if (ns_key_set_rta(key.dst, sizeof(key.dst), rtas[NDA_DST]))
+    return NULL;
+  p = mhash_get(&ns->neigh_by_key, &key);
+  return p ? pool_elt_at_index(ns->netns.neighbors, p[0]) : NULL;
+#else /* FLEXIWAN_FEATURE */
   ns_neigh_t *neigh;
 
   //This describes the values which uniquely identify a route
@@ -692,6 +1024,7 @@ ns_get_neigh(netns_p *ns, struct ndmsg *nd, struct rtattr *rtas[])
         return neigh;
     };
   return NULL;
+#endif /* FLEXIWAN_FEATURE */
 }
 
 static int
@@ -719,6 +1052,9 @@ ns_rcv_neigh(netns_p *ns, struct nlmsghdr *hdr)
   if (hdr->nlmsg_type == RTM_DELNEIGH) {
     if (!neigh)
       return -3;
+#ifdef FLEXIWAN_FEATURE /* netns_hash_index */
+    ns_neigh_index_del(ns, neigh);
+#endif /* FLEXIWAN_FEATURE */
     pool_put(ns->netns.neighbors, neigh);
     netns_notify(ns, neigh, NETNS_TYPE_NEIGH, NETNS_F_DEL);
     return 0;
@@ -740,11 +1076,288 @@ ns_rcv_neigh(netns_p *ns, struct nlmsghdr *hdr)
   }
 
   neigh->nd = *nd;
+#ifdef FLEXIWAN_FEATURE /* netns_hash_index */
+  ns_neigh_index_add(ns, neigh);
+#endif /* FLEXIWAN_FEATURE */
   neigh->last_updated = vlib_time_now(vlib_get_main());
   netns_notify(ns, neigh, NETNS_TYPE_NEIGH, NETNS_F_ADD);
   return 0;
 }
 
+#ifdef FLEXIWAN_FEATURE /* rtnl_overflow_resync */
+/*
+ * The objects updated after the resync start reflect the live notification,
+ * which is newer than the dump. The objects confirmed by the dump are only
+ * touched, so ns_resync_sweep() does not remove them.
+ */
+static int
+ns_route_equal(ns_route_t *a, ns_route_t *b)
+{
+  return !memcmp(a, b, offsetof(ns_route_t, cacheinfo)) &&
+#ifdef FLEXIWAN_FIX
+    a->multipath.length == b->multipath.length &&
+    (!a->multipath.length ||
+     !memcmp(a->multipath.nhops, b->multipath.nhops, a->multipath.length)) &&
+#endif /* FLEXIWAN_FIX */
+    !memcmp(a->encap, b->encap, sizeof(a->encap));
+}
+
+static int
+ns_resync_route(netns_p *ns, struct nlmsghdr *hdr, f64 now)
+{
+  static ns_route_t dumped;  /* its multipath is freed by the next call */
+  ns_route_t *route;
+  struct rtmsg *rtm;
+  struct rtattr *rtas[RTA_MAX + 1] = {};
+
+  if (hdr->nlmsg_len - NLMSG_ALIGN(sizeof(*hdr)) < sizeof(*rtm))
+    return -1;
+
+  rtm = NLMSG_DATA(hdr);
+  rtnl_ns_route_free(&dumped);  /* free the previous dump */
+  if (rtnl_parse_rtattr(rtas, RTA_MAX, RTM_RTA(rtm), RTM_PAYLOAD(hdr)) ||
+      rtnl_msg_to_ns_route(hdr, &dumped))
+    return -2;
+
+  route = ns_get_route(ns, rtm, rtas, NULL /*map*/);
+  if (route) {
+    if (route->last_updated >= ns->resync_start)
+      return 0;
+    if (ns_route_equal(route, &dumped)) {
+      route->last_updated = now;
+      return 0;
+    }
+    netns_notify(ns, route, NETNS_TYPE_ROUTE, NETNS_F_DEL);
+    ns_route_index_del(ns, route);
+    pool_put(ns->netns.routes, route);
+    rtnl_ns_route_free(route);
+    ns->resync_n_changed++;
+  } else {
+    ns->resync_n_added++;
+  }
+  return ns_rcv_route(ns, hdr);
+}
+
+static int
+ns_resync_link(netns_p *ns, struct nlmsghdr *hdr, f64 now)
+{
+  ns_link_t *link, dumped;
+  struct ifinfomsg *ifi;
+  struct rtattr *rtas[IFLA_MAX + 1] = {};
+
+  if (hdr->nlmsg_len - NLMSG_ALIGN(sizeof(*hdr)) < sizeof(*ifi))
+    return -1;
+
+  ifi = NLMSG_DATA(hdr);
+  if (rtnl_parse_rtattr(rtas, IFLA_MAX, IFLA_RTA(ifi), IFLA_PAYLOAD(hdr)))
+    return -2;
+
+  link = ns_get_link(ns, ifi, rtas);
+  if (link) {
+    if (link->last_updated >= ns->resync_start)
+      return 0;
+    rtnl_entry_set(&dumped, rtas, ns_ifmap, 1);
+    if (link->ifi.ifi_flags == ifi->ifi_flags &&
+        !memcmp(link->hwaddr, dumped.hwaddr,
+                offsetof(ns_link_t, stats) - offsetof(ns_link_t, hwaddr))) {
+      link->last_updated = now;
+      return 0;
+    }
+    /* The link is updated in place, as on the live notification */
+    ns->resync_n_changed++;
+  } else {
+    ns->resync_n_added++;
+  }
+  return ns_rcv_link(ns, hdr);
+}
+
+static int
+ns_resync_addr(netns_p *ns, struct nlmsghdr *hdr, f64 now)
+{
+  ns_addr_t *addr;
+  struct ifaddrmsg *ifaddr;
+  struct rtattr *rtas[IFA_MAX + 1] = {};
+
+  if (hdr->nlmsg_len - NLMSG_ALIGN(sizeof(*hdr)) < sizeof(*ifaddr))
+    return -1;
+
+  ifaddr = NLMSG_DATA(hdr);
+  if (rtnl_parse_rtattr(rtas, IFA_MAX, IFA_RTA(ifaddr), IFA_PAYLOAD(hdr)))
+    return -2;
+
+  addr = ns_get_addr(ns, ifaddr, rtas);
+  if (addr) {
+    if (addr->last_updated >= ns->resync_start)
+      return 0;
+    if (addr->ifaddr.ifa_index == ifaddr->ifa_index) {
+      addr->last_updated = now;
+      return 0;
+    }
+    /* The address moved to another interface */
+    netns_notify(ns, addr, NETNS_TYPE_ADDR, NETNS_F_DEL);
+    ns_addr_index_del(ns, addr);
+    pool_put(ns->netns.addresses, addr);
+    ns->resync_n_changed++;
+  } else {
+    ns->resync_n_added++;
+  }
+  return ns_rcv_addr(ns, hdr);
+}
+
+static int
+ns_resync_neigh(netns_p *ns, struct nlmsghdr *hdr, f64 now)
+{
+  ns_neigh_t *neigh, dumped;
+  struct ndmsg *nd;
+  struct rtattr *rtas[NDA_MAX + 1] = {};
+
+  if (hdr->nlmsg_len - NLMSG_ALIGN(sizeof(*hdr)) < sizeof(*nd))
+    return -1;
+
+  nd = NLMSG_DATA(hdr);
+  if (rtnl_parse_rtattr(rtas, NDA_MAX, NDA_RTA(nd), NDA_PAYLOAD(hdr)))
+    return -2;
+
+  neigh = ns_get_neigh(ns, nd, rtas);
+  if (neigh) {
+    if (neigh->last_updated >= ns->resync_start)
+      return 0;
+    rtnl_entry_set(&dumped, rtas, ns_neighmap, 1);
+    if (memcmp(neigh->lladdr, dumped.lladdr, sizeof(neigh->lladdr))) {
+      /* ns_rcv_neigh() ignores the new mac if the state is the same */
+      netns_notify(ns, neigh, NETNS_TYPE_NEIGH, NETNS_F_DEL);
+      ns_neigh_index_del(ns, neigh);
+      pool_put(ns->netns.neighbors, neigh);
+    } else if (neigh->nd.ndm_state == nd->ndm_state) {
+      neigh->last_updated = now;
+      return 0;
+    }
+    ns->resync_n_changed++;
+  } else {
+    ns->resync_n_added++;
+  }
+  return ns_rcv_neigh(ns, hdr);
+}
+
+static void
+ns_link_index_del(netns_p *ns, ns_link_t *link)
+{
+  hash_unset(ns->link_by_ifindex, link->ifi.ifi_index);
+}
+
+#define ns_resync_family_dumped(family) \
+  ((family) == AF_INET || (family) == AF_INET6)
+#define ns_resync_neigh_dumped(n) ns_resync_family_dumped((n)->nd.ndm_family)
+#define ns_resync_route_dumped(r) ns_resync_family_dumped((r)->rtm.rtm_family)
+#define ns_resync_addr_dumped(a) ns_resync_family_dumped((a)->ifaddr.ifa_family)
+#define ns_resync_link_dumped(l) 1  /* dumped for AF_UNSPEC, i.e. all */
+
+/*
+ * Removes the objects that were neither dumped nor notified since the resync
+ * start. The routes, addresses and neighbors are dumped for AF_INET and
+ * AF_INET6 only, so the objects of other families are left alone.
+ */
+static void
+ns_resync_sweep(netns_p *ns)
+{
+  u32 *indexes = 0;
+  u32 index, *i;
+
+#define _(pool, type, index_del, entry_free, dumped)                     \
+  pool_foreach_index(index, ns->netns.pool) {                           \
+      if (ns->netns.pool[index].last_updated < ns->resync_start &&      \
+          dumped(&ns->netns.pool[index]))                               \
+        vec_add1(indexes, index);                                       \
+    }                                                                   \
+  vec_foreach(i, indexes) {                                             \
+    index_del(ns, &ns->netns.pool[*i]);                                 \
+    pool_put_index(ns->netns.pool, *i);                                 \
+    netns_notify(ns, &ns->netns.pool[*i], type, NETNS_F_DEL);           \
+    entry_free(&ns->netns.pool[*i]);                                    \
+  }                                                                     \
+  ns->resync_n_removed += vec_len(indexes);                             \
+  vec_reset_length(indexes);
+#define ns_entry_nofree(entry)
+
+  _(neighbors, NETNS_TYPE_NEIGH, ns_neigh_index_del, ns_entry_nofree,
+    ns_resync_neigh_dumped)
+  _(routes, NETNS_TYPE_ROUTE, ns_route_index_del, rtnl_ns_route_free,
+    ns_resync_route_dumped)
+  _(addresses, NETNS_TYPE_ADDR, ns_addr_index_del, ns_entry_nofree,
+    ns_resync_addr_dumped)
+  _(links, NETNS_TYPE_LINK, ns_link_index_del, ns_entry_nofree,
+    ns_resync_link_dumped)
+
+#undef ns_entry_nofree
+#undef _
+  vec_free(indexes);
+}
+
+static int
+ns_recv_resync(rtnl_resync_event_t ev, struct nlmsghdr *hdr, uword o)
+{
+  netns_p *ns = &netns_main.netnss[o];
+  f64 now = vlib_time_now(vlib_get_main());
+  int ret = 0;
+
+  switch (ev) {
+  case RTNL_RESYNC_START:
+    ns->resync_start = now;
+    ns->resync_active = 1;
+    ns->resync_dirty = 0;
+    ns->resync_n_added = ns->resync_n_changed = ns->resync_n_removed = 0;
+    clib_warning("netns [%s]: resync started", ns->netns.name);
+    break;
+
+  case RTNL_RESYNC_MSG:
+    if (rtnl_debug_is_enabled())
+      clib_warning("resync: %U", format_rtnl_msg, hdr);
+
+    /*
+     * The kernel flags the dump, if the table changed while it was being
+     * dumped, e.g. an object deleted meanwhile could be dumped before its
+     * deletion was notified and so be re-added.
+     */
+    if (hdr->nlmsg_flags & NLM_F_DUMP_INTR)
+      ns->resync_dirty = 1;
+
+    switch (hdr->nlmsg_type) {
+    case RTM_NEWROUTE:
+      ret = ns_resync_route(ns, hdr, now);
+      break;
+    case RTM_NEWLINK:
+      ret = ns_resync_link(ns, hdr, now);
+      break;
+    case RTM_NEWADDR:
+      ret = ns_resync_addr(ns, hdr, now);
+      break;
+    case RTM_NEWNEIGH:
+      ret = ns_resync_neigh(ns, hdr, now);
+      break;
+    default:
+      break;
+    }
+    if (ret)
+      clib_warning("resync %U failed: %d", format_rtnl_msg_type, hdr, ret);
+    break;
+
+  case RTNL_RESYNC_DONE:
+    ns_resync_sweep(ns);
+    ns->resync_active = 0;
+    clib_warning("netns [%s]: resync done: added %u, changed %u, removed %u",
+                 ns->netns.name, ns->resync_n_added, ns->resync_n_changed,
+                 ns->resync_n_removed);
+    return ns->resync_dirty;
+
+  case RTNL_RESYNC_ABORT:
+    ns->resync_active = 0;
+    clib_warning("netns [%s]: resync aborted", ns->netns.name);
+    break;
+  }
+  return 0;
+}
+#endif /* FLEXIWAN_FEATURE */
+
 #define ns_object_foreach                       \
   _(neighbors, NETNS_TYPE_NEIGH)                \
   _(routes, NETNS_TYPE_ROUTE)                   \
@@ -773,6 +1386,11 @@ ns_recv_error(rtnl_error_t err, uword o)
 
 #undef _
     vec_free(indexes);
+
+#ifdef FLEXIWAN_FEATURE /* netns_hash_index */
+  ns_index_free(ns);
+  ns_index_init(ns);
+#endif /* FLEXIWAN_FEATURE */
 }
 
 static void
@@ -818,7 +1436,7 @@ int rtnl_msg_to_ns_route(struct nlmsghdr* hdr, ns_route_t* route)
   struct rtattr* rtas[RTA_MAX + 1] = {};
   int            ret;
 
-  memset(route, 0, sizeof(*route));
+  memset(route, 0, sizeof(*route));  /*the caller frees the previous content*/
   ret = rtnl_parse_rtattr(rtas, RTA_MAX, RTM_RTA(rtm), RTM_PAYLOAD(hdr));
   if (ret)
       return ret;
@@ -837,8 +1455,17 @@ netns_destroy(netns_p *ns)
   pool_put(nm->netnss, ns);
   pool_free(ns->netns.links);
   pool_free(ns->netns.addresses);
+#ifdef FLEXIWAN_FIX
+  ns_route_t *route;
+  pool_foreach(route, ns->netns.routes) {
+      rtnl_ns_route_free(route);
+    };
+#endif /* FLEXIWAN_FIX */
   pool_free(ns->netns.routes);
   pool_free(ns->netns.neighbors);
+#ifdef FLEXIWAN_FEATURE /* netns_hash_index */
+  ns_index_free(ns);
+#endif /* FLEXIWAN_FEATURE */
 }
 
 static netns_p *
@@ -858,6 +1485,9 @@ netns_get(char *name)
   rtnl_stream_t s = {
     .recv_message = ns_recv_rtnl,
     .error = ns_recv_error,
+#ifdef FLEXIWAN_FEATURE /* rtnl_overflow_resync */
+    .resync = ns_recv_resync,
+#endif /* FLEXIWAN_FEATURE */
     .opaque = (uword)(ns - nm->netnss),
   };
   strcpy(s.name, name);
@@ -873,8 +1503,14 @@ netns_get(char *name)
   ns->netns.links = 0;
   ns->netns.neighbors = 0;
   ns->netns.routes = 0;
+#ifdef FLEXIWAN_FEATURE /* netns_hash_index */
+  ns_index_init(ns);
+#endif /* FLEXIWAN_FEATURE */
   ns->subscriber_count = 0;
   ns->rtnl_handle = handle;
+#ifdef FLEXIWAN_FEATURE /* rtnl_overflow_resync */
+  ns->resync_active = 0;
+#endif /* FLEXIWAN_FEATURE */
   return ns;
 }
 
@@ -894,6 +1530,25 @@ u32 netns_open(char *name, netns_sub_t *sub)
   return p - nm->handles;
 }
 
+#ifdef FLEXIWAN_FEATURE /* netns_hash_index */
+void netns_rcv_msg(u32 handle, struct nlmsghdr *hdr)
+{
+  netns_main_t *nm = &netns_main;
+  netns_handle_t *h = pool_elt_at_index(nm->handles, handle);
+  ns_recv_rtnl(hdr, h->netns_index);
+}
+#endif /* FLEXIWAN_FEATURE */
+
+#ifdef FLEXIWAN_FEATURE /* rtnl_overflow_resync */
+int netns_rcv_resync(u32 handle, rtnl_resync_event_t ev,
+                     struct nlmsghdr *hdr)
+{
+  netns_main_t *nm = &netns_main;
+  netns_handle_t *h = pool_elt_at_index(nm->handles, handle);
+  return ns_recv_resync(ev, hdr, h->netns_index);
+}
+#endif /* FLEXIWAN_FEATURE */
+
 netns_t *netns_getns(u32 handle)
 {
   netns_main_t *nm = &netns_main;
@@ -21,6 +21,14 @@
  *      2. Add support in RTA_MULTIPATH attribute of netlink messages.
  *   - fix hashing logic: use 'dst' as key for hash. This is to prevent
  *     duplicated entries in VPP FIB and out of think between VPP FIB and kernel.
+ *   - RTA_MULTIPATH next hops are allocated on demand, so routes without
+ *     multipath do not take 8KB each. Use rtnl_ns_route_free() to free them.
+ *
+ *  List of features made for FlexiWAN (denoted by FLEXIWAN_FEATURE flag):
+ *   - netns_hash_index: hash indexed namespace database. netns_rcv_msg() feeds
+ *     messages into the database directly, it is used by the benchmark.
+ *   - rtnl_overflow_resync: netns_rcv_resync() feeds resync events into the
+ *     database directly, it is used by the resync test.
  */
 
 #ifndef NETNS_H_
@@ -55,8 +63,8 @@ typedef struct {
 
 #ifdef FLEXIWAN_FIX
 typedef struct {
-  struct rtnexthop nhops[MULTIPATH_NEXTHOP_MAX];
-  int length;
+  struct rtnexthop *nhops;  /*allocated on demand, NULL if route has no multipath*/
+  int length;               /*in bytes*/
 } multipath_t;
 #endif /*#ifdef FLEXIWAN_FIX*/
 
@@ -138,6 +146,26 @@ typedef struct {
  */
 u32 netns_open(char *name, netns_sub_t *sub);
 
+#ifdef FLEXIWAN_FEATURE /* netns_hash_index */
+/*
+ * Feeds the netlink message into the namespace database
+ * as if it was received from the kernel. All subscribers
+ * of the namespace are notified. Used by benchmarks.
+ */
+void netns_rcv_msg(u32 handle, struct nlmsghdr *hdr);
+#endif /* FLEXIWAN_FEATURE */
+
+#ifdef FLEXIWAN_FEATURE /* rtnl_overflow_resync */
+/*
+ * Feeds the resync event into the namespace database as if
+ * the namespace was dumped after the netlink socket overflow.
+ * Returns non-zero on DONE if one more resync is needed.
+ * Used by tests.
+ */
+int netns_rcv_resync(u32 handle, rtnl_resync_event_t ev,
+                     struct nlmsghdr *hdr);
+#endif /* FLEXIWAN_FEATURE */
+
 /*
  * Retrieves the namespace structure associated with a
  * given namespace handler.
@@ -171,6 +199,11 @@ u8 *format_ns_flags(u8 *s, va_list *args);
 void rtnl_enable_debug(int enable);
 
 int rtnl_msg_to_ns_route(struct nlmsghdr* hdr, ns_route_t* route);
+/*
+ * Frees the memory allocated for the route by rtnl_msg_to_ns_route(),
+ * should be called even if parsing failed.
+ */
+void rtnl_ns_route_free(ns_route_t* route);
 
 
 #endif
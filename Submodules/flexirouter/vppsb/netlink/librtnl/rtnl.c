@@ -19,6 +19,14 @@
  *   - add error callback function to handle error conditions on netlink socket
  *      1. close/open netlink socket on error condition
  *   - increase size of netlink socket rx buffer to allow process more events from kernel under heavy load
+ *
+ *  List of features made for FlexiWAN (denoted by FLEXIWAN_FEATURE flag):
+ *   - rtnl_overflow_resync: when the kernel drops notifications (ENOBUFS),
+ *     the links, addresses, routes and neighbors are dumped in background
+ *     on a separate socket and fed to the stream resync callback, so the
+ *     subscriber can apply the missed changes only. The live notifications
+ *     keep being processed during the dump. Resyncs are rate limited and
+ *     the dump is read in chunks, so it does not starve rtnl-process.
  */
 
 #define _GNU_SOURCE
@@ -49,6 +57,9 @@ typedef enum {
   RTNL_E_OPEN,
   RTNL_E_CLOSE,
   RTNL_E_READ,
+#ifdef FLEXIWAN_FEATURE /* rtnl_overflow_resync */
+  RTNL_E_RESYNC_READ,
+#endif /* FLEXIWAN_FEATURE */
 } rtnl_event_t;
 
 typedef enum {
@@ -66,6 +77,18 @@ typedef enum {
   RTNL_SS_NEIGH,
 } rtnl_sync_state_t;
 
+#ifdef FLEXIWAN_FEATURE /* rtnl_overflow_resync */
+typedef enum {
+  RTNL_RS_IDLE,
+  RTNL_RS_PENDING,
+  RTNL_RS_LINK,
+  RTNL_RS_ADDR,
+  RTNL_RS_ROUTE4,
+  RTNL_RS_ROUTE6,
+  RTNL_RS_NEIGH,
+} rtnl_resync_state_t;
+#endif /* FLEXIWAN_FEATURE */
+
 typedef struct {
   rtnl_stream_t stream;
   rtnl_state_t state;
@@ -75,6 +98,15 @@ typedef struct {
   u32 unix_index;
   u32 rtnl_seq;
   f64 timeout;
+#ifdef FLEXIWAN_FEATURE /* rtnl_overflow_resync */
+  rtnl_resync_state_t resync_state;
+  int resync_socket;
+  u32 resync_unix_index;
+  u32 resync_seq;
+  u8 resync_again;   /* notifications lost or dump interrupted */
+  f64 resync_timeout;
+  f64 resync_last;
+#endif /* FLEXIWAN_FEATURE */
 } rtnl_ns_t;
 
 typedef struct {
@@ -88,6 +120,15 @@ static vlib_node_registration_t rtnl_process_node;
 #define RTNL_BUFFSIZ 16384
 #define RTNL_DUMP_TIMEOUT 1
 
+#ifdef FLEXIWAN_FEATURE /* rtnl_overflow_resync */
+#define RTNL_RESYNC_INTERVAL 5  /* minimal interval between two resyncs */
+#define RTNL_RESYNC_TIMEOUT  5  /* dump socket may be silent that long */
+#define RTNL_RESYNC_BUDGET   8  /* buffers read from dump socket at once */
+
+static void rtnl_resync_request(rtnl_ns_t *ns);
+static void rtnl_resync_abort(rtnl_ns_t *ns);
+#endif /* FLEXIWAN_FEATURE */
+
 static inline u32 grpmask(u32 g)
 {
   ASSERT (g <= 31);
@@ -203,9 +244,10 @@ u8 *format_rtmsg(u8 *s, va_list *args)
   ret = rtnl_msg_to_ns_route(hdr, &route);
   if (ret) {
       s = format(s, "!!! failed to parse attributes !!!: %d\n", ret);
-      return s;
+  } else {
+      s = format(s, " rtattrs: %U", format_ns_route, &route);
   }
-  s = format(s, " rtattrs: %U", format_ns_route, &route);
+  rtnl_ns_route_free(&route);
   return s;
 }
 
@@ -266,6 +308,16 @@ static clib_error_t *rtnl_error_cb(struct clib_file * f)
     clib_warning("rtnetlink: read error fd (%d) stream [%s]: %s", ns->rtnl_socket, ns->stream.name, strerror(error));
   }
 
+#ifdef FLEXIWAN_FEATURE /* rtnl_overflow_resync */
+  /* The socket is fine, only the notifications were lost */
+  if (error == ENOBUFS && ns->state == RTNL_S_READY) {
+    rtnl_resync_request(ns);
+    vlib_process_signal_event(vlib_get_main(), rtnl_process_node.index,
+                              RTNL_E_READ, (uword)(ns - rm->streams));
+    return 0;
+  }
+#endif /* FLEXIWAN_FEATURE */
+
   rtnl_sync_reset(ns);
   rtnl_schedule_timeout(ns, rm->now);
   rtnl_sync_timeout(ns);
@@ -464,6 +516,10 @@ rtnl_sync_reset(rtnl_ns_t *ns)
   if (ns->sync_state == RTNL_SS_OPENING)
     return;
 
+#ifdef FLEXIWAN_FEATURE /* rtnl_overflow_resync */
+  /* The full synchronization follows */
+  rtnl_resync_abort(ns);
+#endif /* FLEXIWAN_FEATURE */
   rtnl_socket_close(ns);
   ns->sync_state = RTNL_SS_OPENING;
 }
@@ -612,6 +668,9 @@ rtnl_process_close(rtnl_ns_t *ns)
   if (ns->state == RTNL_S_INIT)
     return;
 
+#ifdef FLEXIWAN_FEATURE /* rtnl_overflow_resync */
+  rtnl_resync_abort(ns);
+#endif /* FLEXIWAN_FEATURE */
   rtnl_socket_close(ns);
   close(ns->ns_fd);
   pool_put(rm->streams, ns);
@@ -625,6 +684,13 @@ rtnl_process_read(rtnl_ns_t *ns)
   struct nlmsghdr *hdr;
   while(1) {
     if((len = recv(ns->rtnl_socket, buff, RTNL_BUFFSIZ, MSG_DONTWAIT)) < 0) {
+#ifdef FLEXIWAN_FEATURE /* rtnl_overflow_resync */
+      if (errno == ENOBUFS && ns->state == RTNL_S_READY) {
+        clib_warning("rtnetlink [%s]: notifications were lost, resync", ns->stream.name);
+        rtnl_resync_request(ns);
+        continue;
+      }
+#endif /* FLEXIWAN_FEATURE */
       if(errno != EAGAIN) {
         clib_warning("rtnetlink recv error (%d) [%s]: %s", ns->rtnl_socket, ns->stream.name, strerror(errno));
         return -1;
@@ -647,6 +713,293 @@ rtnl_process_read(rtnl_ns_t *ns)
   return 0;
 }
 
+#ifdef FLEXIWAN_FEATURE /* rtnl_overflow_resync */
+static clib_error_t *rtnl_resync_read_cb(struct clib_file * f)
+{
+  vlib_process_signal_event(vlib_get_main(), rtnl_process_node.index,
+                            RTNL_E_RESYNC_READ, f->private_data);
+  return 0;
+}
+
+/* this function is run in the namespace by the second thread */
+static void *rtnl_resync_socket_fn(void *p)
+{
+  int fd, size = 1024000;
+
+  if ((fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE)) == -1)
+    return (void *) -1;
+
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (const void *)&size, sizeof(size)) != 0)
+    clib_warning("rtnetlink: setsockopt error %s", strerror(errno));
+
+  return (void *) (uword) fd;
+}
+
+static int
+rtnl_resync_open(rtnl_ns_t *ns)
+{
+  rtnl_main_t *rm = &rtnl_main;
+  struct sockaddr_nl addr = { .nl_family = AF_NETLINK };
+  clib_file_t template = {0};
+  void *ret = (void *) -1;
+  int fd;
+
+  if (rtnl_exec_in_namespace_byfd(ns->ns_fd, rtnl_resync_socket_fn, NULL, &ret) ||
+      (fd = (int) (uword) ret) < 0)
+    return -1;
+
+  /* No multicast groups, the socket is used for the dump only */
+  if (bind(fd, (struct sockaddr*) &addr, sizeof(addr))) {
+    close(fd);
+    return -2;
+  }
+
+  template.read_function = rtnl_resync_read_cb;
+  template.description = format (0, "rtnetlink resync fd: %d", fd);
+  template.file_descriptor = fd;
+  template.private_data = (uword) (ns - rm->streams);
+  ns->resync_unix_index = clib_file_add (&file_main, &template);
+  ns->resync_socket = fd;
+  return 0;
+}
+
+static void
+rtnl_resync_close(rtnl_ns_t *ns)
+{
+  if (ns->resync_socket < 0)
+    return;
+
+  clib_file_del(&file_main, &file_main.file_pool[ns->resync_unix_index]);
+  close(ns->resync_socket);
+  ns->resync_socket = -1;
+}
+
+static int
+rtnl_resync_dump_request(rtnl_ns_t *ns, int type, void *req, size_t len)
+{
+  struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+  struct nlmsghdr nlh = {
+    .nlmsg_len = NLMSG_LENGTH(len),
+    .nlmsg_type = type,
+    .nlmsg_flags = NLM_F_DUMP|NLM_F_REQUEST,
+    .nlmsg_seq = ++ns->resync_seq,
+  };
+  struct iovec iov[2] = {
+    { .iov_base = &nlh, .iov_len = sizeof(nlh) },
+    { .iov_base = req, .iov_len = len }
+  };
+  struct msghdr msg = {
+    .msg_name = &nladdr,
+    .msg_namelen =  sizeof(nladdr),
+    .msg_iov = iov,
+    .msg_iovlen = 2,
+  };
+  if(sendmsg(ns->resync_socket, &msg, 0) < 0) {
+    clib_warning("rtnetlink resync sendmsg error: %s", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Schedules the resync. The resync is not started earlier than
+ * RTNL_RESYNC_INTERVAL after the previous one. If it is running already,
+ * another one is scheduled after it, as the running dump might miss the
+ * dropped notifications.
+ */
+static void
+rtnl_resync_request(rtnl_ns_t *ns)
+{
+  rtnl_main_t *rm = &rtnl_main;
+
+  if (ns->state != RTNL_S_READY || ns->resync_state == RTNL_RS_PENDING)
+    return;
+
+  if (ns->resync_state != RTNL_RS_IDLE) {
+    ns->resync_again = 1;
+    return;
+  }
+
+  ns->resync_state = RTNL_RS_PENDING;
+  ns->resync_timeout = clib_max(rm->now, ns->resync_last + RTNL_RESYNC_INTERVAL);
+}
+
+/* Returns non-zero if one more resync is needed */
+static int
+rtnl_resync_end(rtnl_ns_t *ns, rtnl_resync_event_t ev)
+{
+  int again = ns->resync_again;
+
+  rtnl_resync_close(ns);
+  ns->resync_state = RTNL_RS_IDLE;
+  ns->resync_timeout = DBL_MAX;
+  ns->resync_again = 0;
+
+  if (ns->stream.resync && ns->stream.resync(ev, NULL, ns->stream.opaque))
+    again = 1;
+  return again;
+}
+
+static void
+rtnl_resync_abort(rtnl_ns_t *ns)
+{
+  if (ns->resync_state == RTNL_RS_IDLE)
+    return;
+
+  if (ns->resync_state == RTNL_RS_PENDING) {
+    ns->resync_state = RTNL_RS_IDLE;
+    ns->resync_timeout = DBL_MAX;
+    return;
+  }
+
+  rtnl_resync_end(ns, RTNL_RESYNC_ABORT);
+}
+
+static void
+rtnl_resync_retry(rtnl_ns_t *ns)
+{
+  rtnl_resync_abort(ns);
+  rtnl_resync_request(ns);
+}
+
+/* Requests the dump of the next object type */
+static void
+rtnl_resync_next(rtnl_ns_t *ns)
+{
+  rtnl_main_t *rm = &rtnl_main;
+  struct ifinfomsg ifimsg;
+  struct ifaddrmsg addrmsg;
+  struct rtmsg rtmsg;
+  struct ndmsg ndmsg;
+  int ret = 0;
+
+  switch (ns->resync_state) {
+  case RTNL_RS_IDLE:
+    return;
+  case RTNL_RS_PENDING:
+    memset(&ifimsg, 0, sizeof(ifimsg));
+    ifimsg.ifi_family = AF_UNSPEC;
+    ret = rtnl_resync_dump_request(ns, RTM_GETLINK, &ifimsg, sizeof(ifimsg));
+    break;
+  case RTNL_RS_LINK:
+    memset(&addrmsg, 0, sizeof(addrmsg));
+    addrmsg.ifa_family = AF_UNSPEC;
+    ret = rtnl_resync_dump_request(ns, RTM_GETADDR, &addrmsg, sizeof(addrmsg));
+    break;
+  case RTNL_RS_ADDR:
+  case RTNL_RS_ROUTE4:
+    memset(&rtmsg, 0, sizeof(rtmsg));
+    rtmsg.rtm_family = (ns->resync_state == RTNL_RS_ADDR)?AF_INET:AF_INET6;
+    rtmsg.rtm_table = RT_TABLE_UNSPEC;
+    ret = rtnl_resync_dump_request(ns, RTM_GETROUTE, &rtmsg, sizeof(rtmsg));
+    break;
+  case RTNL_RS_ROUTE6:
+    memset(&ndmsg, 0, sizeof(ndmsg));
+    ndmsg.ndm_family = AF_UNSPEC;
+    ret = rtnl_resync_dump_request(ns, RTM_GETNEIGH, &ndmsg, sizeof(ndmsg));
+    break;
+  case RTNL_RS_NEIGH:
+    if (rtnl_resync_end(ns, RTNL_RESYNC_DONE))
+      rtnl_resync_request(ns);
+    return;
+  }
+
+  if (ret) {
+    rtnl_resync_retry(ns);
+    return;
+  }
+  ns->resync_state++;
+  ns->resync_timeout = rm->now + RTNL_RESYNC_TIMEOUT;
+}
+
+static void
+rtnl_resync_start(rtnl_ns_t *ns)
+{
+  rtnl_main_t *rm = &rtnl_main;
+
+  if (rtnl_resync_open(ns)) {
+    clib_warning("rtnetlink [%s]: could not open resync socket", ns->stream.name);
+    ns->resync_timeout = rm->now + RTNL_RESYNC_INTERVAL;
+    return;
+  }
+
+  ns->resync_last = rm->now;
+  ns->resync_again = 0;
+  if (ns->stream.resync)
+    ns->stream.resync(RTNL_RESYNC_START, NULL, ns->stream.opaque);
+  rtnl_resync_next(ns);
+}
+
+static void
+rtnl_resync_timeout(rtnl_ns_t *ns)
+{
+  if (ns->resync_state == RTNL_RS_PENDING) {
+    rtnl_resync_start(ns);
+    return;
+  }
+
+  clib_warning("rtnetlink [%s]: resync timed out", ns->stream.name);
+  rtnl_resync_retry(ns);
+}
+
+/*
+ * Reads up to RTNL_RESYNC_BUDGET buffers of the dump. The rest is read
+ * when rtnl-process is scheduled next time, as the socket stays readable.
+ */
+static void
+rtnl_resync_read(rtnl_ns_t *ns)
+{
+  rtnl_main_t *rm = &rtnl_main;
+  uint8_t buff[RTNL_BUFFSIZ];
+  struct nlmsghdr *hdr;
+  ssize_t len;
+  int n;
+
+  for (n = 0; n < RTNL_RESYNC_BUDGET && ns->resync_socket >= 0; n++) {
+    if ((len = recv(ns->resync_socket, buff, RTNL_BUFFSIZ, MSG_DONTWAIT)) < 0) {
+      if (errno == EAGAIN)
+        return;
+      clib_warning("rtnetlink resync recv error [%s]: %s", ns->stream.name, strerror(errno));
+      rtnl_resync_retry(ns);
+      return;
+    }
+    ns->resync_timeout = rm->now + RTNL_RESYNC_TIMEOUT;
+
+    for(hdr = (struct nlmsghdr *) buff;
+        len > 0;
+        len -= NLMSG_ALIGN(hdr->nlmsg_len),
+          hdr = (struct nlmsghdr *) (((uint8_t *) hdr) + NLMSG_ALIGN(hdr->nlmsg_len))) {
+      if((sizeof(*hdr) > (size_t)len) || (hdr->nlmsg_len > (size_t)len)) {
+        clib_warning("rtnetlink resync buffer too small (%d Vs %d)", (int) hdr->nlmsg_len, (int) len);
+        rtnl_resync_retry(ns);
+        return;
+      }
+      if (hdr->nlmsg_seq != ns->resync_seq)
+        continue;
+
+      switch (hdr->nlmsg_type) {
+      case NLMSG_DONE:
+        /* The objects are flagged for the stream, the end of dump here */
+        if (hdr->nlmsg_flags & NLM_F_DUMP_INTR)
+          ns->resync_again = 1;
+        rtnl_resync_next(ns);
+        if (ns->resync_socket < 0)
+          return;
+        break;
+      case NLMSG_ERROR:
+        clib_warning("rtnetlink [%s]: resync dump failed", ns->stream.name);
+        rtnl_resync_retry(ns);
+        return;
+      default:
+        if (ns->stream.resync)
+          ns->stream.resync(RTNL_RESYNC_MSG, hdr, ns->stream.opaque);
+        break;
+      }
+    }
+  }
+}
+#endif /* FLEXIWAN_FEATURE */
+
 static void
 rtnl_process_timeout(rtnl_ns_t *ns)
 {
@@ -685,6 +1038,10 @@ rtnl_process (vlib_main_t * vm,
             ns->timeout = DBL_MAX;
             rtnl_process_timeout(ns);
           }
+#ifdef FLEXIWAN_FEATURE /* rtnl_overflow_resync */
+          if (ns->resync_timeout < rm->now)
+            rtnl_resync_timeout(ns);
+#endif /* FLEXIWAN_FEATURE */
         };
     } else {
       rtnl_ns_t *ns;
@@ -702,6 +1059,11 @@ rtnl_process (vlib_main_t * vm,
           case RTNL_E_READ:
             rtnl_process_read(ns);
             break;
+#ifdef FLEXIWAN_FEATURE /* rtnl_overflow_resync */
+          case RTNL_E_RESYNC_READ:
+            rtnl_resync_read(ns);
+            break;
+#endif /* FLEXIWAN_FEATURE */
           }
       }
     }
@@ -712,6 +1074,10 @@ rtnl_process (vlib_main_t * vm,
     pool_foreach(ns, rm->streams) {
         if (ns->timeout < timeout)
           timeout = ns->timeout;
+#ifdef FLEXIWAN_FEATURE /* rtnl_overflow_resync */
+        if (ns->resync_timeout < timeout)
+          timeout = ns->resync_timeout;
+#endif /* FLEXIWAN_FEATURE */
       };
   }
   return frame->n_vectors;
@@ -745,6 +1111,14 @@ rtnl_stream_open(rtnl_stream_t *template)
   ns->state = RTNL_S_INIT;
   ns->ns_fd = fd;
   ns->stream = *template;
+#ifdef FLEXIWAN_FEATURE /* rtnl_overflow_resync */
+  ns->resync_state = RTNL_RS_IDLE;
+  ns->resync_socket = -1;
+  ns->resync_seq = 0;
+  ns->resync_again = 0;
+  ns->resync_timeout = DBL_MAX;
+  ns->resync_last = -RTNL_RESYNC_INTERVAL;
+#endif /* FLEXIWAN_FEATURE */
   vlib_process_signal_event(vm, rtnl_process_node.index, RTNL_E_OPEN, (uword)(ns - rm->streams));
   return ns - rm->streams;
 }
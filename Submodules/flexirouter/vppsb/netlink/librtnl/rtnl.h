@@ -13,6 +13,14 @@
  * limitations under the License.
  */
 
+/*
+ *  Copyright (C) 2023 flexiWAN Ltd.
+ *  List of features made for FlexiWAN (denoted by FLEXIWAN_FEATURE flag):
+ *   - rtnl_overflow_resync: resync callback of the stream, that is used to
+ *     bring the namespace database back in sync after the netlink socket
+ *     overflow.
+ */
+
 #ifndef RTNL_H_
 #define RTNL_H_
 
@@ -25,6 +33,15 @@ typedef enum {
   RTNL_ERR_UNKNOWN,
 } rtnl_error_t;
 
+#ifdef FLEXIWAN_FEATURE /* rtnl_overflow_resync */
+typedef enum {
+  RTNL_RESYNC_START,
+  RTNL_RESYNC_MSG,
+  RTNL_RESYNC_DONE,
+  RTNL_RESYNC_ABORT,
+} rtnl_resync_event_t;
+#endif /* FLEXIWAN_FEATURE */
+
 #define RTNL_NETNS_NAMELEN 128
 
 /*
@@ -41,6 +58,17 @@ typedef struct rtnl_stream_s {
   char name[RTNL_NETNS_NAMELEN + 1];
   void (*recv_message)(struct nlmsghdr *hdr, uword opaque);
   void (*error)(rtnl_error_t err, uword opaque);
+#ifdef FLEXIWAN_FEATURE /* rtnl_overflow_resync */
+  /*
+   * resync is called when the kernel dropped notifications because
+   * the socket buffer overflowed. The current state is dumped in
+   * background: START, MSG for every dumped object and DONE or ABORT.
+   * The stream is still READY and recv_message is still called for
+   * the live notifications meanwhile. Non-zero returned on DONE
+   * requests one more resync.
+   */
+  int (*resync)(rtnl_resync_event_t ev, struct nlmsghdr *hdr, uword opaque);
+#endif /* FLEXIWAN_FEATURE */
   uword opaque;
 } rtnl_stream_t;
 
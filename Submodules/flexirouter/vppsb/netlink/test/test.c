@@ -13,6 +13,14 @@
  * limitations under the License.
  */
 
+/*
+ *  List of features made for FlexiWAN (denoted by FLEXIWAN_FEATURE flag):
+ *   - netns_hash_index: "test netns bench routes" benchmark of the namespace
+ *     route database.
+ *   - rtnl_overflow_resync: "test netns resync" checks how the namespace
+ *     route database is brought in sync with the dump.
+ */
+
 #include <librtnl/netns.h>
 
 #include <vnet/plugin/plugin.h>
@@ -194,6 +202,274 @@ VLIB_CLI_COMMAND (mapper_iface_command, static) = {
     .function = mapper_iface_command_fn,
 };
 
+#ifdef FLEXIWAN_FEATURE /* netns_hash_index */
+typedef struct {
+  struct nlmsghdr hdr;
+  struct rtmsg rtm;
+  struct rtattr dst_rta;
+  u32 dst;
+  struct rtattr priority_rta;
+  u32 priority;
+  struct rtattr oif_rta;
+  u32 oif;
+} test_route_msg_t;
+
+/*
+ * Loads <count> /32 routes into the namespace database, then deletes them.
+ * The database is shared by all subscribers of the namespace, so use scratch
+ * namespace, e.g. "ip netns add bench".
+ */
+static clib_error_t *
+test_bench_routes_command_fn (vlib_main_t * vm,
+                              unformat_input_t * input,
+                              vlib_cli_command_t * cmd)
+{
+  char *nsname = 0;
+  u32 n_routes = 1 << 20;
+  u32 handle, i;
+  test_route_msg_t *msgs = 0, *m;
+  ns_route_t route;
+  netns_sub_t sub = {};
+  f64 cps = vm->clib_time.clocks_per_second;
+  u64 t0, t1, t2, t3;
+
+  if (!unformat(input, "%s", &nsname))
+    return clib_error_return(0, "unknown input `%U'",
+                             format_unformat_error, input);
+  if (unformat(input, "count %u", &n_routes) && (!n_routes || n_routes > 1 << 24))
+    return clib_error_return(0, "count must be 1..%u", 1 << 24);
+  vec_add1(nsname, 0);
+
+  if (!strcmp(nsname, "default"))
+    nsname[0] = 0;
+
+  handle = netns_open(nsname, &sub);
+  if (handle == ~0) {
+    clib_error_t *error = clib_error_create("Could not open netns with name %s", nsname);
+    vec_free(nsname);
+    return error;
+  }
+
+  vec_validate(msgs, n_routes - 1);
+  for (i = 0; i < n_routes; i++) {
+    m = msgs + i;
+    m->hdr.nlmsg_len = sizeof(*m);
+    m->hdr.nlmsg_type = RTM_NEWROUTE;
+    m->hdr.nlmsg_flags = NLM_F_CREATE | NLM_F_EXCL;
+    m->rtm.rtm_family = AF_INET;
+    m->rtm.rtm_dst_len = 32;
+    m->rtm.rtm_table = RT_TABLE_MAIN;
+    m->rtm.rtm_protocol = RTPROT_ZEBRA;
+    m->rtm.rtm_scope = RT_SCOPE_UNIVERSE;
+    m->rtm.rtm_type = RTN_UNICAST;
+    m->dst_rta.rta_type = RTA_DST;
+    m->dst_rta.rta_len = RTA_LENGTH(sizeof(m->dst));
+    m->dst = clib_host_to_net_u32(0x0a000000 + i);
+    m->priority_rta.rta_type = RTA_PRIORITY;
+    m->priority_rta.rta_len = RTA_LENGTH(sizeof(m->priority));
+    m->priority = 20;
+    m->oif_rta.rta_type = RTA_OIF;
+    m->oif_rta.rta_len = RTA_LENGTH(sizeof(m->oif));
+    m->oif = 1;
+  }
+
+  t0 = clib_cpu_time_now();
+  vec_foreach(m, msgs) {
+    rtnl_msg_to_ns_route(&m->hdr, &route);
+    rtnl_ns_route_free(&route);
+  }
+  t1 = clib_cpu_time_now();
+  vec_foreach(m, msgs)
+    netns_rcv_msg(handle, &m->hdr);
+  t2 = clib_cpu_time_now();
+  vec_foreach(m, msgs) {
+    m->hdr.nlmsg_type = RTM_DELROUTE;
+    netns_rcv_msg(handle, &m->hdr);
+  }
+  t3 = clib_cpu_time_now();
+
+  vlib_cli_output(vm, "%u routes:", n_routes);
+  vlib_cli_output(vm, "  parse  %.2f clocks/route, %.3f sec",
+                  (f64)(t1 - t0) / n_routes, (t1 - t0) / cps);
+  vlib_cli_output(vm, "  add    %.2f clocks/route, %.3f sec",
+                  (f64)(t2 - t1) / n_routes, (t2 - t1) / cps);
+  vlib_cli_output(vm, "  del    %.2f clocks/route, %.3f sec",
+                  (f64)(t3 - t2) / n_routes, (t3 - t2) / cps);
+
+  vec_free(msgs);
+  vec_free(nsname);
+  netns_close(handle);
+  return 0;
+}
+
+VLIB_CLI_COMMAND (test_bench_routes_command, static) = {
+    .path = "test netns bench routes",
+    .short_help = "test netns bench routes [<ns-name>|default] [count <n>]",
+    .function = test_bench_routes_command_fn,
+};
+#endif /* FLEXIWAN_FEATURE */
+
+#ifdef FLEXIWAN_FEATURE /* rtnl_overflow_resync */
+#define TEST_RESYNC_TABLE 200
+
+typedef struct {
+  u32 n_add;
+  u32 n_del;
+} test_resync_counters_t;
+
+static void
+test_resync_notify(void *obj, netns_type_t type, u32 flags, uword opaque)
+{
+  test_resync_counters_t *c = (test_resync_counters_t *) opaque;
+
+  if (type != NETNS_TYPE_ROUTE ||
+      ((ns_route_t *)obj)->rtm.rtm_table != TEST_RESYNC_TABLE)
+    return;
+  if (flags & NETNS_F_ADD)
+    c->n_add++;
+  else if (flags & NETNS_F_DEL)
+    c->n_del++;
+}
+
+static struct nlmsghdr *
+test_resync_route(test_route_msg_t *m, u16 type, u16 flags, u8 family,
+                  u32 dst, u32 oif)
+{
+  clib_memset(m, 0, sizeof(*m));
+  m->hdr.nlmsg_len = sizeof(*m);
+  m->hdr.nlmsg_type = type;
+  m->hdr.nlmsg_flags = flags;
+  m->rtm.rtm_family = family;
+  m->rtm.rtm_dst_len = 32;
+  m->rtm.rtm_table = TEST_RESYNC_TABLE;
+  m->rtm.rtm_protocol = RTPROT_STATIC;
+  m->rtm.rtm_scope = RT_SCOPE_UNIVERSE;
+  m->rtm.rtm_type = RTN_UNICAST;
+  m->dst_rta.rta_type = RTA_DST;
+  m->dst_rta.rta_len = RTA_LENGTH(sizeof(m->dst));
+  m->dst = clib_host_to_net_u32(0x0aff0000 + dst);
+  m->priority_rta.rta_type = RTA_PRIORITY;
+  m->priority_rta.rta_len = RTA_LENGTH(sizeof(m->priority));
+  m->priority = 20;
+  m->oif_rta.rta_type = RTA_OIF;
+  m->oif_rta.rta_len = RTA_LENGTH(sizeof(m->oif));
+  m->oif = oif;
+  return &m->hdr;
+}
+
+#define test_resync_live(type, family, dst, oif) \
+  netns_rcv_msg(handle, test_resync_route(&m, type, 0, family, dst, oif))
+#define test_resync_dump(flags, dst, oif)                               \
+  netns_rcv_resync(handle, RTNL_RESYNC_MSG,                             \
+                   test_resync_route(&m, RTM_NEWROUTE, NLM_F_MULTI | flags, \
+                                     AF_INET, dst, oif))
+
+#define TEST_RESYNC(cond, ...)                                          \
+  do {                                                                  \
+    if (!(cond)) {                                                      \
+      error = clib_error_return(0, __VA_ARGS__);                        \
+      goto done;                                                        \
+    }                                                                   \
+  } while (0)
+
+/*
+ * Feeds the routes of table 200 into the namespace database and resyncs it
+ * with the dump of some of them:
+ *  - 10.255.0.1 is dumped unchanged and is not notified,
+ *  - 10.255.0.2 is deleted by the live notification during the resync,
+ *  - 10.255.0.3 is dumped with other oif and is replaced,
+ *  - 10.255.0.4 is not dumped and is removed at the end of resync,
+ *  - 10.255.0.5 is the multicast (RTNL_FAMILY_IPMR) route, which is not
+ *    dumped, so it is kept,
+ *  - 10.255.0.6 is dumped only and is added.
+ * The live deletion must not request one more resync, the dump flagged
+ * by the kernel as interrupted must. As the bench, use scratch namespace.
+ */
+static clib_error_t *
+test_resync_command_fn (vlib_main_t * vm,
+                        unformat_input_t * input,
+                        vlib_cli_command_t * cmd)
+{
+  char *nsname = 0;
+  u32 handle, n_mroutes = 0;
+  test_route_msg_t m;
+  test_resync_counters_t c = {};
+  netns_sub_t sub = {
+    .notify = test_resync_notify,
+    .opaque = (uword) &c,
+  };
+  clib_error_t *error = 0;
+  ns_route_t *route;
+  int again;
+
+  if (!unformat(input, "%s", &nsname))
+    return clib_error_return(0, "unknown input `%U'",
+                             format_unformat_error, input);
+  vec_add1(nsname, 0);
+
+  if (!strcmp(nsname, "default"))
+    nsname[0] = 0;
+
+  handle = netns_open(nsname, &sub);
+  if (handle == ~0) {
+    error = clib_error_create("Could not open netns with name %s", nsname);
+    vec_free(nsname);
+    return error;
+  }
+
+  test_resync_live(RTM_NEWROUTE, AF_INET, 1, 1);
+  test_resync_live(RTM_NEWROUTE, AF_INET, 2, 1);
+  test_resync_live(RTM_NEWROUTE, AF_INET, 3, 1);
+  test_resync_live(RTM_NEWROUTE, AF_INET, 4, 1);
+  test_resync_live(RTM_NEWROUTE, RTNL_FAMILY_IPMR, 5, 1);
+  TEST_RESYNC(c.n_add == 5, "live: %u routes added, expected 5", c.n_add);
+
+  c.n_add = c.n_del = 0;
+  netns_rcv_resync(handle, RTNL_RESYNC_START, NULL);
+  test_resync_dump(0, 1, 1);
+  test_resync_live(RTM_DELROUTE, AF_INET, 2, 1);
+  test_resync_dump(0, 3, 2);
+  test_resync_dump(0, 6, 1);
+  again = netns_rcv_resync(handle, RTNL_RESYNC_DONE, NULL);
+  TEST_RESYNC(!again, "resync: live deletion requested one more resync");
+  TEST_RESYNC(c.n_add == 2 && c.n_del == 3,
+              "resync: %u added, %u deleted, expected 2 and 3",
+              c.n_add, c.n_del);
+
+  pool_foreach(route, netns_getns(handle)->routes) {
+    if (route->rtm.rtm_table == TEST_RESYNC_TABLE &&
+        route->rtm.rtm_family == RTNL_FAMILY_IPMR)
+      n_mroutes++;
+  };
+  TEST_RESYNC(n_mroutes == 1, "resync: multicast route was removed");
+
+  c.n_add = c.n_del = 0;
+  netns_rcv_resync(handle, RTNL_RESYNC_START, NULL);
+  test_resync_dump(NLM_F_DUMP_INTR, 1, 1);
+  again = netns_rcv_resync(handle, RTNL_RESYNC_DONE, NULL);
+  TEST_RESYNC(again, "resync: interrupted dump did not request resync");
+  TEST_RESYNC(c.n_add == 0 && c.n_del == 2,
+              "interrupted resync: %u added, %u deleted, expected 0 and 2",
+              c.n_add, c.n_del);
+
+  vlib_cli_output(vm, "resync test passed");
+
+done:
+  /* 10.255.0.1 and the multicast route are left after the last resync */
+  test_resync_live(RTM_DELROUTE, AF_INET, 1, 1);
+  test_resync_live(RTM_DELROUTE, RTNL_FAMILY_IPMR, 5, 1);
+  vec_free(nsname);
+  netns_close(handle);
+  return error;
+}
+
+VLIB_CLI_COMMAND (test_resync_command, static) = {
+    .path = "test netns resync",
+    .short_help = "test netns resync [<ns-name>|default]",
+    .function = test_resync_command_fn,
+};
+#endif /* FLEXIWAN_FEATURE */
+
 /* *INDENT-OFF* */
 VLIB_PLUGIN_REGISTER () = {
   //.version = VPP_BUILD_VER, FIXME
@@ -28,6 +28,8 @@
  *   - don't route all ARP traffic directly to VPPSB. Instead, register VPPSB tap-neighbor
  *     node within "arp" arc, enabling thus ARP traffic to pass the VRRP module
  *     before reaching the VPPSB.
+ *   - tap_inject_virtio: back the Linux side of the interface by VPP tapv2
+ *     interface instead of tun/tap file descriptor, see tap_inject_tap.c.
  */
 
 #include "tap_inject.h"
@@ -132,6 +134,12 @@ void tap_inject_map_interface_set (u32 src_sw_if_index, u32 dst_sw_if_index)
   vec_validate_init_empty (im->sw_if_index_to_tap_fd, dst_sw_if_index, ~0);
   im->sw_if_index_to_tap_fd[dst_sw_if_index] = im->sw_if_index_to_tap_fd[src_sw_if_index];
 
+#ifdef FLEXIWAN_FEATURE /* tap_inject_virtio */
+  vec_validate_init_empty (im->sw_if_index_to_virtio_sw_if_index, dst_sw_if_index, ~0);
+  im->sw_if_index_to_virtio_sw_if_index[dst_sw_if_index] =
+    tap_inject_lookup_virtio_sw_if_index (src_sw_if_index);
+#endif /* FLEXIWAN_FEATURE - tap_inject_virtio */
+
   tap_inject_type_set(dst_sw_if_index, TAP_INJECT_MAPPED);
 }
 
@@ -140,6 +148,10 @@ void tap_inject_map_interface_delete (u32 src_sw_if_index, u32 dst_sw_if_index)
   tap_inject_main_t *im = tap_inject_get_main();
 
   im->sw_if_index_to_tap_fd[dst_sw_if_index] = ~0;
+#ifdef FLEXIWAN_FEATURE /* tap_inject_virtio */
+  if (dst_sw_if_index < vec_len (im->sw_if_index_to_virtio_sw_if_index))
+    im->sw_if_index_to_virtio_sw_if_index[dst_sw_if_index] = ~0;
+#endif /* FLEXIWAN_FEATURE - tap_inject_virtio */
 
   im->sw_if_index_to_sw_if_index[src_sw_if_index] = ~0;
 }
@@ -254,6 +266,38 @@ tap_inject_delete_tap (u32 sw_if_index)
   hash_unset (im->tap_if_index_to_sw_if_index, tap_if_index);
 }
 
+#ifdef FLEXIWAN_FEATURE /* tap_inject_virtio */
+void
+tap_inject_insert_virtio (u32 sw_if_index, u32 virtio_sw_if_index)
+{
+  tap_inject_main_t * im = tap_inject_get_main ();
+
+  if (tap_inject_debug_is_enabled())
+    {
+      clib_warning("sw_if_index: %d, virtio_sw_if_index: %d",
+                   sw_if_index, virtio_sw_if_index);
+    }
+
+  vec_validate_init_empty (im->sw_if_index_to_virtio_sw_if_index, sw_if_index, ~0);
+  vec_validate_init_empty (im->virtio_sw_if_index_to_sw_if_index, virtio_sw_if_index, ~0);
+  im->sw_if_index_to_virtio_sw_if_index[sw_if_index] = virtio_sw_if_index;
+  im->virtio_sw_if_index_to_sw_if_index[virtio_sw_if_index] = sw_if_index;
+}
+
+void
+tap_inject_delete_virtio (u32 sw_if_index)
+{
+  tap_inject_main_t * im = tap_inject_get_main ();
+  u32 virtio_sw_if_index = tap_inject_lookup_virtio_sw_if_index (sw_if_index);
+
+  if (virtio_sw_if_index == ~0)
+    return;
+
+  im->sw_if_index_to_virtio_sw_if_index[sw_if_index] = ~0;
+  im->virtio_sw_if_index_to_sw_if_index[virtio_sw_if_index] = ~0;
+}
+#endif /* FLEXIWAN_FEATURE - tap_inject_virtio */
+
 u32
 tap_inject_lookup_tap_fd (u32 sw_if_index)
 {
@@ -1025,7 +1069,11 @@ tap_inject_enable_ip4_output_cli (vlib_main_t * vm, unformat_input_t * input,
       error = clib_error_return (0, "Invalid sw_if_index");
       goto done;
     }
-  if (tap_inject_lookup_tap_fd(sw_if_index) == ~0)
+  if (tap_inject_lookup_tap_fd(sw_if_index) == ~0
+#ifdef FLEXIWAN_FEATURE /* tap_inject_virtio */
+      && tap_inject_lookup_virtio_sw_if_index(sw_if_index) == ~0
+#endif /* FLEXIWAN_FEATURE - tap_inject_virtio */
+     )
     {
       error = clib_error_return (0, "The input is not a tap interface ");
       goto done;
@@ -1186,6 +1234,11 @@ tap_inject_config (vlib_main_t * vm, unformat_input_t * input)
       else if (unformat (input, "debug"))
         im->flags |= TAP_INJECT_F_DEBUG_ENABLE;
 
+#ifdef FLEXIWAN_FEATURE /* tap_inject_virtio */
+      else if (unformat (input, "virtio"))
+        im->flags |= TAP_INJECT_F_CONFIG_VIRTIO;
+#endif /* FLEXIWAN_FEATURE - tap_inject_virtio */
+
       else
         return clib_error_return (0, "syntax error `%U'",
                                   format_unformat_error, input);
@@ -24,6 +24,11 @@
  *   plugin. The exported classifier_acls plugin API is used to perform the
  *   classification function.
  *   - fix memory leak with clib_file_add() on tap inject/delete
+ *   - tap_inject_virtio: back the Linux side of the interface by VPP tapv2
+ *   interface (vhost-net rings) instead of tun/tap file descriptor, so
+ *   packets are passed to and from Linux in batches and without copying.
+ *   Enabled by the 'virtio' keyword in the 'tap-inject' startup section.
+ *   The tun/tap fd is used as a fallback if the tapv2 can't be created.
  */
 
 #ifndef _TAP_INJECT_H
@@ -68,6 +73,9 @@ typedef struct {
 #define TAP_INJECT_F_CONFIG_NETLINK (1U << 2)
 #define TAP_INJECT_F_ENABLED        (1U << 3)
 #define TAP_INJECT_F_DEBUG_ENABLE   (1U << 4)
+#ifdef FLEXIWAN_FEATURE /* tap_inject_virtio */
+#define TAP_INJECT_F_CONFIG_VIRTIO  (1U << 5)
+#endif /* FLEXIWAN_FEATURE - tap_inject_virtio */
 
   u32 flags;
 
@@ -100,6 +108,18 @@ typedef struct {
 
   u32 * rx_buffers;
 
+#ifdef FLEXIWAN_FEATURE /* tap_inject_virtio */
+  /*
+   * Interfaces that are backed by tapv2 have no tap fd. The packets to Linux
+   * are sent to the tapv2 interface output and the packets from Linux are
+   * redirected by virtio-input into the tap-inject-virtio-rx node.
+   */
+  u32 * sw_if_index_to_virtio_sw_if_index;
+  u32 * virtio_sw_if_index_to_sw_if_index;
+  u32 virtio_rx_node_index;
+  u32 interface_output_node_index;
+#endif /* FLEXIWAN_FEATURE - tap_inject_virtio */
+
 #ifdef FLEXIWAN_FEATURE /* nat-tap-inject-output */
   u32 * sw_if_index_to_ip4_output;
   u32 ip4_output_tap_node_index;
@@ -137,6 +157,35 @@ u32 tap_inject_lookup_tap_fd (u32 sw_if_index);
 u32 tap_inject_lookup_sw_if_index_from_tap_fd (u32 tap_fd);
 u32 tap_inject_lookup_sw_if_index_from_tap_if_index (u32 tap_if_index);
 
+#ifdef FLEXIWAN_FEATURE /* tap_inject_virtio */
+void tap_inject_insert_virtio (u32 sw_if_index, u32 virtio_sw_if_index);
+void tap_inject_delete_virtio (u32 sw_if_index);
+
+/*
+ * The lookups are done by the tx nodes on workers, so unlike the tap fd
+ * lookups they never resize the vectors.
+ */
+static inline u32
+tap_inject_lookup_virtio_sw_if_index (u32 sw_if_index)
+{
+  tap_inject_main_t * im = tap_inject_get_main ();
+
+  if (sw_if_index >= vec_len (im->sw_if_index_to_virtio_sw_if_index))
+    return ~0;
+  return im->sw_if_index_to_virtio_sw_if_index[sw_if_index];
+}
+
+static inline u32
+tap_inject_lookup_sw_if_index_from_virtio (u32 virtio_sw_if_index)
+{
+  tap_inject_main_t * im = tap_inject_get_main ();
+
+  if (virtio_sw_if_index >= vec_len (im->virtio_sw_if_index_to_sw_if_index))
+    return ~0;
+  return im->virtio_sw_if_index_to_sw_if_index[virtio_sw_if_index];
+}
+#endif /* FLEXIWAN_FEATURE - tap_inject_virtio */
+
 void tap_inject_vlan_sw_if_index_add_del (u16 vlan, u32 parent_sw_if_index, u32 vlan_sw_if_index, u32 add);
 u32 tap_inject_vlan_sw_if_index_get (u16 vlan, u32 parent_sw_if_index);
 
@@ -22,6 +22,13 @@
  *   - fixed deletion of ARP entries on RTM_NEWNEIGH and RTM_DELNEIGH netlink
  *     messages - see add_del_neigh() function.
  *   - fixed deletion of static ARP entries not installed by us.
+ *
+ *  List of features made for FlexiWAN (denoted by FLEXIWAN_FEATURE flag):
+ *   - tap_inject_route_batch: route add/del events received from netlink are
+ *     collected for a short window and applied to the FIB in one pass.
+ *     Pairs of add and del of the same path within the window cancel out,
+ *     and all paths of the same prefix are added or removed by single FIB
+ *     call, so the prefix is updated and back-walked once per batch.
  */
 
 #include <librtnl/netns.h>
@@ -38,6 +45,343 @@
 
 #include "tap_inject.h"
 
+#ifdef FLEXIWAN_FEATURE /* tap_inject_route_batch */
+#include <vppinfra/mhash.h>
+
+/*
+ * The FIB identifies path by next hop, interface and weight,
+ * see fib_path_cmp_w_route_path(). The batch uses the same identity,
+ * so the add and the del of the same key refer to the same FIB path.
+ */
+typedef struct {
+  u32 fib_index;
+  ip4_address_t dst;
+  u32 dst_len;
+  ip4_address_t nh;
+  u32 sw_if_index;
+  u32 weight;
+} tap_inject_route_key_t;
+
+#define TAP_INJECT_ROUTE_OP_F_DEL (1 << 0)
+#define TAP_INJECT_ROUTE_OP_F_ADD (1 << 1)
+
+typedef struct {
+  tap_inject_route_key_t key;
+  fib_prefix_t prefix;
+  fib_route_path_t del_path;   /* valid if TAP_INJECT_ROUTE_OP_F_DEL is set */
+  fib_route_path_t add_path;   /* valid if TAP_INJECT_ROUTE_OP_F_ADD is set */
+  u8 flags;
+} tap_inject_route_op_t;
+
+#define TAP_INJECT_ROUTE_BATCH_WINDOW_DEFAULT 0.01  /* 10 msec */
+#define TAP_INJECT_ROUTE_BATCH_MAX_DEFAULT    65536
+
+typedef struct {
+  tap_inject_route_op_t * ops;
+  mhash_t op_index_by_key;
+  u32 * flush_indices;
+  fib_route_path_t * adds;
+  fib_route_path_t * dels;
+  fib_route_path_t * readds;
+
+  /* window to collect events in, 0 disables batching */
+  f64 window;
+  u32 max_ops;
+  u8 process_signalled;
+
+  /* statistics */
+  u64 n_events;
+  u64 n_cancelled;
+  u64 n_flushes;
+  u64 n_fib_calls;
+} tap_inject_route_batch_t;
+
+static tap_inject_route_batch_t tap_inject_route_batch;
+
+static vlib_node_registration_t tap_inject_route_batch_node;
+
+static_always_inline int
+tap_inject_route_batch_is_enabled (void)
+{
+  return tap_inject_route_batch.window > 0;
+}
+
+static void
+tap_inject_route_op_free (tap_inject_route_op_t * op)
+{
+  tap_inject_route_batch_t * rb = &tap_inject_route_batch;
+
+  if (op->flags & TAP_INJECT_ROUTE_OP_F_DEL)
+    vec_free (op->del_path.frp_label_stack);
+  if (op->flags & TAP_INJECT_ROUTE_OP_F_ADD)
+    vec_free (op->add_path.frp_label_stack);
+
+  mhash_unset (&rb->op_index_by_key, &op->key, 0);
+  pool_put (rb->ops, op);
+}
+
+static int
+tap_inject_route_path_attrs_equal (const fib_route_path_t * p1,
+                                   const fib_route_path_t * p2)
+{
+  if (p1->frp_preference != p2->frp_preference)
+    return 0;
+  if (vec_len (p1->frp_label_stack) != vec_len (p2->frp_label_stack))
+    return 0;
+  return !memcmp (p1->frp_label_stack, p2->frp_label_stack,
+                  vec_len (p1->frp_label_stack) * sizeof (p1->frp_label_stack[0]));
+}
+
+static int
+tap_inject_route_op_prefix_cmp (const tap_inject_route_op_t * op1,
+                                const tap_inject_route_op_t * op2)
+{
+  if (op1->key.fib_index != op2->key.fib_index)
+    return op1->key.fib_index < op2->key.fib_index ? -1 : 1;
+  if (op1->key.dst.as_u32 != op2->key.dst.as_u32)
+    return op1->key.dst.as_u32 < op2->key.dst.as_u32 ? -1 : 1;
+  if (op1->key.dst_len != op2->key.dst_len)
+    return op1->key.dst_len < op2->key.dst_len ? -1 : 1;
+  return 0;
+}
+
+static int
+tap_inject_route_op_index_cmp (void * a1, void * a2)
+{
+  tap_inject_route_batch_t * rb = &tap_inject_route_batch;
+
+  return tap_inject_route_op_prefix_cmp (pool_elt_at_index (rb->ops, *(u32 *)a1),
+                                         pool_elt_at_index (rb->ops, *(u32 *)a2));
+}
+
+/*
+ * Applies the collected operations to the FIB. Operations are grouped by
+ * prefix, so every prefix gets at most three FIB calls per batch.
+ * The new paths are added before the old are removed, so the prefix that
+ * moves to a different next hop is never left without path.
+ * The paths that change only their attributes (preference, labels) have to
+ * be removed before they are added back, as the FIB considers them equal.
+ */
+static void
+tap_inject_route_batch_flush (void)
+{
+  tap_inject_route_batch_t * rb = &tap_inject_route_batch;
+  vnet_main_t * vnm = vnet_get_main ();
+  tap_inject_route_op_t * op, * first;
+  u32 i, j, index;
+
+  rb->process_signalled = 0;
+
+  if (pool_elts (rb->ops) == 0)
+    return;
+
+  vec_reset_length (rb->flush_indices);
+  pool_foreach_index (index, rb->ops)
+    {
+      vec_add1 (rb->flush_indices, index);
+    }
+  vec_sort_with_function (rb->flush_indices, tap_inject_route_op_index_cmp);
+
+  for (i = 0; i < vec_len (rb->flush_indices); i = j)
+    {
+      first = pool_elt_at_index (rb->ops, rb->flush_indices[i]);
+
+      vec_reset_length (rb->adds);
+      vec_reset_length (rb->dels);
+      vec_reset_length (rb->readds);
+
+      for (j = i; j < vec_len (rb->flush_indices); j++)
+        {
+          op = pool_elt_at_index (rb->ops, rb->flush_indices[j]);
+          if (tap_inject_route_op_prefix_cmp (first, op))
+            break;
+
+          if (op->flags & TAP_INJECT_ROUTE_OP_F_DEL)
+            vec_add1 (rb->dels, op->del_path);
+
+          /* The interface might be deleted while the path was waiting */
+          if (!(op->flags & TAP_INJECT_ROUTE_OP_F_ADD) ||
+              !vnet_get_sw_interface_or_null (vnm, op->key.sw_if_index))
+            continue;
+
+          if (op->flags & TAP_INJECT_ROUTE_OP_F_DEL)
+            vec_add1 (rb->readds, op->add_path);
+          else
+            vec_add1 (rb->adds, op->add_path);
+        }
+
+      if (vec_len (rb->adds))
+        {
+          fib_table_entry_path_add2 (first->key.fib_index, &first->prefix,
+                                     FIB_SOURCE_API, FIB_ENTRY_FLAG_NONE,
+                                     rb->adds);
+          rb->n_fib_calls++;
+        }
+      if (vec_len (rb->dels))
+        {
+          fib_table_entry_path_remove2 (first->key.fib_index, &first->prefix,
+                                        FIB_SOURCE_API, rb->dels);
+          rb->n_fib_calls++;
+        }
+      if (vec_len (rb->readds))
+        {
+          fib_table_entry_path_add2 (first->key.fib_index, &first->prefix,
+                                     FIB_SOURCE_API, FIB_ENTRY_FLAG_NONE,
+                                     rb->readds);
+          rb->n_fib_calls++;
+        }
+    }
+
+  vec_foreach_index (i, rb->flush_indices)
+    {
+      tap_inject_route_op_free (pool_elt_at_index (rb->ops, rb->flush_indices[i]));
+    }
+
+  rb->n_flushes++;
+}
+
+/*
+ * Merges the route path operation into the batch. The batch takes ownership
+ * of the path label stack.
+ */
+static void
+tap_inject_route_batch_add (u32 fib_index, fib_prefix_t * prefix,
+                            fib_route_path_t * rpath, int is_del)
+{
+  tap_inject_route_batch_t * rb = &tap_inject_route_batch;
+  tap_inject_route_key_t key;
+  tap_inject_route_op_t * op;
+  uword * p;
+
+  clib_memset (&key, 0, sizeof (key));
+  key.fib_index = fib_index;
+  key.dst = prefix->fp_addr.ip4;
+  key.dst_len = prefix->fp_len;
+  key.nh = rpath->frp_addr.ip4;
+  key.sw_if_index = rpath->frp_sw_if_index;
+  key.weight = rpath->frp_weight;
+
+  rb->n_events++;
+
+  p = mhash_get (&rb->op_index_by_key, &key);
+  if (!p)
+    {
+      pool_get_zero (rb->ops, op);
+      op->key = key;
+      op->prefix = *prefix;
+      if (is_del)
+        {
+          op->flags = TAP_INJECT_ROUTE_OP_F_DEL;
+          op->del_path = *rpath;
+        }
+      else
+        {
+          op->flags = TAP_INJECT_ROUTE_OP_F_ADD;
+          op->add_path = *rpath;
+        }
+      mhash_set (&rb->op_index_by_key, &key, op - rb->ops, 0);
+    }
+  else
+    {
+      op = pool_elt_at_index (rb->ops, p[0]);
+
+      if (is_del)
+        {
+          if (op->flags == TAP_INJECT_ROUTE_OP_F_ADD)
+            {
+              /* Path added within the window is deleted - nothing to do */
+              vec_free (rpath->frp_label_stack);
+              tap_inject_route_op_free (op);
+              rb->n_cancelled += 2;
+              return;
+            }
+
+          /* Drop the pending re-add, keep the first del */
+          if (op->flags & TAP_INJECT_ROUTE_OP_F_ADD)
+            {
+              vec_free (op->add_path.frp_label_stack);
+              op->flags &= ~TAP_INJECT_ROUTE_OP_F_ADD;
+              rb->n_cancelled++;
+            }
+          vec_free (rpath->frp_label_stack);
+          rb->n_cancelled++;
+        }
+      else
+        {
+          if (op->flags & TAP_INJECT_ROUTE_OP_F_ADD)
+            {
+              vec_free (op->add_path.frp_label_stack);
+              rb->n_cancelled++;
+            }
+
+          if (op->flags & TAP_INJECT_ROUTE_OP_F_DEL &&
+              tap_inject_route_path_attrs_equal (&op->del_path, rpath))
+            {
+              /* Path flapped back to what the FIB has already */
+              vec_free (rpath->frp_label_stack);
+              tap_inject_route_op_free (op);
+              rb->n_cancelled += 2;
+              return;
+            }
+
+          op->flags |= TAP_INJECT_ROUTE_OP_F_ADD;
+          op->add_path = *rpath;
+        }
+    }
+
+  if (pool_elts (rb->ops) >= rb->max_ops)
+    {
+      tap_inject_route_batch_flush ();
+    }
+  else if (!rb->process_signalled)
+    {
+      vlib_process_signal_event (vlib_get_main (),
+                                 tap_inject_route_batch_node.index, 0, 0);
+      rb->process_signalled = 1;
+    }
+}
+
+static uword
+tap_inject_route_batch_process (vlib_main_t * vm, vlib_node_runtime_t * node,
+                                vlib_frame_t * frame)
+{
+  tap_inject_route_batch_t * rb = &tap_inject_route_batch;
+
+  while (1)
+    {
+      vlib_process_wait_for_event (vm);
+      vlib_process_get_events (vm, NULL);
+
+      /* Let the rest of the burst come in */
+      if (rb->window > 0)
+        vlib_process_suspend (vm, rb->window);
+
+      tap_inject_route_batch_flush ();
+    }
+  return 0;
+}
+
+VLIB_REGISTER_NODE (tap_inject_route_batch_node, static) = {
+  .function = tap_inject_route_batch_process,
+  .name = "tap-inject-route-batch-process",
+  .type = VLIB_NODE_TYPE_PROCESS,
+};
+
+static clib_error_t *
+tap_inject_route_batch_init (vlib_main_t * vm)
+{
+  tap_inject_route_batch_t * rb = &tap_inject_route_batch;
+
+  mhash_init (&rb->op_index_by_key, sizeof (uword),
+              sizeof (tap_inject_route_key_t));
+  rb->window = TAP_INJECT_ROUTE_BATCH_WINDOW_DEFAULT;
+  rb->max_ops = TAP_INJECT_ROUTE_BATCH_MAX_DEFAULT;
+  return 0;
+}
+
+VLIB_INIT_FUNCTION (tap_inject_route_batch_init);
+#endif /* FLEXIWAN_FEATURE - tap_inject_route_batch */
+
 static void
 add_del_addr (ns_addr_t * a, int is_del)
 {
@@ -311,6 +655,14 @@ add_del_fib (u32 sw_if_index, unsigned char rtm_family, unsigned char rtm_dst_le
       rpath.frp_fib_index = 0;
     }
 
+#ifdef FLEXIWAN_FEATURE /* tap_inject_route_batch */
+  if (tap_inject_route_batch_is_enabled ())
+    {
+      tap_inject_route_batch_add (fib_index, &prefix, &rpath, is_del);
+      return;
+    }
+#endif /* FLEXIWAN_FEATURE - tap_inject_route_batch */
+
   vec_add1(rpaths, rpath);
 
   if (is_del)
@@ -421,6 +773,13 @@ netns_notify_cb (void * obj, netns_type_t type, u32 flags, uword opaque)
     clib_warning("%s: flags %x", netns_type_strings[type], flags);
   }
 
+#ifdef FLEXIWAN_FEATURE /* tap_inject_route_batch */
+  /* Routes may depend on the addresses, links and neighbors,
+     so keep the order of the other events relative to the routes */
+  if (type != NETNS_TYPE_ROUTE)
+    tap_inject_route_batch_flush ();
+#endif /* FLEXIWAN_FEATURE - tap_inject_route_batch */
+
   if (type == NETNS_TYPE_ADDR)
     add_del_addr ((ns_addr_t *)obj, flags & NETNS_F_DEL);
 
@@ -445,3 +804,67 @@ tap_inject_enable_netlink (void)
 
   netns_open (&nsname, &sub);
 }
+
+#ifdef FLEXIWAN_FEATURE /* tap_inject_route_batch */
+static clib_error_t *
+tap_inject_route_batch_cli (vlib_main_t * vm, unformat_input_t * input,
+                            vlib_cli_command_t * cmd)
+{
+  tap_inject_route_batch_t * rb = &tap_inject_route_batch;
+  u32 window_msec = ~0, max_ops = ~0;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "window %u", &window_msec))
+        ;
+      else if (unformat (input, "max %u", &max_ops))
+        ;
+      else if (unformat (input, "disable"))
+        window_msec = 0;
+      else
+        return clib_error_return (0, "unknown input '%U'",
+                                  format_unformat_error, input);
+    }
+
+  if (max_ops == 0)
+    return clib_error_return (0, "max should be greater than 0");
+
+  if (max_ops != ~0)
+    rb->max_ops = max_ops;
+  if (window_msec != ~0)
+    rb->window = window_msec * 1e-3;
+
+  /* Apply what was collected under the previous settings */
+  tap_inject_route_batch_flush ();
+  return 0;
+}
+
+VLIB_CLI_COMMAND (tap_inject_route_batch_cmd, static) = {
+  .path = "tap-inject route-batch",
+  .short_help = "tap-inject route-batch [window <msec>] [max <n>] [disable]",
+  .function = tap_inject_route_batch_cli,
+};
+
+static clib_error_t *
+show_tap_inject_route_batch_cli (vlib_main_t * vm, unformat_input_t * input,
+                                 vlib_cli_command_t * cmd)
+{
+  tap_inject_route_batch_t * rb = &tap_inject_route_batch;
+
+  if (tap_inject_route_batch_is_enabled ())
+    vlib_cli_output (vm, "window %.0f msec, max %u, pending %u",
+                     rb->window * 1e3, rb->max_ops, pool_elts (rb->ops));
+  else
+    vlib_cli_output (vm, "disabled");
+
+  vlib_cli_output (vm, "events %llu, cancelled %llu, flushes %llu, fib calls %llu",
+                   rb->n_events, rb->n_cancelled, rb->n_flushes, rb->n_fib_calls);
+  return 0;
+}
+
+VLIB_CLI_COMMAND (show_tap_inject_route_batch_cmd, static) = {
+  .path = "show tap-inject route-batch",
+  .short_help = "show tap-inject route-batch",
+  .function = show_tap_inject_route_batch_cli,
+};
+#endif /* FLEXIWAN_FEATURE - tap_inject_route_batch */
@@ -17,7 +17,8 @@
 /*
  *  Copyright (C) 2019 flexiWAN Ltd.
  *  List of fixes made for FlexiWAN (denoted by FLEXIWAN_FIX flag):
- *   - add support in fragmented packets designated for TAP
+ *   - add support in fragmented packets designated for TAP: the buffer chain
+ *   is written into TAP by single scatter-gather writev()
  *   - fix b->current to enable packets received on L2GRE to be pushed into TAP
  *   - enable VxLan decapsulation before packets are pushed into TAP
  *
@@ -27,6 +28,10 @@
  *   - enable_acl_based_classification: Classifies packet using classifier_acls
  *   plugin. The exported classifier_acls plugin API is used to perform the
  *   classification function.
+ *   - tap_inject_virtio: exchange packets with Linux through the tapv2
+ *   interface that backs the tap-inject interface. The packets to Linux are
+ *   enqueued to the tapv2 output in one frame, the packets from Linux come
+ *   into the tap-inject-virtio-rx node in frames redirected by virtio-input.
  */
 
 /*
@@ -43,15 +48,16 @@
 
 #include <netinet/in.h>
 #include <vlib/vlib.h>
-#ifdef FLEXIWAN_FIX
 #include <sys/uio.h>
-#endif /* FLEXIWAN_FIX */
 #include <vnet/ethernet/arp_packet.h>
 #include <linux/if_tun.h>
 
 vlib_node_registration_t tap_inject_rx_node;
 vlib_node_registration_t tap_inject_tx_node;
 vlib_node_registration_t tap_inject_neighbor_node;
+#ifdef FLEXIWAN_FEATURE /* tap_inject_virtio */
+vlib_node_registration_t tap_inject_virtio_rx_node;
+#endif /* FLEXIWAN_FEATURE - tap_inject_virtio */
 
 enum {
 #ifndef FLEXIWAN_FEATURE   /* enable VRRP */
@@ -98,64 +104,47 @@ ip4_ttl_inc (vlib_buffer_t * b, ip4_header_t * ip)
 }
 
 #ifdef FLEXIWAN_FIX
+/* Enough for 64KB GSO packet in the default 2KB buffers. */
+#define TAP_INJECT_TX_MAX_SEGMENTS 64
+
+/*
+ * Writes the packet into the tap. The chained buffers are gathered by writev()
+ * right from the buffers data, so jumbo and GSO packets are written without
+ * allocation and copy.
+ */
 static inline void
 tap_inject_tap_send_buffer (vlib_main_t * vm, int fd, vlib_buffer_t * b)
 {
-  struct iovec iov;
+  struct iovec iov[TAP_INJECT_TX_MAX_SEGMENTS];
+  u32 n_iov = 0;
   ssize_t n_bytes;
-  u8 *    reassembled_buffer = 0;
-
-  iov.iov_base = vlib_buffer_get_current (b);
-  iov.iov_len = b->current_length;
-
-  // Handle fragmented packet:
-  // Calculate total lenght, allocate buffer and copy all fragments into it.
-  // TODO: use static buffer per thread.
-  /* Handle fragmented packet */
-  if (b->flags & VLIB_BUFFER_NEXT_PRESENT)
-  {
-    u16             total_length = 0;
-    vlib_buffer_t * b_curr = b;
-    u8 *            p_buff;
+  ssize_t length = 0;
 
-    while (b_curr->flags & VLIB_BUFFER_NEXT_PRESENT)
+  while (1)
     {
-      total_length += b_curr->current_length;
-      b_curr = vlib_get_buffer (vm, b_curr->next_buffer);
-    }
-    total_length += b_curr->current_length;
+      if (PREDICT_FALSE (n_iov == TAP_INJECT_TX_MAX_SEGMENTS))
+        {
+          clib_warning ("buffer chain is longer than %d segments",
+                        TAP_INJECT_TX_MAX_SEGMENTS);
+          return;
+        }
 
-    reassembled_buffer = clib_mem_alloc (total_length);
-    if (reassembled_buffer == 0)
-    {
-      clib_warning ("clib_mem_alloc (total_length=%d)failed", total_length);
-      return;
+      iov[n_iov].iov_base = vlib_buffer_get_current (b);
+      iov[n_iov].iov_len = b->current_length;
+      length += b->current_length;
+      n_iov++;
+
+      if (!(b->flags & VLIB_BUFFER_NEXT_PRESENT))
+        break;
+      b = vlib_get_buffer (vm, b->next_buffer);
     }
 
-    b_curr = b;
-    p_buff = reassembled_buffer;
-    do
-    {
-      clib_memcpy_fast(p_buff, b_curr->data + b_curr->current_data, b_curr->current_length);
-      p_buff += b_curr->current_length;
-    } while ((b_curr->flags & VLIB_BUFFER_NEXT_PRESENT) &&
-       (b_curr = vlib_get_buffer (vm, b_curr->next_buffer)));
-
-    iov.iov_base = reassembled_buffer;
-    iov.iov_len  = total_length;
-  }
-
-  n_bytes = writev (fd, &iov, 1);
+  n_bytes = writev (fd, iov, n_iov);
 
   if (n_bytes < 0)
     clib_warning ("writev failed");
-  // Handle fragmented packet
-  //else if (n_bytes < b->current_length || b->flags & VLIB_BUFFER_NEXT_PRESENT)
-  else if (n_bytes < b->current_length)
+  else if (n_bytes < length)
     clib_warning ("buffer truncated");
-
-  if (reassembled_buffer)
-    clib_mem_free(reassembled_buffer);
 }
 #else
 static inline void
@@ -176,6 +165,29 @@ tap_inject_tap_send_buffer (int fd, vlib_buffer_t * b)
 }
 #endif /* FLEXIWAN_FIX */
 
+#ifdef FLEXIWAN_FEATURE /* tap_inject_virtio */
+/*
+ * Sends buffers into Linux through the tapv2 interfaces set in
+ * sw_if_index[VLIB_TX]. The interface-output dispatches them to the tapv2 tx
+ * node, that posts them into vring as they are, chained buffers included.
+ */
+static_always_inline void
+tap_inject_virtio_send (vlib_main_t * vm, u32 * buffers, u32 n_buffers)
+{
+  tap_inject_main_t * im = tap_inject_get_main ();
+  vlib_frame_t * frame;
+
+  if (n_buffers == 0)
+    return;
+
+  frame = vlib_get_frame_to_node (vm, im->interface_output_node_index);
+  clib_memcpy_fast (vlib_frame_vector_args (frame), buffers,
+                    n_buffers * sizeof (buffers[0]));
+  frame->n_vectors = n_buffers;
+  vlib_put_frame_to_node (vm, im->interface_output_node_index, frame);
+}
+#endif /* FLEXIWAN_FEATURE - tap_inject_virtio */
+
 #ifdef FLEXIWAN_FIX
 static int
 is_vrrp_buffer(vlib_buffer_t * b)
@@ -214,12 +226,19 @@ tap_inject_tx (vlib_main_t * vm, vlib_node_runtime_t * node, vlib_frame_t * f)
   u32 * pkts;
   u32 fd;
   u32 i;
-#ifdef FLEXIWAN_FIX
   u32 bi;
+#ifdef FLEXIWAN_FIX
   u32 next_index = node->cached_next_index;
   u32 next;
   u32 n_left;
   u32 * to_next;
+  u32 to_free[VLIB_FRAME_SIZE];
+  u32 n_free = 0;
+#ifdef FLEXIWAN_FEATURE /* tap_inject_virtio */
+  u32 to_virtio[VLIB_FRAME_SIZE];
+  u32 n_virtio = 0;
+  u32 virtio_sw_if_index;
+#endif /* FLEXIWAN_FEATURE - tap_inject_virtio */
 #endif /*#ifdef FLEXIWAN_FIX*/
 
   pkts = vlib_frame_vector_args (f);
@@ -230,11 +249,20 @@ tap_inject_tx (vlib_main_t * vm, vlib_node_runtime_t * node, vlib_frame_t * f)
       b = vlib_get_buffer (vm, bi);
 
       fd = tap_inject_lookup_tap_fd (vnet_buffer (b)->sw_if_index[VLIB_RX]);
+#ifdef FLEXIWAN_FIX
+#ifdef FLEXIWAN_FEATURE /* tap_inject_virtio */
+      virtio_sw_if_index =
+        tap_inject_lookup_virtio_sw_if_index (vnet_buffer (b)->sw_if_index[VLIB_RX]);
+      if (fd == ~0 && virtio_sw_if_index == ~0)
+#else
       if (fd == ~0)
-        continue;
+#endif /* FLEXIWAN_FEATURE - tap_inject_virtio */
+        {
+          to_free[n_free++] = bi;
+          continue;
+        }
 
       /* Re-wind the buffer to the start of the Ethernet header. */
-#ifdef FLEXIWAN_FIX
       // The '-b->current_data' assumes that packet is regular L2-L3-APP packet.
       // This is not true in case of l2gre.
       // The packet that comes out of L2-GRE Tunnel (ipsec-gre node)
@@ -271,11 +299,38 @@ tap_inject_tx (vlib_main_t * vm, vlib_node_runtime_t * node, vlib_frame_t * f)
         continue;
       }
 
+#ifdef FLEXIWAN_FEATURE /* tap_inject_virtio */
+      if (virtio_sw_if_index != ~0)
+        {
+          vnet_buffer (b)->sw_if_index[VLIB_TX] = virtio_sw_if_index;
+          to_virtio[n_virtio++] = bi;
+          continue;
+        }
+#endif /* FLEXIWAN_FEATURE - tap_inject_virtio */
+
       tap_inject_tap_send_buffer (vm, fd, b);
-#endif /* FLEXIWAN_FIX */
+      to_free[n_free++] = bi;
+#else
+      if (fd == ~0)
+        {
+          vlib_buffer_free (vm, &bi, 1);
+          continue;
+        }
+
+      /* Re-wind the buffer to the start of the Ethernet header. */
+      vlib_buffer_advance (b, -b->current_data);
+      tap_inject_tap_send_buffer (fd, b);
       vlib_buffer_free (vm, &bi, 1);
+#endif /* FLEXIWAN_FIX */
     }
 
+#ifdef FLEXIWAN_FIX
+#ifdef FLEXIWAN_FEATURE /* tap_inject_virtio */
+  tap_inject_virtio_send (vm, to_virtio, n_virtio);
+#endif /* FLEXIWAN_FEATURE - tap_inject_virtio */
+  vlib_buffer_free (vm, to_free, n_free);
+#endif /* FLEXIWAN_FIX */
+
   return f->n_vectors;
 }
 
@@ -309,6 +364,13 @@ tap_inject_pppoe_tx (vlib_main_t * vm, vlib_node_runtime_t * node, vlib_frame_t
   u32 * pkts;
   u32 fd;
   u32 i;
+#ifdef FLEXIWAN_FEATURE /* tap_inject_virtio */
+  u32 to_virtio[VLIB_FRAME_SIZE];
+  u32 to_free[VLIB_FRAME_SIZE];
+  u32 n_virtio = 0;
+  u32 n_free = 0;
+  u32 virtio_sw_if_index;
+#endif /* FLEXIWAN_FEATURE - tap_inject_virtio */
 
   pkts = vlib_frame_vector_args (f);
 
@@ -316,6 +378,19 @@ tap_inject_pppoe_tx (vlib_main_t * vm, vlib_node_runtime_t * node, vlib_frame_t
     {
       b = vlib_get_buffer (vm, pkts[i]);
 
+#ifdef FLEXIWAN_FEATURE /* tap_inject_virtio */
+      virtio_sw_if_index =
+        tap_inject_lookup_virtio_sw_if_index (vnet_buffer (b)->sw_if_index[VLIB_RX]);
+      if (virtio_sw_if_index != ~0)
+        {
+          vlib_buffer_advance (b, -sizeof(ethernet_header_t));
+          vnet_buffer (b)->sw_if_index[VLIB_TX] = virtio_sw_if_index;
+          to_virtio[n_virtio++] = pkts[i];
+          continue;
+        }
+      to_free[n_free++] = pkts[i];
+#endif /* FLEXIWAN_FEATURE - tap_inject_virtio */
+
       fd = tap_inject_lookup_tap_fd (vnet_buffer (b)->sw_if_index[VLIB_RX]);
       if (fd == ~0) {
         clib_warning("FD is unknown, VLIB_RX %u", vnet_buffer (b)->sw_if_index[VLIB_RX]);
@@ -326,7 +401,12 @@ tap_inject_pppoe_tx (vlib_main_t * vm, vlib_node_runtime_t * node, vlib_frame_t
       tap_inject_tap_send_buffer (vm, fd, b);
     }
 
+#ifdef FLEXIWAN_FEATURE /* tap_inject_virtio */
+  tap_inject_virtio_send (vm, to_virtio, n_virtio);
+  vlib_buffer_free (vm, to_free, n_free);
+#else
   vlib_buffer_free (vm, pkts, f->n_vectors);
+#endif /* FLEXIWAN_FEATURE - tap_inject_virtio */
   return f->n_vectors;
 }
 
@@ -379,6 +459,14 @@ tap_inject_neighbor (vlib_main_t * vm,
   u32 next = ~0;
   u32 n_left;
   u32 * to_next;
+#ifdef FLEXIWAN_FEATURE /* tap_inject_virtio */
+  u32 to_virtio[VLIB_FRAME_SIZE];
+  u32 n_virtio = 0;
+  u32 virtio_sw_if_index;
+  vlib_buffer_t * c;
+#endif /* FLEXIWAN_FEATURE - tap_inject_virtio */
+  u32 to_free[VLIB_FRAME_SIZE];
+  u32 n_free = 0;
 
   pkts = vlib_frame_vector_args (f);
 
@@ -388,9 +476,15 @@ tap_inject_neighbor (vlib_main_t * vm,
       b = vlib_get_buffer (vm, bi);
 
       fd = tap_inject_lookup_tap_fd (vnet_buffer (b)->sw_if_index[VLIB_RX]);
+#ifdef FLEXIWAN_FEATURE /* tap_inject_virtio */
+      virtio_sw_if_index =
+        tap_inject_lookup_virtio_sw_if_index (vnet_buffer (b)->sw_if_index[VLIB_RX]);
+      if (fd == ~0 && virtio_sw_if_index == ~0)
+#else
       if (fd == ~0)
+#endif /* FLEXIWAN_FEATURE - tap_inject_virtio */
         {
-          vlib_buffer_free (vm, &bi, 1);
+          to_free[n_free++] = bi;
           continue;
         }
 
@@ -409,7 +503,12 @@ tap_inject_neighbor (vlib_main_t * vm,
       if (tap_inject_type_check(vnet_buffer (b)->sw_if_index[VLIB_RX], TAP_INJECT_VLAN))
         vlib_buffer_advance (b, -sizeof(ethernet_vlan_header_t));
 
+#ifdef FLEXIWAN_FEATURE /* tap_inject_virtio */
+      if (virtio_sw_if_index == ~0)
+        tap_inject_tap_send_buffer (vm, fd, b);
+#else
       tap_inject_tap_send_buffer (vm, fd, b);
+#endif /* FLEXIWAN_FEATURE - tap_inject_virtio */
 #endif /* FLEXIWAN_FIX */
       /* Send the buffer to a neighbor node too? */
       {
@@ -438,9 +537,28 @@ tap_inject_neighbor (vlib_main_t * vm,
           }
       }
 
+#ifdef FLEXIWAN_FEATURE /* tap_inject_virtio */
+      /*
+       * The tapv2 takes the buffer itself, so if the neighbor node needs it
+       * too, Linux gets a copy. These are ARP replies and ND advertisements
+       * only.
+       */
+      if (virtio_sw_if_index != ~0)
+        {
+          c = (next == ~0) ? b : vlib_buffer_copy (vm, b);
+          if (c)
+            {
+              vnet_buffer (c)->sw_if_index[VLIB_TX] = virtio_sw_if_index;
+              to_virtio[n_virtio++] = (c == b) ? bi : vlib_get_buffer_index (vm, c);
+            }
+          if (next == ~0)
+            continue;
+        }
+#endif /* FLEXIWAN_FEATURE - tap_inject_virtio */
+
       if (next == ~0)
         {
-          vlib_buffer_free (vm, &bi, 1);
+          to_free[n_free++] = bi;
           continue;
         }
 
@@ -457,6 +575,11 @@ tap_inject_neighbor (vlib_main_t * vm,
       vlib_put_next_frame (vm, node, next_index, n_left);
     }
 
+#ifdef FLEXIWAN_FEATURE /* tap_inject_virtio */
+  tap_inject_virtio_send (vm, to_virtio, n_virtio);
+#endif /* FLEXIWAN_FEATURE - tap_inject_virtio */
+  vlib_buffer_free (vm, to_free, n_free);
+
   return f->n_vectors;
 }
 
@@ -509,68 +632,17 @@ tap_rx_ip4_output_tap_worker_offset (tap_inject_main_t * tm, ip4_header_t * ip4)
 }
 #endif /* FLEXIWAN_FEATURE */
 
-#define MTU 1500
-#define MTU_BUFFERS ((MTU + VLIB_BUFFER_DEFAULT_DATA_SIZE - 1) / VLIB_BUFFER_DEFAULT_DATA_SIZE)
-#define NUM_BUFFERS_TO_ALLOC 32
-
-static inline uword
-tap_rx (vlib_main_t * vm, vlib_node_runtime_t * node, vlib_frame_t * f, int fd)
+/*
+ * Prepares the packet received from Linux on the sw_if_index tap for the data
+ * plane and returns the node it should be injected into. Returns ~0 if the
+ * packet should be handed off to ip4-output-tap-inject on *thread_index.
+ */
+static_always_inline u32
+tap_inject_rx_next_node (vlib_main_t * vm, vlib_node_runtime_t * node,
+                         vlib_buffer_t * b, u32 sw_if_index,
+                         u16 * thread_index)
 {
   tap_inject_main_t * im = tap_inject_get_main ();
-  u32 sw_if_index;
-  struct iovec iov[MTU_BUFFERS];
-  u32 bi[MTU_BUFFERS];
-  vlib_buffer_t * b;
-  ssize_t n_bytes;
-  ssize_t n_bytes_left;
-  u32 i, j;
-
-  sw_if_index = tap_inject_lookup_sw_if_index_from_tap_fd (fd);
-  if (sw_if_index == ~0)
-    {
-      clib_warning ("failed to lookup sw_if_index, tap_fd %d", fd);
-      return 0;
-    }
-
-  /* Allocate buffers in bulk when there are less than enough to rx an MTU. */
-  if (vec_len (im->rx_buffers) < MTU_BUFFERS)
-    {
-      u32 len = vec_len (im->rx_buffers);
-
-      len = vlib_buffer_alloc_on_numa (vm,
-            &im->rx_buffers[len], NUM_BUFFERS_TO_ALLOC,
-            vm->numa_node);
-
-      _vec_len (im->rx_buffers) += len;
-
-      if (vec_len (im->rx_buffers) < MTU_BUFFERS)
-        {
-          clib_warning ("failed to allocate buffers");
-          return 0;
-        }
-    }
-
-  /* Fill buffers from the end of the list to make it easier to resize. */
-  for (i = 0, j = vec_len (im->rx_buffers) - 1; i < MTU_BUFFERS; ++i, --j)
-    {
-      vlib_buffer_t * b;
-
-      bi[i] = im->rx_buffers[j];
-
-      b = vlib_get_buffer (vm, bi[i]);
-
-      iov[i].iov_base = b->data;
-      iov[i].iov_len = VLIB_BUFFER_DEFAULT_DATA_SIZE;
-    }
-
-  n_bytes = readv (fd, iov, MTU_BUFFERS);
-  if (n_bytes < 0)
-    {
-      clib_warning ("readv failed");
-      return 0;
-    }
-
-  b = vlib_get_buffer (vm, bi[0]);
 
   // The Flexiwan peer feature pushes Linux packets into
   // ip4-input node and not into loopX-output.
@@ -601,15 +673,6 @@ tap_rx (vlib_main_t * vm, vlib_node_runtime_t * node, vlib_frame_t * f, int fd)
     vnet_buffer (b)->sw_if_index[VLIB_TX] = sw_if_index;
   }
 
-  n_bytes_left = n_bytes - VLIB_BUFFER_DEFAULT_DATA_SIZE;
-
-  if (n_bytes_left > 0)
-    {
-      b->total_length_not_including_first_buffer = n_bytes_left;
-      b->flags |= VLIB_BUFFER_TOTAL_LENGTH_VALID;
-    }
-
-  b->current_length = n_bytes;
   b->error = node->errors[0];
 #ifdef FLEXIWAN_FEATURE  /* enable_acl_based_classification */
   if (im->classifier_acls_fn)
@@ -639,26 +702,10 @@ tap_rx (vlib_main_t * vm, vlib_node_runtime_t * node, vlib_frame_t * f, int fd)
     }
 #endif /* FLEXIWAN_FEATURE - enable_acl_based_classification */
 
-  /* If necessary, configure any remaining buffers in the chain. */
-  for (i = 1; n_bytes_left > 0 && i < MTU_BUFFERS; ++i, n_bytes_left -= VLIB_BUFFER_DEFAULT_DATA_SIZE)
-    {
-      b = vlib_get_buffer (vm, bi[i - 1]);
-      b->current_length = VLIB_BUFFER_DEFAULT_DATA_SIZE;
-      b->flags |= VLIB_BUFFER_NEXT_PRESENT;
-      b->next_buffer = bi[i];
-
-      b = vlib_get_buffer (vm, bi[i]);
-      b->current_length = n_bytes_left;
-    }
-
-  _vec_len (im->rx_buffers) -= i;
-
 #ifdef FLEXIWAN_FEATURE /* nat-tap-inject-output */
   vnet_sw_interface_t * sw = vnet_get_sw_interface_or_null (vnet_get_main (), sw_if_index);
   vnet_hw_interface_t * hw = vnet_get_hw_interface (vnet_get_main (), sw->hw_if_index);
-  u32 output_handoff_index = hw->output_node_index;
   u32 ip4_output_set = 0;
-  u16 ip4_output_tap_thread_index;
   ip4_header_t *ip4 = NULL;
 
   if (tap_inject_type_check(sw_if_index, TAP_INJECT_TAP)) {
@@ -694,55 +741,143 @@ tap_rx (vlib_main_t * vm, vlib_node_runtime_t * node, vlib_frame_t * f, int fd)
     }
   }
 
+  // Packets are inserted into 'ip4-output-tap-inject' node if 'enable-ip4-output' feature is enabled.
   if (ip4_output_set) {
-    ip4_output_tap_thread_index = im->ip4_output_tap_first_worker_index +
-                                  tap_rx_ip4_output_tap_worker_offset (im, ip4);
-    output_handoff_index = im->ip4_output_tap_node_index;
+    if (im->num_workers) {
+      *thread_index = im->ip4_output_tap_first_worker_index +
+                      tap_rx_ip4_output_tap_worker_offset (im, ip4);
+      return ~0;
+    }
+    return im->ip4_output_tap_node_index;
+  }
+
+  // Packets are inserted into 'ip4-input' node if 'enable-ip4-output' feature is disabled.
+  if (!tap_inject_is_enabled_ip4_output(sw_if_index) &&
+      tap_inject_type_check(sw_if_index, TAP_INJECT_TUN)) {
+    return im->ip4_input_node_index;
   }
 
-  if ((ip4_output_set) && (im->num_workers))
+  return hw->output_node_index;
+#else
+  /* Get the packet to the output node. */
+  return vnet_get_hw_interface (vnet_get_main (), sw_if_index)->output_node_index;
+#endif /* FLEXIWAN_FEATURE */
+}
+
+#define MTU 1500
+#define MTU_BUFFERS ((MTU + VLIB_BUFFER_DEFAULT_DATA_SIZE - 1) / VLIB_BUFFER_DEFAULT_DATA_SIZE)
+#define NUM_BUFFERS_TO_ALLOC 32
+
+static inline uword
+tap_rx (vlib_main_t * vm, vlib_node_runtime_t * node, vlib_frame_t * f, int fd)
+{
+  tap_inject_main_t * im = tap_inject_get_main ();
+  u32 sw_if_index;
+  struct iovec iov[MTU_BUFFERS];
+  u32 bi[MTU_BUFFERS];
+  vlib_buffer_t * b;
+  ssize_t n_bytes;
+  ssize_t n_bytes_left;
+  u32 i, j;
+  u32 next_node_index;
+  u16 thread_index;
+
+  sw_if_index = tap_inject_lookup_sw_if_index_from_tap_fd (fd);
+  if (sw_if_index == ~0)
     {
-      vlib_buffer_enqueue_to_thread (vm, im->ip4_output_tap_queue_index, &bi[0],
-				     &ip4_output_tap_thread_index, 1, 1);
+      clib_warning ("failed to lookup sw_if_index, tap_fd %d", fd);
+      return 0;
     }
-  else
+
+  /* Allocate buffers in bulk when there are less than enough to rx an MTU. */
+  if (vec_len (im->rx_buffers) < MTU_BUFFERS)
     {
-      vlib_frame_t * new_frame;
-      u32 * to_next;
-      new_frame = vlib_get_frame_to_node (vm, output_handoff_index);
-      to_next = vlib_frame_vector_args (new_frame);
-      to_next[0] = bi[0];
-      new_frame->n_vectors = 1;
-
-      // Packets are inserted into 'ip4-input' node if 'enable-ip4-output' feature is disabled.
-      if (!tap_inject_is_enabled_ip4_output(sw_if_index) &&
-          tap_inject_type_check(sw_if_index, TAP_INJECT_TUN)) {
-        vlib_put_frame_to_node (vm, im->ip4_input_node_index, new_frame);
-      }
-      // Packets are inserted into 'ip4-output-tap-inject' node if 'enable-ip4-output' feature is enabled.
-      else {
-        vlib_put_frame_to_node (vm, output_handoff_index, new_frame);
-      }
+      u32 len = vec_len (im->rx_buffers);
+
+      len = vlib_buffer_alloc_on_numa (vm,
+            &im->rx_buffers[len], NUM_BUFFERS_TO_ALLOC,
+            vm->numa_node);
+
+      _vec_len (im->rx_buffers) += len;
+
+      if (vec_len (im->rx_buffers) < MTU_BUFFERS)
+        {
+          clib_warning ("failed to allocate buffers");
+          return 0;
+        }
     }
-#else
-  /* Get the packet to the output node. */
+
+  /* Fill buffers from the end of the list to make it easier to resize. */
+  for (i = 0, j = vec_len (im->rx_buffers) - 1; i < MTU_BUFFERS; ++i, --j)
+    {
+      vlib_buffer_t * b;
+
+      bi[i] = im->rx_buffers[j];
+
+      b = vlib_get_buffer (vm, bi[i]);
+
+      iov[i].iov_base = b->data;
+      iov[i].iov_len = VLIB_BUFFER_DEFAULT_DATA_SIZE;
+    }
+
+  n_bytes = readv (fd, iov, MTU_BUFFERS);
+  if (n_bytes < 0)
+    {
+      clib_warning ("readv failed");
+      return 0;
+    }
+
+  b = vlib_get_buffer (vm, bi[0]);
+
+  n_bytes_left = n_bytes - VLIB_BUFFER_DEFAULT_DATA_SIZE;
+
+  if (n_bytes_left > 0)
+    {
+      b->total_length_not_including_first_buffer = n_bytes_left;
+      b->flags |= VLIB_BUFFER_TOTAL_LENGTH_VALID;
+    }
+
+  b->current_length = n_bytes;
+
+  /* If necessary, configure any remaining buffers in the chain. */
+  for (i = 1; n_bytes_left > 0 && i < MTU_BUFFERS; ++i, n_bytes_left -= VLIB_BUFFER_DEFAULT_DATA_SIZE)
+    {
+      b = vlib_get_buffer (vm, bi[i - 1]);
+      b->current_length = VLIB_BUFFER_DEFAULT_DATA_SIZE;
+      b->flags |= VLIB_BUFFER_NEXT_PRESENT;
+      b->next_buffer = bi[i];
+
+      b = vlib_get_buffer (vm, bi[i]);
+      b->current_length = n_bytes_left;
+    }
+
+  _vec_len (im->rx_buffers) -= i;
+
+  b = vlib_get_buffer (vm, bi[0]);
+  next_node_index = tap_inject_rx_next_node (vm, node, b, sw_if_index,
+                                             &thread_index);
+
+#ifdef FLEXIWAN_FEATURE /* nat-tap-inject-output */
+  if (next_node_index == ~0)
+    {
+      vlib_buffer_enqueue_to_thread (vm, im->ip4_output_tap_queue_index, &bi[0],
+				     &thread_index, 1, 1);
+      return 1;
+    }
+#endif /* FLEXIWAN_FEATURE */
+
   {
-    vnet_hw_interface_t * hw;
     vlib_frame_t * new_frame;
     u32 * to_next;
 
-    hw = vnet_get_hw_interface (vnet_get_main (), sw_if_index);
-
-    new_frame = vlib_get_frame_to_node (vm, hw->output_node_index);
+    new_frame = vlib_get_frame_to_node (vm, next_node_index);
     to_next = vlib_frame_vector_args (new_frame);
     to_next[0] = bi[0];
     new_frame->n_vectors = 1;
 
-    vlib_put_frame_to_node (vm, hw->output_node_index, new_frame);
+    vlib_put_frame_to_node (vm, next_node_index, new_frame);
   }
 
-#endif /* FLEXIWAN_FEATURE */
-
   return 1;
 }
 
@@ -777,6 +912,120 @@ VLIB_REGISTER_NODE (tap_inject_rx_node) = {
   .vector_size = sizeof (u32),
 };
 
+#ifdef FLEXIWAN_FEATURE /* tap_inject_virtio */
+#define foreach_tap_inject_virtio_rx_error \
+_(RX, "packets received from Linux") \
+_(NO_TAP, "no tap-inject interface for tapv2")
+
+typedef enum
+{
+#define _(sym,str) TAP_INJECT_VIRTIO_RX_ERROR_##sym,
+  foreach_tap_inject_virtio_rx_error
+#undef _
+  TAP_INJECT_VIRTIO_RX_N_ERROR,
+} tap_inject_virtio_rx_error_t;
+
+static char *tap_inject_virtio_rx_error_strings[] = {
+#define _(sym,string) string,
+  foreach_tap_inject_virtio_rx_error
+#undef _
+};
+
+enum {
+  NEXT_VIRTIO_RX_DROP,
+};
+
+/*
+ * Gets frames received by virtio-input on the tapv2 interfaces and injects
+ * them into the data plane as tap_rx() does for packets read from tun/tap fd.
+ * The packets of one frame go to the same node usually, so they are enqueued
+ * by frames and not one by one.
+ */
+static uword
+tap_inject_virtio_rx (vlib_main_t * vm, vlib_node_runtime_t * node,
+                      vlib_frame_t * f)
+{
+  tap_inject_main_t * im = tap_inject_get_main ();
+  u32 * from = vlib_frame_vector_args (f);
+  u32 n_left = f->n_vectors;
+  u32 handoffs[VLIB_FRAME_SIZE], drops[VLIB_FRAME_SIZE];
+  u16 thread_indices[VLIB_FRAME_SIZE];
+  u32 n_handoffs = 0, n_drops = 0;
+  vlib_frame_t * to_frame = 0;
+  u32 to_node_index = ~0;
+  u32 * to_next = 0;
+  u32 sw_if_index, next_node_index, bi;
+  vlib_buffer_t * b;
+
+  while (n_left > 0)
+    {
+      if (n_left > 1)
+        vlib_prefetch_buffer_header (vlib_get_buffer (vm, from[1]), LOAD);
+
+      bi = from[0];
+      b = vlib_get_buffer (vm, bi);
+      from += 1;
+      n_left -= 1;
+
+      sw_if_index =
+        tap_inject_lookup_sw_if_index_from_virtio (vnet_buffer (b)->sw_if_index[VLIB_RX]);
+      if (PREDICT_FALSE (sw_if_index == ~0))
+        {
+          b->error = node->errors[TAP_INJECT_VIRTIO_RX_ERROR_NO_TAP];
+          drops[n_drops++] = bi;
+          continue;
+        }
+
+      next_node_index = tap_inject_rx_next_node (vm, node, b, sw_if_index,
+                                                 &thread_indices[n_handoffs]);
+      if (next_node_index == ~0)
+        {
+          handoffs[n_handoffs++] = bi;
+          continue;
+        }
+
+      if (PREDICT_FALSE (next_node_index != to_node_index))
+        {
+          if (to_frame)
+            vlib_put_frame_to_node (vm, to_node_index, to_frame);
+          to_frame = vlib_get_frame_to_node (vm, next_node_index);
+          to_next = vlib_frame_vector_args (to_frame);
+          to_node_index = next_node_index;
+        }
+      to_next[to_frame->n_vectors++] = bi;
+    }
+
+  if (to_frame)
+    vlib_put_frame_to_node (vm, to_node_index, to_frame);
+
+  if (n_handoffs)
+    vlib_buffer_enqueue_to_thread (vm, im->ip4_output_tap_queue_index,
+                                   handoffs, thread_indices, n_handoffs, 1);
+
+  if (n_drops)
+    vlib_buffer_enqueue_to_single_next (vm, node, drops, NEXT_VIRTIO_RX_DROP,
+                                        n_drops);
+
+  vlib_node_increment_counter (vm, node->node_index,
+                               TAP_INJECT_VIRTIO_RX_ERROR_RX,
+                               f->n_vectors - n_drops);
+  return f->n_vectors;
+}
+
+VLIB_REGISTER_NODE (tap_inject_virtio_rx_node) = {
+  .function = tap_inject_virtio_rx,
+  .name = "tap-inject-virtio-rx",
+  .vector_size = sizeof (u32),
+  .type = VLIB_NODE_TYPE_INTERNAL,
+  .n_errors = TAP_INJECT_VIRTIO_RX_N_ERROR,
+  .error_strings = tap_inject_virtio_rx_error_strings,
+  .n_next_nodes = 1,
+  .next_nodes = {
+    [NEXT_VIRTIO_RX_DROP] = "error-drop",
+  },
+};
+#endif /* FLEXIWAN_FEATURE - tap_inject_virtio */
+
 /**
  * @brief no-op lock function.
  */
@@ -823,6 +1072,11 @@ tap_inject_init (vlib_main_t * vm)
   im->rx_node_index = tap_inject_rx_node.index;
   im->tx_node_index = tap_inject_tx_node.index;
   im->neighbor_node_index = tap_inject_neighbor_node.index;
+#ifdef FLEXIWAN_FEATURE /* tap_inject_virtio */
+  im->virtio_rx_node_index = tap_inject_virtio_rx_node.index;
+  im->interface_output_node_index =
+    vlib_get_node_by_name (vm, (u8 *) "interface-output")->index;
+#endif /* FLEXIWAN_FEATURE - tap_inject_virtio */
 
   tap_inject_dpo_type = dpo_register_new_type (&tap_inject_vft, tap_inject_nodes);
 
@@ -18,6 +18,11 @@
  *  Copyright (C) 2022 flexiWAN Ltd.
  *  List of features made for FlexiWAN (denoted by FLEXIWAN_FEATURE flag):
  *   - fix memory leak with clib_file_add() on tap inject/delete
+ *   - tap_inject_virtio: back the Linux side of the interface by VPP tapv2
+ *   interface. The tapv2 driver exchanges packets with the kernel through
+ *   vhost-net rings: the whole frame is posted at once and buffer chains are
+ *   passed by descriptors, so there is no readv/writev per packet and no
+ *   copy. The tun/tap fd below is used if the tapv2 can't be created.
  */
 
 #include "tap_inject.h"
@@ -32,6 +37,11 @@
 #include <netinet/in.h>
 #include <vnet/unix/tuntap.h>
 #include <vlib/unix/unix.h>
+#ifdef FLEXIWAN_FEATURE /* tap_inject_virtio */
+#include <vnet/devices/netlink.h>
+#include <vnet/devices/virtio/virtio.h>
+#include <vnet/devices/tap/tap.h>
+#endif /* FLEXIWAN_FEATURE - tap_inject_virtio */
 
 
 static clib_error_t *
@@ -50,6 +60,101 @@ tap_inject_tap_read (clib_file_t * f)
 #define TAP_INJECT_TAP_BASE_NAME "vpp"
 #define TAP_INJECT_TUN_BASE_NAME "vpp_tun"
 
+#ifdef FLEXIWAN_FEATURE /* tap_inject_virtio */
+#define TAP_INJECT_VIRTIO_RING_SIZE 1024
+
+/*
+ * Creates tapv2 interface with the same name and MAC in Linux as the tun/tap
+ * created by tap_inject_tap_connect() would have. The tapv2 itself is hidden
+ * from tap-inject by the no-vppsb flag, it is used as the transport only.
+ */
+static clib_error_t *
+tap_inject_virtio_connect (vnet_hw_interface_t * hw)
+{
+  vlib_main_t * vm = vlib_get_main ();
+  vnet_main_t * vnet_main = vnet_get_main ();
+  tap_inject_main_t * im = tap_inject_get_main ();
+  vnet_sw_interface_t * sw = vnet_get_sw_interface (vnet_main, hw->sw_if_index);
+  tap_create_if_args_t args = { 0 };
+  vnet_hw_interface_t * virtio_hw;
+  virtio_if_t * vif;
+  clib_error_t * err;
+  u32 type;
+  u8 * name;
+
+  if (hw->hw_class_index == tun_device_hw_interface_class.index ||
+      vnet_hw_interface_get_flexiwan_flag(vnet_main, sw->hw_if_index, VNET_INTERFACE_FLEXIWAN_FLAG_VPPSB_TUN))
+    {
+      args.tap_flags = TAP_FLAG_TUN;
+      type = TAP_INJECT_TUN;
+    }
+  else
+    {
+      if (hw->hw_address)
+        mac_address_from_bytes (&args.host_mac_addr, hw->hw_address);
+      type = TAP_INJECT_TAP;
+    }
+
+  char * prefix = hw->hw_class_index == tun_device_hw_interface_class.index ?
+                  TAP_INJECT_TUN_BASE_NAME : TAP_INJECT_TAP_BASE_NAME;
+  name = format (0, "%s%u%c", prefix, sw->sw_if_index, 0);
+
+  args.id = ~0;
+  args.tap_flags |= TAP_FLAG_NO_VPPSB;
+  args.num_rx_queues = 1;
+  args.rx_ring_sz = TAP_INJECT_VIRTIO_RING_SIZE;
+  args.tx_ring_sz = TAP_INJECT_VIRTIO_RING_SIZE;
+  args.host_if_name = name;
+
+  tap_create_if (vm, &args);
+  if (args.rv)
+    {
+      vec_free (name);
+      if (args.error)
+        return args.error;
+      return clib_error_return (0, "failed to create tapv2 for %U: %d",
+                                format_vnet_sw_interface_name, vnet_main, sw,
+                                args.rv);
+    }
+  clib_error_free (args.error);
+
+  virtio_hw = vnet_get_sup_hw_interface (vnet_main, args.sw_if_index);
+  vif = pool_elt_at_index (virtio_main.interfaces, virtio_hw->dev_instance);
+
+  /*
+   * The tun/tap fd created by tap_inject_tap_connect() is down until it is
+   * brought up from Linux, the tapv2 is created up. Keep it the same.
+   */
+  err = vnet_netlink_set_link_state (vif->ifindex, 0 /* DOWN */);
+  if (err)
+    {
+      tap_delete_if (vm, args.sw_if_index);
+      vec_free (name);
+      return err;
+    }
+
+  /*
+   * Linux packets are handled by the main thread as they are in the tun/tap
+   * fd case, see tap_inject_rx(). So the tapv2 queue is served by the main
+   * thread in interrupt mode.
+   */
+  vnet_hw_interface_unassign_rx_thread (vnet_main, virtio_hw->hw_if_index, 0);
+  vnet_hw_interface_assign_rx_thread (vnet_main, virtio_hw->hw_if_index, 0,
+                                      0 /* main thread */);
+  vnet_hw_interface_set_rx_mode (vnet_main, virtio_hw->hw_if_index, 0,
+                                 VNET_HW_IF_RX_MODE_INTERRUPT);
+  vnet_hw_interface_rx_redirect_to_node (vnet_main, virtio_hw->hw_if_index,
+                                         im->virtio_rx_node_index);
+  vnet_sw_interface_set_flags (vnet_main, args.sw_if_index,
+                               VNET_SW_INTERFACE_FLAG_ADMIN_UP);
+
+  tap_inject_type_set (sw->sw_if_index, type);
+  tap_inject_insert_tap (sw->sw_if_index, ~0, vif->ifindex, name);
+  tap_inject_insert_virtio (sw->sw_if_index, args.sw_if_index);
+  return 0;
+}
+#endif /* FLEXIWAN_FEATURE - tap_inject_virtio */
+
 clib_error_t *
 tap_inject_tap_connect (vnet_hw_interface_t * hw)
 {
@@ -66,6 +171,19 @@ tap_inject_tap_connect (vnet_hw_interface_t * hw)
   u32 tap_fd;
   u8 * name;
 
+#ifdef FLEXIWAN_FEATURE /* tap_inject_virtio */
+  if (im->flags & TAP_INJECT_F_CONFIG_VIRTIO)
+    {
+      clib_error_t * err = tap_inject_virtio_connect (hw);
+
+      if (!err)
+        return 0;
+
+      clib_warning ("%U, fall back to tun/tap fd", format_clib_error, err);
+      clib_error_free (err);
+    }
+#endif /* FLEXIWAN_FEATURE - tap_inject_virtio */
+
   memset (&ifr, 0, sizeof (ifr));
   memset (&template, 0, sizeof (template));
 
@@ -167,6 +285,19 @@ tap_inject_tap_disconnect (u32 sw_if_index)
   u32 clib_file_index;
 #endif /* FLEXIWAN_FEATURE */
 
+#ifdef FLEXIWAN_FEATURE /* tap_inject_virtio */
+  u32 virtio_sw_if_index = tap_inject_lookup_virtio_sw_if_index (sw_if_index);
+
+  if (virtio_sw_if_index != ~0)
+    {
+      tap_inject_delete_virtio (sw_if_index);
+      tap_inject_delete_tap (sw_if_index);
+      if (tap_delete_if (vlib_get_main (), virtio_sw_if_index))
+        return clib_error_return (0, "failed to delete tapv2 %u",
+                                  virtio_sw_if_index);
+      return 0;
+    }
+#endif /* FLEXIWAN_FEATURE - tap_inject_virtio */
 
   tap_fd = tap_inject_lookup_tap_fd (sw_if_index);
   if (tap_fd == ~0)